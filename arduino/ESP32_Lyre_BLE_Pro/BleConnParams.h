@@ -0,0 +1,79 @@
+#ifndef BLECONNPARAMS_H
+#define BLECONNPARAMS_H
+
+#include <Arduino.h>
+#include "settings.h"
+/***********************************************************************************************
+----------------------------    BleConnParams.h   ----------------------------------------------
+************************************************************************************************
+Parametres de connexion BLE: l'intervalle de connexion est le plus gros terme de la latence
+d'une note (une note attend en moyenne un demi-intervalle avant de partir du central). Le
+setMinPreferred() de l'advertising n'est qu'une indication: apres chaque connexion, on demande
+BLE_CONN_INTERVAL_MIN..MAX (7,5 - 11,25 ms), latence esclave 0 et l'extension de longueur de
+paquet (DLE), puis on suit ce que le central accorde vraiment.
+
+Si le central accorde moins bien (intervalle plus long, latence plus grande que demandee), ou
+degrade plus tard les parametres, une nouvelle demande part apres BLE_CONN_RETRY_MS, delai
+double a chaque refus, au plus BLE_CONN_MAX_RETRIES fois par cible (iOS refuse sous 15 ms:
+inutile d'insister).
+
+Au repos (PowerManager: plus de message MIDI depuis POWER_ACTIVE_HOLD_MS), la latence
+demandee passe a PowerManager::idleLatency(), ce que le budget de latence permet: la radio
+saute des evenements de connexion. Elle revient a BLE_CONN_LATENCY des la premiere note.
+
+Les evenements viennent des handlers GATTS/GAP de la pile (tache BLE) et sont copies sous
+verrou; les demandes et l'affichage se font dans update(), depuis la loop. Independant de la
+facon dont le serveur a ete cree (BLE natif ou bibliotheque BLE-MIDI). Ces handlers passent
+apres ceux du serveur: ils reveillent aussi la loop (LoopScheduler::wake) a chaque ecriture
+recue, le message MIDI est alors deja dans la file de la bibliotheque ou traite.
+
+Rapport SysEx (F0 7D 43 01 F7): F0 7D 43 02 [intervalle] [latence] [supervision] [MTU]
+[DLE tx] [DLE rx] [demandes] [mises a jour] F7, 2 octets de 7 bits par champ, poids faible en
+premier (intervalle en 1,25 ms, supervision en 10 ms, 0 = inconnu).
+************************************************************************************************/
+
+#define BLE_CONN_REPORT_LENGTH 21
+
+class BleConnParams {
+  public:
+    struct Params {
+      bool connected;
+      uint16_t intervalUnits;  // 1,25 ms (0: pas encore de mise a jour recue)
+      uint16_t latency;        // Intervalles que le peripherique peut sauter
+      uint16_t timeoutUnits;   // Supervision, 10 ms
+      uint16_t mtu;
+      uint16_t txOctets;       // DLE: octets par paquet radio (27 sans extension)
+      uint16_t rxOctets;
+      uint16_t requests;       // Demandes envoyees sur cette connexion
+      uint16_t updates;        // Parametres (re)negocies par le central
+    };
+
+  private:
+    static Params _params;
+    static uint8_t _peer[6];
+    static bool _requestDue;
+    static uint16_t _targetLatency;  // BLE_CONN_LATENCY en jeu, latence de repos sinon
+    static uint8_t _attempts;        // Demandes envoyees pour cette cible
+    static unsigned long _requestAtMs;
+    static uint16_t _retryDelayMs;
+    static bool _changed;  // Nouvelle valeur a afficher
+
+  public:
+    static void begin();   // Apres l'initialisation BLE: installe les handlers GATTS/GAP
+    static void update();  // Dans loop(): demandes en attente, affichage des changements
+
+    static Params get();
+    static bool isOnTarget(const Params& p);  // Intervalle et latence dans la cible (jeu/repos)
+    static uint32_t intervalUs(const Params& p) { return p.intervalUnits * 1250UL; }
+    static uint8_t buildReport(uint8_t* sysex);  // BLE_CONN_REPORT_LENGTH octets, F0..F7
+    static void print();
+
+    // Appeles par les handlers de la pile BLE
+    static void onConnect(const uint8_t* peer);
+    static void onDisconnect();
+    static void onMtu(uint16_t mtu);
+    static void onParams(uint16_t intervalUnits, uint16_t latency, uint16_t timeoutUnits);
+    static void onDataLength(uint16_t txOctets, uint16_t rxOctets);
+};
+
+#endif // BLECONNPARAMS_H
@@ -0,0 +1,179 @@
+#include "BleMidiTx.h"
+#include "LoopScheduler.h"
+
+uint8_t BleMidiTx::_ring[BLE_TX_RING_BYTES];
+uint32_t BleMidiTx::_head = 0;
+uint32_t BleMidiTx::_tail = 0;
+uint16_t BleMidiTx::_pendingBytes = 0;
+unsigned long BleMidiTx::_firstQueuedUs = 0;
+uint16_t BleMidiTx::_payloadSize = 20;
+BleMidiTx::SendFunction BleMidiTx::_send = nullptr;
+BleMidiTx::Stats BleMidiTx::_stats;
+
+#if defined(ESP32)
+  static portMUX_TYPE txMux = portMUX_INITIALIZER_UNLOCKED;
+  #define TX_LOCK() portENTER_CRITICAL(&txMux)
+  #define TX_UNLOCK() portEXIT_CRITICAL(&txMux)
+#else
+  #define TX_LOCK()
+  #define TX_UNLOCK()
+#endif
+
+// Entree de l'anneau: timestamp ms (2 octets), longueur, message
+#define TX_ENTRY_HEADER 3
+#define TX_AT(pos) _ring[(pos) & (BLE_TX_RING_BYTES - 1)]
+
+void BleMidiTx::begin(SendFunction send) {
+  _send = send;
+  memset(&_stats, 0, sizeof(_stats));
+  clear();
+}
+
+void BleMidiTx::setPayloadSize(uint16_t bytes) {
+  if (bytes < 20) bytes = 20;  // MTU minimal 23
+  _payloadSize = bytes < BLE_TX_PACKET_MAX ? bytes : BLE_TX_PACKET_MAX;
+}
+
+bool BleMidiTx::send(const uint8_t* message, uint8_t length) {
+  return push(message, length, millis() & 0x1FFF);
+}
+
+bool BleMidiTx::send(const uint8_t* message, uint8_t length, unsigned long atUs) {
+  // Timestamp dans le domaine de millis(), comme les messages envoyes "maintenant"
+  return push(message, length, (millis() - (micros() - atUs) / 1000) & 0x1FFF);
+}
+
+bool BleMidiTx::push(const uint8_t* message, uint8_t length, uint16_t timestampMs) {
+  if (length == 0) return false;
+
+  TX_LOCK();
+  if (_head - _tail + TX_ENTRY_HEADER + length > BLE_TX_RING_BYTES) {
+    _stats.dropped++;
+    TX_UNLOCK();
+    return false;
+  }
+  bool first = (_head == _tail);
+  if (first) {
+    _firstQueuedUs = micros();
+  }
+  TX_AT(_head++) = timestampMs >> 8;
+  TX_AT(_head++) = timestampMs & 0xFF;
+  TX_AT(_head++) = length;
+  for (uint8_t i = 0; i < length; i++) {
+    TX_AT(_head++) = message[i];
+  }
+  _pendingBytes += 1 + length;
+  TX_UNLOCK();
+  if (first) {
+    LoopScheduler::wake();  // update() doit voir la file pour programmer l'envoi
+  }
+  return true;
+}
+
+void BleMidiTx::clear() {
+  TX_LOCK();
+  _tail = _head;
+  _pendingBytes = 0;
+  TX_UNLOCK();
+}
+
+uint16_t BleMidiTx::buildPacket(uint8_t* packet) {
+  uint16_t length = 0;
+  uint16_t lastMs = 0;
+  uint8_t runningStatus = 0;
+  uint16_t messages = 0;
+
+  while (_tail != _head) {
+    uint16_t ms = (TX_AT(_tail) << 8) | TX_AT(_tail + 1);
+    uint8_t size = TX_AT(_tail + 2);
+    uint32_t data = _tail + TX_ENTRY_HEADER;
+    uint8_t status = TX_AT(data);
+
+    bool sysEx = (status == 0xF0);
+    bool running = (status >= 0x80 && status < 0xF0 && status == runningStatus);
+    bool sameTimestamp = (length > 0 && ms == lastMs);
+    uint16_t cost;
+    if (sysEx) {
+      cost = 1 + size + 1;  // Timestamp, message, timestamp avant F7
+    } else if (running) {
+      cost = (sameTimestamp ? 0 : 1) + size - 1;
+    } else {
+      cost = 1 + size;
+    }
+
+    if (length > 0 && ((ms - lastMs) & 0x1FFF) > 0x1000) {
+      break;  // Timestamp plus ancien: il recommencera un paquet
+    }
+    if (length + (length == 0 ? 1 : 0) + cost > _payloadSize) {
+      if (length > 0) break;  // Paquet plein: le message ouvre le suivant
+      _stats.dropped++;  // Ne tient dans aucun paquet
+      _tail = data + size;
+      _pendingBytes -= 1 + size;
+      continue;
+    }
+
+    if (length == 0) {
+      packet[length++] = 0x80 | ((ms >> 7) & 0x3F);
+    }
+    uint8_t timestamp = 0x80 | (ms & 0x7F);
+    if (sysEx) {
+      packet[length++] = timestamp;
+      for (uint8_t i = 0; i + 1 < size; i++) {
+        packet[length++] = TX_AT(data + i);
+      }
+      packet[length++] = timestamp;
+      packet[length++] = 0xF7;
+      runningStatus = 0;  // Un SysEx annule le running status
+    } else if (running) {
+      if (!sameTimestamp) {
+        packet[length++] = timestamp;
+      }
+      for (uint8_t i = 1; i < size; i++) {
+        packet[length++] = TX_AT(data + i);
+      }
+      _stats.runningStatus++;
+    } else {
+      packet[length++] = timestamp;
+      for (uint8_t i = 0; i < size; i++) {
+        packet[length++] = TX_AT(data + i);
+      }
+      runningStatus = (status >= 0x80 && status < 0xF0) ? status : 0;
+    }
+
+    lastMs = ms;
+    messages++;
+    _tail = data + size;
+    _pendingBytes -= 1 + size;
+  }
+
+  _stats.messages += messages;
+  if (messages > _stats.maxMessagesPerPacket) {
+    _stats.maxMessagesPerPacket = messages;
+  }
+  return length;
+}
+
+void BleMidiTx::update() {
+  if (_tail == _head) return;
+  unsigned long waited = micros() - _firstQueuedUs;
+  if (waited >= BLE_TX_FLUSH_US || _pendingBytes + 1 >= _payloadSize) {
+    flush();
+  } else {
+    LoopScheduler::wakeWithin((BLE_TX_FLUSH_US - waited) / 1000);
+  }
+}
+
+void BleMidiTx::flush() {
+  uint8_t packet[BLE_TX_PACKET_MAX];
+  for (;;) {
+    TX_LOCK();
+    uint16_t length = buildPacket(packet);
+    TX_UNLOCK();
+    if (length == 0) return;
+    if (_send) {
+      _send(packet, length);
+    }
+    _stats.packets++;
+    _stats.bytes += length;
+  }
+}
@@ -0,0 +1,71 @@
+#ifndef BLEMIDITX_H
+#define BLEMIDITX_H
+
+#include <Arduino.h>
+#include "settings.h"
+/***********************************************************************************************
+----------------------------    BleMidiTx.h   --------------------------------------------------
+************************************************************************************************
+File d'envoi BLE-MIDI: les messages sortants (feedback, CC d'etat, erreurs, SysEx) sont copies
+dans un anneau preallouee avec leur timestamp, puis regroupes en paquets aussi grands que le
+MTU negocie le permet: une notification par intervalle de connexion au lieu d'une par message.
+
+  BleMidiTx::send(message, 3);           // timestamp = maintenant
+  BleMidiTx::send(message, 3, doneUs);   // timestamp = instant passe (micros())
+
+Paquet: en-tete (6 bits de poids fort du timestamp en ms), puis pour chaque message un octet de
+timestamp et le message. Running status: un message de canal qui a le meme statut que le
+precedent perd son octet de statut, et son timestamp s'il est identique. Un SysEx doit tenir
+dans un paquet (timestamp avant F7 compris).
+
+Envoi quand le plus ancien message a attendu BLE_TX_FLUSH_US (un intervalle de connexion) ou
+quand la file remplit un paquet. Dans un paquet les timestamps ne reculent jamais: un message
+plus ancien que le precedent ouvre un nouveau paquet.
+
+send() peut etre appele depuis la loop et depuis la tache BLE (anneau sous verrou); update()
+et flush() depuis la loop uniquement. Le premier message d'une file vide reveille la loop
+(LoopScheduler), update() la garde ensuite eveillee jusqu'a l'envoi.
+************************************************************************************************/
+
+class BleMidiTx {
+  public:
+    typedef void (*SendFunction)(const uint8_t* packet, size_t length);
+
+    struct Stats {
+      uint32_t messages;  // Messages envoyes
+      uint32_t packets;   // Notifications
+      uint32_t bytes;     // Octets notifies (en-tetes et timestamps compris)
+      uint32_t runningStatus;  // Octets de statut economises
+      uint32_t dropped;   // Anneau plein ou message trop long pour un paquet
+      uint16_t maxMessagesPerPacket;
+    };
+
+  private:
+    static uint8_t _ring[BLE_TX_RING_BYTES];
+    static uint32_t _head;  // Positions libres (modulo BLE_TX_RING_BYTES)
+    static uint32_t _tail;
+    static uint16_t _pendingBytes;  // Estimation de la taille en paquet des messages en attente
+    static unsigned long _firstQueuedUs;
+    static uint16_t _payloadSize;
+    static SendFunction _send;
+    static Stats _stats;
+
+    static bool push(const uint8_t* message, uint8_t length, uint16_t timestampMs);
+    static uint16_t buildPacket(uint8_t* packet);  // Sous verrou, retire les messages copies
+
+  public:
+    static void begin(SendFunction send);
+    static void setPayloadSize(uint16_t bytes);  // MTU - 3, borne a BLE_TX_PACKET_MAX
+
+    static bool send(const uint8_t* message, uint8_t length);
+    static bool send(const uint8_t* message, uint8_t length, unsigned long atUs);
+
+    static void update();  // Dans loop(): envoie quand l'intervalle est ecoule ou un paquet plein
+    static void flush();   // Envoie tout de suite
+    static void clear();   // Deconnexion: file videe sans envoi
+
+    static uint16_t getPayloadSize() { return _payloadSize; }
+    static const Stats& getStats() { return _stats; }
+};
+
+#endif // BLEMIDITX_H
@@ -0,0 +1,75 @@
+#ifndef DEFERREDLOG_H
+#define DEFERREDLOG_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "settings.h"
+#include "LogFormats.h"
+/***********************************************************************************************
+----------------------------    DeferredLog.h   ------------------------------------------------
+************************************************************************************************
+Journal differe pour les chemins critiques (callbacks MIDI, pluck, mute): au lieu d'un
+Serial.printf (formatage + attente du port serie), DeferredLog::log() copie l'identifiant du
+message et ses arguments dans une file circulaire et rend la main (~1 us).
+
+  DeferredLog::log(LOG_SERVO_PLUCK, servoIndex, position);
+
+La file est videe par une tache basse priorite (ESP32) qui envoie soit le texte formate
+(DEFERRED_LOG_BINARY false), soit des trames binaires decodees sur le PC par tools/lyre_log.
+Les messages sont toujours enregistres; DEBUG ne decide que de leur envoi sur le port serie.
+
+File pleine: le message est perdu et compte, la tache de vidage signale ensuite le nombre de
+messages perdus (LOG_DROPPED). log() ne bloque jamais et n'alloue rien.
+
+Plusieurs producteurs possibles (tache Arduino, tache BLE, callbacks WiFi), un seul
+consommateur: file MPSC sans verrou, chaque case porte un numero de sequence atomique.
+************************************************************************************************/
+
+#define DEFERRED_LOG_RING_SIZE 128  // Puissance de 2
+
+class DeferredLog {
+  private:
+    struct Slot {
+      std::atomic<uint32_t> sequence;  // = position: libre, = position+1: message pret
+      LogRecord record;
+    };
+
+    static Slot _ring[DEFERRED_LOG_RING_SIZE];
+    static std::atomic<uint32_t> _enqueuePos;
+    static uint32_t _dequeuePos;               // Consommateur unique
+    static std::atomic<uint32_t> _dropped;     // Perdus depuis le dernier signalement
+    static std::atomic<uint32_t> _written;
+    static uint32_t _droppedTotal;
+    static bool _ready;
+
+    static bool push(uint8_t formatId, uint8_t argCount, uint32_t a, uint32_t b, uint32_t c);
+    static bool pop(LogRecord& record);
+    static void emit(const LogRecord& record);
+
+  public:
+    // A appeler en tete de setup(): prepare la file et lance la tache de vidage
+    static void begin();
+
+    static inline bool log(uint8_t formatId) {
+      return push(formatId, 0, 0, 0, 0);
+    }
+    static inline bool log(uint8_t formatId, uint32_t a) {
+      return push(formatId, 1, a, 0, 0);
+    }
+    static inline bool log(uint8_t formatId, uint32_t a, uint32_t b) {
+      return push(formatId, 2, a, b, 0);
+    }
+    static inline bool log(uint8_t formatId, uint32_t a, uint32_t b, uint32_t c) {
+      return push(formatId, 3, a, b, c);
+    }
+
+    // Vide au plus maxRecords messages, retourne le nombre envoye (appele par la tache)
+    static uint16_t drain(uint16_t maxRecords);
+
+    static uint32_t getWrittenCount() { return _written.load(std::memory_order_relaxed); }
+    static uint32_t getDroppedCount() {
+      return _droppedTotal + _dropped.load(std::memory_order_relaxed);
+    }
+};
+
+#endif // DEFERREDLOG_H
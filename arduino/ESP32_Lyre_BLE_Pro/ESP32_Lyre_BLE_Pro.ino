@@ -6,6 +6,7 @@ Version optimisée avec:
 - Réponse SysEx Identity Request (identification automatique)
 - Messages MIDI d'état de connexion
 - Performance optimisée pour réactivité maximale
+- Fréquence CPU variable et sommeil léger au repos, latence ajoutée bornée par un budget
 - Compatible toutes apps MIDI BLE
 
 MATERIEL REQUIS:
@@ -23,7 +24,13 @@ BIBLIOTHEQUES:
 #include <BLEServer.h>
 #include <BLEUtils.h>
 #include <BLE2902.h>
-#include "Instrument.h"
+#include "instrument.h"
+#include "DeferredLog.h"
+#include "EventTrace.h"
+#include "BleMidiTx.h"
+#include "BleConnParams.h"
+#include "LoopScheduler.h"
+#include "PowerManager.h"
 #include "settings.h"
 
 // Configuration
@@ -39,7 +46,37 @@ BIBLIOTHEQUES:
 BLEServer* pServer = NULL;
 BLECharacteristic* pCharacteristic = NULL;
 bool deviceConnected = false;
-bool readyToSend = false;
+bool readyToSend = false;  // Le central a activé les notifications (CCCD écrit)
+
+// Cycle de connexion et messages MIDI reçus: les callbacks Bluedroid ne font que poster un
+// événement, loop() le traite. Une seule file: une note reçue avant une déconnexion est jouée
+// avant la panique, jamais après
+enum BleLinkEventType : uint8_t {
+  LINK_CONNECTED,
+  LINK_DISCONNECTED,
+  LINK_SUBSCRIBED,    // Notifications activées par le central (CCCD = 1)
+  LINK_UNSUBSCRIBED,
+  LINK_MIDI           // Note On/Off, CC: appels à l'instrument
+};
+struct BleLinkEvent {
+  BleLinkEventType type;
+  unsigned long atUs;  // micros() dans le callback
+  uint8_t midi[3];     // LINK_MIDI: statut (sans canal), données
+};
+QueueHandle_t linkEvents = NULL;
+
+// Mesures du cycle de connexion (ms)
+struct LinkStats {
+  uint32_t connections;
+  unsigned long disconnectUs;  // Dernière déconnexion (0: aucune depuis le démarrage)
+  unsigned long connectUs;
+  unsigned long subscribeUs;
+  int32_t reconnectMs;         // Déconnexion -> connexion suivante (-1: premier démarrage)
+  int32_t subscribeMs;         // Connexion -> notifications activées
+  int32_t firstNoteMs;         // Connexion -> première Note On reçue
+};
+LinkStats linkStats = {0, 0, 0, 0, -1, -1, -1};
+volatile unsigned long firstNoteUs = 0;  // Écrit par la tâche BLE (processMIDIMessage)
 
 // Instrument
 Instrument instrument;
@@ -52,20 +89,35 @@ uint32_t lastActivityTime = 0;
 ENVOI MESSAGES MIDI BLE
 ************************************************************************************************/
 
+// Mise en file: BleMidiTx regroupe les messages (timestamp, running status) en un paquet par
+// intervalle de connexion, envoyé par sendBLEPacket() depuis loop()
 void sendMIDIMessage(uint8_t* data, size_t length) {
   if (!deviceConnected || !readyToSend || !pCharacteristic) return;
+  BleMidiTx::send(data, length);
+}
 
-  // Format BLE MIDI: [header][timestamp][MIDI bytes]
-  uint8_t blePacket[length + 2];
-  blePacket[0] = 0x80;  // Header (bit 7 = 1)
-  blePacket[1] = 0x80;  // Timestamp high bit
-
-  memcpy(&blePacket[2], data, length);
-
-  pCharacteristic->setValue(blePacket, length + 2);
+// Paquet BLE MIDI complet (en-tête et timestamps compris): une notification
+void sendBLEPacket(const uint8_t* packet, size_t length) {
+  if (!deviceConnected || !readyToSend || !pCharacteristic) return;
+  pCharacteristic->setValue((uint8_t*)packet, length);
   pCharacteristic->notify();
 }
 
+// Feedback d'actionnement (Instrument::ActuationCallback): la corde a bougé à doneUs
+void onActuation(uint8_t servo, uint8_t note, uint8_t velocity, unsigned long doneUs) {
+  if (!deviceConnected || !readyToSend) return;
+  uint8_t channel = (MIDI_FEEDBACK_CHANNEL - 1) & 0x0F;
+  uint8_t servoMsg[3] = {(uint8_t)(0xB0 | channel), FEEDBACK_SERVO_CC, servo};
+  uint8_t noteMsg[3] = {(uint8_t)((velocity > 0 ? 0x90 : 0x80) | channel), note, velocity};
+  BleMidiTx::send(servoMsg, 3, doneUs);
+  BleMidiTx::send(noteMsg, 3, doneUs);
+  if (velocity > 0) {
+    DeferredLog::log(LOG_MIDI_OUT_NOTE_ON, note, velocity);
+  } else {
+    DeferredLog::log(LOG_MIDI_OUT_NOTE_OFF, note);
+  }
+}
+
 // Envoyer Note On
 void sendNoteOn(uint8_t note, uint8_t velocity, uint8_t channel = 0) {
   uint8_t msg[3] = {(uint8_t)(0x90 | channel), note, velocity};
@@ -104,9 +156,16 @@ void sendIdentityReply() {
 
   sendMIDIMessage(identity, sizeof(identity));
 
-  if (DEBUG) {
-    Serial.println("[SYSEX] Identity Reply envoyé");
-  }
+  DeferredLog::log(LOG_SYSEX_IDENTITY_REPLY);
+
+  // Paramètres de connexion accordés (intervalle: plus gros terme de la latence BLE)
+  sendConnectionReport();
+}
+
+void sendConnectionReport() {
+  uint8_t report[BLE_CONN_REPORT_LENGTH];
+  uint8_t length = BleConnParams::buildReport(report);
+  sendMIDIMessage(report, length);
 }
 
 // Envoyer message de connexion établie
@@ -129,10 +188,34 @@ void sendDisconnectionWarning() {
   }
 }
 
+// Débit et regroupement des envois depuis le rapport précédent
+void printTxStats() {
+  static BleMidiTx::Stats last = {};
+  static unsigned long lastTime = 0;
+  const BleMidiTx::Stats& s = BleMidiTx::getStats();
+  unsigned long now = millis();
+  uint32_t messages = s.messages - last.messages;
+  uint32_t packets = s.packets - last.packets;
+  uint32_t bytes = s.bytes - last.bytes;
+  unsigned long elapsed = now - lastTime;
+
+  Serial.printf("[BLE TX] %lu messages en %lu notifications (%.1f msg/notif, max %u) | "
+                "%lu o/s | MTU utile %u | running status %lu | perdus %lu\n",
+                (unsigned long)messages, (unsigned long)packets,
+                packets ? (float)messages / packets : 0.0f, s.maxMessagesPerPacket,
+                elapsed ? (unsigned long)(bytes * 1000UL / elapsed) : 0UL,
+                BleMidiTx::getPayloadSize(), (unsigned long)s.runningStatus,
+                (unsigned long)s.dropped);
+  last = s;
+  lastTime = now;
+}
+
 /***********************************************************************************************
 TRAITEMENT MESSAGES MIDI RECUS
 ************************************************************************************************/
 
+// Tâche BLE: décodage, journal et réponses SysEx ici; les appels à l'instrument passent par
+// la file et sont faits par loop() (handleMidiEvent), comme update()
 void processMIDIMessage(uint8_t* data, size_t length) {
   if (length < 3) return;
 
@@ -148,22 +231,14 @@ void processMIDIMessage(uint8_t* data, size_t length) {
         uint8_t note = data[3];
         uint8_t velocity = data[4];
 
-        if (DEBUG) {
-          Serial.printf("[MIDI IN] Note On: %d (vel: %d)\n", note, velocity);
+        DeferredLog::log(LOG_MIDI_IN_NOTE_ON, note, velocity, channel + 1);
+        EventTrace::record(TRACE_MIDI_NOTE_ON, note, velocity);
+        if (firstNoteUs == 0 && velocity > 0) {
+          firstNoteUs = micros() | 1;  // Mesure "première note" (0 = pas encore reçue)
         }
 
-        if (velocity > 0) {
-          instrument.noteOn(note, velocity);
-          // Feedback: confirmer note jouée
-          if (MIDI_SEND_FEEDBACK) {
-            sendNoteOn(note, velocity, channel);
-          }
-        } else {
-          instrument.noteOff(note);
-          if (MIDI_SEND_FEEDBACK) {
-            sendNoteOff(note, channel);
-          }
-        }
+        // Feedback: confirmé par onActuation() quand la corde a bougé
+        postMidiEvent(status, note, velocity);
       }
       break;
 
@@ -171,14 +246,10 @@ void processMIDIMessage(uint8_t* data, size_t length) {
       if (length >= 4) {
         uint8_t note = data[3];
 
-        if (DEBUG) {
-          Serial.printf("[MIDI IN] Note Off: %d\n", note);
-        }
+        DeferredLog::log(LOG_MIDI_IN_NOTE_OFF, note, channel + 1);
+        EventTrace::record(TRACE_MIDI_NOTE_OFF, note);
 
-        instrument.noteOff(note);
-        if (MIDI_SEND_FEEDBACK) {
-          sendNoteOff(note, channel);
-        }
+        postMidiEvent(status, note, 0);
       }
       break;
 
@@ -187,17 +258,10 @@ void processMIDIMessage(uint8_t* data, size_t length) {
         uint8_t controller = data[3];
         uint8_t value = data[4];
 
-        if (DEBUG) {
-          Serial.printf("[MIDI IN] CC: %d = %d\n", controller, value);
-        }
+        DeferredLog::log(LOG_MIDI_IN_CC, controller, value);
+        EventTrace::record(TRACE_MIDI_CC, controller, value);
 
-        // All Notes Off
-        if (controller == 123) {
-          Serial.println("[MIDI] All Notes Off");
-          for (int i = MIDI_NOTE_MIN; i <= MIDI_NOTE_MAX; i++) {
-            instrument.noteOff(i);
-          }
-        }
+        postMidiEvent(status, controller, value);
       }
       break;
 
@@ -210,11 +274,12 @@ void processMIDIMessage(uint8_t* data, size_t length) {
 
         uint8_t subID = data[6];
         if (subID == 0x01) {  // Identity Request
-          if (DEBUG) {
-            Serial.println("[SYSEX] Identity Request reçu");
-          }
+          DeferredLog::log(LOG_SYSEX_IDENTITY_REQUEST);
           sendIdentityReply();
         }
+      } else if (length >= 6 && data[3] == SYSEX_MANUFACTURER_ID &&
+                 data[4] == SYSEX_CONNECTION && data[5] == SYSEX_CONNECTION_QUERY) {
+        sendConnectionReport();
       }
       break;
   }
@@ -224,36 +289,165 @@ void processMIDIMessage(uint8_t* data, size_t length) {
 CALLBACKS BLE
 ************************************************************************************************/
 
+// Appelé depuis la tâche BLE: ne bloque jamais (file pleine = événement perdu et compté)
+volatile uint32_t linkEventsLost = 0;
+void postLinkEvent(BleLinkEventType type) {
+  BleLinkEvent event = { type, micros(), { 0, 0, 0 } };
+  if (linkEvents == NULL || xQueueSend(linkEvents, &event, 0) != pdTRUE) {
+    linkEventsLost++;
+  }
+  LoopScheduler::wake();
+}
+
+void postMidiEvent(uint8_t status, uint8_t data1, uint8_t data2) {
+  BleLinkEvent event = { LINK_MIDI, micros(), { status, data1, data2 } };
+  if (linkEvents == NULL || xQueueSend(linkEvents, &event, 0) != pdTRUE) {
+    linkEventsLost++;
+  }
+  LoopScheduler::wake();
+}
+
 class MyServerCallbacks: public BLEServerCallbacks {
     void onConnect(BLEServer* pServer) {
-      deviceConnected = true;
-      readyToSend = true;
+      firstNoteUs = 0;  // Même tâche que processMIDIMessage: aucune note ne peut passer avant
+      postLinkEvent(LINK_CONNECTED);
+    };
 
-      Serial.println("\n[BLE] ✓ CONNEXION ETABLIE");
+    void onDisconnect(BLEServer* pServer) {
+      readyToSend = false;  // Tout de suite: plus rien ne doit partir vers ce central
+      postLinkEvent(LINK_DISCONNECTED);
+    }
+};
+
+// Descripteur 2902 (CCCD): le central y écrit 1 quand il s'abonne aux notifications
+class MyCccdCallbacks: public BLEDescriptorCallbacks {
+    void onWrite(BLEDescriptor* pDescriptor) {
+      bool enabled = ((BLE2902*)pDescriptor)->getNotifications();
+      postLinkEvent(enabled ? LINK_SUBSCRIBED : LINK_UNSUBSCRIBED);
+    }
+};
+
+/***********************************************************************************************
+CYCLE DE CONNEXION BLE
+************************************************************************************************/
 
-      // Délai court pour stabiliser la connexion
-      delay(100);
+// Messages MIDI reçus, dans la même tâche que instrument.update()
+void handleMidiEvent(const uint8_t* midi) {
+  uint8_t status = midi[0];
+  uint8_t data1 = midi[1];
+  uint8_t data2 = midi[2];
+
+  switch (status) {
+    case 0x90: // Note On
+      if (data2 > 0) {
+        instrument.noteOn(data1, data2);
+      } else {
+        instrument.noteOff(data1);
+      }
+      break;
 
-      // Envoyer message de connexion
+    case 0x80: // Note Off
+      instrument.noteOff(data1);
+      break;
+
+    case 0xB0: // Control Change
+      // Sustain / sostenuto: mutes differes jusqu'au relachement de la pedale
+      if (data1 == 64) {
+        instrument.setSustain(data2 >= 64);
+      }
+      if (data1 == 66) {
+        instrument.setSostenuto(data2 >= 64);
+      }
+
+      // Legato: mode pluck-through
+      if (data1 == 68) {
+        instrument.setPluckThrough(data2 >= 64);
+      }
+
+      // All Sound Off / Reset All Controllers / All Notes Off: panique
+      if (data1 == 120 || data1 == 121 || data1 == 123) {
+        Serial.println("[MIDI] All Notes Off");
+        instrument.panic();
+      }
+      break;
+  }
+}
+
+void handleLinkEvent(const BleLinkEvent& event) {
+  switch (event.type) {
+    case LINK_MIDI:
+      handleMidiEvent(event.midi);
+      break;
+
+    case LINK_CONNECTED:
+      deviceConnected = true;
+      linkStats.connections++;
+      linkStats.connectUs = event.atUs;
+      linkStats.subscribeMs = -1;
+      linkStats.firstNoteMs = -1;
+      linkStats.reconnectMs = linkStats.disconnectUs
+                              ? (int32_t)((event.atUs - linkStats.disconnectUs) / 1000) : -1;
+      Serial.println("\n[BLE] ✓ CONNEXION ETABLIE");
+      if (linkStats.reconnectMs >= 0) {
+        Serial.printf("[BLE] Reconnexion en %ld ms après la déconnexion\n",
+                      (long)linkStats.reconnectMs);
+      }
+      break;
+
+    case LINK_SUBSCRIBED:
+      // Le central écoute: messages d'état envoyés tout de suite, sans délai fixe
+      if (!deviceConnected || readyToSend) break;
+      readyToSend = true;
+      linkStats.subscribeUs = event.atUs;
+      linkStats.subscribeMs = (int32_t)((event.atUs - linkStats.connectUs) / 1000);
       sendConnectionEstablished();
+      sendIdentityReply();  // Pour que l'interface sache immédiatement qui on est
+      BleMidiTx::flush();
+      Serial.printf("[BLE] Notifications activées %ld ms après la connexion\n",
+                    (long)linkStats.subscribeMs);
+      break;
 
-      // Envoyer Identity (pour que l'interface sache immédiatement qui on est)
-      delay(50);
-      sendIdentityReply();
-    };
+    case LINK_UNSUBSCRIBED:
+      readyToSend = false;
+      BleMidiTx::clear();
+      Serial.println("[BLE] Notifications désactivées par le central");
+      break;
 
-    void onDisconnect(BLEServer* pServer) {
+    case LINK_DISCONNECTED:
       readyToSend = false;
       deviceConnected = false;
-
+      linkStats.disconnectUs = event.atUs ? event.atUs : 1;
       Serial.println("[BLE] ✗ Déconnexion");
 
-      // Redémarrer advertising automatiquement
-      delay(500);
+      // Les noteOff en cours ne viendront plus: cordes au repos
+      instrument.panic();
+      BleMidiTx::clear();
+
+      // Hors du callback Bluedroid: l'advertising peut repartir sans attendre
       pServer->getAdvertising()->start();
       Serial.println("[BLE] Advertising redémarré (prêt pour nouvelle connexion)");
+      break;
+  }
+}
+
+void updateLink() {
+  BleLinkEvent event;
+  while (xQueueReceive(linkEvents, &event, 0) == pdTRUE) {
+    handleLinkEvent(event);
+  }
+
+  // Première note après la connexion (reçue dans la tâche BLE)
+  unsigned long noteUs = firstNoteUs;
+  if (deviceConnected && noteUs != 0 && linkStats.firstNoteMs < 0) {
+    linkStats.firstNoteMs = (int32_t)((noteUs - linkStats.connectUs) / 1000);
+    Serial.printf("[BLE] Première note %ld ms après la connexion", (long)linkStats.firstNoteMs);
+    if (linkStats.subscribeMs >= 0) {
+      Serial.printf(" (%ld ms après l'abonnement)",
+                    (long)((noteUs - linkStats.subscribeUs) / 1000));
     }
-};
+    Serial.println();
+  }
+}
 
 class MyCallbacks: public BLECharacteristicCallbacks {
     void onWrite(BLECharacteristic *pCharacteristic) {
@@ -273,6 +467,9 @@ SETUP
 
 void setup() {
   Serial.begin(SERIAL_BAUD_RATE);
+  DeferredLog::begin();  // Avant tout message différé (servos, MIDI)
+  EventTrace::begin();   // Trace d'avant un reset logiciel conservée
+  LoopScheduler::begin();
   delay(1000);
 
   Serial.println("\n========================================");
@@ -290,8 +487,16 @@ void setup() {
     Serial.println("[I2C] Pins par défaut (SDA=21, SCL=22)");
   #endif
 
+  // Détection du PCA9685: non-bloquante, se poursuit dans loop() pendant que le BLE démarre
+  instrument.begin();
+
+  // Fréquence variable / sommeil léger, avant le démarrage de la pile BLE
+  PowerManager::begin();
+
   // Initialiser BLE
   Serial.println("[BLE] Initialisation...");
+  linkEvents = xQueueCreate(BLE_EVENT_QUEUE_SIZE, sizeof(BleLinkEvent));
+  BleConnParams::begin();
   BLEDevice::init(BLE_DEVICE_NAME);
   BLEDevice::setMTU(517); // MTU max pour BLE MIDI (optimisation)
 
@@ -312,11 +517,19 @@ void setup() {
   );
 
   pCharacteristic->setCallbacks(new MyCallbacks());
-  pCharacteristic->addDescriptor(new BLE2902());
+  BLE2902* cccd = new BLE2902();
+  cccd->setCallbacks(new MyCccdCallbacks());
+  pCharacteristic->addDescriptor(cccd);
 
   // Démarrer service
   pService->start();
 
+  // Envoi regroupé, et feedback d'actionnement horodaté à la fin de l'écriture I2C
+  BleMidiTx::begin(sendBLEPacket);
+  if (MIDI_SEND_FEEDBACK) {
+    instrument.setActuationCallback(onActuation);
+  }
+
   // Configurer advertising
   BLEAdvertising *pAdvertising = BLEDevice::getAdvertising();
   pAdvertising->addServiceUUID(SERVICE_UUID);
@@ -332,6 +545,9 @@ void setup() {
   Serial.println("========================================");
   Serial.println("\nEn attente de connexion...\n");
 
+  // Heartbeat / message d'attente: seule tâche périodique, la loop dort entre deux messages
+  LoopScheduler::every("etat", 30000, periodicStatus);
+
   lastActivityTime = millis();
 }
 
@@ -339,31 +555,51 @@ void setup() {
 LOOP
 ************************************************************************************************/
 
+// Toutes les 30 secondes: heartbeat si connecté, sinon message d'attente
+void periodicStatus() {
+  if (!deviceConnected) {
+    Serial.println("[BLE] En attente de connexion...");
+    return;
+  }
+
+  // CC 103 = Heartbeat/Alive
+  sendControlChange(103, 127);
+
+  if (DEBUG) {
+    Serial.printf("[STATS] Messages reçus: %lu | Uptime: %lu s\n",
+                  midiMessagesReceived, millis() / 1000);
+    printTxStats();
+    BleConnParams::print();
+    Serial.printf("[BLE] Connexions: %lu | reconnexion %ld ms | abonnement %ld ms | "
+                  "première note %ld ms | événements perdus %lu\n",
+                  (unsigned long)linkStats.connections, (long)linkStats.reconnectMs,
+                  (long)linkStats.subscribeMs, (long)linkStats.firstNoteMs,
+                  (unsigned long)linkEventsLost);
+    LoopScheduler::print();
+    PowerManager::print();
+  }
+}
+
 void loop() {
+  // Événements de connexion et messages MIDI postés par la pile BLE
+  updateLink();
+
   // Mettre à jour instrument
   instrument.update();
+  LoopScheduler::wakeWithin(instrument.msUntilUpdate());
 
-  // Heartbeat périodique si connecté (toutes les 30 secondes)
-  static unsigned long lastHeartbeat = 0;
-  if (deviceConnected && millis() - lastHeartbeat >= 30000) {
-    // CC 103 = Heartbeat/Alive
-    sendControlChange(103, 127);
-
-    if (DEBUG) {
-      Serial.printf("[STATS] Messages reçus: %lu | Uptime: %lu s\n",
-                    midiMessagesReceived, millis() / 1000);
-    }
-
-    lastHeartbeat = millis();
+  // Messages en attente: un paquet à la taille du MTU négocié par intervalle de connexion
+  // Paramètres de connexion: demande après connexion, renégociation si dégradés
+  BleConnParams::update();
+  if (deviceConnected) {
+    BleMidiTx::setPayloadSize(BleConnParams::get().mtu - 3);
   }
+  BleMidiTx::update();
 
-  // Message périodique si non connecté
-  static unsigned long lastStatusMsg = 0;
-  if (!deviceConnected && millis() - lastStatusMsg >= 30000) {
-    Serial.println("[BLE] En attente de connexion...");
-    lastStatusMsg = millis();
-  }
+  // CPU à fond pendant le jeu, économie après POWER_ACTIVE_HOLD_MS sans message MIDI
+  PowerManager::update();
 
-  // Délai minimal pour réactivité
-  delay(1);
+  // Tâche périodique due, puis sommeil jusqu'à la prochaine échéance, un message MIDI
+  // (écriture GATT) ou un événement de connexion
+  LoopScheduler::run();
 }
@@ -0,0 +1,49 @@
+#ifndef EVENTTRACE_H
+#define EVENTTRACE_H
+
+#include <Arduino.h>
+#include <esp_attr.h>
+#include <esp_system.h>
+#include "settings.h"
+#include "TraceFormat.h"
+/***********************************************************************************************
+----------------------------    EventTrace.h   -------------------------------------------------
+************************************************************************************************
+Enregistreur de vol: les TRACE_BUFFER_EVENTS derniers evenements (entrees MIDI, decisions de
+l'instrument, ecritures PCA9685, alimentation des voies) avec leur horodatage en us, dans un
+tampon circulaire en memoire RTC.
+
+La memoire RTC n'est pas effacee par un reset logiciel, watchdog ou panic: apres un plantage
+ou un decrochage en concert, la trace montre ce qui s'est passe juste avant. Elle est videe a
+la mise sous tension et apres une chute d'alimentation (contenu non fiable).
+
+  EventTrace::record(TRACE_PLUCK, servo, note);
+
+Un evenement coute une courte section critique et 8 octets ecrits en RAM RTC. Le tampon prend
+sur les 8 Ko de RAM RTC lente: 256 evenements = 2 Ko.
+Vidage binaire par dump() (port serie) ou evenement par evenement pour un envoi SysEx,
+rendu par tools/lyre_trace.
+************************************************************************************************/
+
+class EventTrace {
+  private:
+    static bool _ready;
+    static bool _paused;  // Pendant un vidage: le tampon ne bouge plus
+
+  public:
+    // Dans setup(), avant instrument.begin(): garde ou efface le tampon selon la cause du reset
+    static void begin();
+
+    static void record(uint8_t type, uint8_t a = 0, uint16_t b = 0);
+
+    static void pause(bool paused) { _paused = paused; }
+    static uint16_t count();                 // Evenements disponibles (au plus la capacite)
+    static TraceEvent event(uint16_t index);  // 0 = le plus ancien
+    static void fillHeader(TraceDumpHeader& header);
+
+    // Trame binaire complete sur le port serie (voir TraceFormat.h)
+    static void dump();
+    static void clear();
+};
+
+#endif // EVENTTRACE_H
@@ -0,0 +1,81 @@
+#ifndef TRACEFORMAT_H
+#define TRACEFORMAT_H
+
+#include <stdint.h>
+/***********************************************************************************************
+----------------------------    TraceFormat.h   ------------------------------------------------
+************************************************************************************************
+Format de la trace d'evenements (EventTrace.h), partage avec l'outil PC tools/lyre_trace.
+
+Evenement (8 octets): horodatage micros(), type, deux arguments. Les horodatages repartent de
+zero a chaque demarrage: un TRACE_BOOT separe les demarrages successifs dans la trace.
+
+Vidage serie (commande 't' du sketch Enhanced): 0x00 0xA6, un TraceDumpHeader (24 octets)
+puis header.count evenements du plus ancien au plus recent, little-endian.
+
+Vidage SysEx (F0 7D 54 01 F7): F0 7D 54 02 <en-tete> F7 puis des blocs
+F0 7D 54 03 <index 2> <evenements> F7, chaque champ en octets de 7 bits poids faible en
+premier (en-tete: magic 5, version 1, count 2, total 5, bootCount 5, nowUs 5; evenement:
+horodatage 5, type 1, a 2, b 3).
+
+Ce fichier n'inclut rien de specifique a Arduino: il est aussi compile par l'outil PC.
+************************************************************************************************/
+
+#define TRACE_MAGIC 0x5452594CUL  // "LYRT"
+#define TRACE_VERSION 1
+
+#define TRACE_FRAME_SYNC0 0x00
+#define TRACE_FRAME_SYNC1 0xA6
+
+enum TraceEventType : uint8_t {
+  TRACE_NONE = 0,
+  TRACE_BOOT,           // a: cause du reset (esp_reset_reason_t), b: numero de demarrage
+  TRACE_MIDI_NOTE_ON,   // a: note, b: velocite
+  TRACE_MIDI_NOTE_OFF,  // a: note
+  TRACE_MIDI_CC,        // a: controleur, b: valeur
+  TRACE_PLUCK,          // a: servo, b: note (decision: grattage)
+  TRACE_MUTE,           // a: servo, b: note (decision: etouffement immediat)
+  TRACE_MUTE_DEFERRED,  // a: servo, b: note (pedale ou pluck-through: plus tard)
+  TRACE_SCORE,          // a: servo, b: tick (evenement de partition du a l'instant)
+  TRACE_SERVO_WRITE,    // a: voie, b: valeur OFF ecrite (4096 = full-OFF), fin d'ecriture I2C
+  TRACE_GROUP_WRITE,    // a: premiere voie | derniere voie << 4, b: voies alimentees
+  TRACE_POWER,          // a: TracePowerState, b: masque des voies concernees
+  TRACE_PANIC,
+  TRACE_I2C_ERROR,      // a: code Wire.endTransmission()
+  TRACE_DEVICE,         // a: 1 = PCA9685 detecte, 0 = perdu, 2 = mode degrade
+  TRACE_TYPE_COUNT
+};
+
+enum TracePowerState : uint8_t {
+  TRACE_POWER_OE_OFF = 0,  // Broche OE: sorties coupees
+  TRACE_POWER_OE_ON,
+  TRACE_POWER_RELEASE,     // Voies passees en full-OFF (inactivite)
+  TRACE_POWER_WAKE         // Voie liberee realimentee
+};
+
+struct TraceEvent {
+  uint32_t timestampUs;
+  uint8_t type;  // TraceEventType
+  uint8_t a;
+  uint16_t b;
+};
+
+struct TraceDumpHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t count;        // Evenements qui suivent
+  uint32_t total;        // Evenements enregistres depuis la mise sous tension
+  uint32_t bootCount;    // Demarrages a chaud depuis la mise sous tension
+  uint32_t nowUs;        // micros() au moment du vidage
+  uint32_t reserved;
+};
+
+inline const char* traceEventName(uint8_t type) {
+  static const char* const names[TRACE_TYPE_COUNT] = {
+    "-", "BOOT", "NOTE_ON", "NOTE_OFF", "CC", "PLUCK", "MUTE", "MUTE_DEFER", "SCORE",
+    "WRITE", "GROUP_WRITE", "POWER", "PANIC", "I2C_ERROR", "DEVICE"
+  };
+  return type < TRACE_TYPE_COUNT ? names[type] : "?";
+}
+
+#endif // TRACEFORMAT_H
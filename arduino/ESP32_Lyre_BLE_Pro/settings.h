@@ -11,14 +11,68 @@ Configuration pour version professionnelle avec SysEx et feedback MIDI
 // CONFIGURATION DEBUG
 // =============================================================================================
 #define DEBUG 1  // 0=OFF, 1=ON (affiche messages MIDI dans Serial Monitor)
+#define DEFERRED_LOG_BINARY false   // Journal différé (DeferredLog.h): true = trames binaires pour tools/lyre_log
+#define DEFERRED_LOG_DRAIN_MS 20     // Période de vidage du journal par la tâche basse priorité
+#define ENABLE_EVENT_TRACE false     // Trace d'événements en RAM RTC (EventTrace.h), à vider avec EventTrace::dump()
+#define TRACE_BUFFER_EVENTS 256      // Puissance de 2, 8 octets par événement (8 Ko de RAM RTC au total)
+#define LOOP_MAX_SLEEP_MS 1000       // Boucle événementielle (LoopScheduler.h): sommeil max sans échéance ni événement
+#define LOOP_TASKS_MAX 8             // Tâches périodiques de la loop
 
 // =============================================================================================
 // CONFIGURATION BLE MIDI
 // =============================================================================================
 #define BLE_DEVICE_NAME "Lyre-MIDI-ESP32"  // Nom Bluetooth (32 caractères max)
+#define BLE_EVENT_QUEUE_SIZE 32  // Tâche BLE → loop(): connexions et messages MIDI reçus en attente
+
+// Paramètres de connexion demandés au central après chaque connexion (BleConnParams.h)
+#define BLE_CONN_INTERVAL_MIN 6          // 7,5 ms (unités de 1,25 ms)
+#define BLE_CONN_INTERVAL_MAX 9          // 11,25 ms
+#define BLE_CONN_LATENCY 0               // Latence esclave: aucun intervalle sauté
+#define BLE_CONN_TIMEOUT 400             // Supervision: 4 s (unités de 10 ms)
+#define BLE_CONN_REQUEST_DELAY_MS 1000   // Première demande après la découverte des services
+#define BLE_CONN_RETRY_MS 2000           // Paramètres refusés ou dégradés: nouvelle demande, délai doublé
+#define BLE_CONN_MAX_RETRIES 5           // Nouvelles demandes au plus par connexion
+#define BLE_DATA_LENGTH 251              // DLE: octets par paquet radio demandés (27 sans extension)
+
+// SysEx: F0 7D 43 01 F7 → paramètres de connexion accordés, aussi envoyés après chaque
+// Identity Reply: F0 7D 43 02 [intervalle] [latence] [supervision] [MTU] [DLE tx] [DLE rx]
+// [demandes] [mises à jour] F7 (2 octets de 7 bits par champ, poids faible en premier)
+#define SYSEX_MANUFACTURER_ID 0x7D
+#define SYSEX_CONNECTION 0x43  // 'C'
+#define SYSEX_CONNECTION_QUERY 0x01
+#define SYSEX_CONNECTION_REPLY 0x02
 
 // Feedback MIDI (envoyer confirmations des notes jouées)
 #define MIDI_SEND_FEEDBACK true  // true = envoie Note On/Off en retour
+#define MIDI_FEEDBACK_CHANNEL 1  // Canal des confirmations (1-16)
+// Feedback d'actionnement: envoyé quand la corde a bougé, horodaté avec l'instant de fin
+// d'écriture I2C et précédé du CC portant l'index du servo
+#define FEEDBACK_SERVO_CC 104        // CC 104 = corde actionnée (0-15)
+
+// File d'envoi BLE-MIDI (BleMidiTx.h): messages regroupés en un paquet par intervalle
+#define BLE_TX_RING_BYTES 1024       // Puissance de 2 (3 octets d'en-tête par message)
+#define BLE_TX_FLUSH_US 7500         // Attente max d'un message: intervalle de connexion minimal
+#define BLE_TX_PACKET_MAX 244        // Octets par notification: un seul paquet radio avec DLE (251 - 7)
+
+// =============================================================================================
+// GESTION D'ENERGIE (PowerManager.h)
+// =============================================================================================
+// Au repos (aucun message MIDI depuis POWER_ACTIVE_HOLD_MS), le CPU descend à 80 MHz et peut
+// dormir entre deux événements BLE. La première note après un repos paie la latence ajoutée
+// du mode, bornée par POWER_LATENCY_BUDGET_US; le reste du budget permet une latence esclave.
+#define POWER_MODE 2                     // 0 = performance, 1 = fréquence variable, 2 = + sommeil léger
+#define POWER_LATENCY_BUDGET_US 2000
+#define POWER_ACTIVE_HOLD_MS 10000
+#define POWER_CPU_MAX_MHZ 240
+#define POWER_CPU_MIN_MHZ 80             // APB (I2C, UART) inchangé à 80 MHz
+#define POWER_IDLE_LATENCY_MAX 4         // Latence esclave BLE au repos, au plus
+#define POWER_DFS_WAKE_US 50             // Retour à 240 MHz
+#define POWER_LIGHT_SLEEP_WAKE_US 1000   // Sortie de sommeil léger
+// Estimations du rapport (valeurs typiques de la datasheet, à remplacer par une mesure)
+#define POWER_MA_CPU_MAX 50              // CPU à 240 MHz
+#define POWER_MA_CPU_MIN 22              // CPU à 80 MHz
+#define POWER_MA_LIGHT_SLEEP 1           // Sommeil léger
+#define POWER_MA_BLE 8                   // Radio BLE, intervalle 7,5 ms sans latence esclave
 
 // =============================================================================================
 // CONFIGURATION MATERIEL
@@ -38,7 +92,33 @@ Configuration pour version professionnelle avec SysEx et feedback MIDI
 // =============================================================================================
 #define SERVO_INIT_DELAY_MS 500
 #define SERVO_RESET_DELAY_MS 100
-#define SERVO_AUTO_DISABLE_TIMEOUT_MS 2000  // Désactiver après 2s d'inactivité
+// Balayage d'initialisation par groupes: N servos bougent ensemble (budget alimentation,
+// ~700 mA de pointe par SG90). 16 servos par 4 = 4 x (500 + 100) ms au lieu de 9,6 s.
+#define SERVO_INIT_GROUP_SIZE 4
+// Redémarrage à chaud (watchdog, reset logiciel): l'état des servos est conservé en mémoire RTC
+// et le balayage est sauté. Après une mise sous tension ou une chute d'alimentation il a lieu.
+#define SERVO_WARM_BOOT true
+#define SERVO_AUTO_DISABLE_TIMEOUT_MS 2000  // Voie libérée (bit full-OFF du PCA9685) après 2s sans mouvement
+// Prédiction de trafic: tant que des notes arrivent (une dans la dernière fenêtre), les cordes
+// jouées récemment restent alimentées plus longtemps pour ne pas être réveillées à chaque note
+#define SERVO_TRAFFIC_WINDOW_MS 4000
+#define SERVO_TRAFFIC_HOLD_MS 10000
+
+// Modèle de déplacement des servos (SG90: 0.1 s / 60° sous 4.8V)
+// Sert à compenser la latence mécanique (partitions compilées, anticipation)
+#define SERVO_US_PER_DEGREE 1667
+#define PLUCK_RELEASE_ANGLE (PLUCK_ANGLE / 2)  // Degrés parcourus depuis le repos avant que la corde s'échappe
+
+// Anticipation (lecture programmée): le servo est amené juste avant le point d'échappement,
+// seuls les derniers degrés sont parcourus à l'échéance
+#define LOOKAHEAD_PRESTAGE_ANGLE 5   // Doit rester < PLUCK_RELEASE_ANGLE (corde tendue, pas lâchée)
+#define LOOKAHEAD_WINDOW_US 60000    // Horizon d'anticipation
+#define LOOKAHEAD_MAX_STAGED 4       // Budget alimentation: servos maintenus en tension simultanément
+
+// Mode pluck-through: après un grattage le servo reste de l'autre côté de la corde et la note
+// suivante la traverse depuis là (un seul mouvement par note). Activable aussi par CC 68.
+#define PLUCK_THROUGH_MODE false
+#define PLUCK_THROUGH_DAMP_MS 0      // 0 = noteOff ignoré, >0 = étouffement N ms après le grattage
 
 // =============================================================================================
 // MAPPING MIDI → SERVOS
@@ -98,5 +178,12 @@ const uint16_t SERVO_PULSE_MIN = 500;
 const uint16_t SERVO_PULSE_MAX = 2500;
 const uint16_t SERVO_FREQUENCY = 50;
 const uint32_t PCA9685_OSCILLATOR_FREQ = 27000000;
+const uint8_t PCA9685_I2C_ADDRESS = 0x40;  // Adresse I2C du PCA9685 (cavaliers A0-A5 ouverts)
+
+// Détection du PCA9685 au démarrage (non-bloquante, le BLE/WiFi démarre en parallèle)
+#define PCA9685_PROBE_ATTEMPTS 5        // Essais avant de passer en mode dégradé (MIDI accepté, erreur signalée)
+#define PCA9685_PROBE_RETRY_MIN_MS 10   // Délai entre deux essais, doublé à chaque échec...
+#define PCA9685_PROBE_RETRY_MAX_MS 2000 // ...jusqu'à ce plafond (recherche en arrière-plan)
+#define PCA9685_I2C_TIMEOUT_MS 10       // Durée maximale d'une transaction I2C (bus bloqué)
 
 #endif
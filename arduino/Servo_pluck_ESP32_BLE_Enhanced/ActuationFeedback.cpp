@@ -0,0 +1,129 @@
+#include "ActuationFeedback.h"
+#include "DeferredLog.h"
+#include "LoopScheduler.h"
+
+ActuationFeedback::Event ActuationFeedback::_queue[FEEDBACK_QUEUE_SIZE];
+uint8_t ActuationFeedback::_head = 0;
+uint8_t ActuationFeedback::_count = 0;
+unsigned long ActuationFeedback::_firstQueuedUs = 0;
+ActuationFeedback::SendFunction ActuationFeedback::_send = nullptr;
+uint8_t ActuationFeedback::_channel = 0;
+uint32_t ActuationFeedback::_events = 0;
+uint32_t ActuationFeedback::_packets = 0;
+uint32_t ActuationFeedback::_dropped = 0;
+
+#if defined(ESP32)
+  static portMUX_TYPE feedbackMux = portMUX_INITIALIZER_UNLOCKED;
+  #define FEEDBACK_LOCK() portENTER_CRITICAL(&feedbackMux)
+  #define FEEDBACK_UNLOCK() portEXIT_CRITICAL(&feedbackMux)
+#else
+  #define FEEDBACK_LOCK()
+  #define FEEDBACK_UNLOCK()
+#endif
+
+// Taille d'un actionnement dans un paquet: deux fois timestamp + 3 octets MIDI
+#define FEEDBACK_EVENT_BYTES 8
+
+void ActuationFeedback::begin(SendFunction send, uint8_t channel) {
+  _send = send;
+  _channel = (channel - 1) & 0x0F;
+  clear();
+}
+
+void ActuationFeedback::push(uint8_t servo, uint8_t midiNote, uint8_t velocity,
+                             unsigned long doneUs) {
+  // Timestamp BLE-MIDI dans le domaine de millis(), comme les autres messages de la pile
+  unsigned long nowUs = micros();
+  uint16_t timestampMs = (millis() - (nowUs - doneUs) / 1000) & 0x1FFF;
+
+  FEEDBACK_LOCK();
+  if (_count >= FEEDBACK_QUEUE_SIZE) {
+    _dropped++;
+    FEEDBACK_UNLOCK();
+    return;
+  }
+  if (_count == 0) {
+    _firstQueuedUs = nowUs;
+  }
+  Event& e = _queue[(_head + _count) % FEEDBACK_QUEUE_SIZE];
+  e.timestampMs = timestampMs;
+  e.servo = servo;
+  e.note = midiNote;
+  e.velocity = velocity;
+  _count++;
+  FEEDBACK_UNLOCK();
+
+  if (velocity > 0) {
+    DeferredLog::log(LOG_MIDI_OUT_NOTE_ON, midiNote, velocity);
+  } else {
+    DeferredLog::log(LOG_MIDI_OUT_NOTE_OFF, midiNote);
+  }
+}
+
+void ActuationFeedback::update() {
+  if (_count == 0) return;
+  unsigned long waited = micros() - _firstQueuedUs;
+  if (waited >= FEEDBACK_COALESCE_US) {
+    flush();
+  } else {
+    LoopScheduler::wakeWithin((FEEDBACK_COALESCE_US - waited) / 1000);
+  }
+}
+
+void ActuationFeedback::clear() {
+  FEEDBACK_LOCK();
+  _head = 0;
+  _count = 0;
+  FEEDBACK_UNLOCK();
+}
+
+void ActuationFeedback::flush() {
+  // Copie de la file hors du verrou: l'envoi BLE peut prendre du temps
+  Event events[FEEDBACK_QUEUE_SIZE];
+  uint8_t count;
+  FEEDBACK_LOCK();
+  count = _count;
+  for (uint8_t i = 0; i < count; i++) {
+    events[i] = _queue[(_head + i) % FEEDBACK_QUEUE_SIZE];
+  }
+  _head = (_head + count) % FEEDBACK_QUEUE_SIZE;
+  _count = 0;
+  FEEDBACK_UNLOCK();
+
+  if (count == 0 || !_send) return;
+
+  uint8_t packet[FEEDBACK_PACKET_SIZE];
+  uint8_t length = 0;
+  uint16_t lastMs = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    const Event& e = events[i];
+    if (length + FEEDBACK_EVENT_BYTES > FEEDBACK_PACKET_SIZE) {
+      _send(packet, length);
+      _packets++;
+      length = 0;
+    }
+
+    // Dans un paquet les timestamps ne doivent pas reculer (un recul = 128 ms de plus pour le
+    // recepteur): deux taches peuvent empiler dans un ordre decale d'une milliseconde
+    uint16_t ms = e.timestampMs;
+    if (length == 0) {
+      packet[length++] = 0x80 | ((ms >> 7) & 0x3F);  // En-tete: 6 bits de poids fort
+    } else if (((ms - lastMs) & 0x1FFF) > 0x1000) {
+      ms = lastMs;
+    }
+    lastMs = ms;
+    uint8_t timestamp = 0x80 | (ms & 0x7F);
+
+    packet[length++] = timestamp;
+    packet[length++] = 0xB0 | _channel;
+    packet[length++] = FEEDBACK_SERVO_CC;
+    packet[length++] = e.servo;
+    packet[length++] = timestamp;
+    packet[length++] = (e.velocity > 0 ? 0x90 : 0x80) | _channel;
+    packet[length++] = e.note;
+    packet[length++] = e.velocity;
+    _events++;
+  }
+  _send(packet, length);
+  _packets++;
+}
@@ -0,0 +1,64 @@
+#ifndef ACTUATIONFEEDBACK_H
+#define ACTUATIONFEEDBACK_H
+
+#include <Arduino.h>
+#include "settings.h"
+/***********************************************************************************************
+----------------------------    ActuationFeedback.h   ------------------------------------------
+************************************************************************************************
+Feedback d'actionnement BLE-MIDI: la confirmation d'une note part quand la corde a reellement
+bouge (fin de l'ecriture PCA9685, voir Instrument::setActuationCallback), pas a la reception.
+
+Chaque actionnement donne deux messages avec le meme timestamp BLE-MIDI (ms, 13 bits) = instant
+de fin d'ecriture I2C:
+  B0|canal FEEDBACK_SERVO_CC <servo>      corde actionnee (0-15)
+  90|canal <note> <velocite>              grattage (80|canal <note> 0: etouffement)
+Le DAW compare ce timestamp a l'envoi de sa note pour compenser la latence en boucle fermee.
+
+Les actionnements sont mis en file puis envoyes ensemble: un paquet par intervalle de
+connexion (FEEDBACK_COALESCE_US) au lieu d'une notification par note. L'attente ne fausse rien,
+le timestamp porte l'instant reel.
+
+push() peut etre appele depuis la loop et depuis la tache BLE (file sous verrou); update() et
+flush() depuis la loop uniquement.
+************************************************************************************************/
+
+class ActuationFeedback {
+  public:
+    typedef void (*SendFunction)(const uint8_t* packet, size_t length);
+
+  private:
+    struct Event {
+      uint16_t timestampMs;  // millis() de l'actionnement, 13 bits
+      uint8_t servo;
+      uint8_t note;
+      uint8_t velocity;
+    };
+
+    static Event _queue[FEEDBACK_QUEUE_SIZE];
+    static uint8_t _head;
+    static uint8_t _count;
+    static unsigned long _firstQueuedUs;  // micros() du plus ancien actionnement en attente
+    static SendFunction _send;
+    static uint8_t _channel;  // 0-15
+    static uint32_t _events;
+    static uint32_t _packets;
+    static uint32_t _dropped;
+
+  public:
+    // channel: 1-16. send ecrit un paquet BLE-MIDI complet (en-tete compris) en une notification
+    static void begin(SendFunction send, uint8_t channel);
+
+    // Signature d'Instrument::ActuationCallback
+    static void push(uint8_t servo, uint8_t midiNote, uint8_t velocity, unsigned long doneUs);
+
+    static void update();  // Dans loop(): envoie la file une fois l'intervalle ecoule
+    static void flush();   // Envoie tout de suite
+    static void clear();   // Deconnexion: file videe sans envoi
+
+    static uint32_t getEventCount() { return _events; }
+    static uint32_t getPacketCount() { return _packets; }
+    static uint32_t getDroppedCount() { return _dropped; }
+};
+
+#endif // ACTUATIONFEEDBACK_H
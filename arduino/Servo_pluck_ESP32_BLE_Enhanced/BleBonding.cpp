@@ -0,0 +1,361 @@
+#include "BleBonding.h"
+#include "LoopScheduler.h"
+#include <BLEDevice.h>
+#include <BLESecurity.h>
+#include <Preferences.h>
+#include <esp_gap_ble_api.h>
+
+#define BOND_NVS_NAMESPACE "lyre_bond"
+#define BOND_NVS_KEY "peers"
+
+BleBonding::Peer BleBonding::_peers[BLE_BOND_MAX];
+uint8_t BleBonding::_count = 0;
+BleBonding::Stats BleBonding::_stats;
+BleBonding::AdvertisingPhase BleBonding::_phase = BleBonding::ADV_IDLE;
+unsigned long BleBonding::_phaseStartMs = 0;
+unsigned long BleBonding::_downSinceMs = 0;
+bool BleBonding::_measuring = false;
+bool BleBonding::_encryptPending = false;
+unsigned long BleBonding::_connectMs = 0;
+bool BleBonding::_connected = false;
+bool BleBonding::_pairingOpen = false;
+bool BleBonding::_advertiseDue = false;
+bool BleBonding::_connectedDue = false;
+bool BleBonding::_authDue = false;
+BleBonding::Peer BleBonding::_authPeer;
+
+static portMUX_TYPE bondMux = portMUX_INITIALIZER_UNLOCKED;
+
+class BondSecurityCallbacks : public BLESecurityCallbacks {
+  // Just Works (ni ecran ni clavier): pas de code a afficher ni a saisir
+  uint32_t onPassKeyRequest() override { return 0; }
+  void onPassKeyNotify(uint32_t passKey) override {}
+  bool onConfirmPIN(uint32_t pin) override { return true; }
+
+  bool onSecurityRequest() override {
+    return BleBonding::onSecurityRequest();
+  }
+
+  void onAuthenticationComplete(esp_ble_auth_cmpl_t cmpl) override {
+    BleBonding::onAuthenticationComplete(cmpl.bd_addr, cmpl.addr_type, cmpl.success);
+  }
+};
+
+static BondSecurityCallbacks securityCallbacks;
+
+// Cles gardees par la pile BLE (liste a liberer avec free())
+static int readStackBonds(esp_ble_bond_dev_t** list) {
+  int count = esp_ble_get_bond_device_num();
+  *list = nullptr;
+  if (count <= 0) return 0;
+  *list = (esp_ble_bond_dev_t*)malloc(count * sizeof(esp_ble_bond_dev_t));
+  if (!*list) return 0;
+  esp_ble_get_bond_device_list(&count, *list);
+  return count;
+}
+
+static void printAddress(const uint8_t* address) {
+  Serial.printf("%02X:%02X:%02X:%02X:%02X:%02X",
+                address[0], address[1], address[2], address[3], address[4], address[5]);
+}
+
+void BleBonding::begin() {
+  memset(&_stats, 0, sizeof(_stats));
+
+  // Liaison demandee a chaque connexion: un appareil lie chiffre avec sa cle, un nouveau
+  // s'appaire (accepte ou non selon la fenetre d'appairage)
+  BLESecurity* security = new BLESecurity();
+  security->setAuthenticationMode(ESP_LE_AUTH_REQ_SC_BOND);
+  security->setCapability(ESP_IO_CAP_NONE);
+  security->setInitEncryptionKey(ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK);
+  security->setRespEncryptionKey(ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK);
+  BLEDevice::setEncryptionLevel(ESP_BLE_SEC_ENCRYPT);
+  BLEDevice::setSecurityCallbacks(&securityCallbacks);
+
+  load();
+  if (syncStackBonds(false)) {
+    save();
+  }
+
+  portENTER_CRITICAL(&bondMux);
+  _downSinceMs = millis();
+  _measuring = true;
+  _encryptPending = true;
+  _advertiseDue = true;
+  portEXIT_CRITICAL(&bondMux);
+
+  Serial.printf("[BOND] %u appareil(s) lie(s)", _count);
+  if (_count > 0) {
+    Serial.print(", dernier ");
+    printAddress(_peers[0].address);
+  }
+  Serial.println();
+}
+
+void BleBonding::load() {
+  _count = 0;
+  Preferences prefs;
+  if (!prefs.begin(BOND_NVS_NAMESPACE, true)) return;
+  size_t length = prefs.getBytesLength(BOND_NVS_KEY);
+  if (length > 0 && length <= sizeof(_peers) && length % sizeof(Peer) == 0) {
+    prefs.getBytes(BOND_NVS_KEY, _peers, length);
+    _count = length / sizeof(Peer);
+  }
+  prefs.end();
+}
+
+void BleBonding::save() {
+  Preferences prefs;
+  if (!prefs.begin(BOND_NVS_NAMESPACE, false)) {
+    Serial.println("[BOND] NVS indisponible, liste non sauvegardee");
+    return;
+  }
+  if (_count > 0) {
+    prefs.putBytes(BOND_NVS_KEY, _peers, _count * sizeof(Peer));
+  } else {
+    prefs.remove(BOND_NVS_KEY);
+  }
+  prefs.end();
+}
+
+int8_t BleBonding::find(const uint8_t* address) {
+  for (uint8_t i = 0; i < _count; i++) {
+    if (memcmp(_peers[i].address, address, sizeof(_peers[i].address)) == 0) return i;
+  }
+  return -1;
+}
+
+bool BleBonding::promote(const Peer& peer) {
+  int8_t index = find(peer.address);
+  if (index == 0) return false;
+  if (index < 0) {
+    if (_count == BLE_BOND_MAX) {
+      // Liste pleine: le plus ancien est oublie, cle de la pile comprise
+      _count--;
+      Serial.print("[BOND] Liste pleine, oubli de ");
+      printAddress(_peers[_count].address);
+      Serial.println();
+      esp_ble_remove_bond_device(_peers[_count].address);
+      _stats.bondsForgotten++;
+    }
+    index = _count++;
+  }
+  memmove(&_peers[1], &_peers[0], index * sizeof(Peer));
+  _peers[0] = peer;
+  return true;
+}
+
+bool BleBonding::syncStackBonds(bool adopt) {
+  esp_ble_bond_dev_t* list;
+  int stackCount = readStackBonds(&list);
+  bool changed = false;
+
+  if (!adopt) {
+    // Cles perdues par la pile: l'appareil devra s'appairer a nouveau
+    for (uint8_t i = 0; i < _count; ) {
+      bool present = false;
+      for (int j = 0; j < stackCount && !present; j++) {
+        present = memcmp(list[j].bd_addr, _peers[i].address, sizeof(_peers[i].address)) == 0;
+      }
+      if (present) {
+        i++;
+      } else {
+        memmove(&_peers[i], &_peers[i + 1], (_count - i - 1) * sizeof(Peer));
+        _count--;
+        changed = true;
+      }
+    }
+  }
+
+  for (int j = 0; j < stackCount; j++) {
+    if (find(list[j].bd_addr) >= 0) continue;
+    if (adopt) {
+      // Nouvelle liaison: adresse d'identite donnee par l'appareil (IRK) si distribuee
+      Peer peer;
+      memcpy(peer.address, list[j].bd_addr, sizeof(peer.address));
+      peer.addressType = (list[j].bond_key.key_mask & ESP_LE_KEY_PID)
+                         ? list[j].bond_key.pid_key.addr_type : BLE_ADDR_TYPE_PUBLIC;
+      changed |= promote(peer);
+    } else {
+      // Cle hors liste (liste effacee, firmware precedent): la liste fait foi
+      esp_ble_remove_bond_device(list[j].bd_addr);
+    }
+  }
+
+  free(list);
+  return changed;
+}
+
+void BleBonding::startDirected(const Peer& peer) {
+  // Dirige haute frequence: le central connu se connecte au premier paquet recu, personne
+  // d'autre ne peut se connecter pendant ce temps (1,28 s au plus)
+  esp_ble_adv_params_t params;
+  memset(&params, 0, sizeof(params));
+  params.adv_int_min = BLE_BOND_FAST_ADV_MIN;
+  params.adv_int_max = BLE_BOND_FAST_ADV_MAX;
+  params.adv_type = ADV_TYPE_DIRECT_IND_HIGH;
+  params.own_addr_type = BLE_ADDR_TYPE_PUBLIC;
+  memcpy(params.peer_addr, peer.address, sizeof(params.peer_addr));
+  params.peer_addr_type = (esp_ble_addr_type_t)peer.addressType;
+  params.channel_map = ADV_CHNL_ALL;
+  params.adv_filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY;
+  esp_ble_gap_stop_advertising();
+  esp_ble_gap_start_advertising(&params);
+}
+
+void BleBonding::startNormal() {
+  // Advertising de la bibliotheque (donnees BLE-MIDI), a intervalle court
+  esp_ble_gap_stop_advertising();
+  BLEAdvertising* advertising = BLEDevice::getAdvertising();
+  advertising->setMinInterval(BLE_BOND_FAST_ADV_MIN);
+  advertising->setMaxInterval(BLE_BOND_FAST_ADV_MAX);
+  advertising->start();
+}
+
+void BleBonding::update() {
+  portENTER_CRITICAL(&bondMux);
+  bool connected = _connected;
+  bool advertise = _advertiseDue && !connected;
+  if (advertise || connected) _advertiseDue = false;
+  bool connectedDue = _connectedDue;
+  unsigned long connectMs = _connectMs;
+  _connectedDue = false;
+  bool authDue = _authDue;
+  Peer authPeer = _authPeer;
+  _authDue = false;
+  unsigned long encryptedMs = _stats.lastEncryptedMs;
+  portEXIT_CRITICAL(&bondMux);
+
+  // Connexion: avant tout changement de phase, pour savoir si le dirige a servi
+  if (connectedDue) {
+    bool directed = (_phase == ADV_DIRECTED);
+    _stats.reconnects++;
+    if (directed) _stats.directedReconnects++;
+    _stats.lastMs = connectMs;
+    if (_stats.reconnects == 1 || connectMs < _stats.minMs) _stats.minMs = connectMs;
+    if (connectMs > _stats.maxMs) _stats.maxMs = connectMs;
+    Serial.printf("[BOND] Connexion en %lu ms (advertising %s)\n",
+                  connectMs, directed ? "dirige" : "normal");
+  }
+  if (connected) {
+    _phase = ADV_IDLE;  // La pile arrete l'advertising a la connexion
+  }
+
+  if (advertise) {
+    if (_count > 0) {
+      startDirected(_peers[0]);
+      _phase = ADV_DIRECTED;
+    } else {
+      startNormal();
+      _phase = ADV_NORMAL;
+    }
+    _phaseStartMs = millis();
+  } else if (_phase == ADV_DIRECTED && millis() - _phaseStartMs >= BLE_BOND_DIRECTED_MS) {
+    // Le dernier appareil n'a pas repondu: advertising ouvert a tous
+    startNormal();
+    _phase = ADV_NORMAL;
+  }
+  if (_phase == ADV_DIRECTED) {
+    LoopScheduler::wakeWithin(BLE_BOND_DIRECTED_MS - (millis() - _phaseStartMs));
+  }
+
+  if (authDue) {
+    int8_t index = find(authPeer.address);
+    bool changed;
+    if (index >= 0) {
+      Serial.printf("[BOND] Chiffre en %lu ms (appareil lie %d/%u)\n", encryptedMs, index + 1, _count);
+      changed = promote(_peers[index]);  // Devient le dernier appareil
+    } else {
+      changed = syncStackBonds(true);
+      if (changed) {
+        Serial.print("[BOND] Nouvel appareil lie ");
+        printAddress(_peers[0].address);
+        Serial.printf(" (%u/%d)\n", _count, BLE_BOND_MAX);
+      }
+    }
+    if (changed) {
+      save();
+    }
+  }
+}
+
+void BleBonding::setPairingOpen(bool open) {
+  portENTER_CRITICAL(&bondMux);
+  _pairingOpen = open;
+  portEXIT_CRITICAL(&bondMux);
+}
+
+void BleBonding::clear() {
+  esp_ble_bond_dev_t* list;
+  int stackCount = readStackBonds(&list);
+  for (int j = 0; j < stackCount; j++) {
+    esp_ble_remove_bond_device(list[j].bd_addr);  // Deconnecte l'appareil s'il est connecte
+  }
+  free(list);
+  _count = 0;
+  save();
+  Serial.printf("[BOND] Liste effacee (%d cle(s) supprimee(s))\n", stackCount);
+}
+
+void BleBonding::print() {
+  Serial.printf("[BOND] Appareils lies: %u/%d", _count, BLE_BOND_MAX);
+  for (uint8_t i = 0; i < _count; i++) {
+    Serial.print(i == 0 ? " | " : ", ");
+    printAddress(_peers[i].address);
+  }
+  Serial.println();
+  Stats s = getStats();
+  if (s.reconnects > 0) {
+    Serial.printf("[BOND] Reconnexions: %lu (dont %lu dirigees) | dernier %lu ms | min %lu ms | "
+                  "max %lu ms | chiffre en %lu ms\n",
+                  (unsigned long)s.reconnects, (unsigned long)s.directedReconnects, s.lastMs,
+                  s.minMs, s.maxMs, s.lastEncryptedMs);
+  }
+  if (s.pairingsRefused > 0 || s.bondsForgotten > 0) {
+    Serial.printf("[BOND] Appairages refuses: %lu | appareils oublies: %lu\n",
+                  (unsigned long)s.pairingsRefused, (unsigned long)s.bondsForgotten);
+  }
+}
+
+void BleBonding::onConnected() {
+  portENTER_CRITICAL(&bondMux);
+  _connected = true;
+  if (_measuring) {
+    _connectMs = millis() - _downSinceMs;
+    _measuring = false;
+    _connectedDue = true;
+  }
+  portEXIT_CRITICAL(&bondMux);
+}
+
+void BleBonding::onDisconnected() {
+  portENTER_CRITICAL(&bondMux);
+  _connected = false;
+  _downSinceMs = millis();
+  _measuring = true;
+  _encryptPending = true;
+  _advertiseDue = true;
+  portEXIT_CRITICAL(&bondMux);
+}
+
+bool BleBonding::onSecurityRequest() {
+  portENTER_CRITICAL(&bondMux);
+  bool accept = _pairingOpen;
+  if (!accept) _stats.pairingsRefused++;
+  portEXIT_CRITICAL(&bondMux);
+  return accept;
+}
+
+void BleBonding::onAuthenticationComplete(const uint8_t* address, uint8_t addressType, bool success) {
+  if (!success) return;
+  portENTER_CRITICAL(&bondMux);
+  memcpy(_authPeer.address, address, sizeof(_authPeer.address));
+  _authPeer.addressType = addressType;
+  if (_encryptPending) {
+    _stats.lastEncryptedMs = millis() - _downSinceMs;
+    _encryptPending = false;
+  }
+  _authDue = true;
+  portEXIT_CRITICAL(&bondMux);
+  LoopScheduler::wake();
+}
@@ -0,0 +1,94 @@
+#ifndef BLEBONDING_H
+#define BLEBONDING_H
+
+#include <Arduino.h>
+#include "settings.h"
+/***********************************************************************************************
+----------------------------    BleBonding.h   -------------------------------------------------
+************************************************************************************************
+Appareils appaires: liaison BLE (bonding) gardee en NVS et reconnexion rapide au dernier
+appareil apres un redemarrage ou une deconnexion.
+
+- Le chiffrement est demande a chaque connexion. Un appareil deja lie le retrouve avec sa cle,
+  sans nouvel appairage. Un nouvel appareil n'est lie que pendant la fenetre d'appairage
+  (setPairingOpen): hors de cette fenetre, sa demande d'appairage est refusee.
+- Liste autorisee: BLE_BOND_MAX appareils au plus, du plus recent au plus ancien, en NVS
+  (namespace "lyre_bond"). Au-dela, le plus ancien est oublie, cle comprise. La pile BLE garde
+  ses propres cles: au demarrage, celles qui ne sont pas dans la liste sont effacees.
+- Advertising: au demarrage et a chaque deconnexion, advertising dirige vers le dernier
+  appareil (BLE_BOND_DIRECTED_MS, la reconnexion part au premier paquet recu par le central),
+  puis advertising normal rapide pour tous les autres. Un central qui change d'adresse
+  (adresse privee non resolue) ne repond pas au dirige: il se reconnecte pendant la phase
+  normale.
+- Duree de reconnexion: de la deconnexion (ou du demarrage BLE) a la connexion, et jusqu'au
+  chiffrement pour un appareil lie.
+
+Les evenements de connexion et de securite viennent de la tache BLE: ils sont copies sous
+verrou, l'advertising, la NVS et l'affichage sont traites dans update(), depuis la loop.
+************************************************************************************************/
+
+class BleBonding {
+  public:
+    struct Peer {
+      uint8_t address[6];
+      uint8_t addressType;  // esp_ble_addr_type_t (adresse d'identite)
+    };
+
+    struct Stats {
+      uint32_t reconnects;          // Connexions mesurees (depuis demarrage ou deconnexion)
+      uint32_t directedReconnects;  // ... dont pendant l'advertising dirige
+      unsigned long lastMs;         // Derniere duree jusqu'a la connexion
+      unsigned long minMs;
+      unsigned long maxMs;
+      unsigned long lastEncryptedMs;  // Derniere duree jusqu'au chiffrement (appareil lie)
+      uint32_t pairingsRefused;     // Demandes d'appairage hors fenetre
+      uint32_t bondsForgotten;      // Appareils oublies (liste pleine)
+    };
+
+  private:
+    enum AdvertisingPhase { ADV_IDLE, ADV_DIRECTED, ADV_NORMAL };
+
+    static Peer _peers[BLE_BOND_MAX];
+    static uint8_t _count;
+    static Stats _stats;
+    static AdvertisingPhase _phase;
+    static unsigned long _phaseStartMs;
+    static unsigned long _downSinceMs;  // Debut de la mesure de reconnexion
+    static bool _measuring;             // Connexion attendue depuis _downSinceMs
+    static bool _encryptPending;        // Chiffrement attendu depuis _downSinceMs
+    static unsigned long _connectMs;    // Duree mesuree, a afficher
+    static bool _connected;
+    static bool _pairingOpen;
+    static bool _advertiseDue;   // Demarrage ou deconnexion: advertising a relancer
+    static bool _connectedDue;   // Connexion a comptabiliser et afficher
+    static bool _authDue;        // Chiffrement termine: liste a mettre a jour
+    static Peer _authPeer;
+
+    static void load();
+    static void save();
+    static int8_t find(const uint8_t* address);
+    static bool promote(const Peer& peer);  // En tete de liste, oublie le plus ancien si pleine
+    // Cles de la pile <-> liste: au demarrage, efface ce qui n'est pas des deux cotes; apres
+    // un appairage (adopt), ajoute en tete les cles inconnues de la liste
+    static bool syncStackBonds(bool adopt);
+    static void startDirected(const Peer& peer);
+    static void startNormal();
+
+  public:
+    static void begin();   // Apres l'initialisation BLE (MIDI.begin)
+    static void update();  // Dans loop()
+
+    static void setPairingOpen(bool open);
+    static void clear();   // Oublie tous les appareils (NVS et cles de la pile)
+    static uint8_t count() { return _count; }
+    static Stats getStats() { return _stats; }
+    static void print();
+
+    // Appeles depuis la tache BLE
+    static void onConnected();
+    static void onDisconnected();
+    static bool onSecurityRequest();
+    static void onAuthenticationComplete(const uint8_t* address, uint8_t addressType, bool success);
+};
+
+#endif // BLEBONDING_H
@@ -0,0 +1,209 @@
+#include "BleConnParams.h"
+#include "LoopScheduler.h"
+#include "PowerManager.h"
+#include <BLEDevice.h>
+#include <esp_gap_ble_api.h>
+
+BleConnParams::Params BleConnParams::_params;
+uint8_t BleConnParams::_peer[6];
+bool BleConnParams::_requestDue = false;
+uint16_t BleConnParams::_targetLatency = BLE_CONN_LATENCY;
+uint8_t BleConnParams::_attempts = 0;
+unsigned long BleConnParams::_requestAtMs = 0;
+uint16_t BleConnParams::_retryDelayMs = BLE_CONN_RETRY_MS;
+bool BleConnParams::_changed = false;
+
+static portMUX_TYPE connMux = portMUX_INITIALIZER_UNLOCKED;
+
+static void gattsHandler(esp_gatts_cb_event_t event, esp_gatt_if_t gattsIf,
+                         esp_ble_gatts_cb_param_t* param) {
+  switch (event) {
+    case ESP_GATTS_CONNECT_EVT:
+      BleConnParams::onConnect(param->connect.remote_bda);
+      break;
+    case ESP_GATTS_DISCONNECT_EVT:
+      BleConnParams::onDisconnect();
+      break;
+    case ESP_GATTS_MTU_EVT:
+      BleConnParams::onMtu(param->mtu.mtu);
+      break;
+    case ESP_GATTS_WRITE_EVT:
+      PowerManager::activity();  // CPU a fond avant le traitement du message
+      break;  // Message MIDI deja remis a la bibliotheque ou au callback: reste a le traiter
+    default:
+      return;
+  }
+  LoopScheduler::wake();
+}
+
+static void gapHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param) {
+  switch (event) {
+    case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+      if (param->update_conn_params.status == ESP_BT_STATUS_SUCCESS) {
+        BleConnParams::onParams(param->update_conn_params.conn_int,
+                                param->update_conn_params.latency,
+                                param->update_conn_params.timeout);
+      }
+      break;
+    case ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT:
+      BleConnParams::onDataLength(param->pkt_data_lenth_cmpl.params.tx_len,
+                                  param->pkt_data_lenth_cmpl.params.rx_len);
+      break;
+    default:
+      return;
+  }
+  LoopScheduler::wake();
+}
+
+void BleConnParams::begin() {
+  memset(&_params, 0, sizeof(_params));
+  BLEDevice::setCustomGattsHandler(gattsHandler);
+  BLEDevice::setCustomGapHandler(gapHandler);
+}
+
+void BleConnParams::onConnect(const uint8_t* peer) {
+  portENTER_CRITICAL(&connMux);
+  memcpy(_peer, peer, sizeof(_peer));
+  memset(&_params, 0, sizeof(_params));
+  _params.connected = true;
+  _params.mtu = 23;
+  _params.txOctets = 27;
+  _params.rxOctets = 27;
+  // Premiere demande une fois la decouverte des services passee (le central la refuse sinon)
+  _requestDue = true;
+  _requestAtMs = millis() + BLE_CONN_REQUEST_DELAY_MS;
+  _retryDelayMs = BLE_CONN_RETRY_MS;
+  _targetLatency = BLE_CONN_LATENCY;
+  _attempts = 0;
+  portEXIT_CRITICAL(&connMux);
+}
+
+void BleConnParams::onDisconnect() {
+  portENTER_CRITICAL(&connMux);
+  _params.connected = false;
+  _requestDue = false;
+  portEXIT_CRITICAL(&connMux);
+}
+
+void BleConnParams::onMtu(uint16_t mtu) {
+  portENTER_CRITICAL(&connMux);
+  _params.mtu = mtu;
+  _changed = true;
+  portEXIT_CRITICAL(&connMux);
+}
+
+void BleConnParams::onParams(uint16_t intervalUnits, uint16_t latency, uint16_t timeoutUnits) {
+  portENTER_CRITICAL(&connMux);
+  _params.intervalUnits = intervalUnits;
+  _params.latency = latency;
+  _params.timeoutUnits = timeoutUnits;
+  _params.updates++;
+  _changed = true;
+  if (isOnTarget(_params)) {
+    _requestDue = false;
+    _retryDelayMs = BLE_CONN_RETRY_MS;
+  } else if (_attempts < BLE_CONN_MAX_RETRIES + 1) {
+    // Refus ou degradation: nouvelle demande plus tard, de plus en plus espacee
+    _requestDue = true;
+    _requestAtMs = millis() + _retryDelayMs;
+    _retryDelayMs = _retryDelayMs < 32000 ? _retryDelayMs * 2 : 64000;
+  }
+  portEXIT_CRITICAL(&connMux);
+}
+
+void BleConnParams::onDataLength(uint16_t txOctets, uint16_t rxOctets) {
+  portENTER_CRITICAL(&connMux);
+  _params.txOctets = txOctets;
+  _params.rxOctets = rxOctets;
+  _changed = true;
+  portEXIT_CRITICAL(&connMux);
+}
+
+bool BleConnParams::isOnTarget(const Params& p) {
+  return p.intervalUnits >= BLE_CONN_INTERVAL_MIN && p.intervalUnits <= BLE_CONN_INTERVAL_MAX &&
+         p.latency <= _targetLatency;
+}
+
+BleConnParams::Params BleConnParams::get() {
+  portENTER_CRITICAL(&connMux);
+  Params p = _params;
+  portEXIT_CRITICAL(&connMux);
+  return p;
+}
+
+void BleConnParams::update() {
+  // Latence esclave selon le jeu: nouvelle demande aussitot quand la cible change
+  uint16_t target = PowerManager::isActive() ? BLE_CONN_LATENCY
+                                             : max((uint16_t)BLE_CONN_LATENCY, PowerManager::idleLatency());
+
+  portENTER_CRITICAL(&connMux);
+  if (target != _targetLatency && _params.connected && _params.intervalUnits != 0) {
+    _targetLatency = target;
+    _attempts = 0;
+    _retryDelayMs = BLE_CONN_RETRY_MS;
+    _requestDue = !isOnTarget(_params) || _params.latency != target;
+    _requestAtMs = millis();
+  }
+  bool due = _params.connected && _requestDue && (long)(millis() - _requestAtMs) >= 0;
+  bool firstRequest = (_params.requests == 0);
+  bool changed = _changed;
+  if (due) {
+    _requestDue = false;
+    _params.requests++;
+    _attempts++;
+  }
+  _changed = false;
+  long waitMs = (_params.connected && _requestDue) ? (long)(_requestAtMs - millis()) : -1;
+  esp_ble_conn_update_params_t request;
+  memcpy(request.bda, _peer, sizeof(_peer));
+  request.latency = _targetLatency;
+  portEXIT_CRITICAL(&connMux);
+
+  if (waitMs > 0) {
+    LoopScheduler::wakeWithin(waitMs);
+  }
+
+  if (due) {
+    request.min_int = BLE_CONN_INTERVAL_MIN;
+    request.max_int = BLE_CONN_INTERVAL_MAX;
+    request.timeout = BLE_CONN_TIMEOUT;
+    esp_ble_gap_update_conn_params(&request);
+    if (firstRequest) {
+      esp_ble_gap_set_pkt_data_len(request.bda, BLE_DATA_LENGTH);
+    }
+  }
+  if (changed) {
+    PowerManager::setConnection(intervalUs(get()), true);
+    print();
+  }
+}
+
+void BleConnParams::print() {
+  Params p = get();
+  if (!p.connected) {
+    Serial.println("[BLE] Parametres: pas de connexion");
+    return;
+  }
+  Serial.printf("[BLE] Intervalle %u.%02u ms | latence %u | supervision %u ms | MTU %u | "
+                "DLE %u/%u octets | demandes %u | %s\n",
+                (unsigned)(intervalUs(p) / 1000), (unsigned)(intervalUs(p) % 1000 / 10),
+                p.latency, p.timeoutUnits * 10, p.mtu, p.txOctets, p.rxOctets, p.requests,
+                p.intervalUnits == 0 ? "en attente" : (isOnTarget(p) ? "cible" : "hors cible"));
+}
+
+uint8_t BleConnParams::buildReport(uint8_t* sysex) {
+  Params p = get();
+  uint16_t fields[8] = { p.intervalUnits, p.latency, p.timeoutUnits, p.mtu,
+                         p.txOctets, p.rxOctets, p.requests, p.updates };
+  uint8_t length = 0;
+  sysex[length++] = 0xF0;
+  sysex[length++] = SYSEX_MANUFACTURER_ID;
+  sysex[length++] = SYSEX_CONNECTION;
+  sysex[length++] = SYSEX_CONNECTION_REPLY;
+  for (uint8_t i = 0; i < 8; i++) {
+    sysex[length++] = fields[i] & 0x7F;
+    sysex[length++] = (fields[i] >> 7) & 0x7F;
+  }
+  sysex[length++] = 0xF7;
+  return length;
+}
@@ -0,0 +1,146 @@
+#include "LatencyStats.h"
+
+/***********************************************************************************************
+HISTOGRAMME
+************************************************************************************************/
+
+void LatencyHistogram::reset() {
+  memset(_counts, 0, sizeof(_counts));
+  _total = 0;
+  _maxUs = 0;
+}
+
+// Cases 0-7: 1 us chacune. Ensuite 4 cases par octave [2^n, 2^(n+1)[
+uint8_t LatencyHistogram::bucketOf(uint32_t us) {
+  if (us < 8) {
+    return us;
+  }
+  uint8_t octave = 31 - __builtin_clz(us);
+  uint32_t bucket = 8 + (octave - 3) * 4 + ((us >> (octave - 2)) & 3);
+  return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+uint32_t LatencyHistogram::bucketUpperUs(uint8_t bucket) {
+  if (bucket < 8) {
+    return bucket;
+  }
+  if (bucket == LATENCY_BUCKETS - 1) {
+    return _maxUs;  // Case ouverte: tout ce qui depasse la plage
+  }
+  uint8_t octave = 3 + (bucket - 8) / 4;
+  uint8_t quarter = (bucket - 8) % 4;
+  return ((uint32_t)(5 + quarter) << (octave - 2)) - 1;
+}
+
+void LatencyHistogram::record(uint32_t us) {
+  _counts[bucketOf(us)]++;
+  _total++;
+  if (us > _maxUs) {
+    _maxUs = us;
+  }
+}
+
+uint32_t LatencyHistogram::percentileUs(uint8_t percent) {
+  if (_total == 0) {
+    return 0;
+  }
+  // Rang du percentile (arrondi au-dessus), puis premiere case qui l'atteint
+  uint32_t rank = ((uint64_t)_total * percent + 99) / 100;
+  if (rank == 0) {
+    rank = 1;
+  }
+  uint32_t seen = 0;
+  for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += _counts[i];
+    if (seen >= rank) {
+      uint32_t upper = bucketUpperUs(i);
+      return upper < _maxUs ? upper : _maxUs;
+    }
+  }
+  return _maxUs;
+}
+
+/***********************************************************************************************
+STATISTIQUES PAR SOURCE ET PAR ETAPE
+************************************************************************************************/
+
+LatencyStats::LatencyStats() : _receiveUs(0) {
+}
+
+void LatencyStats::recordMessage(LatencySource source, unsigned long receiveUs,
+                                 unsigned long entryUs, unsigned long callUs,
+                                 unsigned long i2cStartUs, unsigned long i2cDoneUs) {
+  if (!ENABLE_LATENCY_STATS) return;
+
+  LatencyHistogram* h = _histograms[source];
+  h[LATENCY_STAGE_RECEIVE].record(entryUs - receiveUs);
+  h[LATENCY_STAGE_DISPATCH].record(callUs - entryUs);
+
+  // Aucune ecriture depuis l'appel: note ignoree ou differee
+  if ((long)(i2cStartUs - callUs) < 0) {
+    return;
+  }
+  h[LATENCY_STAGE_RELEASE].record(i2cStartUs - callUs);
+  h[LATENCY_STAGE_I2C].record(i2cDoneUs - i2cStartUs);
+  h[LATENCY_STAGE_TOTAL].record(i2cDoneUs - receiveUs);
+}
+
+void LatencyStats::recordScheduled(LatencySource source, unsigned long dueUs,
+                                   unsigned long i2cStartUs, unsigned long i2cDoneUs) {
+  if (!ENABLE_LATENCY_STATS) return;
+
+  // Ecriture ignoree (PCA9685 absent): rien a mesurer
+  if ((long)(i2cStartUs - dueUs) < 0) {
+    return;
+  }
+  LatencyHistogram* h = _histograms[source];
+  h[LATENCY_STAGE_RELEASE].record(i2cStartUs - dueUs);
+  h[LATENCY_STAGE_I2C].record(i2cDoneUs - i2cStartUs);
+  h[LATENCY_STAGE_TOTAL].record(i2cDoneUs - dueUs);
+}
+
+void LatencyStats::reset() {
+  for (uint8_t s = 0; s < LATENCY_SOURCE_COUNT; s++) {
+    for (uint8_t e = 0; e < LATENCY_STAGE_COUNT; e++) {
+      _histograms[s][e].reset();
+    }
+  }
+}
+
+void LatencyStats::print() {
+  Serial.println("\n============== LATENCES (us) ==============");
+  Serial.println("Source    Etape         n       p50    p95    p99    max");
+  for (uint8_t s = 0; s < LATENCY_SOURCE_COUNT; s++) {
+    for (uint8_t e = 0; e < LATENCY_STAGE_COUNT; e++) {
+      LatencyHistogram& h = _histograms[s][e];
+      if (h.count() == 0) continue;
+      Serial.printf("%-9s %-11s %7lu %7lu %6lu %6lu %6lu\n",
+                    sourceName((LatencySource)s), stageName((LatencyStage)e),
+                    (unsigned long)h.count(),
+                    (unsigned long)h.percentileUs(50),
+                    (unsigned long)h.percentileUs(95),
+                    (unsigned long)h.percentileUs(99),
+                    (unsigned long)h.maxUs());
+    }
+  }
+  Serial.println("===========================================\n");
+}
+
+const char* LatencyStats::sourceName(LatencySource source) {
+  switch (source) {
+    case LATENCY_SOURCE_BLE:   return "BLE";
+    case LATENCY_SOURCE_SCORE: return "Partition";
+    default:                   return "?";
+  }
+}
+
+const char* LatencyStats::stageName(LatencyStage stage) {
+  switch (stage) {
+    case LATENCY_STAGE_RECEIVE:  return "reception";
+    case LATENCY_STAGE_DISPATCH: return "dispatch";
+    case LATENCY_STAGE_RELEASE:  return "liberation";
+    case LATENCY_STAGE_I2C:      return "I2C";
+    case LATENCY_STAGE_TOTAL:    return "total";
+    default:                     return "?";
+  }
+}
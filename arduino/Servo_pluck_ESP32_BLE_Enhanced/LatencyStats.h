@@ -0,0 +1,92 @@
+#ifndef LATENCYSTATS_H
+#define LATENCYSTATS_H
+
+#include <Arduino.h>
+#include "settings.h"
+/***********************************************************************************************
+----------------------------    LatencyStats.h   -----------------------------------------------
+************************************************************************************************
+Histogrammes de latence par etape et par source, de la reception a la fin de l'ecriture I2C.
+
+Horodatages (micros()) pris le long du trajet d'une note:
+  reception   la source livre le message (debut de MIDI.read(); echeance pour une partition)
+  entree      le callback du handler est appele
+  appel       le message est valide, l'instrument est appele
+  debut I2C   l'ecriture PCA9685 commence (logique instrument, attente de l'ordonnanceur)
+  fin I2C     l'ecriture PCA9685 est terminee
+
+Chaque intervalle est une etape, plus le total reception -> fin I2C. Une note qui n'ecrit rien
+(ignoree, differee par une pedale) n'alimente que les deux premieres etapes. La file interne
+de la pile BLE, avant que loop() n'appelle MIDI.read(), n'est pas visible.
+
+Chaque histogramme a LATENCY_BUCKETS cases a echelle logarithmique: 1 us de resolution sous
+8 us, puis 4 cases par octave (erreur < 25 %). Le maximum est garde exactement. record() ne
+coute qu'un comptage de zeros et un increment: les mesures peuvent rester actives en jeu.
+************************************************************************************************/
+
+#define LATENCY_BUCKETS 64  // Derniere case: >= 128 ms (le maximum exact reste connu)
+
+enum LatencySource : uint8_t {
+  LATENCY_SOURCE_BLE,
+  LATENCY_SOURCE_SCORE,
+  LATENCY_SOURCE_COUNT
+};
+
+enum LatencyStage : uint8_t {
+  LATENCY_STAGE_RECEIVE,   // Reception -> entree du handler (decodage BLE-MIDI)
+  LATENCY_STAGE_DISPATCH,  // Entree du handler -> appel instrument (validation, filtres)
+  LATENCY_STAGE_RELEASE,   // Appel instrument ou echeance -> debut de l'ecriture I2C
+  LATENCY_STAGE_I2C,       // Duree de l'ecriture I2C
+  LATENCY_STAGE_TOTAL,     // Reception -> fin de l'ecriture I2C
+  LATENCY_STAGE_COUNT
+};
+
+class LatencyHistogram {
+  private:
+    uint32_t _counts[LATENCY_BUCKETS];
+    uint32_t _total;
+    uint32_t _maxUs;
+
+    static uint8_t bucketOf(uint32_t us);
+    uint32_t bucketUpperUs(uint8_t bucket);
+
+  public:
+    LatencyHistogram() { reset(); }
+    void reset();
+    void record(uint32_t us);
+    uint32_t count() { return _total; }
+    uint32_t maxUs() { return _maxUs; }
+    uint32_t percentileUs(uint8_t percent);  // Borne haute de la case (0 si vide)
+};
+
+class LatencyStats {
+  private:
+    LatencyHistogram _histograms[LATENCY_SOURCE_COUNT][LATENCY_STAGE_COUNT];
+    unsigned long _receiveUs;  // Horodatage de reception du message en cours (BLE)
+
+  public:
+    LatencyStats();
+
+    // Source BLE: markReceive() avant MIDI.read(), recordMessage() apres l'appel instrument
+    void markReceive() { _receiveUs = micros(); }
+    unsigned long receiveUs() { return _receiveUs; }
+    void recordMessage(LatencySource source, unsigned long receiveUs, unsigned long entryUs,
+                       unsigned long callUs, unsigned long i2cStartUs, unsigned long i2cDoneUs);
+
+    // Partition: pas de reception ni de dispatch, la liberation part de l'echeance
+    void recordScheduled(LatencySource source, unsigned long dueUs,
+                         unsigned long i2cStartUs, unsigned long i2cDoneUs);
+
+    LatencyHistogram& histogram(LatencySource source, LatencyStage stage) {
+      return _histograms[source][stage];
+    }
+    void reset();
+    void print();
+
+    static const char* sourceName(LatencySource source);
+    static const char* stageName(LatencyStage stage);
+};
+
+extern LatencyStats latencyStats;  // Defini dans le .ino
+
+#endif // LATENCYSTATS_H
@@ -1,4 +1,9 @@
 #include "MidiHandler.h"
+#include "Profiler.h"
+#include "DeferredLog.h"
+#include "EventTrace.h"
+#include "ActuationFeedback.h"
+#include "BleConnParams.h"
 
 // Déclaration externe de l'interface MIDI (définie dans le .ino)
 extern BLEMIDI_NAMESPACE::BLEMIDI_Transport<BLEMIDI_NAMESPACE::BLEMIDI_ESP32> MIDI;
@@ -62,9 +67,7 @@ bool MidiHandler::checkRateLimit() {
 
   // Vérifier limite
   if (_rateLimiter.noteCount >= MAX_NOTES_PER_SECOND) {
-    if (DEBUG) {
-      Serial.println("[MIDI] RATE LIMIT dépassé!");
-    }
+    DeferredLog::log(LOG_MIDI_RATE_LIMIT);
     _stats.droppedMessages++;
     sendMidiError(ERROR_RATE_LIMIT, _rateLimiter.noteCount);
     return false;
@@ -75,26 +78,10 @@ bool MidiHandler::checkRateLimit() {
 }
 
 /***********************************************************************************************
-ENVOI DE MESSAGES MIDI (FEEDBACK)
+ENVOI DE MESSAGES MIDI (ERREURS)
 ************************************************************************************************/
 
-void MidiHandler::sendMidiFeedback(byte messageType, byte note, byte velocity) {
-  if (!MIDI_SEND_FEEDBACK) return;
-
-  // Envoyer via BLE MIDI
-  if (messageType == MIDI_NOTE_ON) {
-    MIDI.sendNoteOn(note, velocity, MIDI_CHANNEL);
-    if (DEBUG) {
-      Serial.printf("[MIDI OUT] Note On: %d (vel: %d)\n", note, velocity);
-    }
-  } else if (messageType == MIDI_NOTE_OFF) {
-    MIDI.sendNoteOff(note, 0, MIDI_CHANNEL);
-    if (DEBUG) {
-      Serial.printf("[MIDI OUT] Note Off: %d\n", note);
-    }
-  }
-}
-
+// Le feedback Note On/Off part de ActuationFeedback, à la fin de l'écriture I2C (voir le .ino)
 void MidiHandler::sendMidiError(byte errorCode, byte data) {
   // Envoyer erreur via Control Change
   // CC 127 = Error Type
@@ -104,19 +91,7 @@ void MidiHandler::sendMidiError(byte errorCode, byte data) {
 
   _stats.errorCount++;
 
-  if (DEBUG) {
-    const char* errorNames[] = {
-      "UNKNOWN",
-      "NOTE_NOT_PLAYABLE",
-      "SERVO_TIMEOUT",
-      "RATE_LIMIT",
-      "INVALID_CHANNEL",
-      "INVALID_VELOCITY"
-    };
-    Serial.printf("[MIDI ERR] %s (data: %d)\n",
-                  errorCode <= 5 ? errorNames[errorCode] : errorNames[0],
-                  data);
-  }
+  DeferredLog::log(LOG_MIDI_ERROR, errorCode, data);
 }
 
 /***********************************************************************************************
@@ -124,11 +99,14 @@ CALLBACKS MIDI
 ************************************************************************************************/
 
 void MidiHandler::onNoteOn(byte channel, byte note, byte velocity) {
+  PROFILE_SCOPE("onNoteOn");
+  unsigned long entryUs = micros();
   _stats.lastMessageTime = millis();
+  EventTrace::record(TRACE_MIDI_NOTE_ON, note, velocity);
 
   // Vérifier canal
   if (!isValidMidiChannel(channel)) {
-    if (DEBUG) Serial.printf("[MIDI] Canal ignoré: %d\n", channel + 1);
+    DeferredLog::log(LOG_MIDI_CHANNEL_IGNORED, channel + 1);
     updateStats(false);
     return;
   }
@@ -140,7 +118,7 @@ void MidiHandler::onNoteOn(byte channel, byte note, byte velocity) {
   }
 
   if (!isValidVelocity(velocity)) {
-    if (DEBUG) Serial.printf("[MIDI] Vélocité invalide: %d\n", velocity);
+    DeferredLog::log(LOG_MIDI_BAD_VELOCITY, velocity);
     sendMidiError(ERROR_INVALID_VELOCITY, velocity);
     updateStats(false);
     return;
@@ -148,7 +126,7 @@ void MidiHandler::onNoteOn(byte channel, byte note, byte velocity) {
 
   // Vérifier note
   if (!isValidNote(note)) {
-    if (DEBUG) Serial.printf("[MIDI] Note hors plage: %d\n", note);
+    DeferredLog::log(LOG_MIDI_NOTE_RANGE, note);
     _stats.outOfRangeNotes++;
     sendMidiError(ERROR_NOTE_NOT_PLAYABLE, note);
     updateStats(false);
@@ -166,15 +144,22 @@ void MidiHandler::onNoteOn(byte channel, byte note, byte velocity) {
   _stats.noteOnCount++;
 
   // Jouer la note
+  unsigned long callUs = micros();
   _instrument.noteOn(note, velocity);
+  recordLatency(entryUs, callUs);
 
-  // Envoyer feedback si la note a été jouée
-  // (vérifié dans Instrument::noteOn)
-  sendMidiFeedback(MIDI_NOTE_ON, note, velocity);
+  // PCA9685 absent (mode dégradé) ou déconnecté: la note est acceptée mais ne sonne pas
+  // (pas de feedback d'actionnement non plus)
+  if (!_instrument.isOnline()) {
+    sendMidiError(ERROR_SERVO_TIMEOUT, note);
+  }
 }
 
 void MidiHandler::onNoteOff(byte channel, byte note, byte velocity) {
+  PROFILE_SCOPE("onNoteOff");
+  unsigned long entryUs = micros();
   _stats.lastMessageTime = millis();
+  EventTrace::record(TRACE_MIDI_NOTE_OFF, note);
 
   // Vérifier canal
   if (!isValidMidiChannel(channel)) {
@@ -194,14 +179,15 @@ void MidiHandler::onNoteOff(byte channel, byte note, byte velocity) {
   _stats.noteOffCount++;
 
   // Arrêter la note
+  unsigned long callUs = micros();
   _instrument.noteOff(note);
-
-  // Envoyer feedback
-  sendMidiFeedback(MIDI_NOTE_OFF, note, 0);
+  recordLatency(entryUs, callUs);
 }
 
 void MidiHandler::onControlChange(byte channel, byte controller, byte value) {
+  PROFILE_SCOPE("onControlChange");
   _stats.lastMessageTime = millis();
+  EventTrace::record(TRACE_MIDI_CC, controller, value);
 
   if (!isValidMidiChannel(channel)) {
     updateStats(false);
@@ -235,6 +221,32 @@ void MidiHandler::onPolyPressure(byte channel, byte note, byte pressure) {
   // _instrument.polyKeyPressure(note, pressure);
 }
 
+void MidiHandler::onSystemExclusive(byte* data, unsigned size) {
+  // F0 7D <groupe> <commande> F7 (voir settings.h), les autres SysEx sont ignorés
+  if (size < 5 || data[1] != SYSEX_MANUFACTURER_ID) return;
+
+  if (data[2] == SYSEX_LATENCY) {
+    switch (data[3]) {
+      case SYSEX_LATENCY_QUERY:
+        sendLatencyReport();
+        break;
+      case SYSEX_LATENCY_RESET:
+        latencyStats.reset();
+        break;
+    }
+  } else if (data[2] == SYSEX_TRACE && data[3] == SYSEX_TRACE_QUERY) {
+    sendTraceDump();
+  } else if (data[2] == SYSEX_MIDIMIND && data[3] == SYSEX_MIDIMIND_PING &&
+             size >= 11 && data[4] == SYSEX_MIDIMIND_REQUEST) {
+    // Réception: début du MIDI.read() qui a livré le message (file BLE non comprise)
+    sendPingReply(data + 5, latencyStats.receiveUs());
+  } else if (data[2] == SYSEX_CONNECTION && data[3] == SYSEX_CONNECTION_QUERY) {
+    uint8_t report[BLE_CONN_REPORT_LENGTH];
+    uint8_t length = BleConnParams::buildReport(report);
+    MIDI.sendSysEx(length, report, true);
+  }
+}
+
 /***********************************************************************************************
 CONTROL CHANGE
 ************************************************************************************************/
@@ -252,31 +264,134 @@ void MidiHandler::processControlChange(byte controller, byte value) {
       // Implémentation future
       break;
 
-    case 120: // All Sound Off
-      // Couper tous les sons immédiatement
-      if (DEBUG) Serial.println("[MIDI] All Sound Off");
+    case 64:  // Sustain: les noteOff sont différés jusqu'au relâchement
+      _instrument.setSustain(value >= 64);
+      break;
+
+    case 66:  // Sostenuto: seules les notes tenues à l'appui sont prolongées
+      _instrument.setSostenuto(value >= 64);
       break;
 
-    case 121: // Reset All Controllers
-      if (DEBUG) Serial.println("[MIDI] Reset Controllers");
+    case 68:  // Legato footswitch → mode pluck-through
+      _instrument.setPluckThrough(value >= 64);
       break;
 
+    case 120: // All Sound Off
+    case 121: // Reset All Controllers (pédales relâchées)
     case 123: // All Notes Off
-      if (DEBUG) Serial.println("[MIDI] All Notes Off");
-      // Arrêter toutes les notes
-      for (int i = MIDI_NOTE_MIN; i <= MIDI_NOTE_MAX; i++) {
-        _instrument.noteOff(i);
-      }
+      DeferredLog::log(LOG_MIDI_PANIC, controller);
+      // Toutes les cordes au repos en une écriture I2C, attentes et partition annulées
+      _instrument.panic();
       break;
 
     default:
-      if (DEBUG) {
-        Serial.printf("[MIDI] CC non géré: %d = %d\n", controller, value);
-      }
+      DeferredLog::log(LOG_MIDI_CC_UNHANDLED, controller, value);
       break;
   }
 }
 
+/***********************************************************************************************
+LATENCES
+************************************************************************************************/
+
+void MidiHandler::recordLatency(unsigned long entryUs, unsigned long callUs) {
+  latencyStats.recordMessage(LATENCY_SOURCE_BLE, latencyStats.receiveUs(), entryUs, callUs,
+                             _instrument.getI2CStartUs(), _instrument.getI2CDoneUs());
+}
+
+// Valeur sur `count` octets de 7 bits, poids faible en premier
+static byte* packSysEx7(byte* out, uint32_t value, uint8_t count) {
+  for (uint8_t i = 0; i < count; i++) {
+    *out++ = value & 0x7F;
+    value >>= 7;
+  }
+  return out;
+}
+
+void MidiHandler::sendLatencyReport() {
+  for (uint8_t s = 0; s < LATENCY_SOURCE_COUNT; s++) {
+    for (uint8_t e = 0; e < LATENCY_STAGE_COUNT; e++) {
+      LatencyHistogram& h = latencyStats.histogram((LatencySource)s, (LatencyStage)e);
+      if (h.count() == 0) continue;
+
+      byte reply[28];
+      byte* p = reply;
+      *p++ = 0xF0;
+      *p++ = SYSEX_MANUFACTURER_ID;
+      *p++ = SYSEX_LATENCY;
+      *p++ = SYSEX_LATENCY_REPLY;
+      *p++ = s;
+      *p++ = e;
+      p = packSysEx7(p, h.count(), 5);
+      p = packSysEx7(p, h.percentileUs(50), 4);
+      p = packSysEx7(p, h.percentileUs(95), 4);
+      p = packSysEx7(p, h.percentileUs(99), 4);
+      p = packSysEx7(p, h.maxUs(), 4);
+      *p++ = 0xF7;
+      MIDI.sendSysEx(p - reply, reply, true);  // true: F0/F7 déjà dans le tableau
+    }
+  }
+}
+
+void MidiHandler::sendTraceDump() {
+  EventTrace::pause(true);  // Le tampon ne tourne pas pendant l'envoi
+  TraceDumpHeader header;
+  EventTrace::fillHeader(header);
+
+  byte reply[5 + 2 + SYSEX_TRACE_CHUNK * 11];
+  byte* p = reply;
+  *p++ = 0xF0;
+  *p++ = SYSEX_MANUFACTURER_ID;
+  *p++ = SYSEX_TRACE;
+  *p++ = SYSEX_TRACE_HEADER;
+  p = packSysEx7(p, header.magic, 5);
+  p = packSysEx7(p, header.version, 1);
+  p = packSysEx7(p, header.count, 2);
+  p = packSysEx7(p, header.total, 5);
+  p = packSysEx7(p, header.bootCount, 5);
+  p = packSysEx7(p, header.nowUs, 5);
+  *p++ = 0xF7;
+  MIDI.sendSysEx(p - reply, reply, true);
+
+  for (uint16_t first = 0; first < header.count; first += SYSEX_TRACE_CHUNK) {
+    p = reply;
+    *p++ = 0xF0;
+    *p++ = SYSEX_MANUFACTURER_ID;
+    *p++ = SYSEX_TRACE;
+    *p++ = SYSEX_TRACE_EVENTS;
+    p = packSysEx7(p, first, 2);
+    for (uint16_t i = first; i < header.count && i < first + SYSEX_TRACE_CHUNK; i++) {
+      TraceEvent e = EventTrace::event(i);
+      p = packSysEx7(p, e.timestampUs, 5);
+      p = packSysEx7(p, e.type, 1);
+      p = packSysEx7(p, e.a, 2);
+      p = packSysEx7(p, e.b, 3);
+    }
+    *p++ = 0xF7;
+    MIDI.sendSysEx(p - reply, reply, true);
+  }
+  EventTrace::pause(false);
+}
+
+// Le nonce revient tel quel avec les instants de réception et d'envoi (temps passé dans la
+// lyre, à retrancher de l'aller-retour mesuré par l'hôte)
+void MidiHandler::sendPingReply(const byte* nonce, unsigned long receiveUs) {
+  byte reply[21];
+  byte* p = reply;
+  *p++ = 0xF0;
+  *p++ = SYSEX_MANUFACTURER_ID;
+  *p++ = SYSEX_MIDIMIND;
+  *p++ = SYSEX_MIDIMIND_PING;
+  *p++ = SYSEX_MIDIMIND_REPLY;
+  for (uint8_t i = 0; i < 5; i++) {
+    *p++ = nonce[i] & 0x7F;
+  }
+  p = packSysEx7(p, receiveUs, 5);
+  p = packSysEx7(p, micros(), 5);
+  *p++ = 0xF7;
+  MIDI.sendSysEx(p - reply, reply, true);
+}
+
 /***********************************************************************************************
 STATISTIQUES
 ************************************************************************************************/
@@ -301,6 +416,20 @@ void MidiHandler::printStatistics() {
   Serial.printf("Note Off:            %lu\n", _stats.noteOffCount);
   Serial.printf("Control Change:      %lu\n", _stats.controlChangeCount);
   Serial.println("-------------------------------------");
+  const Instrument::SustainStats& pedal = _instrument.getSustainStats();
+  Serial.printf("Mutes différés:      %lu\n", pedal.deferredMutes);
+  Serial.printf("Mouvements évités:   %lu\n", pedal.savedMoves);
+  Serial.printf("Écritures I2C évit.: %lu\n", pedal.flushedMutes - pedal.flushes);
+  Serial.println("-------------------------------------");
+  Serial.printf("Journal écrit/perdu: %lu / %lu\n",
+                (unsigned long)DeferredLog::getWrittenCount(),
+                (unsigned long)DeferredLog::getDroppedCount());
+  Serial.printf("Feedback notes/notif: %lu / %lu (perdus %lu)\n",
+                (unsigned long)ActuationFeedback::getEventCount(),
+                (unsigned long)ActuationFeedback::getPacketCount(),
+                (unsigned long)ActuationFeedback::getDroppedCount());
+  BleConnParams::print();
+  Serial.println("-------------------------------------");
   Serial.printf("Messages/seconde:    %lu\n", _stats.messagesPerSecond);
   Serial.printf("Dernier message:     %lu ms\n",
                 millis() - _stats.lastMessageTime);
@@ -317,6 +446,8 @@ void MidiHandler::resetStatistics() {
   _stats.controlChangeCount = 0;
   _stats.errorCount = 0;
   _stats.messagesPerSecond = 0;
+  _instrument.resetSustainStats();
+  latencyStats.reset();
 
   Serial.println("[MIDI] Statistiques réinitialisées");
 }
@@ -2,6 +2,7 @@
 #define MIDIHANDLER_H
 
 #include "instrument.h"
+#include "LatencyStats.h"
 #include "settings.h"
 #include <BLEMIDI_Transport.h>
 
@@ -13,7 +14,8 @@ Version améliorée avec:
 - Filtrage par canal
 - Protection anti-spam
 - Statistiques en temps réel
-- Feedback MIDI (envoi de confirmations)
+- Histogrammes de latence (LatencyStats), interrogeables par SysEx
+- Erreurs MIDI (CC 127/126); le feedback des notes est dans ActuationFeedback
 - Gestion d'erreurs
 ************************************************************************************************/
 
@@ -49,9 +51,12 @@ class MidiHandler {
     bool isValidNote(byte note);
     bool isValidVelocity(byte velocity);
     bool checkRateLimit();
-    void sendMidiFeedback(byte messageType, byte note, byte velocity);
     void sendMidiError(byte errorCode, byte data);
     void updateStats(bool valid);
+    void recordLatency(unsigned long entryUs, unsigned long callUs);
+    void sendLatencyReport();  // Une réponse SysEx par histogramme non vide
+    void sendTraceDump();      // Trace d'événements en blocs SysEx
+    void sendPingReply(const byte* nonce, unsigned long receiveUs);
 
   public:
     MidiHandler(Instrument &instrument);
@@ -63,6 +68,7 @@ class MidiHandler {
     void onPitchBend(byte channel, int bend);
     void onAfterTouch(byte channel, byte pressure);
     void onPolyPressure(byte channel, byte note, byte pressure);
+    void onSystemExclusive(byte* data, unsigned size);
 
     // Gestion statistiques
     void printStatistics();
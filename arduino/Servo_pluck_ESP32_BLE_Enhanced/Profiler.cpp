@@ -0,0 +1,69 @@
+#include "Profiler.h"
+
+ProfileSection* Profiler::_sections[PROFILER_MAX_SECTIONS];
+uint8_t Profiler::_sectionCount = 0;
+uint32_t Profiler::_overhead = 0;
+
+ProfileSection::ProfileSection(const char* sectionName, bool listed)
+  : name(sectionName), count(0), total(0), max(0) {
+  if (listed) {
+    Profiler::add(this);
+  }
+}
+
+void Profiler::add(ProfileSection* section) {
+  if (_sectionCount >= PROFILER_MAX_SECTIONS) {
+    Serial.printf("[PROF] ERREUR: table pleine, section '%s' ignoree\n", section->name);
+    return;
+  }
+  _sections[_sectionCount++] = section;
+}
+
+uint32_t Profiler::calibrate() {
+  // Section hors table, meme code que PROFILE_SCOPE autour d'un bloc vide
+  static ProfileSection probe("calibration", false);
+
+  uint32_t best = UINT32_MAX;
+  for (uint8_t i = 0; i < 64; i++) {
+    probe.reset();
+    { ProfileScope scope(probe); }
+    if (probe.max < best) {
+      best = probe.max;
+    }
+  }
+  _overhead = best;
+  return best;
+}
+
+void Profiler::dump() {
+  if (_overhead == 0) {
+    calibrate();
+  }
+
+  Serial.println("\n==================== PROFIL ====================");
+  Serial.printf("Unite: %s, cout d'une section vide: %lu (retranche)\n",
+                PROFILER_UNIT, (unsigned long)_overhead);
+  #if defined(ESP32)
+    Serial.printf("CPU: %lu MHz (cycles / MHz = us)\n", (unsigned long)getCpuFrequencyMhz());
+  #endif
+  Serial.println("Section              Appels     Moyenne        Max        Total");
+  for (uint8_t i = 0; i < _sectionCount; i++) {
+    ProfileSection* s = _sections[i];
+    if (s->count == 0) continue;
+    uint64_t net = s->total > (uint64_t)s->count * _overhead ?
+                   s->total - (uint64_t)s->count * _overhead : 0;
+    uint32_t maxNet = s->max > _overhead ? s->max - _overhead : 0;
+    Serial.printf("%-18s %8lu %11lu %10lu %12llu\n",
+                  s->name, (unsigned long)s->count,
+                  (unsigned long)(net / s->count), (unsigned long)maxNet,
+                  (unsigned long long)net);
+  }
+  Serial.println("================================================\n");
+  reset();
+}
+
+void Profiler::reset() {
+  for (uint8_t i = 0; i < _sectionCount; i++) {
+    _sections[i]->reset();
+  }
+}
@@ -0,0 +1,117 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <Arduino.h>
+#include "settings.h"
+/***********************************************************************************************
+----------------------------    Profiler.h   ---------------------------------------------------
+************************************************************************************************
+Profileur par sections: PROFILE_SCOPE("nom") en tete d'un bloc mesure le temps passe jusqu'a
+la fin du bloc (nombre d'appels, total et maximum) dans une table statique.
+
+  void loop() {
+    PROFILE_SCOPE("loop");
+    { PROFILE_SCOPE("MIDI.read"); MIDI.read(); }
+    ...
+  }
+
+Compteur utilise:
+  ESP32   registre CCOUNT (cycles CPU, lu en une instruction)
+  AVR     micros() (resolution 4 us, Timer0 du coeur Arduino: Timer1 reste libre)
+  PC      TSC x86 ou horloge monotone en ns (benchmark tools/profiler_bench)
+
+Avec ENABLE_PROFILER a false les macros disparaissent a la compilation. Sinon chaque section
+coute une lecture du compteur a l'entree et a la sortie, plus la mise a jour de la table:
+Profiler::calibrate() mesure ce cout sur la cible et le retranche a l'affichage.
+
+CCOUNT est propre a chaque coeur: une section doit commencer et finir dans la meme tache
+(les taches Arduino et BLE sont epinglees a leur coeur). Le compteur 32 bits reboucle toutes
+les 17 s a 240 MHz, largement au-dela de la duree d'une section.
+************************************************************************************************/
+
+#define PROFILER_MAX_SECTIONS 24
+
+#if defined(ESP32)
+  #define PROFILER_UNIT "cycles"
+  static inline uint32_t profilerTicks() {
+    uint32_t ccount;
+    __asm__ __volatile__("rsr %0, ccount" : "=a"(ccount));
+    return ccount;
+  }
+#elif defined(__AVR__)
+  #define PROFILER_UNIT "us"
+  static inline uint32_t profilerTicks() {
+    return micros();
+  }
+#elif defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+  #define PROFILER_UNIT "cycles TSC"
+  static inline uint32_t profilerTicks() {
+    return (uint32_t)__rdtsc();
+  }
+#else
+  #include <chrono>
+  #define PROFILER_UNIT "ns"
+  static inline uint32_t profilerTicks() {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+#endif
+
+struct ProfileSection {
+  const char* name;
+  uint32_t count;
+  uint64_t total;
+  uint32_t max;
+
+  ProfileSection(const char* sectionName, bool listed = true);  // listed: ajoutee a la table
+  void reset() { count = 0; total = 0; max = 0; }
+};
+
+class ProfileScope {
+  private:
+    ProfileSection& _section;
+    uint32_t _start;
+
+  public:
+    inline ProfileScope(ProfileSection& section) : _section(section), _start(profilerTicks()) {}
+    inline ~ProfileScope() {
+      uint32_t elapsed = profilerTicks() - _start;
+      _section.count++;
+      _section.total += elapsed;
+      if (elapsed > _section.max) {
+        _section.max = elapsed;
+      }
+    }
+};
+
+class Profiler {
+  private:
+    static ProfileSection* _sections[PROFILER_MAX_SECTIONS];
+    static uint8_t _sectionCount;
+    static uint32_t _overhead;  // Cout d'une section vide, mesure par calibrate()
+
+  public:
+    static void add(ProfileSection* section);
+    static uint8_t sectionCount() { return _sectionCount; }
+    static ProfileSection* section(uint8_t index) { return _sections[index]; }
+    static uint32_t calibrate();  // Cout d'une section vide (minimum sur 64 essais)
+    static void dump();           // Affiche la table puis la remet a zero
+    static void reset();
+};
+
+#define PROFILER_CONCAT2(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT2(a, b)
+
+// Toujours actif (benchmark); le firmware utilise PROFILE_SCOPE
+#define PROFILER_SCOPE_IMPL(sectionName) \
+  static ProfileSection PROFILER_CONCAT(_profileSection, __LINE__)(sectionName); \
+  ProfileScope PROFILER_CONCAT(_profileScope, __LINE__)(PROFILER_CONCAT(_profileSection, __LINE__))
+
+#if ENABLE_PROFILER
+  #define PROFILE_SCOPE(sectionName) PROFILER_SCOPE_IMPL(sectionName)
+#else
+  #define PROFILE_SCOPE(sectionName)
+#endif
+
+#endif // PROFILER_H
@@ -0,0 +1,61 @@
+#ifndef SCOREFORMAT_H
+#define SCOREFORMAT_H
+
+#include "stdint.h"
+#include "settings.h"
+/***********************************************************************************************
+----------------------------    ScoreFormat.h   ------------------------------------------------
+************************************************************************************************
+Format binaire des partitions compilees (.lyrs) produites par tools/lyre_score.
+
+Une partition compilee est une suite d'actionnements deja resolus sur le PC: direction de
+grattage planifiee, compensation de latence appliquee, notes injouables transposees ou
+supprimees. Le firmware n'a plus qu'a attendre deltaUs et ecrire la valeur PCA9685.
+
+Toutes les valeurs sont en little-endian (natif ESP32) et alignees sur 4 octets pour etre
+lues directement depuis la flash mappee en memoire (esp_partition_mmap ou tableau const).
+
+  [ScoreHeader 16 octets][ScoreRecord 8 octets] x recordCount
+
+Ce fichier n'inclut rien de specifique a Arduino: il est aussi compile par l'outil PC.
+************************************************************************************************/
+
+#define SCORE_MAGIC          0x5352594CUL  // "LYRS" lu en little-endian
+#define SCORE_FORMAT_VERSION 1
+
+// Drapeaux d'un enregistrement
+#define SCORE_FLAG_PLUCK     0x01  // Grattage (la valeur sort de la position de repos)
+#define SCORE_FLAG_MUTE      0x02  // Retour sur la corde (position de repos)
+#define SCORE_FLAG_DIR_UP    0x04  // Direction planifiee (bit de currentPositions apres le grattage)
+#define SCORE_FLAG_END       0x80  // Dernier enregistrement de la partition
+
+struct ScoreHeader {
+  uint32_t magic;        // SCORE_MAGIC
+  uint8_t  version;      // SCORE_FORMAT_VERSION
+  uint8_t  numServos;    // NUM_SERVOS de l'instrument cible
+  uint16_t headerSize;   // sizeof(ScoreHeader), permet d'etendre l'en-tete
+  uint32_t recordCount;  // Nombre d'enregistrements qui suivent
+  uint32_t profileHash;  // Empreinte du profil instrument (voir scoreProfileHash)
+};
+
+struct ScoreRecord {
+  uint32_t deltaUs;      // Delai depuis l'enregistrement precedent (microsecondes)
+  uint8_t  servo;        // Index servo 0..NUM_SERVOS-1
+  uint8_t  flags;        // SCORE_FLAG_*
+  uint16_t tick;         // Valeur OFF du PCA9685 (0-4095)
+};
+
+// Empreinte FNV-1a du profil (angles, mapping, angle de grattage): une partition compilee
+// pour une autre lyre est refusee au chargement plutot que de jouer des angles faux.
+inline uint32_t scoreProfileHash() {
+  uint32_t hash = 2166136261UL;
+  for (uint8_t i = 0; i < NUM_SERVOS; i++) {
+    hash = (hash ^ (initialAngles[i] & 0xFF)) * 16777619UL;
+    hash = (hash ^ (initialAngles[i] >> 8)) * 16777619UL;
+    hash = (hash ^ MidiServoMapping[i]) * 16777619UL;
+  }
+  hash = (hash ^ PLUCK_ANGLE) * 16777619UL;
+  return hash;
+}
+
+#endif // SCOREFORMAT_H
@@ -0,0 +1,244 @@
+#include "ScorePlayer.h"
+#include "LatencyStats.h"
+#include "LoopScheduler.h"
+#include <esp_partition.h>
+#include <limits.h>
+
+static_assert(sizeof(ScoreHeader) == 16, "ScoreHeader doit faire 16 octets");
+static_assert(sizeof(ScoreRecord) == 8, "ScoreRecord doit faire 8 octets");
+
+ScorePlayer::ScorePlayer(Instrument &instrument)
+  : _instrument(instrument), _records(nullptr), _recordCount(0),
+    _index(0), _nextDueUs(0), _playing(false),
+    _lookaheadIndex(0), _lookaheadDueUs(0), _stagedServos(0), _deferredCount(0), _panicCount(0) {
+  memset(_pending, 0, sizeof(_pending));
+}
+
+bool ScorePlayer::load(const uint8_t* data, size_t length) {
+  stop();
+  _records = nullptr;
+  _recordCount = 0;
+
+  if (data == nullptr || length < sizeof(ScoreHeader)) {
+    Serial.println("[SCORE] ERREUR: partition absente ou tronquee");
+    return false;
+  }
+
+  const ScoreHeader* header = (const ScoreHeader*)data;
+  if (header->magic != SCORE_MAGIC) {
+    Serial.println("[SCORE] ERREUR: pas une partition compilee (.lyrs)");
+    return false;
+  }
+  if (header->version != SCORE_FORMAT_VERSION) {
+    Serial.printf("[SCORE] ERREUR: version %d non supportee (attendu %d)\n",
+                  header->version, SCORE_FORMAT_VERSION);
+    return false;
+  }
+  if (header->numServos != NUM_SERVOS || header->profileHash != scoreProfileHash()) {
+    Serial.println("[SCORE] ERREUR: partition compilee pour un autre profil d'instrument");
+    return false;
+  }
+  if (header->headerSize < sizeof(ScoreHeader) ||
+      (header->headerSize & 3) != 0 ||
+      length < header->headerSize + (size_t)header->recordCount * sizeof(ScoreRecord)) {
+    Serial.println("[SCORE] ERREUR: taille incoherente");
+    return false;
+  }
+
+  // Servo et valeur servent d'index et de registre PCA9685 a la lecture: verifies une fois ici
+  const ScoreRecord* records = (const ScoreRecord*)(data + header->headerSize);
+  for (uint32_t i = 0; i < header->recordCount; i++) {
+    if (records[i].servo >= NUM_SERVOS || records[i].tick > 4095) {
+      Serial.printf("[SCORE] ERREUR: evenement %lu invalide (servo %u, valeur %u)\n",
+                    (unsigned long)i, records[i].servo, records[i].tick);
+      return false;
+    }
+  }
+
+  _records = records;
+  _recordCount = header->recordCount;
+
+  Serial.printf("[SCORE] Partition chargee: %lu evenements\n", (unsigned long)_recordCount);
+  return true;
+}
+
+bool ScorePlayer::loadFromPartition() {
+  const esp_partition_t* partition = esp_partition_find_first(
+    ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, SCORE_PARTITION_LABEL);
+  if (partition == nullptr) {
+    Serial.printf("[SCORE] ERREUR: partition '%s' introuvable\n", SCORE_PARTITION_LABEL);
+    return false;
+  }
+
+  // Le mapping reste actif tant que le firmware tourne: les enregistrements sont lus en flash
+  static spi_flash_mmap_handle_t handle = 0;
+  static const void* mapped = nullptr;
+  if (mapped == nullptr &&
+      esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA,
+                         &mapped, &handle) != ESP_OK) {
+    mapped = nullptr;
+    Serial.println("[SCORE] ERREUR: mmap de la partition impossible");
+    return false;
+  }
+
+  return load((const uint8_t*)mapped, partition->size);
+}
+
+void ScorePlayer::start() {
+  if (_records == nullptr || _recordCount == 0) {
+    Serial.println("[SCORE] Aucune partition chargee");
+    return;
+  }
+
+  _index = 0;
+  _nextDueUs = micros() + _records[0].deltaUs;
+  _lookaheadIndex = 0;
+  _lookaheadDueUs = _nextDueUs;
+  memset(_pending, 0, sizeof(_pending));
+  _stagedServos = 0;
+  _deferredCount = 0;
+  _panicCount = _instrument.getPanicCount();
+  _playing = true;
+  Serial.println("[SCORE] Lecture demarree");
+}
+
+void ScorePlayer::stop() {
+  if (!_playing) return;
+
+  _playing = false;
+  _deferredCount = 0;
+  _stagedServos = 0;
+  _instrument.panic();
+  _panicCount = _instrument.getPanicCount();
+  Serial.println("[SCORE] Lecture arretee");
+}
+
+void ScorePlayer::update() {
+  if (!_playing) return;
+
+  // Panique (CC 120/123, deconnexion): les evenements restants sont abandonnes
+  if (_instrument.getPanicCount() != _panicCount) {
+    _playing = false;
+    _deferredCount = 0;
+    _stagedServos = 0;
+    Serial.println("[SCORE] Lecture interrompue (panique)");
+    return;
+  }
+
+  unsigned long now = micros();
+  fireDeferred(now);
+
+  // Plusieurs enregistrements peuvent etre dus en meme temps (accords: deltaUs = 0)
+  while (_index < _recordCount && (long)(now - _nextDueUs) >= 0) {
+    const ScoreRecord& record = _records[_index];
+    if (_index < _lookaheadIndex) {
+      _pending[record.servo]--;
+    }
+    fireRecord(record, _nextDueUs);
+
+    _index++;
+    if (_index >= _recordCount || (record.flags & SCORE_FLAG_END)) {
+      _index = _recordCount;  // Plus rien a lire: restent les grattages differes
+      break;
+    }
+    _nextDueUs += _records[_index].deltaUs;  // Echeances absolues: pas de derive cumulee
+  }
+
+  if (_index >= _recordCount) {
+    // Fin de partition une fois les derniers grattages anticipes tires a leur echeance
+    if (_deferredCount == 0) {
+      _playing = false;
+      Serial.println("[SCORE] Fin de partition");
+      return;
+    }
+  } else {
+    scanAhead(now);
+  }
+
+  // Reveil de la loop: enregistrement suivant, grattage differe, ou entree du suivant dans la
+  // fenetre d'anticipation
+  long left = _index < _recordCount ? (long)(_nextDueUs - now) : LONG_MAX;
+  for (uint8_t i = 0; i < _deferredCount; i++) {
+    left = min(left, (long)(_deferred[i].dueUs - now));
+  }
+  if (_index < _recordCount && _lookaheadIndex < _recordCount) {
+    left = min(left, (long)(_lookaheadDueUs - now) - (long)LOOKAHEAD_WINDOW_US);
+  }
+  LoopScheduler::wakeWithin(left > 0 ? left / 1000 : 0);
+}
+
+void ScorePlayer::fireRecord(const ScoreRecord& record, unsigned long dueUs) {
+  uint16_t bit = 1 << record.servo;
+  if ((record.flags & SCORE_FLAG_PLUCK) && (_stagedServos & bit)) {
+    // Servo pre-positionne: il reste moins de course, on tire plus tard du meme ecart. Une
+    // place est toujours libre (scanAhead ne pre-positionne pas au-dela)
+    _stagedServos &= ~bit;
+    DeferredPluck& deferred = _deferred[_deferredCount++];
+    deferred.dueUs = dueUs + (uint32_t)LOOKAHEAD_PRESTAGE_ANGLE * SERVO_US_PER_DEGREE;
+    deferred.servo = record.servo;
+    deferred.tick = record.tick;
+    return;
+  }
+  _instrument.actuate(record.servo, record.tick);
+  latencyStats.recordScheduled(LATENCY_SOURCE_SCORE, dueUs,
+                               _instrument.getI2CStartUs(), _instrument.getI2CDoneUs());
+}
+
+void ScorePlayer::fireDeferred(unsigned long now) {
+  uint8_t i = 0;
+  while (i < _deferredCount) {
+    if ((long)(now - _deferred[i].dueUs) >= 0) {
+      _instrument.actuate(_deferred[i].servo, _deferred[i].tick);
+      latencyStats.recordScheduled(LATENCY_SOURCE_SCORE, _deferred[i].dueUs,
+                                   _instrument.getI2CStartUs(), _instrument.getI2CDoneUs());
+      _deferred[i] = _deferred[--_deferredCount];
+    } else {
+      i++;
+    }
+  }
+}
+
+// Grattages pre-positionnes pas encore arrives a echeance
+uint8_t ScorePlayer::stagedCount() const {
+  uint8_t count = 0;
+  for (uint16_t mask = _stagedServos; mask; mask &= mask - 1) {
+    count++;
+  }
+  return count;
+}
+
+void ScorePlayer::scanAhead(unsigned long now) {
+  if (_lookaheadIndex < _index) {
+    _lookaheadIndex = _index;
+    _lookaheadDueUs = _nextDueUs;
+  }
+
+  const unsigned long stagingTimeUs = (unsigned long)LOOKAHEAD_PRESTAGE_ANGLE * SERVO_US_PER_DEGREE;
+  while (_lookaheadIndex < _recordCount && (long)(_lookaheadDueUs - now) <= LOOKAHEAD_WINDOW_US) {
+    const ScoreRecord& record = _records[_lookaheadIndex];
+
+    // La partition est connue: les voies liberees sont realimentees avant leur grattage
+    if (record.flags & SCORE_FLAG_PLUCK) {
+      _instrument.arm(record.servo);
+    }
+
+    // Pre-positionner seulement si le servo n'a rien d'autre a faire d'ici la, que le
+    // mouvement d'approche a le temps de se terminer avant l'echeance et qu'une place reste
+    // pour le grattage differe (sinon il est joue sans anticipation, a son echeance)
+    if ((record.flags & SCORE_FLAG_PLUCK) &&
+        _pending[record.servo] == 0 &&
+        stagedCount() + _deferredCount < LOOKAHEAD_MAX_STAGED &&
+        (long)(_lookaheadDueUs - now) >= (long)stagingTimeUs) {
+      int8_t direction = (record.tick > _instrument.restTick(record.servo)) ? 1 : -1;
+      if (_instrument.prestage(record.servo, direction)) {
+        _stagedServos |= (1 << record.servo);
+      }
+    }
+    _pending[record.servo]++;
+
+    _lookaheadIndex++;
+    if (_lookaheadIndex < _recordCount) {
+      _lookaheadDueUs += _records[_lookaheadIndex].deltaUs;
+    }
+  }
+}
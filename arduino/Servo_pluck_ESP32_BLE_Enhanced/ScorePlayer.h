@@ -0,0 +1,59 @@
+#ifndef SCOREPLAYER_H
+#define SCOREPLAYER_H
+
+#include "instrument.h"
+#include "ScoreFormat.h"
+/***********************************************************************************************
+----------------------------    ScorePlayer.h   ------------------------------------------------
+************************************************************************************************
+Lecteur de partitions compilees (voir ScoreFormat.h et tools/lyre_score).
+
+Les enregistrements sont lus en place depuis la flash: pas de copie, pas de decodage MIDI,
+pas de choix de direction. update() compare micros() a l'echeance suivante et ecrit la
+valeur PCA9685 telle quelle.
+
+Anticipation: la partition etant connue a l'avance, les grattages qui tombent dans les
+LOOKAHEAD_WINDOW_US suivantes sont pre-positionnes (Instrument::prestage). A l'echeance il ne
+reste que les derniers degres a parcourir: l'ecriture est retardee d'autant pour que la corde
+sonne au meme instant qu'avec un grattage complet depuis le repos.
+************************************************************************************************/
+
+class ScorePlayer {
+  private:
+    Instrument& _instrument;
+    const ScoreRecord* _records;
+    uint32_t _recordCount;
+    uint32_t _index;
+    unsigned long _nextDueUs;  // Echeance de l'enregistrement _index
+    bool _playing;
+
+    // Anticipation
+    struct DeferredPluck {
+      unsigned long dueUs;
+      uint8_t servo;
+      uint16_t tick;
+    };
+    uint32_t _lookaheadIndex;        // Prochain enregistrement a examiner (>= _index)
+    unsigned long _lookaheadDueUs;   // Echeance de _lookaheadIndex
+    uint8_t _pending[NUM_SERVOS];    // Enregistrements examines mais pas encore joues, par servo
+    uint16_t _stagedServos;          // Le prochain grattage de ce servo a ete pre-positionne
+    DeferredPluck _deferred[LOOKAHEAD_MAX_STAGED];
+    uint8_t _deferredCount;
+    uint16_t _panicCount;  // Instrument::getPanicCount() au demarrage: une panique arrete la lecture
+
+    void scanAhead(unsigned long now);
+    void fireRecord(const ScoreRecord& record, unsigned long dueUs);
+    void fireDeferred(unsigned long now);
+    uint8_t stagedCount() const;
+
+  public:
+    ScorePlayer(Instrument &instrument);
+    bool load(const uint8_t* data, size_t length);  // Valide en-tete et enregistrements, false si refuse
+    bool loadFromPartition();  // Mappe la partition SCORE_PARTITION_LABEL
+    void start();
+    void stop();  // Arrete et remet les cordes au repos
+    bool isPlaying() { return _playing; }
+    void update();  // A appeler dans loop()
+};
+
+#endif // SCOREPLAYER_H
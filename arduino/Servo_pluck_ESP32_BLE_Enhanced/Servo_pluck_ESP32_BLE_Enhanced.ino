@@ -7,16 +7,22 @@ CONTRÔLE APPAIRAGE BLE:
 - Bouton physique pour activer/désactiver appairage (GPIO 0)
 - LED d'état de connexion (GPIO 2)
 - Timeout d'appairage automatique (5 minutes)
+- Appareils liés gardés en NVS (4 au plus), reconnexion dirigée au dernier appareil
 - Appui long pour reset liste appareils
 
 MIDI AMELIORE:
 - Filtrage par canal MIDI (configurable)
 - Validation complète des messages
 - Protection anti-spam (rate limiting)
-- Feedback MIDI (confirmations Note On/Off)
+- Feedback MIDI (confirmations Note On/Off à la fin de l'écriture I2C, horodatées)
 - Statistiques en temps réel
+- Histogrammes de latence (réception → fin d'écriture I2C)
 - Gestion d'erreurs avec codes
 
+ENERGIE:
+- Fréquence CPU variable et sommeil léger entre les événements BLE (esp_pm), CPU à fond
+  pendant le jeu, latence ajoutée bornée par un budget
+
 STABILITE:
 - Watchdog pour redémarrage auto
 - Gestion mémoire optimisée
@@ -38,8 +44,18 @@ BIBLIOTHEQUES REQUISES:
 #include <BLEMIDI_Transport.h>
 #include <hardware/BLEMIDI_ESP32.h>
 #include <esp_task_wdt.h>
-#include "Instrument.h"
+#include "instrument.h"
 #include "MidiHandler.h"
+#include "ScorePlayer.h"
+#include "LatencyStats.h"
+#include "Profiler.h"
+#include "DeferredLog.h"
+#include "EventTrace.h"
+#include "ActuationFeedback.h"
+#include "BleConnParams.h"
+#include "BleBonding.h"
+#include "LoopScheduler.h"
+#include "PowerManager.h"
 #include "settings.h"
 
 // Création des objets BLE MIDI
@@ -47,6 +63,8 @@ BLEMIDI_CREATE_INSTANCE(BLE_DEVICE_NAME, MIDI)
 
 Instrument instrument;
 MidiHandler* midiHandler = nullptr;
+ScorePlayer scorePlayer(instrument);
+LatencyStats latencyStats;
 
 /***********************************************************************************************
 VARIABLES GLOBALES
@@ -54,6 +72,13 @@ VARIABLES GLOBALES
 
 // État de connexion BLE
 bool isConnected = false;
+volatile bool disconnectPending = false;  // Posé par la tâche BLE, traité par processEvents()
+
+// Caractéristique BLE-MIDI créée par la bibliothèque: le feedback d'actionnement y écrit ses
+// paquets directement pour porter ses propres timestamps
+#define BLE_MIDI_SERVICE_UUID        "03b80e5a-ede8-4b33-a751-6ce34ec4c700"
+#define BLE_MIDI_CHARACTERISTIC_UUID "7772e5db-3868-4112-a1a9-f2669d106bf3"
+BLECharacteristic* midiCharacteristic = nullptr;
 
 // État d'appairage
 enum PairingState {
@@ -64,32 +89,49 @@ enum PairingState {
 PairingState pairingState = PAIRING_DISABLED;
 unsigned long pairingStartTime = 0;
 
-// Bouton d'appairage
+// Bouton d'appairage (anti-rebond non-bloquant: état lu stable pendant le délai)
 unsigned long buttonPressStart = 0;
 bool buttonPressed = false;
 bool buttonHandled = false;
+bool buttonRawState = false;
+unsigned long buttonRawSince = 0;
 
 // LED d'état
 int ledMode = LED_OFF;
 unsigned long lastLedToggle = 0;
 bool ledState = false;
+uint8_t ledConfirmToggles = 0;  // Clignotements de confirmation restants (x2), prioritaires
 
 /***********************************************************************************************
 FONCTIONS BLE
 ************************************************************************************************/
 
 void onBLEConnected() {
+  PROFILE_SCOPE("onBLEConnected");
   isConnected = true;
   pairingState = PAIRING_CONNECTED;
   ledMode = LED_ON;  // LED fixe quand connecté
+  BleBonding::onConnected();
+  LoopScheduler::wake();
   Serial.println("[BLE] ✓ Connexion établie");
 }
 
 void onBLEDisconnected() {
+  PROFILE_SCOPE("onBLEDisconnected");
   isConnected = false;
   pairingState = PAIRING_DISABLED;
+  BleBonding::setPairingOpen(false);  // Seuls les appareils liés retrouvent leur clé
+  BleBonding::onDisconnected();       // Advertising dirigé vers le dernier appareil
   ledMode = LED_OFF;
   Serial.println("[BLE] ✗ Déconnexion");
+  disconnectPending = true;  // Panique dans la loop, pas en concurrence avec update()
+  LoopScheduler::wake();
+}
+
+void sendFeedbackPacket(const uint8_t* packet, size_t length) {
+  if (!isConnected || !midiCharacteristic) return;
+  midiCharacteristic->setValue((uint8_t*)packet, length);
+  midiCharacteristic->notify();
 }
 
 /***********************************************************************************************
@@ -100,6 +142,17 @@ void updateLED() {
   unsigned long now = millis();
   unsigned long interval;
 
+  // Confirmation d'appui long: 5 clignotements rapides, puis retour au mode courant
+  if (ledConfirmToggles > 0) {
+    if (now - lastLedToggle >= 100) {
+      ledState = !ledState;
+      digitalWrite(PIN_BLE_LED, ledState ? HIGH : LOW);
+      lastLedToggle = now;
+      ledConfirmToggles--;
+    }
+    return;
+  }
+
   switch (ledMode) {
     case LED_OFF:
       digitalWrite(PIN_BLE_LED, LOW);
@@ -139,14 +192,21 @@ void checkPairingButton() {
   unsigned long now = millis();
   bool currentState = digitalRead(PIN_PAIRING_BUTTON) == LOW;  // Bouton actif bas
 
-  // Détection appui avec debounce
+  // Debounce: un changement n'est pris en compte qu'une fois stable pendant le délai
+  if (currentState != buttonRawState) {
+    buttonRawState = currentState;
+    buttonRawSince = now;
+    return;
+  }
+  if (now - buttonRawSince < PAIRING_BUTTON_DEBOUNCE_MS) {
+    return;
+  }
+
+  // Détection appui
   if (currentState && !buttonPressed) {
-    delay(PAIRING_BUTTON_DEBOUNCE_MS);
-    if (digitalRead(PIN_PAIRING_BUTTON) == LOW) {
-      buttonPressed = true;
-      buttonPressStart = now;
-      buttonHandled = false;
-    }
+    buttonPressed = true;
+    buttonPressStart = buttonRawSince;
+    buttonHandled = false;
   }
 
   // Détection relâchement
@@ -169,13 +229,11 @@ void checkPairingButton() {
       resetPairedDevices();
       buttonHandled = true;
 
-      // Blink rapide 5 fois pour confirmation
-      for (int i = 0; i < 5; i++) {
-        digitalWrite(PIN_BLE_LED, HIGH);
-        delay(100);
-        digitalWrite(PIN_BLE_LED, LOW);
-        delay(100);
-      }
+      // Blink rapide 5 fois pour confirmation (updateLED, sans bloquer la loop)
+      ledState = false;
+      digitalWrite(PIN_BLE_LED, LOW);
+      lastLedToggle = now;
+      ledConfirmToggles = 10;
     }
   }
 }
@@ -185,11 +243,13 @@ void togglePairing() {
     // Activer appairage
     pairingState = PAIRING_ENABLED;
     pairingStartTime = millis();
+    BleBonding::setPairingOpen(true);
     ledMode = LED_FAST_BLINK;
     Serial.println("[BLE] Appairage activé (5 min)");
   } else if (pairingState == PAIRING_ENABLED) {
     // Désactiver appairage
     pairingState = PAIRING_DISABLED;
+    BleBonding::setPairingOpen(false);
     ledMode = LED_OFF;
     Serial.println("[BLE] Appairage désactivé");
   }
@@ -201,6 +261,7 @@ void checkPairingTimeout() {
     if (millis() - pairingStartTime >= PAIRING_TIMEOUT_MS) {
       Serial.println("[BLE] Timeout appairage (5 min)");
       pairingState = PAIRING_DISABLED;
+      BleBonding::setPairingOpen(false);
       ledMode = LED_OFF;
     }
   }
@@ -208,8 +269,7 @@ void checkPairingTimeout() {
 
 void resetPairedDevices() {
   Serial.println("[BLE] Reset liste appareils appairés");
-  // TODO: Implémenter sauvegarde NVS des appareils
-  // Pour l'instant, juste un message
+  BleBonding::clear();  // NVS et clés de la pile: chaque appareil devra s'appairer à nouveau
 }
 
 /***********************************************************************************************
@@ -227,20 +287,52 @@ void checkSerialCommands() {
         }
         break;
 
+      case 'l':  // Histogrammes de latence
+        latencyStats.print();
+        break;
+
+      case 'f':  // Profil des sections (affiche puis remet à zéro)
+        #if ENABLE_PROFILER
+          Profiler::dump();
+        #else
+          Serial.println("[PROF] Profileur désactivé (ENABLE_PROFILER dans settings.h)");
+        #endif
+        break;
+
+      case 't':  // Trace d'événements en binaire (tools/lyre_trace)
+        EventTrace::dump();
+        break;
+
       case 'r':  // Reset statistiques
         if (midiHandler) {
           midiHandler->resetStatistics();
         }
+        LoopScheduler::resetStats();
+        PowerManager::resetStats();
         break;
 
       case 'i':  // Informations système
         printSystemInfo();
         break;
 
+      case 'e':  // Énergie: courant estimé et latence ajoutée par mode
+        PowerManager::print();
+        break;
+
       case 'p':  // Toggle appairage
         togglePairing();
         break;
 
+      case 'g':  // Jouer la partition compilée
+        if (scorePlayer.loadFromPartition()) {
+          scorePlayer.start();
+        }
+        break;
+
+      case 'x':  // Arrêter la partition
+        scorePlayer.stop();
+        break;
+
       case 'h':  // Aide
         printHelp();
         break;
@@ -267,6 +359,18 @@ void printSystemInfo() {
   Serial.printf("Pairing State:   %s\n",
                 pairingState == PAIRING_DISABLED ? "DISABLED" :
                 pairingState == PAIRING_ENABLED ? "ENABLED" : "CONNECTED");
+  BleBonding::print();
+  LoopScheduler::print();
+  uint16_t energized = instrument.getEnergizedMask();
+  uint8_t energizedCount = 0;
+  for (uint8_t i = 0; i < NUM_SERVOS; i++) {
+    if (energized & (1 << i)) energizedCount++;
+  }
+  Serial.printf("Voies alimentées: %d/%d (0x%04X)\n", energizedCount, NUM_SERVOS, energized);
+  Serial.printf("Réveils de voie: %lu\n", (unsigned long)instrument.getWakeCount());
+  Serial.printf("PCA9685:         %s (erreurs I2C: %lu)\n",
+                instrument.isOnline() ? "OK" : (instrument.isDegraded() ? "ABSENT (mode dégradé)" : "RECHERCHE"),
+                (unsigned long)instrument.getI2CErrorCount());
   Serial.printf("Free Heap:       %d bytes\n", ESP.getFreeHeap());
   Serial.printf("Uptime:          %lu ms\n", millis());
   Serial.println("=================================\n");
@@ -275,9 +379,15 @@ void printSystemInfo() {
 void printHelp() {
   Serial.println("\n========== COMMANDES SERIE ==========");
   Serial.println("s - Afficher statistiques MIDI");
-  Serial.println("r - Reset statistiques MIDI");
-  Serial.println("i - Informations système");
+  Serial.println("l - Afficher latences (p50/p95/p99/max)");
+  Serial.println("f - Profil CPU par section (affiche et remet à zéro)");
+  Serial.println("t - Vider la trace d'événements (binaire, tools/lyre_trace)");
+  Serial.println("r - Reset statistiques MIDI, latences, boucle et énergie");
+  Serial.println("i - Informations système (BLE, boucle)");
+  Serial.println("e - Énergie: courant estimé / latence ajoutée par mode");
   Serial.println("p - Toggle appairage BLE");
+  Serial.println("g - Jouer la partition compilée (flash)");
+  Serial.println("x - Arrêter la partition");
   Serial.println("h - Afficher cette aide");
   Serial.println("======================================\n");
 }
@@ -288,6 +398,9 @@ SETUP
 
 void setup() {
   Serial.begin(SERIAL_BAUD_RATE);
+  DeferredLog::begin();  // Avant tout message différé (servos, MIDI)
+  EventTrace::begin();   // Trace d'avant un reset logiciel conservée
+  LoopScheduler::begin();
   delay(1000);
 
   Serial.println("\n========================================");
@@ -316,13 +429,36 @@ void setup() {
     Serial.println("[I2C] Pins par défaut: SDA=21, SCL=22");
   #endif
 
+  // Détection du PCA9685: non-bloquante, se poursuit dans loop() pendant que le BLE démarre
+  instrument.begin();
+
   // Initialiser MidiHandler
   Serial.println("[INIT] Initialisation du MidiHandler...");
   midiHandler = new MidiHandler(instrument);
 
+  // Fréquence variable / sommeil léger, avant le démarrage de la pile BLE
+  PowerManager::begin();
+
   // Configurer BLE MIDI
   MIDI.begin();
 
+  // Intervalle de connexion, latence et DLE demandés au central, valeurs accordées suivies
+  BleConnParams::begin();
+
+  // Appareils liés (NVS) et advertising dirigé vers le dernier au démarrage
+  BleBonding::begin();
+
+  // Feedback d'actionnement: à la fin de l'écriture I2C, horodaté avec cet instant
+  BLEServer* bleServer = BLEDevice::getServer();
+  BLEService* midiService = bleServer ? bleServer->getServiceByUUID(BLE_MIDI_SERVICE_UUID) : nullptr;
+  if (midiService) {
+    midiCharacteristic = midiService->getCharacteristic(BLE_MIDI_CHARACTERISTIC_UUID);
+  }
+  if (MIDI_SEND_FEEDBACK && midiCharacteristic) {
+    ActuationFeedback::begin(sendFeedbackPacket, MIDI_CHANNEL);
+    instrument.setActuationCallback(ActuationFeedback::push);
+  }
+
   // Callbacks de connexion
   BLEMIDI.setHandleConnected(onBLEConnected);
   BLEMIDI.setHandleDisconnected(onBLEDisconnected);
@@ -352,11 +488,26 @@ void setup() {
     if (midiHandler) midiHandler->onPolyPressure(channel, note, pressure);
   });
 
+  MIDI.setHandleSystemExclusive([](byte* data, unsigned size) {
+    if (midiHandler) midiHandler->onSystemExclusive(data, size);
+  });
+
   // Activer appairage au démarrage
   pairingState = PAIRING_ENABLED;
   pairingStartTime = millis();
+  BleBonding::setPairingOpen(true);
   ledMode = LED_FAST_BLINK;
 
+  // Tâches périodiques: entre deux échéances, la loop dort jusqu'à un message BLE
+  LoopScheduler::every("bouton", 10, [] { PROFILE_SCOPE("bouton"); checkPairingButton(); });
+  LoopScheduler::every("led", 20, [] { PROFILE_SCOPE("LED"); updateLED(); });
+  LoopScheduler::every("appairage", 1000, checkPairingTimeout);
+  LoopScheduler::every("serie", 20, [] { PROFILE_SCOPE("checkSerialCommands"); checkSerialCommands(); });
+  #if DEBUG
+    // Statistiques toutes les 60 secondes
+    LoopScheduler::every("stats", 60000, [] { if (midiHandler) midiHandler->printStatistics(); });
+  #endif
+
   Serial.println("\n[INIT] ✓ Initialisation terminée");
   Serial.printf("[BLE] Nom: %s\n", BLE_DEVICE_NAME);
   Serial.println("[BLE] Appairage activé (5 min)");
@@ -368,34 +519,62 @@ void setup() {
 LOOP PRINCIPAL
 ************************************************************************************************/
 
-void loop() {
+// Une itération: tout ce qu'un message BLE ou une échéance peut avoir rendu nécessaire
+void processEvents() {
+  PROFILE_SCOPE("loop");
+
   // Reset watchdog
   #if ENABLE_WATCHDOG
     esp_task_wdt_reset();
   #endif
 
-  // Lire événements BLE MIDI
-  MIDI.read();
+  // Déconnexion: les noteOff en cours ne viendront plus
+  if (disconnectPending) {
+    disconnectPending = false;
+    instrument.panic();
+    ActuationFeedback::clear();  // Même tâche que ActuationFeedback::update()
+  }
+
+  // Lire événements BLE MIDI (horodatage de réception pour les latences)
+  {
+    PROFILE_SCOPE("MIDI.read");
+    latencyStats.markReceive();
+    MIDI.read();
+  }
 
   // Mettre à jour instrument (servos, timeouts)
-  instrument.update();
+  {
+    PROFILE_SCOPE("instrument.update");
+    instrument.update();
+    LoopScheduler::wakeWithin(instrument.msUntilUpdate());
+  }
 
-  // Gestion bouton et LED
-  checkPairingButton();
-  checkPairingTimeout();
-  updateLED();
+  // Partition compilée en cours de lecture
+  {
+    PROFILE_SCOPE("scorePlayer.update");
+    scorePlayer.update();
+    if (scorePlayer.isPlaying()) {
+      PowerManager::activity();  // Grattages programmés: pas de sortie de sommeil à chaque note
+    }
+  }
 
-  // Commandes série
-  checkSerialCommands();
+  // Feedback d'actionnement: une notification par intervalle de connexion
+  ActuationFeedback::update();
 
-  // Afficher statistiques périodiquement (toutes les 60 secondes si debug)
-  #if DEBUG
-    static unsigned long lastStatsTime = 0;
-    if (millis() - lastStatsTime >= 60000) {
-      if (midiHandler) {
-        midiHandler->printStatistics();
-      }
-      lastStatsTime = millis();
-    }
-  #endif
+  // Paramètres de connexion: demande après connexion, renégociation si dégradés
+  BleConnParams::update();
+
+  // Advertising (dirigé puis normal), liste des appareils liés en NVS
+  BleBonding::update();
+
+  // Retour au repos (fréquence minimale, sommeil léger) après POWER_ACTIVE_HOLD_MS sans note
+  PowerManager::update();
+}
+
+void loop() {
+  processEvents();
+
+  // Bouton, LED, commandes série, statistiques: tâches dues, puis sommeil jusqu'à la
+  // prochaine échéance ou un message BLE
+  LoopScheduler::run();
 }
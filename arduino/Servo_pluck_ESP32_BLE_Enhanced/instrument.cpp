@@ -1,6 +1,13 @@
-#include "Instrument.h"
+#include "instrument.h"
+#include "DeferredLog.h"
+#include "EventTrace.h"
 
-Instrument::Instrument() : servoController() {
+Instrument::Instrument()
+  : servoController(), pluckThrough(PLUCK_THROUGH_MODE),
+    dampDelayMs(PLUCK_THROUGH_DAMP_MS), dampMask(0),
+    sustainPedal(false), sostenutoPedal(false), sostenutoMask(0), keysDown(0), sustainedMask(0), panicCount(0),
+    actuationCallback(nullptr) {
+  resetSustainStats();
   if (DEBUG) {
     Serial.println("[INSTRUMENT] Demarrage de l'initialisation");
   }
@@ -8,29 +15,148 @@ Instrument::Instrument() : servoController() {
 
 void Instrument::update() {
   servoController.update();
+
+  // Etouffements differes du mode pluck-through: on laisse le grattage finir sa course
+  if (dampMask) {
+    unsigned long now = millis();
+    for (uint8_t servo = 0; servo < NUM_SERVOS; servo++) {
+      uint16_t bit = 1 << servo;
+      if ((dampMask & bit) && now - servoController.getLastMoveTime(servo) >= dampDelayMs) {
+        dampMask &= ~bit;
+        servoController.mute(servo);
+        notifyActuation(bit, 0);
+      }
+    }
+  }
+}
+
+void Instrument::setPluckThrough(bool enabled, uint16_t dampMs) {
+  pluckThrough = enabled;
+  dampDelayMs = dampMs;
+  dampMask = 0;
+  if (DEBUG) {
+    Serial.print("[INSTRUMENT] Pluck-through: ");
+    Serial.println(enabled ? "ON" : "OFF");
+  }
+}
+
+void Instrument::setSustain(bool down) {
+  if (down == sustainPedal) return;
+  sustainPedal = down;
+  if (!down) {
+    releasePedals();
+  }
+}
+
+void Instrument::setSostenuto(bool down) {
+  // Une pedale continue envoie plusieurs valeurs "enfoncee": seul l'appui capture
+  if (down == sostenutoPedal) return;
+  sostenutoPedal = down;
+  if (down) {
+    // Seules les cordes dont la touche est enfoncee au moment de l'appui sont retenues
+    sostenutoMask = keysDown;
+    return;
+  }
+  sostenutoMask = 0;
+  releasePedals();
+}
+
+void Instrument::releasePedals() {
+  uint16_t mask = sustainedMask;
+  if (sustainPedal) {
+    mask = 0;
+  }
+  mask &= ~sostenutoMask;
+  if (mask == 0) return;
+  sustainedMask &= ~mask;
+
+  if (pluckThrough) {
+    // Meme traitement qu'un noteOff en mode pluck-through
+    if (dampDelayMs > 0) {
+      dampMask |= mask;
+    }
+    return;
+  }
+
+  uint8_t count = 0;
+  for (uint16_t m = mask; m; m &= m - 1) {
+    count++;
+  }
+  sustainStats.flushes++;
+  sustainStats.flushedMutes += count;
+  servoController.muteMask(mask);  // Une seule transaction I2C pour toutes les cordes
+  notifyActuation(mask, 0);
+  DeferredLog::log(LOG_INSTR_PEDAL_RELEASE, count, sustainStats.savedMoves);
+}
+
+void Instrument::notifyActuation(uint16_t mask, uint8_t velocity) {
+  // Rien n'a ete ecrit si le PCA9685 est absent ou vient de refuser l'ecriture
+  if (!actuationCallback || !servoController.isOnline()) return;
+
+  unsigned long doneUs = servoController.getI2CDoneUs();
+  for (uint8_t servo = 0; mask; servo++, mask >>= 1) {
+    if (mask & 1) {
+      actuationCallback(servo, servoNote(servo), velocity, doneUs);
+    }
+  }
+}
+
+uint8_t Instrument::servoNote(uint8_t servo) {
+  for (uint8_t i = 0; i <= MIDI_NOTE_MAX - MIDI_NOTE_MIN; i++) {
+    if (ServoMidiMapping[i] == servo) {
+      return MIDI_NOTE_MIN + i;
+    }
+  }
+  return 0;
+}
+
+void Instrument::panic() {
+  // Toutes les actions differees sont abandonnees: rien ne doit bouger apres la panique
+  dampMask = 0;
+  sustainPedal = false;
+  sostenutoPedal = false;
+  sostenutoMask = 0;
+  sustainedMask = 0;
+  keysDown = 0;
+  panicCount++;
+  EventTrace::record(TRACE_PANIC);
+  servoController.panic();
+  DeferredLog::log(LOG_INSTR_PANIC);
+}
+
+void Instrument::resetSustainStats() {
+  memset(&sustainStats, 0, sizeof(sustainStats));
 }
 
 bool Instrument::isReady() {
   return servoController.isInitComplete();
 }
 
+uint32_t Instrument::msUntilUpdate() {
+  uint32_t wait = servoController.msUntilUpdate();
+  if (dampMask) {
+    unsigned long now = millis();
+    for (uint8_t servo = 0; servo < NUM_SERVOS; servo++) {
+      if (dampMask & (1 << servo)) {
+        unsigned long elapsed = now - servoController.getLastMoveTime(servo);
+        wait = min(wait, elapsed >= dampDelayMs ? 0 : (uint32_t)(dampDelayMs - elapsed));
+      }
+    }
+  }
+  return wait;
+}
+
 int16_t Instrument::getServo(uint8_t midiNote) {
   // Recherche optimisee O(1) au lieu de O(n)
   if (midiNote < MIDI_NOTE_MIN || midiNote > MIDI_NOTE_MAX) {
-    if (DEBUG) {
-      Serial.print("[INSTRUMENT] Note MIDI ");
-      Serial.print(midiNote);
-      Serial.println(" hors plage supportee");
-    }
+    DeferredLog::log(LOG_INSTR_NOTE_RANGE, midiNote);
     return -1;
   }
 
   int8_t servo = ServoMidiMapping[midiNote - MIDI_NOTE_MIN];
 
-  if (servo == -1 && DEBUG) {
-    Serial.print("[INSTRUMENT] Note MIDI ");
-    Serial.print(midiNote);
-    Serial.println(" non jouable (non mappee)");
+  if (servo == -1) {
+    DeferredLog::log(LOG_INSTR_NOTE_UNMAPPED, midiNote);
   }
 
   return servo;
@@ -39,14 +165,65 @@ int16_t Instrument::getServo(uint8_t midiNote) {
 void Instrument::noteOn(uint8_t midiNote, uint8_t velocity) {
 	int16_t servo = getServo(midiNote);
 	if (servo != -1){
+		uint16_t bit = 1 << servo;
+		dampMask &= ~bit;  // La corde est regrattee: plus d'etouffement en attente
+		if (sustainedMask & bit) {
+			sustainedMask &= ~bit;  // Le mute differe n'aura jamais lieu
+			sustainStats.savedMoves++;
+		}
+		keysDown |= bit;
+		EventTrace::record(TRACE_PLUCK, servo, midiNote);
 		servoController.pluck(servo);
+		notifyActuation(bit, velocity);
 	}
 }
 
+void Instrument::actuate(uint8_t servo, uint16_t tick) {
+  EventTrace::record(TRACE_SCORE, servo, tick);
+  servoController.writeTick(servo, tick);
+}
+
+bool Instrument::prestage(uint8_t servo, int8_t direction) {
+  return servoController.prestage(servo, direction);
+}
+
+uint32_t Instrument::pluckLatencyUs(uint8_t servo) {
+  return servoController.pluckLatencyUs(servo);
+}
+
+uint16_t Instrument::restTick(uint8_t servo) {
+  return servoController.restTick(servo);
+}
+
+void Instrument::arm(uint8_t servo) {
+  servoController.arm(servo);
+}
+
 void Instrument::noteOff(uint8_t midiNote) {
   int16_t servo = getServo(midiNote);
 	if (servo != -1){
+		uint16_t bit = 1 << servo;
+		keysDown &= ~bit;
+		if (sustainPedal || (sostenutoMask & bit)) {
+			// La corde continue de sonner: le mute est differe au relachement de la pedale
+			if (!(sustainedMask & bit)) {
+				sustainedMask |= bit;
+				sustainStats.deferredMutes++;
+			}
+			EventTrace::record(TRACE_MUTE_DEFERRED, servo, midiNote);
+			return;
+		}
+		if (pluckThrough) {
+			// Le servo reste de l'autre cote: la prochaine note traverse la corde depuis cette position
+			if (dampDelayMs > 0 && !servoController.isAtRest(servo)) {
+				dampMask |= (1 << servo);
+			}
+			EventTrace::record(TRACE_MUTE_DEFERRED, servo, midiNote);
+			return;
+		}
 		// Remet le servo a sa position initiale
+		EventTrace::record(TRACE_MUTE, servo, midiNote);
 		servoController.mute(servo);
+		notifyActuation(1 << servo, 0);
   }
 }
\ No newline at end of file
@@ -18,6 +18,12 @@ NOUVELLES FONCTIONNALITES:
 
 // Configuration Debug
 #define DEBUG 0
+#define DEFERRED_LOG_BINARY false   // Journal différé (DeferredLog.h): true = trames binaires pour tools/lyre_log
+#define DEFERRED_LOG_DRAIN_MS 20     // Période de vidage du journal par la tâche basse priorité
+#define ENABLE_EVENT_TRACE true      // Trace d'événements en RAM RTC (EventTrace.h), gardée après un reset logiciel
+#define TRACE_BUFFER_EVENTS 256      // Puissance de 2, 8 octets par événement (8 Ko de RAM RTC au total)
+#define LOOP_MAX_SLEEP_MS 1000       // Boucle événementielle (LoopScheduler.h): sommeil max sans échéance ni événement
+#define LOOP_TASKS_MAX 8             // Tâches périodiques de la loop
 
 // Version firmware
 #define FIRMWARE_VERSION "2.0"
@@ -28,6 +34,16 @@ CONFIGURATION BLE
 ************************************************************************************************/
 #define BLE_DEVICE_NAME "Lyre-MIDI-ESP32"  // Nom de l'appareil Bluetooth
 
+// Paramètres de connexion demandés au central après chaque connexion (BleConnParams.h)
+#define BLE_CONN_INTERVAL_MIN 6          // 7,5 ms (unités de 1,25 ms)
+#define BLE_CONN_INTERVAL_MAX 9          // 11,25 ms
+#define BLE_CONN_LATENCY 0               // Latence esclave: aucun intervalle sauté
+#define BLE_CONN_TIMEOUT 400             // Supervision: 4 s (unités de 10 ms)
+#define BLE_CONN_REQUEST_DELAY_MS 1000   // Première demande après la découverte des services
+#define BLE_CONN_RETRY_MS 2000           // Paramètres refusés ou dégradés: nouvelle demande, délai doublé
+#define BLE_CONN_MAX_RETRIES 5           // Nouvelles demandes au plus par connexion
+#define BLE_DATA_LENGTH 251              // DLE: octets par paquet radio demandés (27 sans extension)
+
 // Contrôle d'appairage
 #define PIN_PAIRING_BUTTON 0       // GPIO 0 (bouton BOOT sur ESP32)
 #define PIN_BLE_LED 2              // GPIO 2 (LED intégrée ESP32)
@@ -35,6 +51,27 @@ CONFIGURATION BLE
 #define PAIRING_BUTTON_DEBOUNCE_MS 50
 #define PAIRING_LONG_PRESS_MS 3000  // 3 secondes pour effacer liste appairés
 
+// Appareils appairés (BleBonding.h): liés et gardés en NVS, reconnexion dirigée au dernier
+#define BLE_BOND_MAX 4                 // Appareils gardés (au-delà: le plus ancien est oublié)
+#define BLE_BOND_DIRECTED_MS 1280      // Advertising dirigé vers le dernier appareil (max. BLE: 1,28 s)
+#define BLE_BOND_FAST_ADV_MIN 0x20     // Advertising normal ensuite: 20 - 30 ms (unités de 0,625 ms)
+#define BLE_BOND_FAST_ADV_MAX 0x30
+
+// Gestion d'énergie (PowerManager.h): CPU à fond pendant le jeu, économie au repos
+#define POWER_MODE 2                     // 0 = performance (240 MHz fixe), 1 = fréquence variable, 2 = + sommeil léger
+#define POWER_LATENCY_BUDGET_US 2000     // Latence ajoutée tolérée sur la première note après un repos
+#define POWER_ACTIVE_HOLD_MS 10000       // Repos: 10 s sans message MIDI
+#define POWER_CPU_MAX_MHZ 240
+#define POWER_CPU_MIN_MHZ 80             // Pas en dessous: l'APB (I2C, UART) reste à 80 MHz
+#define POWER_IDLE_LATENCY_MAX 4         // Latence esclave BLE au repos, au plus (le budget décide)
+#define POWER_DFS_WAKE_US 50             // Retour à 240 MHz, début de la première note à 80 MHz
+#define POWER_LIGHT_SLEEP_WAKE_US 1000   // Sortie de sommeil léger et traitement d'un événement BLE
+// Courants typiques pour le rapport (datasheet ESP32): à remplacer par une mesure au multimètre
+#define POWER_MA_CPU_MAX 50              // CPU à 240 MHz
+#define POWER_MA_CPU_MIN 22              // CPU à 80 MHz
+#define POWER_MA_LIGHT_SLEEP 1           // Sommeil léger
+#define POWER_MA_BLE 8                   // Radio BLE connectée, intervalle 7,5 ms sans latence esclave
+
 // Modes LED BLE
 #define LED_OFF 0
 #define LED_SLOW_BLINK 1    // 1 Hz - Recherche connexion
@@ -47,6 +84,12 @@ CONFIGURATION MIDI
 #define MIDI_CHANNEL 1             // Canal MIDI principal (1-16)
 #define MIDI_OMNI_MODE false       // true = écoute tous canaux, false = canal unique
 #define MIDI_SEND_FEEDBACK true    // Envoyer feedback MIDI (Note On/Off confirmations)
+// Feedback d'actionnement (ActuationFeedback.h): envoyé quand la corde a bougé, horodaté avec
+// l'instant de fin d'écriture I2C et précédé du CC portant l'index du servo
+#define FEEDBACK_SERVO_CC 104        // CC 104 = corde actionnée (0-15)
+#define FEEDBACK_COALESCE_US 7500    // Regroupement en une notification: intervalle de connexion minimal
+#define FEEDBACK_PACKET_SIZE 20      // Octets par notification (MTU par défaut 23 - 3)
+#define FEEDBACK_QUEUE_SIZE 32       // Actionnements en attente (au-delà: perdus et comptés)
 #define MIDI_SEND_ACTIVE_SENSING false  // Envoyer Active Sensing périodique
 
 // Validation des messages
@@ -73,7 +116,40 @@ CONFIGURATION SERVOS & MATERIEL
 // Délais d'initialisation des servos (en millisecondes)
 #define SERVO_INIT_DELAY_MS 500
 #define SERVO_RESET_DELAY_MS 100
-#define SERVO_AUTO_DISABLE_TIMEOUT_MS 2000  // Désactiver après 2s d'inactivité
+// Balayage d'initialisation par groupes: N servos bougent ensemble (budget alimentation,
+// ~700 mA de pointe par SG90). 16 servos par 4 = 4 x (500 + 100) ms au lieu de 9,6 s.
+#define SERVO_INIT_GROUP_SIZE 4
+// Redémarrage à chaud (watchdog, reset logiciel): l'état des servos est conservé en mémoire RTC
+// et le balayage est sauté. Après une mise sous tension ou une chute d'alimentation il a lieu.
+#define SERVO_WARM_BOOT true
+#define SERVO_AUTO_DISABLE_TIMEOUT_MS 2000  // Voie libérée (bit full-OFF du PCA9685) après 2s sans mouvement
+// Prédiction de trafic: tant que des notes arrivent (une dans la dernière fenêtre), les cordes
+// jouées récemment restent alimentées plus longtemps pour ne pas être réveillées à chaque note
+#define SERVO_TRAFFIC_WINDOW_MS 4000
+#define SERVO_TRAFFIC_HOLD_MS 10000
+
+// Modèle de déplacement des servos (SG90: 0.1 s / 60° sous 4.8V)
+// Sert à compenser la latence mécanique (partitions compilées, anticipation)
+#define SERVO_US_PER_DEGREE 1667
+#define PLUCK_RELEASE_ANGLE (PLUCK_ANGLE / 2)  // Degrés parcourus depuis le repos avant que la corde s'échappe
+
+// Anticipation (lecture programmée): le servo est amené juste avant le point d'échappement,
+// seuls les derniers degrés sont parcourus à l'échéance
+#define LOOKAHEAD_PRESTAGE_ANGLE 5   // Doit rester < PLUCK_RELEASE_ANGLE (corde tendue, pas lâchée)
+#define LOOKAHEAD_WINDOW_US 60000    // Horizon d'anticipation
+#define LOOKAHEAD_MAX_STAGED 4       // Budget alimentation: servos maintenus en tension simultanément
+
+// Mode pluck-through: après un grattage le servo reste de l'autre côté de la corde et la note
+// suivante la traverse depuis là (un seul mouvement par note). Activable aussi par CC 68.
+#define PLUCK_THROUGH_MODE false
+#define PLUCK_THROUGH_DAMP_MS 0      // 0 = noteOff ignoré, >0 = étouffement N ms après le grattage
+
+/***********************************************************************************************
+PARTITIONS COMPILEES (tools/lyre_score)
+************************************************************************************************/
+// Partition flash contenant le fichier .lyrs (la partition "spiffs" du schéma par défaut
+// n'est pas utilisée par ce sketch, elle accueille la partition compilée)
+#define SCORE_PARTITION_LABEL "spiffs"
 
 /***********************************************************************************************
 CONFIGURATION WATCHDOG
@@ -81,6 +157,12 @@ CONFIGURATION WATCHDOG
 #define ENABLE_WATCHDOG true
 #define WATCHDOG_TIMEOUT_SEC 30    // Timeout watchdog en secondes
 
+/***********************************************************************************************
+MESURES DE LATENCE (LatencyStats.h)
+************************************************************************************************/
+#define ENABLE_LATENCY_STATS true  // Histogrammes réception → fin d'écriture I2C (coût: quelques µs)
+#define ENABLE_PROFILER false      // Sections PROFILE_SCOPE (Profiler.h), supprimées à la compilation si false
+
 /***********************************************************************************************
 TYPES DE MESSAGES MIDI
 ************************************************************************************************/
@@ -150,6 +232,13 @@ const uint16_t SERVO_PULSE_MIN = 500;
 const uint16_t SERVO_PULSE_MAX = 2500;
 const uint16_t SERVO_FREQUENCY = 50;
 const uint32_t PCA9685_OSCILLATOR_FREQ = 27000000;
+const uint8_t PCA9685_I2C_ADDRESS = 0x40;  // Adresse I2C du PCA9685 (cavaliers A0-A5 ouverts)
+
+// Détection du PCA9685 au démarrage (non-bloquante, le BLE/WiFi démarre en parallèle)
+#define PCA9685_PROBE_ATTEMPTS 5        // Essais avant de passer en mode dégradé (MIDI accepté, erreur signalée)
+#define PCA9685_PROBE_RETRY_MIN_MS 10   // Délai entre deux essais, doublé à chaque échec...
+#define PCA9685_PROBE_RETRY_MAX_MS 2000 // ...jusqu'à ce plafond (recherche en arrière-plan)
+#define PCA9685_I2C_TIMEOUT_MS 10       // Durée maximale d'une transaction I2C (bus bloqué)
 
 /***********************************************************************************************
 CODES D'ERREUR MIDI
@@ -160,4 +249,37 @@ CODES D'ERREUR MIDI
 #define ERROR_INVALID_CHANNEL   4
 #define ERROR_INVALID_VELOCITY  5
 
+/***********************************************************************************************
+SYSEX (requêtes de diagnostic)
+************************************************************************************************/
+// F0 7D 4C 01 F7 → une réponse par histogramme non vide:
+// F0 7D 4C 03 [source] [étape] [n: 5 octets] [p50] [p95] [p99] [max: 4 octets chacun] F7
+// Valeurs en µs, octets de 7 bits poids faible en premier. F0 7D 4C 02 F7 → remise à zéro.
+#define SYSEX_MANUFACTURER_ID    0x7D  // Usage éducatif / développement
+#define SYSEX_LATENCY            0x4C  // 'L'
+#define SYSEX_LATENCY_QUERY      0x01
+#define SYSEX_LATENCY_RESET      0x02
+#define SYSEX_LATENCY_REPLY      0x03
+
+// F0 7D 54 01 F7 → trace d'événements (EventTrace.h): F0 7D 54 02 [en-tête] F7 puis des blocs
+// F0 7D 54 03 [index: 2 octets] [SYSEX_TRACE_CHUNK événements] F7 (détail dans TraceFormat.h)
+#define SYSEX_TRACE              0x54  // 'T'
+#define SYSEX_TRACE_QUERY        0x01
+#define SYSEX_TRACE_HEADER       0x02
+#define SYSEX_TRACE_EVENTS       0x03
+#define SYSEX_TRACE_CHUNK        8     // 11 octets par événement: 95 octets par bloc
+
+// Ping MidiMind (même format que le sketch WiFi, tools/lyre_ping):
+// F0 7D 00 03 00 [nonce: 5 octets] F7 → F0 7D 00 03 01 [nonce] [réception µs] [envoi µs] F7
+#define SYSEX_MIDIMIND           0x00
+#define SYSEX_MIDIMIND_PING      0x03
+#define SYSEX_MIDIMIND_REQUEST   0x00
+#define SYSEX_MIDIMIND_REPLY     0x01
+
+// F0 7D 43 01 F7 → paramètres de connexion BLE accordés (BleConnParams.h):
+// F0 7D 43 02 [intervalle] [latence] [supervision] [MTU] [DLE tx] [DLE rx] [demandes] [mises à jour] F7
+#define SYSEX_CONNECTION         0x43  // 'C'
+#define SYSEX_CONNECTION_QUERY   0x01
+#define SYSEX_CONNECTION_REPLY   0x02
+
 #endif
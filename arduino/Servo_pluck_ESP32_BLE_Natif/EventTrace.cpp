@@ -0,0 +1,99 @@
+#include "EventTrace.h"
+
+struct TraceBuffer {
+  uint32_t magic;
+  uint16_t capacity;
+  uint16_t reserved;
+  uint32_t total;      // Evenements ecrits depuis la mise sous tension (index du prochain)
+  uint32_t bootCount;
+  TraceEvent events[TRACE_BUFFER_EVENTS];
+};
+
+// Non initialisee au demarrage: garde son contenu tant que l'ESP32 reste alimente
+RTC_NOINIT_ATTR static TraceBuffer traceBuffer;
+
+bool EventTrace::_ready = false;
+bool EventTrace::_paused = false;
+
+#if defined(ESP32)
+  // Enregistrements depuis la loop et depuis la tache BLE: index et ecriture sous verrou
+  // (les instructions atomiques du Xtensa ne fonctionnent pas en RAM RTC)
+  static portMUX_TYPE traceMux = portMUX_INITIALIZER_UNLOCKED;
+  #define TRACE_LOCK() portENTER_CRITICAL(&traceMux)
+  #define TRACE_UNLOCK() portEXIT_CRITICAL(&traceMux)
+#else
+  #define TRACE_LOCK()
+  #define TRACE_UNLOCK()
+#endif
+
+void EventTrace::begin() {
+  if (!ENABLE_EVENT_TRACE || _ready) return;
+
+  esp_reset_reason_t reason = esp_reset_reason();
+  bool powerLost = (reason == ESP_RST_POWERON || reason == ESP_RST_BROWNOUT ||
+                    reason == ESP_RST_UNKNOWN);
+  if (powerLost || traceBuffer.magic != TRACE_MAGIC ||
+      traceBuffer.capacity != TRACE_BUFFER_EVENTS) {
+    clear();
+  } else {
+    traceBuffer.bootCount++;
+  }
+  _ready = true;
+  record(TRACE_BOOT, reason, traceBuffer.bootCount);
+}
+
+void EventTrace::clear() {
+  TRACE_LOCK();
+  memset(&traceBuffer, 0, sizeof(traceBuffer));
+  traceBuffer.magic = TRACE_MAGIC;
+  traceBuffer.capacity = TRACE_BUFFER_EVENTS;
+  TRACE_UNLOCK();
+}
+
+void EventTrace::record(uint8_t type, uint8_t a, uint16_t b) {
+  if (!_ready || _paused) return;
+
+  TRACE_LOCK();
+  TraceEvent& e = traceBuffer.events[traceBuffer.total & (TRACE_BUFFER_EVENTS - 1)];
+  e.timestampUs = micros();
+  e.type = type;
+  e.a = a;
+  e.b = b;
+  traceBuffer.total++;
+  TRACE_UNLOCK();
+}
+
+uint16_t EventTrace::count() {
+  if (!_ready) return 0;
+  return traceBuffer.total < TRACE_BUFFER_EVENTS ? traceBuffer.total : TRACE_BUFFER_EVENTS;
+}
+
+TraceEvent EventTrace::event(uint16_t index) {
+  uint32_t first = traceBuffer.total - count();
+  return traceBuffer.events[(first + index) & (TRACE_BUFFER_EVENTS - 1)];
+}
+
+void EventTrace::fillHeader(TraceDumpHeader& header) {
+  header.magic = TRACE_MAGIC;
+  header.version = TRACE_VERSION;
+  header.count = count();
+  header.total = traceBuffer.total;
+  header.bootCount = traceBuffer.bootCount;
+  header.nowUs = micros();
+  header.reserved = 0;
+}
+
+void EventTrace::dump() {
+  pause(true);
+  TraceDumpHeader header;
+  fillHeader(header);
+
+  uint8_t sync[2] = { TRACE_FRAME_SYNC0, TRACE_FRAME_SYNC1 };
+  Serial.write(sync, sizeof(sync));
+  Serial.write((const uint8_t*)&header, sizeof(header));
+  for (uint16_t i = 0; i < header.count; i++) {
+    TraceEvent e = event(i);
+    Serial.write((const uint8_t*)&e, sizeof(e));
+  }
+  pause(false);
+}
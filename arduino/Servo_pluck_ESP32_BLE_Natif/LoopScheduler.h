@@ -0,0 +1,73 @@
+#ifndef LOOPSCHEDULER_H
+#define LOOPSCHEDULER_H
+
+#include <Arduino.h>
+#include "settings.h"
+/***********************************************************************************************
+----------------------------    LoopScheduler.h   ----------------------------------------------
+************************************************************************************************
+Boucle principale evenementielle: remplace le delay() fixe de fin de loop(). Les taches
+periodiques (LED, bouton, messages d'etat...) sont enregistrees avec leur periode; run(), en
+fin de loop(), execute celles qui sont dues puis endort la tache Arduino jusqu'a la prochaine
+echeance, ou jusqu'a ce qu'un evenement la reveille:
+
+  LoopScheduler::every("led", 20, updateLED);  // Dans setup()
+  ...
+  LoopScheduler::wakeWithin(instrument.msUntilUpdate());  // Echeance d'un module, dans loop()
+  LoopScheduler::run();                                   // Fin de loop()
+
+  LoopScheduler::wake();  // Depuis la tache BLE/WiFi: message MIDI recu, connexion...
+
+Le sommeil est une attente de notification FreeRTOS (ulTaskNotifyTake): un wake() recu
+pendant l'iteration n'est pas perdu, la suivante demarre aussitot. Le tick FreeRTOS (1 ms)
+fixe la resolution: a moins d'un tick d'une echeance, run() rend la main sans dormir.
+
+Mesures: part du temps passe a dormir (CPU libre pour la pile BLE/WiFi et l'idle), delai
+entre wake() et la reprise de la loop, retard des taches sur leur echeance (gigue).
+************************************************************************************************/
+
+class LoopScheduler {
+  public:
+    typedef void (*TaskFunction)();
+
+    struct Stats {
+      uint32_t iterations;
+      uint32_t wakes;             // Reveils par wake() (evenements)
+      uint32_t wakeLatencyMaxUs;  // wake() -> reprise de la loop
+      uint64_t wakeLatencySumUs;
+      uint32_t taskRuns;
+      uint32_t lateMaxUs;         // Retard d'une tache sur son echeance
+      uint64_t lateSumUs;
+      uint64_t sleepUs;           // Temps passe a dormir...
+      uint64_t elapsedUs;         // ...sur ce temps ecoule
+    };
+
+  private:
+    struct Task {
+      const char* name;
+      TaskFunction function;
+      uint32_t periodUs;
+      unsigned long nextUs;
+    };
+
+    static Task _tasks[LOOP_TASKS_MAX];
+    static uint8_t _taskCount;
+    static uint32_t _wakeWithinMs;           // Plus petite echeance signalee pendant l'iteration
+    static volatile unsigned long _wakeRequestUs;  // micros() du premier wake() non servi
+    static volatile bool _wakePending;
+    static unsigned long _lastRunUs;
+    static Stats _stats;
+
+  public:
+    static void begin();  // Dans setup(), depuis la tache Arduino
+    static bool every(const char* name, uint32_t periodMs, TaskFunction function);
+    static void wake();   // Depuis n'importe quelle tache (pas d'ISR)
+    static void wakeWithin(uint32_t ms);  // Dans loop(): ne pas dormir plus de ms
+    static void run();    // Fin de loop(): taches dues, puis sommeil
+
+    static Stats getStats();
+    static void resetStats();
+    static void print();
+};
+
+#endif // LOOPSCHEDULER_H
@@ -0,0 +1,193 @@
+#include "PowerManager.h"
+#include "LoopScheduler.h"
+#include <esp_idf_version.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <driver/uart.h>
+
+PowerManager::Mode PowerManager::_mode = PowerManager::MODE_PERFORMANCE;
+int PowerManager::_error = ESP_OK;
+uint32_t PowerManager::_intervalUs = 0;
+bool PowerManager::_latencyControl = false;
+volatile bool PowerManager::_active = false;
+volatile unsigned long PowerManager::_lastActivityMs = 0;
+unsigned long PowerManager::_lastUpdateUs = 0;
+PowerManager::Stats PowerManager::_stats;
+
+static portMUX_TYPE powerMux = portMUX_INITIALIZER_UNLOCKED;
+static esp_pm_lock_handle_t cpuLock = nullptr;    // CPU a POWER_CPU_MAX_MHZ
+static esp_pm_lock_handle_t sleepLock = nullptr;  // Pas de sommeil leger
+
+// Sortie du mode vers le CPU a fond, premiere note comprise
+static uint32_t wakeUs(PowerManager::Mode mode) {
+  switch (mode) {
+    case PowerManager::MODE_DFS:         return POWER_DFS_WAKE_US;
+    case PowerManager::MODE_LIGHT_SLEEP: return POWER_LIGHT_SLEEP_WAKE_US;
+    default:                             return 0;
+  }
+}
+
+bool PowerManager::configure(Mode mode) {
+#if ESP_IDF_VERSION_MAJOR >= 5
+  esp_pm_config_t config;
+#else
+  esp_pm_config_esp32_t config;
+#endif
+  config.max_freq_mhz = POWER_CPU_MAX_MHZ;
+  config.min_freq_mhz = (mode == MODE_PERFORMANCE) ? POWER_CPU_MAX_MHZ : POWER_CPU_MIN_MHZ;
+  config.light_sleep_enable = (mode == MODE_LIGHT_SLEEP);
+  esp_err_t err = esp_pm_configure(&config);
+  if (err != ESP_OK && mode != MODE_PERFORMANCE) {
+    _error = err;
+    return false;
+  }
+  return true;  // Performance: frequence fixe du core si esp_pm est absent
+}
+
+void PowerManager::begin() {
+  // Mode demande, abaisse jusqu'a tenir dans le budget, puis jusqu'a ce que le core l'accepte
+  Mode mode = (POWER_MODE < MODE_COUNT) ? (Mode)POWER_MODE : MODE_LIGHT_SLEEP;
+  while (mode > MODE_PERFORMANCE && wakeUs(mode) > POWER_LATENCY_BUDGET_US) {
+    mode = (Mode)(mode - 1);
+  }
+  while (!configure(mode)) {
+    Serial.printf("[POWER] Mode %s refuse par esp_pm (%s)\n", modeName(mode), esp_err_to_name(_error));
+    mode = (Mode)(mode - 1);
+  }
+  _mode = mode;
+
+  if (_mode != MODE_PERFORMANCE) {
+    esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "lyre_cpu", &cpuLock);
+    esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "lyre_sleep", &sleepLock);
+  }
+  if (_mode == MODE_LIGHT_SLEEP) {
+    // Commandes serie: reveil sur 3 fronts (le caractere qui reveille est perdu)
+    uart_set_wakeup_threshold(UART_NUM_0, 3);
+    esp_sleep_enable_uart_wakeup(UART_NUM_0);
+  }
+
+  resetStats();
+  Serial.printf("[POWER] Mode %s (budget %lu us, latence ajoutee %lu us)\n", modeName(_mode),
+                (unsigned long)POWER_LATENCY_BUDGET_US, (unsigned long)addedLatencyUs(_mode));
+}
+
+void PowerManager::activity() {
+  _lastActivityMs = millis();
+  if (_active) return;
+
+  portENTER_CRITICAL(&powerMux);
+  bool wasActive = _active;
+  _active = true;
+  if (!wasActive) _stats.activations++;
+  portEXIT_CRITICAL(&powerMux);
+
+  if (!wasActive && _mode != MODE_PERFORMANCE) {
+    esp_pm_lock_acquire(cpuLock);
+    esp_pm_lock_acquire(sleepLock);
+  }
+}
+
+void PowerManager::update() {
+  unsigned long now = micros();
+  unsigned long step = now - _lastUpdateUs;
+  _lastUpdateUs = now;
+
+  portENTER_CRITICAL(&powerMux);
+  _stats.elapsedUs += step;
+  if (_active) _stats.activeUs += step;
+  unsigned long idleMs = millis() - _lastActivityMs;
+  bool release = _active && idleMs >= POWER_ACTIVE_HOLD_MS;
+  if (release) _active = false;
+  bool active = _active;
+  portEXIT_CRITICAL(&powerMux);
+
+  if (release && _mode != MODE_PERFORMANCE) {
+    esp_pm_lock_release(sleepLock);
+    esp_pm_lock_release(cpuLock);
+  }
+  if (active) {
+    LoopScheduler::wakeWithin(POWER_ACTIVE_HOLD_MS - idleMs);
+  }
+}
+
+const char* PowerManager::modeName(Mode mode) {
+  switch (mode) {
+    case MODE_PERFORMANCE: return "performance";
+    case MODE_DFS:         return "frequence variable";
+    case MODE_LIGHT_SLEEP: return "sommeil leger";
+    default:               return "?";
+  }
+}
+
+void PowerManager::setConnection(uint32_t intervalUs, bool latencyControl) {
+  _intervalUs = intervalUs;
+  _latencyControl = latencyControl;
+}
+
+uint16_t PowerManager::idleLatency(Mode mode) {
+  uint32_t wake = wakeUs(mode);
+  if (!_latencyControl || _intervalUs == 0 || wake >= POWER_LATENCY_BUDGET_US) return 0;
+  uint32_t latency = (POWER_LATENCY_BUDGET_US - wake) / _intervalUs;
+  return min(latency, (uint32_t)POWER_IDLE_LATENCY_MAX);
+}
+
+uint32_t PowerManager::addedLatencyUs(Mode mode) {
+  return wakeUs(mode) + idleLatency(mode) * _intervalUs;
+}
+
+uint32_t PowerManager::estimatedMa10(Mode mode) {
+  // Courants en uA: CPU selon l'etat, radio proportionnelle aux evenements de connexion
+  uint32_t intervalUs = _intervalUs ? _intervalUs : 7500;
+  uint32_t idleIntervalUs = intervalUs * (idleLatency(mode) + 1);
+  uint32_t radioActiveUa = POWER_MA_BLE * 1000UL * 7500UL / intervalUs;
+  uint32_t radioIdleUa = POWER_MA_BLE * 1000UL * 7500UL / idleIntervalUs;
+
+  uint32_t cpuIdleUa;
+  if (mode == MODE_PERFORMANCE) {
+    cpuIdleUa = POWER_MA_CPU_MAX * 1000UL;
+  } else if (mode == MODE_DFS) {
+    cpuIdleUa = POWER_MA_CPU_MIN * 1000UL;
+  } else {
+    // Sommeil leger: eveille a POWER_CPU_MIN_MHZ le temps de chaque evenement de connexion
+    uint32_t awakePermille = min(1000UL, POWER_LIGHT_SLEEP_WAKE_US * 1000UL / idleIntervalUs);
+    cpuIdleUa = (POWER_MA_CPU_MIN * awakePermille + POWER_MA_LIGHT_SLEEP * (1000 - awakePermille));
+  }
+
+  Stats s = getStats();
+  uint32_t activePermille = s.elapsedUs ? (uint32_t)(s.activeUs * 1000ULL / s.elapsedUs) : 0;
+  uint64_t ua = (uint64_t)(POWER_MA_CPU_MAX * 1000UL + radioActiveUa) * activePermille +
+                (uint64_t)(cpuIdleUa + radioIdleUa) * (1000 - activePermille);
+  return (uint32_t)(ua / 100000ULL);
+}
+
+PowerManager::Stats PowerManager::getStats() {
+  portENTER_CRITICAL(&powerMux);
+  Stats s = _stats;
+  portEXIT_CRITICAL(&powerMux);
+  return s;
+}
+
+void PowerManager::resetStats() {
+  portENTER_CRITICAL(&powerMux);
+  memset(&_stats, 0, sizeof(_stats));
+  portEXIT_CRITICAL(&powerMux);
+  _lastUpdateUs = micros();
+}
+
+void PowerManager::print() {
+  Stats s = getStats();
+  uint32_t activePermille = s.elapsedUs ? (uint32_t)(s.activeUs * 1000ULL / s.elapsedUs) : 0;
+  Serial.printf("[POWER] Mode %s | en jeu %lu.%lu%% du temps | %lu reprise(s) apres repos\n",
+                modeName(_mode), (unsigned long)(activePermille / 10),
+                (unsigned long)(activePermille % 10), (unsigned long)s.activations);
+  Serial.println("[POWER] Mode                 Courant estime   Latence ajoutee   Latence esclave");
+  for (uint8_t m = 0; m < MODE_COUNT; m++) {
+    Mode mode = (Mode)m;
+    uint32_t ma10 = estimatedMa10(mode);
+    Serial.printf("[POWER] %-20s %7lu.%lu mA %12lu us %17u%s\n", modeName(mode),
+                  (unsigned long)(ma10 / 10), (unsigned long)(ma10 % 10),
+                  (unsigned long)addedLatencyUs(mode), idleLatency(mode),
+                  mode == _mode ? "  <- actif"
+                                : (wakeUs(mode) > POWER_LATENCY_BUDGET_US ? "  (hors budget)" : ""));
+  }
+}
@@ -0,0 +1,81 @@
+#ifndef POWERMANAGER_H
+#define POWERMANAGER_H
+
+#include <Arduino.h>
+#include "settings.h"
+/***********************************************************************************************
+----------------------------    PowerManager.h   -----------------------------------------------
+************************************************************************************************
+Gestion d'energie (esp_pm): entre deux notes, le CPU n'a plus a tourner a 240 MHz. Trois modes
+(POWER_MODE):
+
+- MODE_PERFORMANCE: CPU fixe a POWER_CPU_MAX_MHZ, comme avant.
+- MODE_DFS: frequence variable, POWER_CPU_MIN_MHZ au repos (80 MHz: l'APB, donc l'I2C et
+  l'UART, ne change pas).
+- MODE_LIGHT_SLEEP: en plus, sommeil leger automatique des que toutes les taches attendent
+  (LoopScheduler, pile BLE). Le controleur BLE reveille le CPU a chaque evenement de connexion,
+  la radio dort entre deux (modem sleep); un message MIDI arrive donc toujours par un reveil.
+  L'UART0 reveille aussi le CPU (le premier caractere d'une commande serie est perdu).
+
+Des qu'un message MIDI arrive (activity(), depuis n'importe quelle tache), des verrous esp_pm
+tiennent le CPU a fond et interdisent le sommeil leger pendant POWER_ACTIVE_HOLD_MS: seule la
+premiere note apres un repos paie la latence ajoutee du mode (changement de frequence, sortie
+de sommeil leger). Budget POWER_LATENCY_BUDGET_US: le mode demande est abaisse jusqu'a tenir
+dedans, le reste du budget fixe la latence esclave BLE accordee au repos (idleLatency(): la
+radio saute des evenements de connexion, la premiere note attend jusqu'a autant d'intervalles).
+
+Prerequis de la configuration ESP-IDF du core: CONFIG_PM_ENABLE pour la frequence variable,
+CONFIG_FREERTOS_USE_TICKLESS_IDLE pour le sommeil leger. Sans eux, esp_pm_configure() echoue
+et le mode suivant est essaye (jusqu'a MODE_PERFORMANCE). Avec le quartz principal comme
+horloge basse consommation du controleur BLE (defaut), la pile BLE garde son propre verrou
+tant que la radio est active: le sommeil leger demande un quartz 32 kHz externe.
+
+Rapport print(): part du temps en jeu mesuree, puis pour chaque mode le courant moyen estime
+avec ce meme jeu (valeurs typiques POWER_MA_*, a remplacer par une mesure) et la latence
+ajoutee a la premiere note apres un repos.
+************************************************************************************************/
+
+class PowerManager {
+  public:
+    enum Mode : uint8_t { MODE_PERFORMANCE, MODE_DFS, MODE_LIGHT_SLEEP, MODE_COUNT };
+
+    struct Stats {
+      uint32_t activations;  // Reprises apres un repos (notes payant la latence ajoutee)
+      uint64_t activeUs;     // Temps en jeu (CPU tenu a fond)...
+      uint64_t elapsedUs;    // ...sur ce temps ecoule
+    };
+
+  private:
+    static Mode _mode;
+    static int _error;                  // esp_err_t du dernier esp_pm_configure() refuse
+    static uint32_t _intervalUs;        // Intervalle de connexion BLE (0: inconnu)
+    static bool _latencyControl;        // Latence esclave reglable (BleConnParams)
+    static volatile bool _active;
+    static volatile unsigned long _lastActivityMs;
+    static unsigned long _lastUpdateUs;
+    static Stats _stats;
+
+    static bool configure(Mode mode);
+
+  public:
+    static void begin();     // Dans setup(), avant le demarrage BLE
+    static void activity();  // Message MIDI recu, depuis n'importe quelle tache (pas d'ISR)
+    static void update();    // Dans loop(): retour au repos apres POWER_ACTIVE_HOLD_MS
+
+    static Mode mode() { return _mode; }
+    static bool isActive() { return _active; }
+    static const char* modeName(Mode mode);
+
+    // Connexion BLE: intervalle accorde, et si la latence esclave au repos est reglable
+    static void setConnection(uint32_t intervalUs, bool latencyControl);
+    static uint16_t idleLatency(Mode mode);      // Latence esclave au repos tenant dans le budget
+    static uint16_t idleLatency() { return idleLatency(_mode); }
+    static uint32_t addedLatencyUs(Mode mode);   // Premiere note apres un repos
+    static uint32_t estimatedMa10(Mode mode);    // Courant moyen estime, dixiemes de mA
+
+    static Stats getStats();
+    static void resetStats();
+    static void print();
+};
+
+#endif // POWERMANAGER_H
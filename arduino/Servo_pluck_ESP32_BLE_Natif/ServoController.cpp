@@ -1,48 +1,228 @@
 #include "ServoController.h"
 #include "settings.h"
+#include "DeferredLog.h"
+#include "EventTrace.h"
 
-ServoController::ServoController() {
+#define SERVO_WARM_MAGIC 0x4C595245UL  // "LYRE"
+
+// Broches I2C (recuperation du bus): celles du sketch si definies, sinon celles de la carte
+#if defined(I2C_SDA) && defined(I2C_SCL)
+  #define SERVO_I2C_SDA I2C_SDA
+  #define SERVO_I2C_SCL I2C_SCL
+#elif defined(PIN_SDA) && defined(PIN_SCL)
+  #define SERVO_I2C_SDA PIN_SDA
+  #define SERVO_I2C_SCL PIN_SCL
+#else
+  #define SERVO_I2C_SDA SDA
+  #define SERVO_I2C_SCL SCL
+#endif
+
+// Non initialisee au demarrage: garde son contenu tant que l'ESP32 reste alimente
+RTC_NOINIT_ATTR static ServoWarmState warmState;
+
+static uint32_t servoProfileHash() {
+  uint32_t hash = 2166136261UL;  // FNV-1a
+  for (uint8_t i = 0; i < NUM_SERVOS; i++) {
+    hash = (hash ^ (initialAngles[i] & 0xFF)) * 16777619UL;
+    hash = (hash ^ (initialAngles[i] >> 8)) * 16777619UL;
+  }
+  hash = (hash ^ PLUCK_ANGLE) * 16777619UL;
+  return hash;
+}
+
+static uint32_t msUntil(unsigned long now, unsigned long deadline) {
+  long left = (long)(deadline - now);
+  return left > 0 ? (uint32_t)left : 0;
+}
+
+static uint32_t warmStateChecksum(const ServoWarmState& state) {
+  return state.magic ^ state.profileHash ^ ((uint32_t)state.currentPositions << 8) ^ 0xA5A5A5A5UL;
+}
+
+ServoController::ServoController() : pwm(PCA9685_I2C_ADDRESS) {
+  // Construit pendant l'initialisation statique, avant Wire.begin(): aucun acces materiel ici
+  servosEnabled = false;
+  deviceOnline = false;
+  degraded = false;
+  probeAttempts = 0;
+  probeDelayMs = PCA9685_PROBE_RETRY_MIN_MS;
+  nextProbeTime = 0;
+  i2cErrors = 0;
+  i2cStartUs = 0;
+  i2cDoneUs = 0;
+
+  // Initialiser le bitfield currentPositions (tous les bits a 0)
+  currentPositions = 0;
+  restMask = 0;
+  stagedMask = 0;
+  memset(lastMoveTime, 0, sizeof(lastMoveTime));
+  memset(currentTicks, 0, sizeof(currentTicks));
+  energizedMask = 0;
+
+  // OE reste actif: l'economie d'energie se fait voie par voie (releaseMask)
+  lastTrafficTime = 0;
+  wakeCount = 0;
+
+  // L'initialisation commence avec begin()
+  initState = INIT_IDLE;
+  initServoIndex = 0;
+  initLastTime = 0;
+  warmBoot = false;
+}
+
+void ServoController::begin() {
   // Configurer le pin OE
   pinMode(PIN_SERVO_OE, OUTPUT);
-  enableServos();  // Activer les servos
-
-  pwm = Adafruit_PWMServoDriver();
-  if(pwm.begin() == false){
-    Serial.println("ERREUR CRITIQUE: PCA9685 non detecte sur le bus I2C!");
-    Serial.println("Verifiez les connexions et l'adresse I2C.");
-    while(1) {  // Bloquer l'execution
-      delay(1000);
+  enableServos();  // Activer les servos (OE reste bas ensuite)
+
+  // Transactions bornees: un bus bloque ne doit pas declencher le watchdog
+  Wire.setTimeOut(PCA9685_I2C_TIMEOUT_MS);
+
+  initState = INIT_PROBE;
+  nextProbeTime = millis();
+  update();  // Premier essai immediat
+}
+
+bool ServoController::probe(unsigned long now) {
+  if ((long)(now - nextProbeTime) < 0) {
+    return false;
+  }
+
+  Wire.beginTransmission(PCA9685_I2C_ADDRESS);
+  if (Wire.endTransmission() == 0) {
+    probeAttempts = 0;
+    probeDelayMs = PCA9685_PROBE_RETRY_MIN_MS;
+    return true;
+  }
+
+  // Pas de reponse: un esclave bloque au milieu d'un octet peut tenir SDA a 0
+  probeAttempts++;
+  if (probeAttempts % 4 == 1) {
+    recoverBus();
+  }
+  nextProbeTime = now + probeDelayMs;
+  probeDelayMs = min((uint32_t)probeDelayMs * 2, (uint32_t)PCA9685_PROBE_RETRY_MAX_MS);
+  return false;
+}
+
+// Recuperation du bus (NXP UM10204 3.1.16): si SDA est tenue basse, jusqu'a 9 impulsions SCL
+// pour que l'esclave termine son octet, puis une condition STOP
+void ServoController::recoverBus() {
+  uint32_t clockHz = Wire.getClock();  // Wire.begin() repart a l'horloge par defaut
+  Wire.end();
+  pinMode(SERVO_I2C_SDA, INPUT_PULLUP);
+  if (digitalRead(SERVO_I2C_SDA) == LOW) {
+    pinMode(SERVO_I2C_SCL, OUTPUT_OPEN_DRAIN);
+    for (uint8_t i = 0; i < 9 && digitalRead(SERVO_I2C_SDA) == LOW; i++) {
+      digitalWrite(SERVO_I2C_SCL, LOW);
+      delayMicroseconds(5);
+      digitalWrite(SERVO_I2C_SCL, HIGH);
+      delayMicroseconds(5);
+    }
+    pinMode(SERVO_I2C_SDA, OUTPUT_OPEN_DRAIN);
+    digitalWrite(SERVO_I2C_SDA, LOW);
+    delayMicroseconds(5);
+    digitalWrite(SERVO_I2C_SDA, HIGH);  // STOP: SDA monte pendant que SCL est haute
+    delayMicroseconds(5);
+    if (DEBUG) {
+      Serial.println("[SERVO] Bus I2C bloque: recuperation (impulsions SCL + STOP)");
     }
   }
+  Wire.begin(SERVO_I2C_SDA, SERVO_I2C_SCL);
+  Wire.setClock(clockHz);
+  Wire.setTimeOut(PCA9685_I2C_TIMEOUT_MS);
+}
+
+void ServoController::configureDevice() {
+  pwm.begin();
   pwm.setOscillatorFrequency(PCA9685_OSCILLATOR_FREQ);
   pwm.setPWMFreq(SERVO_FREQUENCY);
+  deviceOnline = true;
+  EventTrace::record(TRACE_DEVICE, 1);
+}
 
-  // Initialiser le bitfield currentPositions (tous les bits a 0)
-  currentPositions = 0;
+void ServoController::onWriteError(uint8_t status) {
+  i2cErrors++;
+  EventTrace::record(TRACE_I2C_ERROR, status);
+  if (deviceOnline) {
+    deviceOnline = false;
+    EventTrace::record(TRACE_DEVICE, 0);
+    probeAttempts = 0;
+    probeDelayMs = PCA9685_PROBE_RETRY_MIN_MS;
+    nextProbeTime = millis() + probeDelayMs;
+    Serial.print("[SERVO] ERREUR: ecriture I2C refusee (code ");
+    Serial.print(status);
+    Serial.println(") - PCA9685 deconnecte, nouvelle detection en cours");
+  }
+}
 
-  // Demarrer l'initialisation non-bloquante
-  initState = INIT_OPENING;
-  initServoIndex = 0;
-  initLastTime = millis();
+void ServoController::pcaWrite(uint8_t channel, uint16_t off) {
+  if (!deviceOnline) {
+    return;  // La valeur reste dans currentTicks et sera reecrite a la reconnexion
+  }
+  i2cStartUs = micros();
+  uint8_t status = pwm.setPWM(channel, 0, off);
+  i2cDoneUs = micros();
+  if (status != 0) {
+    onWriteError(status);
+    return;
+  }
+  EventTrace::record(TRACE_SERVO_WRITE, channel, off);
+}
+
+bool ServoController::restoreWarmState() {
+  if (!SERVO_WARM_BOOT) {
+    return false;
+  }
+  // Mise sous tension ou chute d'alimentation: memoire RTC et positions non fiables
+  esp_reset_reason_t reason = esp_reset_reason();
+  if (reason == ESP_RST_POWERON || reason == ESP_RST_BROWNOUT || reason == ESP_RST_UNKNOWN) {
+    return false;
+  }
+  if (warmState.magic != SERVO_WARM_MAGIC ||
+      warmState.profileHash != servoProfileHash() ||
+      warmState.checksum != warmStateChecksum(warmState)) {
+    return false;
+  }
+  currentPositions = warmState.currentPositions;
+  return true;
+}
+
+void ServoController::saveWarmState() {
+  warmState.magic = SERVO_WARM_MAGIC;
+  warmState.profileHash = servoProfileHash();
+  warmState.currentPositions = currentPositions;
+  warmState.reserved = 0;
+  warmState.checksum = warmStateChecksum(warmState);
+}
+
+void ServoController::finishInit() {
+  restMask = 0xFFFF;
+  initState = INIT_COMPLETE;
+  saveWarmState();
 
-  // Initialiser le timeout de desactivation
-  lastActivityTime = millis();
-  servosEnabled = true;
+  // Temps jusqu'a la premiere note possible, depuis le demarrage de l'ESP32
+  Serial.print("[SERVO] Pret a jouer en ");
+  Serial.print(millis());
+  Serial.println(warmBoot ? " ms (demarrage a chaud, balayage saute)" : " ms (balayage complet)");
 }
 
 void ServoController::setServoAngle(uint8_t servoNum, uint16_t angle) {
   if (servoNum >= NUM_SERVOS) {
-    if (DEBUG) {
-      Serial.print("[SERVO] ERREUR: index servo invalide: ");
-      Serial.println(servoNum);
-    }
+    DeferredLog::log(LOG_SERVO_BAD_INDEX, servoNum);
     return;
   }
 
+  currentTicks[servoNum] = angleToTick(angle);
+  pcaWrite(servoNum, currentTicks[servoNum]);  // Efface aussi le bit full-OFF
+  energizedMask |= (1 << servoNum);
+  lastMoveTime[servoNum] = millis();
+}
+
+uint16_t ServoController::angleToTick(uint16_t angle) {
   // Adaptation de l'angle en plage de pulsations pour Adafruit_ServoDriver
   uint16_t pulsation = map(angle, SERVO_MIN_ANGLE, SERVO_MAX_ANGLE, SERVO_PULSE_MIN, SERVO_PULSE_MAX);
-  int analog_value = int(float(pulsation) / 1000000 * SERVO_FREQUENCY * 4096);
-  pwm.setPWM(servoNum, 0, analog_value);
+  return int(float(pulsation) / 1000000 * SERVO_FREQUENCY * 4096);
 }
 
 void ServoController::update() {
@@ -50,16 +230,52 @@ void ServoController::update() {
   unsigned long currentTime = millis();
 
   switch (initState) {
-    case INIT_OPENING:
-      // Deplacer le servo actuel en position d'ouverture
-      if (initServoIndex % 2 == 0) {
-        setServoAngle(initServoIndex, initialAngles[initServoIndex] + PLUCK_ANGLE);
+    case INIT_PROBE:
+      // Detection non-bloquante: un essai par echeance, le reste de loop() (BLE/WiFi) continue
+      if (!probe(currentTime)) {
+        if (probeAttempts >= PCA9685_PROBE_ATTEMPTS) {
+          // Mode degrade: les notes sont acceptees (et signalees en erreur), la detection
+          // continue en arriere-plan au rythme de PCA9685_PROBE_RETRY_MAX_MS
+          degraded = true;
+          initState = INIT_COMPLETE;
+          EventTrace::record(TRACE_DEVICE, 2);
+          Serial.print("[SERVO] ERREUR: PCA9685 absent a l'adresse 0x");
+          Serial.print(PCA9685_I2C_ADDRESS, HEX);
+          Serial.print(" apres ");
+          Serial.print(probeAttempts);
+          Serial.println(" essais - mode degrade, verifiez le cablage I2C");
+        }
+        break;
+      }
+      configureDevice();
+      if (restoreWarmState()) {
+        // Le PCA9685 n'a pas ete remis a zero: une ecriture groupee ramene toutes les cordes au
+        // repos et l'instrument est pret immediatement. Les voies seront liberees par le delai
+        // d'inactivite, une fois le retour au repos termine.
+        warmBoot = true;
+        muteMask((uint16_t)((1UL << NUM_SERVOS) - 1));
+        finishInit();
       } else {
-        setServoAngle(initServoIndex, initialAngles[initServoIndex] - PLUCK_ANGLE);
+        warmState.magic = 0;  // Un reset pendant le balayage doit le relancer
+        initServoIndex = 0;
+        initLastTime = currentTime;
+        initState = INIT_OPENING;
+      }
+      break;
+
+    case INIT_OPENING:
+      // Deplacer le groupe actuel en position d'ouverture
+      for (uint8_t i = initServoIndex; i < initServoIndex + SERVO_INIT_GROUP_SIZE && i < NUM_SERVOS; i++) {
+        if (i % 2 == 0) {
+          setServoAngle(i, initialAngles[i] + PLUCK_ANGLE);
+        } else {
+          setServoAngle(i, initialAngles[i] - PLUCK_ANGLE);
+        }
       }
       if (DEBUG) {
-        Serial.print("[SERVO] Initialisation servo #");
+        Serial.print("[SERVO] Initialisation servos #");
         Serial.print(initServoIndex);
+        Serial.print("+");
         Serial.println(" - position ouverture");
       }
       initLastTime = currentTime;
@@ -67,9 +283,9 @@ void ServoController::update() {
       break;
 
     case INIT_WAIT_OPENING:
-      // Attendre que le servo se deplace
+      // Attendre que le groupe se deplace
       if (currentTime - initLastTime >= SERVO_INIT_DELAY_MS) {
-        initServoIndex++;
+        initServoIndex += SERVO_INIT_GROUP_SIZE;
         if (initServoIndex >= NUM_SERVOS) {
           // Tous les servos sont en position d'ouverture, passer a la fermeture
           initServoIndex = 0;
@@ -81,28 +297,30 @@ void ServoController::update() {
       break;
 
     case INIT_CLOSING:
-      // Remettre le servo en position de repos
-      setServoAngle(initServoIndex, initialAngles[initServoIndex]);
+      // Remettre le groupe en position de repos
+      for (uint8_t i = initServoIndex; i < initServoIndex + SERVO_INIT_GROUP_SIZE && i < NUM_SERVOS; i++) {
+        setServoAngle(i, initialAngles[i]);
+      }
       if (DEBUG) {
-        Serial.print("[SERVO] Servo #");
+        Serial.print("[SERVO] Servos #");
         Serial.print(initServoIndex);
-        Serial.println(" - position repos");
+        Serial.println("+ - position repos");
       }
       initLastTime = currentTime;
       initState = INIT_WAIT_CLOSING;
       break;
 
     case INIT_WAIT_CLOSING:
-      // Attendre que le servo se deplace
+      // Attendre que le groupe se deplace
       if (currentTime - initLastTime >= SERVO_RESET_DELAY_MS) {
-        initServoIndex++;
+        initServoIndex += SERVO_INIT_GROUP_SIZE;
         if (initServoIndex >= NUM_SERVOS) {
-          // Initialisation complete - desactiver les servos pour economiser l'energie
-          disableServos();
-          initState = INIT_COMPLETE;
+          // Initialisation complete - liberer toutes les voies pour economiser l'energie
+          releaseMask(energizedMask);
+          finishInit();
           if (DEBUG) {
             Serial.println("[SERVO] Tous les servos sont initialises");
-            Serial.println("[SERVO] Servos desactives (economie d'energie)");
+            Serial.println("[SERVO] Voies liberees (economie d'energie)");
           }
         } else {
           initState = INIT_CLOSING;
@@ -111,15 +329,39 @@ void ServoController::update() {
       break;
 
     case INIT_IDLE:
-    case INIT_COMPLETE:
-      // Gerer la desactivation automatique apres timeout
-      if (servosEnabled && (currentTime - lastActivityTime >= SERVO_AUTO_DISABLE_TIMEOUT_MS)) {
-        disableServos();  // servosEnabled est deja mis a false dans disableServos()
-        if (DEBUG) {
-          Serial.println("[SERVO] Timeout - servos desactives");
+      break;
+
+    case INIT_COMPLETE: {
+      if (!deviceOnline) {
+        // PCA9685 absent au demarrage ou perdu en cours de jeu: on le cherche sans bloquer
+        if (probe(currentTime)) {
+          configureDevice();
+          degraded = false;
+          restMask = 0;  // Positions inconnues: toutes les voies sont reecrites au repos
+          muteMask((uint16_t)((1UL << NUM_SERVOS) - 1));
+          Serial.println("[SERVO] PCA9685 detecte - cordes remises au repos");
+        }
+        break;
+      }
+      // Chaque voie est liberee apres son propre temps d'inactivite. Tant que des notes
+      // arrivent, les cordes jouees recemment restent alimentees plus longtemps: elles ont
+      // toutes les chances d'etre rejouees et n'auront pas a etre reveillees.
+      if (energizedMask == 0) break;
+      bool traffic = (currentTime - lastTrafficTime < SERVO_TRAFFIC_WINDOW_MS);
+      unsigned long timeout = traffic ? SERVO_TRAFFIC_HOLD_MS : SERVO_AUTO_DISABLE_TIMEOUT_MS;
+      uint16_t idle = 0;
+      for (uint8_t i = 0; i < NUM_SERVOS; i++) {
+        if ((energizedMask & (1 << i)) && (stagedMask & (1 << i)) == 0 &&
+            currentTime - lastMoveTime[i] >= timeout) {
+          idle |= (1 << i);
         }
       }
+      if (idle) {
+        releaseMask(idle);
+        DeferredLog::log(LOG_SERVO_RELEASED, idle);
+      }
       break;
+    }
   }
 }
 
@@ -127,68 +369,283 @@ bool ServoController::isInitComplete() {
   return (initState == INIT_COMPLETE);
 }
 
+// Echeances de update(): la boucle principale peut dormir jusque-la (LoopScheduler)
+uint32_t ServoController::msUntilUpdate() {
+  unsigned long now = millis();
+  switch (initState) {
+    case INIT_IDLE:
+      return UINT32_MAX;
+    case INIT_PROBE:
+      return msUntil(now, nextProbeTime);
+    case INIT_WAIT_OPENING:
+      return msUntil(now, initLastTime + SERVO_INIT_DELAY_MS);
+    case INIT_WAIT_CLOSING:
+      return msUntil(now, initLastTime + SERVO_RESET_DELAY_MS);
+    case INIT_COMPLETE:
+      break;
+    default:
+      return 0;  // Groupe a deplacer tout de suite
+  }
+
+  if (!deviceOnline) {
+    return msUntil(now, nextProbeTime);
+  }
+  if (energizedMask == 0) {
+    return UINT32_MAX;
+  }
+  // Liberation des voies: meme calcul que update(), plus la fin de la fenetre de trafic qui
+  // raccourcit le delai d'inactivite
+  bool traffic = (now - lastTrafficTime < SERVO_TRAFFIC_WINDOW_MS);
+  unsigned long timeout = traffic ? SERVO_TRAFFIC_HOLD_MS : SERVO_AUTO_DISABLE_TIMEOUT_MS;
+  uint32_t wait = traffic ? msUntil(now, lastTrafficTime + SERVO_TRAFFIC_WINDOW_MS) : UINT32_MAX;
+  for (uint8_t i = 0; i < NUM_SERVOS; i++) {
+    if ((energizedMask & (1 << i)) && (stagedMask & (1 << i)) == 0) {
+      wait = min(wait, msUntil(now, lastMoveTime[i] + timeout));
+    }
+  }
+  return wait;
+}
+
 void ServoController::resetServosPosition() {
   // Methode legacy - plus utilisee avec le systeme non-bloquant
 }
 
 void ServoController::mute(uint8_t servoNum) {
   if (servoNum >= NUM_SERVOS) {
-    if (DEBUG) {
-      Serial.print("[SERVO] ERREUR: index servo invalide: ");
-      Serial.println(servoNum);
-    }
+    DeferredLog::log(LOG_SERVO_BAD_INDEX, servoNum);
     return;
   }
 
-  enableServos();  // Activer avant de bouger (reinitialise aussi le timeout)
+  uint16_t bit = 1 << servoNum;
+  if ((restMask & bit) && !(energizedMask & bit)) {
+    return;  // Deja contre la corde et voie liberee: inutile de la reveiller
+  }
+
+  enableServos();  // Activer avant de bouger
   setServoAngle(servoNum, initialAngles[servoNum]);
+  restMask |= (1 << servoNum);
+  stagedMask &= ~(1 << servoNum);
+}
+
+// Etouffement groupe (relachement de pedale): les registres LEDn des voies first..last sont
+// contigus, une seule ecriture en auto-increment suffit. Les voies intermediaires qui ne sont
+// pas dans le masque sont reecrites avec leur valeur actuelle et ne bougent pas.
+void ServoController::muteMask(uint16_t mask) {
+  mask &= ~(restMask & ~energizedMask);  // Cordes deja au repos sur une voie liberee
+  if (mask == 0) {
+    return;
+  }
+
+  uint8_t first = 0;
+  while (!(mask & (1 << first))) {
+    first++;
+  }
+  uint8_t last = NUM_SERVOS - 1;
+  while (!(mask & (1 << last))) {
+    last--;
+  }
+
+  enableServos();
+  unsigned long now = millis();
+  for (uint8_t i = first; i <= last; i++) {
+    if (mask & (1 << i)) {
+      currentTicks[i] = restTick(i);
+      lastMoveTime[i] = now;
+    }
+  }
+  energizedMask |= mask;
+  writeChannels(first, last);
+
+  restMask |= mask;
+  stagedMask &= ~mask;
+  DeferredLog::log(LOG_SERVO_MUTE_GROUP, first, last);
+}
+
+// Ecrit les voies first..last en une transaction (registres LEDn consecutifs, auto-increment).
+// Les voies liberees gardent leur bit full-OFF.
+void ServoController::writeChannels(uint8_t first, uint8_t last) {
+  if (!deviceOnline) {
+    return;
+  }
+  i2cStartUs = micros();
+  Wire.beginTransmission(PCA9685_I2C_ADDRESS);
+  Wire.write(PCA9685_LED0_ON_L + 4 * first);
+  for (uint8_t i = first; i <= last; i++) {
+    bool energized = energizedMask & (1 << i);
+    Wire.write(0);  // ON_L
+    Wire.write(0);  // ON_H
+    Wire.write(energized ? (currentTicks[i] & 0xFF) : 0);
+    Wire.write(energized ? (currentTicks[i] >> 8) : 0x10);  // OFF_H bit 4 = full-OFF
+  }
+  uint8_t status = Wire.endTransmission();
+  i2cDoneUs = micros();
+  if (status != 0) {
+    onWriteError(status);
+    return;
+  }
+  EventTrace::record(TRACE_GROUP_WRITE, first | (last << 4), energizedMask);
+}
+
+// Le servo cesse d'etre asservi (plus de courant de maintien ni de bourdonnement). La
+// position est conservee dans currentTicks et retrouvee a la prochaine ecriture.
+void ServoController::releaseMask(uint16_t mask) {
+  mask &= energizedMask;
+  if (mask == 0) {
+    return;
+  }
+
+  uint8_t first = 0;
+  while (!(mask & (1 << first))) {
+    first++;
+  }
+  uint8_t last = NUM_SERVOS - 1;
+  while (!(mask & (1 << last))) {
+    last--;
+  }
+
+  energizedMask &= ~mask;
+  EventTrace::record(TRACE_POWER, TRACE_POWER_RELEASE, mask);
+  if (first == last) {
+    pcaWrite(first, 4096);  // OFF = 4096: bit full-OFF seul
+  } else {
+    writeChannels(first, last);
+  }
+}
+
+void ServoController::arm(uint8_t servoNum) {
+  if (servoNum >= NUM_SERVOS || (energizedMask & (1 << servoNum))) {
+    return;
+  }
+  enableServos();
+  energizedMask |= (1 << servoNum);
+  EventTrace::record(TRACE_POWER, TRACE_POWER_WAKE, 1 << servoNum);
+  lastMoveTime[servoNum] = millis();  // Le delai d'inactivite repart de l'armement
+  pcaWrite(servoNum, currentTicks[servoNum]);
+}
+
+// Panique: les 16 voies sont reecrites d'un bloc, sans tenir compte de l'etat courant.
+// Pendant l'initialisation la sequence d'ouverture/fermeture est abandonnee.
+void ServoController::panic() {
+  initState = INIT_COMPLETE;
+  restMask = 0;  // Tout reecrire, meme les voies liberees dont la position n'est pas garantie
+  muteMask((uint16_t)((1UL << NUM_SERVOS) - 1));
 }
 
 void ServoController::enableServos() {
   if (!servosEnabled) {
     digitalWrite(PIN_SERVO_OE, LOW);  // OE actif bas
     servosEnabled = true;
-    if (DEBUG) {
-      Serial.println("[SERVO] Servos actives");
-    }
+    EventTrace::record(TRACE_POWER, TRACE_POWER_OE_ON);
+    DeferredLog::log(LOG_SERVO_ENABLED);
   }
-  lastActivityTime = millis();  // Reinitialiser le timeout
 }
 
 void ServoController::disableServos() {
   digitalWrite(PIN_SERVO_OE, HIGH);  // OE inactif haut
   servosEnabled = false;
+  EventTrace::record(TRACE_POWER, TRACE_POWER_OE_OFF);
+}
+
+// Ecriture directe d'une valeur PCA9685 deja calculee (partitions compilees)
+void ServoController::writeTick(uint8_t servoNum, uint16_t tick) {
+  if (servoNum >= NUM_SERVOS) {
+    return;
+  }
+
+  enableServos();
+  if (!(energizedMask & (1 << servoNum))) {
+    wakeCount++;
+    EventTrace::record(TRACE_POWER, TRACE_POWER_WAKE, 1 << servoNum);
+  }
+  currentTicks[servoNum] = tick;
+  pcaWrite(servoNum, tick);
+  energizedMask |= (1 << servoNum);
+  lastMoveTime[servoNum] = millis();
+  lastTrafficTime = lastMoveTime[servoNum];
+
+  stagedMask &= ~(1 << servoNum);
+  if (tick == restTick(servoNum)) {
+    restMask |= (1 << servoNum);
+  } else {
+    restMask &= ~(1 << servoNum);
+  }
+}
+
+uint16_t ServoController::restTick(uint8_t servoNum) {
+  return angleToTick(initialAngles[servoNum]);
+}
+
+int8_t ServoController::nextPluckDirection(uint8_t servoNum) {
+  // Meme calcul que pluck(): alternance par servo, pairs/impairs en sens opposes
+  int8_t direction = ((currentPositions >> servoNum) & 1) ? 1 : -1;
+  if ((servoNum % 2) != 0) {
+    direction = -direction;
+  }
+  return direction;
+}
+
+bool ServoController::prestage(uint8_t servoNum, int8_t direction) {
+  if (servoNum >= NUM_SERVOS || !(restMask & (1 << servoNum))) {
+    return false;
+  }
+
+  // Budget d'alimentation: chaque servo pre-positionne tire du courant en tendant la corde
+  uint8_t staged = 0;
+  for (uint16_t mask = stagedMask; mask; mask &= mask - 1) {
+    staged++;
+  }
+  if (staged >= LOOKAHEAD_MAX_STAGED) {
+    return false;
+  }
+
+  enableServos();
+  setServoAngle(servoNum, initialAngles[servoNum] + (direction * LOOKAHEAD_PRESTAGE_ANGLE));
+  restMask &= ~(1 << servoNum);
+  stagedMask |= (1 << servoNum);
+  return true;
+}
+
+uint32_t ServoController::pluckLatencyUs(uint8_t servoNum) {
+  uint16_t bit = 1 << servoNum;
+  uint32_t degrees;
+  if (stagedMask & bit) {
+    degrees = PLUCK_RELEASE_ANGLE - LOOKAHEAD_PRESTAGE_ANGLE;  // Derniers degres seulement
+  } else if (restMask & bit) {
+    degrees = PLUCK_RELEASE_ANGLE;
+  } else {
+    degrees = PLUCK_ANGLE + PLUCK_RELEASE_ANGLE;  // Retour depuis l'autre cote de la corde
+  }
+  return degrees * SERVO_US_PER_DEGREE;
 }
 
 //gratte la corde
 void ServoController::pluck(uint8_t servoNum) {
   if (servoNum >= NUM_SERVOS) {
-    if (DEBUG) {
-      Serial.print("[SERVO] ERREUR: index servo invalide: ");
-      Serial.println(servoNum);
-    }
+    DeferredLog::log(LOG_SERVO_BAD_INDEX, servoNum);
     return;
   }
 
   // Activer les servos avant de jouer
   enableServos();
+  if (!(energizedMask & (1 << servoNum))) {
+    wakeCount++;  // Voie liberee: realimentee par l'ecriture ci-dessous
+    EventTrace::record(TRACE_POWER, TRACE_POWER_WAKE, 1 << servoNum);
+  }
+  lastTrafficTime = millis();
 
   // Calcul simplifie de la direction de grattage
   // Position alterne entre 0 et 1, servos pairs/impairs ont des sens opposes
-  uint8_t position = (currentPositions >> servoNum) & 1;  // Extraire le bit correspondant
-  int8_t direction = (position == 1) ? 1 : -1;
-  if ((servoNum % 2) != 0) {
-    direction = -direction;  // Inverser pour les servos impairs
-  }
+  // Si le servo a ete pre-positionne, seuls les derniers degres restent a parcourir
+  int8_t direction = nextPluckDirection(servoNum);
 
   setServoAngle(servoNum, initialAngles[servoNum] + (direction * PLUCK_ANGLE));
+  restMask &= ~(1 << servoNum);
+  stagedMask &= ~(1 << servoNum);
 
   // Toggle la position (0 <-> 1) avec XOR
   currentPositions ^= (1 << servoNum);
-  if (DEBUG) {
-    Serial.print("[SERVO] Pluck servo #");
-    Serial.print(servoNum);
-    Serial.print(" - position: ");
-    Serial.println((currentPositions >> servoNum) & 1);
-  } 
+  if (initState == INIT_COMPLETE) {
+    saveWarmState();  // Quelques ecritures en RAM RTC: le sens d'alternance survit au reset
+  }
+  DeferredLog::log(LOG_SERVO_PLUCK, servoNum, (currentPositions >> servoNum) & 1);
 }
\ No newline at end of file
@@ -2,31 +2,93 @@
 #define SERVOCONTROLLER_H
 #include <Wire.h>
 #include <Adafruit_PWMServoDriver.h>
+#include <esp_attr.h>
+#include <esp_system.h>
 #include "settings.h"
 
+// Etat conserve en memoire RTC a travers un reset logiciel ou watchdog (pas a la mise sous
+// tension): permet de sauter le balayage d'initialisation au redemarrage a chaud
+struct ServoWarmState {
+  uint32_t magic;
+  uint32_t profileHash;     // Angles et mapping: un autre profil force le balayage
+  uint16_t currentPositions;
+  uint16_t reserved;
+  uint32_t checksum;
+};
+
 class ServoController {
 private:
   Adafruit_PWMServoDriver pwm;
   uint16_t currentPositions;  // Bitfield pour stocker les positions (bit 0/1 pour chaque servo) - Economie: 30 bytes
+  uint16_t restMask;    // Bit a 1: servo au repos contre la corde
+  uint16_t stagedMask;  // Bit a 1: servo pre-positionne (anticipation), grattage pas encore tire
+  unsigned long lastMoveTime[NUM_SERVOS];  // millis() de la derniere commande de chaque servo
+  uint16_t currentTicks[NUM_SERVOS];  // Derniere valeur OFF ecrite par voie (reecrite telle quelle par muteMask)
+  uint16_t energizedMask;  // Bit a 0: voie liberee par le bit full-OFF (servo sans impulsions)
+  void writeChannels(uint8_t first, uint8_t last);  // Ecriture groupee des voies first..last
+  void pcaWrite(uint8_t channel, uint16_t off);  // setPWM, ignore si le PCA9685 est absent
+  uint16_t angleToTick(uint16_t angle);
   void setServoAngle(uint8_t servoNum, uint16_t angle);
   void resetServosPosition();  // Utilise au demarrage pour deplacer les servos en position init
 
   // Variables pour l'initialisation non-bloquante
-  enum InitState { INIT_IDLE, INIT_OPENING, INIT_WAIT_OPENING, INIT_CLOSING, INIT_WAIT_CLOSING, INIT_COMPLETE };
+  enum InitState { INIT_IDLE, INIT_PROBE, INIT_OPENING, INIT_WAIT_OPENING, INIT_CLOSING, INIT_WAIT_CLOSING, INIT_COMPLETE };
   InitState initState;
-  uint8_t initServoIndex;
+  uint8_t initServoIndex;  // Premier servo du groupe en cours
   unsigned long initLastTime;
+  bool warmBoot;  // Balayage saute (etat restaure depuis la memoire RTC)
+  void finishInit();
+  bool restoreWarmState();
+  void saveWarmState();
 
-  // Variables pour la desactivation automatique
-  unsigned long lastActivityTime;
-  bool servosEnabled;
+  // Detection du PCA9685: essais espaces (backoff), recuperation du bus, mode degrade
+  bool deviceOnline;  // false: PCA9685 absent ou muet, les ecritures sont ignorees
+  bool degraded;      // Initialisation abandonnee faute de PCA9685 (MIDI toujours accepte)
+  uint8_t probeAttempts;
+  uint16_t probeDelayMs;
+  unsigned long nextProbeTime;
+  uint32_t i2cErrors;
+  unsigned long i2cStartUs;  // Debut et fin de la derniere ecriture PCA9685 (mesure de latence)
+  unsigned long i2cDoneUs;
+  bool probe(unsigned long now);  // Un essai si l'echeance est passee, true si le PCA9685 repond
+  void configureDevice();
+  void recoverBus();
+  void onWriteError(uint8_t status);
+
+  // Liberation des voies inactives (voie par voie) et prediction de trafic
+  unsigned long lastTrafficTime;  // millis() du dernier grattage, toutes cordes confondues
+  uint32_t wakeCount;  // Grattages sur une voie liberee (servo a reveiller)
+  bool servosEnabled;  // Broche OE (toutes les voies)
 
 public:
-  ServoController();  // Initialise tous les servomoteurs et le tableau
+  ServoController();  // N'accede pas au materiel (construit avant setup())
+  void begin();  // A appeler dans setup() apres Wire.begin(): lance la detection du PCA9685
   void update();  // A appeler dans loop() pour gerer l'initialisation non-bloquante
-  bool isInitComplete();  // Retourne true quand l'initialisation est terminee
+  bool isInitComplete();  // Retourne true quand l'initialisation est terminee (ou abandonnee)
+  uint32_t msUntilUpdate();  // Delai avant que update() ait a agir (UINT32_MAX: rien de prevu)
+  bool isOnline() { return deviceOnline; }
+  bool isDegraded() { return degraded; }
+  uint32_t getI2CErrorCount() { return i2cErrors; }
+  unsigned long getI2CStartUs() { return i2cStartUs; }
+  unsigned long getI2CDoneUs() { return i2cDoneUs; }
+  bool isWarmBoot() { return warmBoot; }
   void mute(uint8_t servoNum);  // Met le servo a l'angle d'initialisation contre la corde
+  void muteMask(uint16_t mask);  // Idem pour plusieurs servos en une seule transaction I2C
+  void panic();  // Toutes les cordes au repos en une seule transaction I2C (All Notes Off)
+  void releaseMask(uint16_t mask);  // Coupe les impulsions de ces voies (bit full-OFF)
+  void arm(uint8_t servoNum);  // Realimente une voie liberee avant un grattage prevu
+  uint16_t getEnergizedMask() { return energizedMask; }
+  uint32_t getWakeCount() { return wakeCount; }
   void pluck(uint8_t servoNum);  // Actionne le servo pour gratter la corde
+  void writeTick(uint8_t servoNum, uint16_t tick);  // Ecrit une valeur PCA9685 precalculee (0-4095)
+
+  // Anticipation: amene le servo juste avant le point d'echappement de la corde
+  bool prestage(uint8_t servoNum, int8_t direction);  // false si budget atteint ou servo pas au repos
+  int8_t nextPluckDirection(uint8_t servoNum);  // Sens du prochain pluck() (+1 / -1)
+  uint32_t pluckLatencyUs(uint8_t servoNum);  // Delai commande -> corde lachee (modele SERVO_US_PER_DEGREE)
+  uint16_t restTick(uint8_t servoNum);  // Valeur PCA9685 de la position de repos
+  unsigned long getLastMoveTime(uint8_t servoNum) { return lastMoveTime[servoNum]; }
+  bool isAtRest(uint8_t servoNum) { return restMask & (1 << servoNum); }
   void enableServos();  // Active les servos (OE = LOW)
   void disableServos();  // Desactive les servos (OE = HIGH)
 };
@@ -8,6 +8,7 @@ AVANTAGES:
 - Aucune bibliothèque externe requise (seulement BLE natif ESP32)
 - Plus stable et contrôlable
 - Compatible avec toutes les apps MIDI BLE
+- Économie d'énergie au repos (fréquence variable, sommeil léger entre les événements BLE)
 
 MATERIEL REQUIS:
 - ESP32 (WROOM-32D ou autre)
@@ -25,7 +26,11 @@ BIBLIOTHEQUES REQUISES:
 #include <BLEServer.h>
 #include <BLEUtils.h>
 #include <BLE2902.h>
-#include "Instrument.h"
+#include "instrument.h"
+#include "DeferredLog.h"
+#include "EventTrace.h"
+#include "LoopScheduler.h"
+#include "PowerManager.h"
 #include "settings.h"
 
 // UUIDs pour BLE MIDI (standard Apple MIDI)
@@ -37,13 +42,15 @@ BLEServer* pServer = NULL;
 BLECharacteristic* pCharacteristic = NULL;
 bool deviceConnected = false;
 bool oldDeviceConnected = false;
+unsigned long disconnectTime = 0;
+bool advertisingPending = false;  // Advertising à relancer après une déconnexion
+volatile bool disconnectPending = false;  // Posé par la tâche BLE, traité par loop()
 
 // Instrument
 Instrument instrument;
 
 // LED d'état
 #define PIN_LED 2
-unsigned long lastLedToggle = 0;
 bool ledState = false;
 
 /***********************************************************************************************
@@ -55,12 +62,15 @@ class MyServerCallbacks: public BLEServerCallbacks {
       deviceConnected = true;
       Serial.println("[BLE] ✓ Connexion établie");
       digitalWrite(PIN_LED, HIGH);
+      LoopScheduler::wake();
     };
 
     void onDisconnect(BLEServer* pServer) {
       deviceConnected = false;
       Serial.println("[BLE] ✗ Déconnexion");
       digitalWrite(PIN_LED, LOW);
+      disconnectPending = true;  // Panique dans loop(), pas en concurrence avec update()
+      LoopScheduler::wake();
     }
 };
 
@@ -82,10 +92,8 @@ void processMIDIMessage(uint8_t* data, size_t length) {
         uint8_t note = data[3];
         uint8_t velocity = data[4];
 
-        if (DEBUG) {
-          Serial.printf("[MIDI IN] Note On: %d (vel: %d) canal: %d\n",
-                        note, velocity, channel + 1);
-        }
+        DeferredLog::log(LOG_MIDI_IN_NOTE_ON, note, velocity, channel + 1);
+        EventTrace::record(TRACE_MIDI_NOTE_ON, note, velocity);
 
         if (velocity > 0) {
           instrument.noteOn(note, velocity);
@@ -99,10 +107,8 @@ void processMIDIMessage(uint8_t* data, size_t length) {
       if (length >= 4) {
         uint8_t note = data[3];
 
-        if (DEBUG) {
-          Serial.printf("[MIDI IN] Note Off: %d canal: %d\n",
-                        note, channel + 1);
-        }
+        DeferredLog::log(LOG_MIDI_IN_NOTE_OFF, note, channel + 1);
+        EventTrace::record(TRACE_MIDI_NOTE_OFF, note);
 
         instrument.noteOff(note);
       }
@@ -113,16 +119,26 @@ void processMIDIMessage(uint8_t* data, size_t length) {
         uint8_t controller = data[3];
         uint8_t value = data[4];
 
-        if (DEBUG) {
-          Serial.printf("[MIDI IN] CC: %d = %d\n", controller, value);
+        DeferredLog::log(LOG_MIDI_IN_CC, controller, value);
+        EventTrace::record(TRACE_MIDI_CC, controller, value);
+
+        // Sustain / sostenuto: mutes differes jusqu'au relachement de la pedale
+        if (controller == 64) {
+          instrument.setSustain(value >= 64);
+        }
+        if (controller == 66) {
+          instrument.setSostenuto(value >= 64);
+        }
+
+        // Legato: mode pluck-through
+        if (controller == 68) {
+          instrument.setPluckThrough(value >= 64);
         }
 
-        // All Notes Off
-        if (controller == 123) {
+        // All Sound Off / Reset All Controllers / All Notes Off: panique
+        if (controller == 120 || controller == 121 || controller == 123) {
           Serial.println("[MIDI] All Notes Off");
-          for (int i = MIDI_NOTE_MIN; i <= MIDI_NOTE_MAX; i++) {
-            instrument.noteOff(i);
-          }
+          instrument.panic();
         }
       }
       break;
@@ -136,7 +152,9 @@ class MyCallbacks: public BLECharacteristicCallbacks {
       size_t length = pCharacteristic->getValue().length();
 
       if (length > 0) {
+        PowerManager::activity();  // CPU à fond avant de jouer la note
         processMIDIMessage(data, length);
+        LoopScheduler::wake();  // Échéances de l'instrument (étouffements, libération des voies)
       }
     }
 };
@@ -147,6 +165,9 @@ SETUP
 
 void setup() {
   Serial.begin(SERIAL_BAUD_RATE);
+  DeferredLog::begin();  // Avant tout message differe (servos, MIDI)
+  EventTrace::begin();   // Trace d'avant un reset logiciel conservee
+  LoopScheduler::begin();
   delay(1000);
 
   Serial.println("\n========================================");
@@ -167,6 +188,12 @@ void setup() {
     Serial.println("[I2C] Pins par défaut: SDA=21, SCL=22");
   #endif
 
+  // Détection du PCA9685: non-bloquante, se poursuit dans loop() pendant que le BLE démarre
+  instrument.begin();
+
+  // Fréquence variable / sommeil léger, avant le démarrage de la pile BLE
+  PowerManager::begin();
+
   // Initialiser BLE
   Serial.println("[BLE] Initialisation...");
   BLEDevice::init(BLE_DEVICE_NAME);
@@ -208,45 +235,74 @@ void setup() {
   if (!DEBUG) {
     Serial.println("Pour activer le debug, définir DEBUG=1 dans settings.h\n");
   }
+
+  // Tâches périodiques: la loop dort entre deux échéances ou jusqu'à un message BLE
+  LoopScheduler::every("led", 500, blinkLed);
+  LoopScheduler::every("etat", 30000, periodicStatus);
 }
 
 /***********************************************************************************************
 LOOP
 ************************************************************************************************/
 
+// LED clignotante si non connecté
+void blinkLed() {
+  if (!deviceConnected) {
+    ledState = !ledState;
+    digitalWrite(PIN_LED, ledState);
+  }
+}
+
+// Message périodique si non connecté
+void periodicStatus() {
+  if (!deviceConnected) {
+    Serial.println("[BLE] En attente de connexion...");
+  }
+  if (DEBUG) {
+    LoopScheduler::print();
+    PowerManager::print();
+  }
+}
+
 void loop() {
+  // Déconnexion: les noteOff en cours ne viendront plus
+  if (disconnectPending) {
+    disconnectPending = false;
+    instrument.panic();
+  }
+
   // Mettre à jour instrument (servos, timeouts)
   instrument.update();
+  LoopScheduler::wakeWithin(instrument.msUntilUpdate());
 
-  // Gérer reconnexion
+  // Gérer reconnexion: advertising relancé 500 ms après la déconnexion (temps laissé à la
+  // pile BLE), sans bloquer la loop
   if (!deviceConnected && oldDeviceConnected) {
-    delay(500); // Laisser le temps à la pile BLE
-    pServer->startAdvertising();
-    Serial.println("[BLE] Redémarrage advertising...");
+    disconnectTime = millis();
+    advertisingPending = true;
     oldDeviceConnected = deviceConnected;
   }
+  if (advertisingPending) {
+    unsigned long elapsed = millis() - disconnectTime;
+    if (deviceConnected) {
+      advertisingPending = false;
+    } else if (elapsed >= 500) {
+      pServer->startAdvertising();
+      Serial.println("[BLE] Redémarrage advertising...");
+      advertisingPending = false;
+    } else {
+      LoopScheduler::wakeWithin(500 - elapsed);
+    }
+  }
 
   // Gérer nouvelle connexion
   if (deviceConnected && !oldDeviceConnected) {
     oldDeviceConnected = deviceConnected;
   }
 
-  // LED clignotante si non connecté
-  if (!deviceConnected) {
-    unsigned long now = millis();
-    if (now - lastLedToggle >= 500) {
-      ledState = !ledState;
-      digitalWrite(PIN_LED, ledState);
-      lastLedToggle = now;
-    }
-  }
-
-  // Message périodique si non connecté
-  static unsigned long lastStatusTime = 0;
-  if (!deviceConnected && millis() - lastStatusTime > 30000) {
-    Serial.println("[BLE] En attente de connexion...");
-    lastStatusTime = millis();
-  }
+  // Retour au repos après POWER_ACTIVE_HOLD_MS sans message MIDI
+  PowerManager::update();
 
-  delay(10);
+  // Tâches dues, puis sommeil jusqu'à la prochaine échéance ou un message BLE
+  LoopScheduler::run();
 }
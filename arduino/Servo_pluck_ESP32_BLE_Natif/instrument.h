@@ -11,16 +11,79 @@ execute les messages noteOn et noteOff
 
 ************************************************************************************************/
 class Instrument {
+public:
+	// Appelee a la fin de chaque ecriture PCA9685 qui fait sonner ou etouffe une corde jouee en
+	// MIDI: velocity 0 = etouffement, doneUs = micros() de fin d'ecriture I2C
+	typedef void (*ActuationCallback)(uint8_t servo, uint8_t midiNote, uint8_t velocity,
+	                                  unsigned long doneUs);
+
+	// Compteurs pedales: mouvements et ecritures I2C economises
+	struct SustainStats {
+		uint32_t deferredMutes;  // noteOff mis en attente sous une pedale
+		uint32_t savedMoves;     // Mutes annules: la corde a ete regrattee avant le relachement
+		uint32_t flushes;        // Relachements ayant etouffe au moins une corde
+		uint32_t flushedMutes;   // Cordes etouffees par ces relachements (une ecriture I2C chacun)
+	};
+
 private:
   ServoController servoController;
 	int16_t getServo(uint8_t midiNote); //renvoit le numero du servo de 0 a 15 et -1 si la note ne peut pas etre jouee
+
+	// Mode pluck-through: le servo reste de l'autre cote de la corde apres un grattage
+	bool pluckThrough;
+	uint16_t dampDelayMs;  // 0 = noteOff ignore, sinon etouffement differe
+	uint16_t dampMask;     // Etouffements en attente (bit par servo)
+
+	// Pedales (CC 64 sustain, CC 66 sostenuto)
+	bool sustainPedal;
+	bool sostenutoPedal;
+	uint16_t sostenutoMask;  // Cordes retenues par la sostenuto (capturees a l'appui)
+	uint16_t keysDown;       // Notes actuellement enfoncees (bit par servo)
+	uint16_t sustainedMask;  // noteOff recus sous la pedale: mutes en attente du relachement
+	SustainStats sustainStats;
+	void releasePedals();    // Etouffe les cordes qui ne sont plus retenues
+	uint16_t panicCount;     // Incremente a chaque panic(), surveille par les sequenceurs
+	ActuationCallback actuationCallback;
+	void notifyActuation(uint16_t mask, uint8_t velocity);  // Apres l'ecriture I2C de ces cordes
 	
 public:
 	Instrument();
+	void begin() { servoController.begin(); }  // Dans setup(), apres Wire.begin()
 	void update();  // A appeler dans loop() pour gerer les taches non-bloquantes
 	bool isReady();  // Retourne true quand l'instrument est pret a jouer
+	uint32_t msUntilUpdate();  // Delai avant que update() ait a agir (UINT32_MAX: rien de prevu)
 	void noteOn(uint8_t midiNote, uint8_t velocity);
 	void noteOff(uint8_t midiNote);
+	void panic();  // All Notes Off / All Sound Off: tout au repos, pedales et attentes effacees
+	uint16_t getPanicCount() { return panicCount; }
+	void setPluckThrough(bool enabled, uint16_t dampMs = PLUCK_THROUGH_DAMP_MS);
+	bool isPluckThrough() { return pluckThrough; }
+	void setSustain(bool down);    // CC 64
+	void setSostenuto(bool down);  // CC 66
+	const SustainStats& getSustainStats() { return sustainStats; }
+	void resetSustainStats();
+	void actuate(uint8_t servo, uint16_t tick);  // Ecriture precalculee (partition compilee)
+	void setActuationCallback(ActuationCallback callback) { actuationCallback = callback; }
+	static uint8_t servoNote(uint8_t servo);  // Note MIDI jouee par ce servo (0 si aucune)
+
+	// Anticipation des evenements programmes (voir ServoController::prestage)
+	bool prestage(uint8_t servo, int8_t direction);
+	uint32_t pluckLatencyUs(uint8_t servo);
+	uint16_t restTick(uint8_t servo);
+	void arm(uint8_t servo);  // Realimente une voie liberee (grattage imminent)
+
+	// Alimentation voie par voie (voir ServoController::releaseMask)
+	uint16_t getEnergizedMask() { return servoController.getEnergizedMask(); }
+	uint32_t getWakeCount() { return servoController.getWakeCount(); }
+
+	// PCA9685 absent ou deconnecte: les notes sont acceptees mais ne jouent pas
+	bool isOnline() { return servoController.isOnline(); }
+	bool isDegraded() { return servoController.isDegraded(); }
+	uint32_t getI2CErrorCount() { return servoController.getI2CErrorCount(); }
+
+	// Derniere ecriture PCA9685 (mesure de latence, voir LatencyStats)
+	unsigned long getI2CStartUs() { return servoController.getI2CStartUs(); }
+	unsigned long getI2CDoneUs() { return servoController.getI2CDoneUs(); }
 };
 
 #endif // INSTRUMENT_H
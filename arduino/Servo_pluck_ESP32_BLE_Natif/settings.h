@@ -14,10 +14,31 @@ DIFFERENCES avec la version Arduino Leonardo:
 
 // Configuration Debug
 #define DEBUG 0
+#define DEFERRED_LOG_BINARY false   // Journal differe (DeferredLog.h): true = trames binaires pour tools/lyre_log
+#define DEFERRED_LOG_DRAIN_MS 20     // Periode de vidage du journal par la tache basse priorite
+#define ENABLE_EVENT_TRACE false     // Trace d'evenements en RAM RTC (EventTrace.h), a vider avec EventTrace::dump()
+#define TRACE_BUFFER_EVENTS 256      // Puissance de 2, 8 octets par evenement (8 Ko de RAM RTC au total)
+#define LOOP_MAX_SLEEP_MS 1000       // Boucle evenementielle (LoopScheduler.h): sommeil max sans echeance ni evenement
+#define LOOP_TASKS_MAX 8             // Taches periodiques de la loop
 
 // Configuration BLE MIDI
 #define BLE_DEVICE_NAME "Lyre-MIDI-ESP32"  // Nom de l'appareil Bluetooth
 
+// Gestion d'energie (PowerManager.h): CPU a fond pendant le jeu, economie au repos
+#define POWER_MODE 2                     // 0 = performance (240 MHz fixe), 1 = frequence variable, 2 = + sommeil leger
+#define POWER_LATENCY_BUDGET_US 2000     // Latence ajoutee toleree sur la premiere note apres un repos
+#define POWER_ACTIVE_HOLD_MS 10000       // Repos: 10 s sans message MIDI
+#define POWER_CPU_MAX_MHZ 240
+#define POWER_CPU_MIN_MHZ 80             // Pas en dessous: l'APB (I2C, UART) reste a 80 MHz
+#define POWER_IDLE_LATENCY_MAX 0         // Latence esclave au repos: pas de renegociation dans ce sketch
+#define POWER_DFS_WAKE_US 50             // Retour a 240 MHz, debut de la premiere note a 80 MHz
+#define POWER_LIGHT_SLEEP_WAKE_US 1000   // Sortie de sommeil leger et traitement d'un evenement BLE
+// Courants typiques pour le rapport (datasheet ESP32): a remplacer par une mesure au multimetre
+#define POWER_MA_CPU_MAX 50              // CPU a 240 MHz
+#define POWER_MA_CPU_MIN 22              // CPU a 80 MHz
+#define POWER_MA_LIGHT_SLEEP 1           // Sommeil leger
+#define POWER_MA_BLE 8                   // Radio BLE connectee, intervalle 7,5 ms sans latence esclave
+
 // Configuration generale
 #define NUM_SERVOS 16
 #define PLUCK_ANGLE 15
@@ -32,7 +53,33 @@ DIFFERENCES avec la version Arduino Leonardo:
 // Delais d'initialisation des servos (en millisecondes)
 #define SERVO_INIT_DELAY_MS 500
 #define SERVO_RESET_DELAY_MS 100
-#define SERVO_AUTO_DISABLE_TIMEOUT_MS 2000  // Desactiver apres 2s d'inactivite
+// Balayage d'initialisation par groupes: N servos bougent ensemble (budget alimentation,
+// ~700 mA de pointe par SG90). 16 servos par 4 = 4 x (500 + 100) ms au lieu de 9,6 s.
+#define SERVO_INIT_GROUP_SIZE 4
+// Redemarrage a chaud (watchdog, reset logiciel): l'etat des servos est conserve en memoire RTC
+// et le balayage est saute. Apres une mise sous tension ou une chute d'alimentation il a lieu.
+#define SERVO_WARM_BOOT true
+#define SERVO_AUTO_DISABLE_TIMEOUT_MS 2000  // Voie liberee (bit full-OFF du PCA9685) apres 2s sans mouvement
+// Prediction de trafic: tant que des notes arrivent (une dans la derniere fenetre), les cordes
+// jouees recemment restent alimentees plus longtemps pour ne pas etre reveillees a chaque note
+#define SERVO_TRAFFIC_WINDOW_MS 4000
+#define SERVO_TRAFFIC_HOLD_MS 10000
+
+// Modele de deplacement des servos (SG90: 0.1 s / 60 deg sous 4.8V)
+// Sert a compenser la latence mecanique (partitions compilees, anticipation)
+#define SERVO_US_PER_DEGREE 1667
+#define PLUCK_RELEASE_ANGLE (PLUCK_ANGLE / 2)  // Degres parcourus depuis le repos avant que la corde s'echappe
+
+// Anticipation (lecture programmee): le servo est amene juste avant le point d'echappement,
+// seuls les derniers degres sont parcourus a l'echeance
+#define LOOKAHEAD_PRESTAGE_ANGLE 5   // Doit rester < PLUCK_RELEASE_ANGLE (corde tendue, pas lachee)
+#define LOOKAHEAD_WINDOW_US 60000    // Horizon d'anticipation
+#define LOOKAHEAD_MAX_STAGED 4       // Budget alimentation: servos maintenus en tension simultanement
+
+// Mode pluck-through: apres un grattage le servo reste de l'autre cote de la corde et la note
+// suivante la traverse depuis la (un seul mouvement par note). Activable aussi par CC 68.
+#define PLUCK_THROUGH_MODE false
+#define PLUCK_THROUGH_DAMP_MS 0      // 0 = noteOff ignore, >0 = etouffement N ms apres le grattage
 
 // Types de messages MIDI
 #define MIDI_NOTE_ON 0x90
@@ -93,5 +140,12 @@ const uint16_t SERVO_PULSE_MIN = 500;
 const uint16_t SERVO_PULSE_MAX = 2500;
 const uint16_t SERVO_FREQUENCY = 50;
 const uint32_t PCA9685_OSCILLATOR_FREQ = 27000000;
+const uint8_t PCA9685_I2C_ADDRESS = 0x40;  // Adresse I2C du PCA9685 (cavaliers A0-A5 ouverts)
+
+// Detection du PCA9685 au demarrage (non-bloquante, le BLE/WiFi demarre en parallele)
+#define PCA9685_PROBE_ATTEMPTS 5        // Essais avant de passer en mode degrade (MIDI accepte, erreur signalee)
+#define PCA9685_PROBE_RETRY_MIN_MS 10   // Delai entre deux essais, double a chaque echec...
+#define PCA9685_PROBE_RETRY_MAX_MS 2000 // ...jusqu'a ce plafond (recherche en arriere-plan)
+#define PCA9685_I2C_TIMEOUT_MS 10       // Duree maximale d'une transaction I2C (bus bloque)
 
 #endif
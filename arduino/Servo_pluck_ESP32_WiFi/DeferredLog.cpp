@@ -0,0 +1,122 @@
+#include "DeferredLog.h"
+
+DeferredLog::Slot DeferredLog::_ring[DEFERRED_LOG_RING_SIZE];
+std::atomic<uint32_t> DeferredLog::_enqueuePos(0);
+uint32_t DeferredLog::_dequeuePos = 0;
+std::atomic<uint32_t> DeferredLog::_dropped(0);
+std::atomic<uint32_t> DeferredLog::_written(0);
+uint32_t DeferredLog::_droppedTotal = 0;
+bool DeferredLog::_ready = false;
+
+#if defined(ESP32)
+static void deferredLogTask(void* parameter) {
+  for (;;) {
+    DeferredLog::drain(32);
+    vTaskDelay(pdMS_TO_TICKS(DEFERRED_LOG_DRAIN_MS));
+  }
+}
+#endif
+
+void DeferredLog::begin() {
+  if (_ready) return;
+
+  for (uint32_t i = 0; i < DEFERRED_LOG_RING_SIZE; i++) {
+    _ring[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  _enqueuePos.store(0, std::memory_order_relaxed);
+  _dequeuePos = 0;
+  _ready = true;
+
+  #if defined(ESP32)
+    // Coeur 0, juste au-dessus de la tache idle: ne preempte ni la loop ni la pile BLE
+    xTaskCreatePinnedToCore(deferredLogTask, "log", 3072, nullptr, tskIDLE_PRIORITY + 1,
+                            nullptr, 0);
+  #endif
+}
+
+bool DeferredLog::push(uint8_t formatId, uint8_t argCount, uint32_t a, uint32_t b, uint32_t c) {
+  if (!_ready) return false;
+
+  uint32_t pos = _enqueuePos.load(std::memory_order_relaxed);
+  Slot* slot;
+  for (;;) {
+    slot = &_ring[pos & (DEFERRED_LOG_RING_SIZE - 1)];
+    uint32_t sequence = slot->sequence.load(std::memory_order_acquire);
+    int32_t diff = (int32_t)(sequence - pos);
+    if (diff == 0) {
+      // Case libre: la reserver (un autre producteur a pu la prendre entre-temps)
+      if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // Case encore occupee par le tour precedent: file pleine
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      pos = _enqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+
+  LogRecord& r = slot->record;
+  r.timestampUs = micros();
+  r.formatId = formatId;
+  r.argCount = argCount;
+  r.reserved = 0;
+  r.args[0] = a;
+  r.args[1] = b;
+  r.args[2] = c;
+  slot->sequence.store(pos + 1, std::memory_order_release);
+  _written.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+bool DeferredLog::pop(LogRecord& record) {
+  Slot* slot = &_ring[_dequeuePos & (DEFERRED_LOG_RING_SIZE - 1)];
+  if (slot->sequence.load(std::memory_order_acquire) != _dequeuePos + 1) {
+    return false;  // Vide, ou message en cours d'ecriture
+  }
+  record = slot->record;
+  slot->sequence.store(_dequeuePos + DEFERRED_LOG_RING_SIZE, std::memory_order_release);
+  _dequeuePos++;
+  return true;
+}
+
+void DeferredLog::emit(const LogRecord& record) {
+  if (!DEBUG) return;
+
+  if (DEFERRED_LOG_BINARY) {
+    uint8_t frame[2 + sizeof(LogRecord)];
+    frame[0] = LOG_FRAME_SYNC0;
+    frame[1] = LOG_FRAME_SYNC1;
+    memcpy(frame + 2, &record, sizeof(LogRecord));
+    Serial.write(frame, sizeof(frame));
+  } else {
+    char line[160];
+    logFormatRecord(line, sizeof(line), record);
+    Serial.println(line);
+  }
+}
+
+uint16_t DeferredLog::drain(uint16_t maxRecords) {
+  if (!_ready) return 0;
+
+  uint16_t sent = 0;
+  uint32_t dropped = _dropped.exchange(0, std::memory_order_relaxed);
+  if (dropped > 0) {
+    _droppedTotal += dropped;
+    LogRecord notice = {};
+    notice.timestampUs = micros();
+    notice.formatId = LOG_DROPPED;
+    notice.argCount = 1;
+    notice.args[0] = dropped;
+    emit(notice);
+    sent++;
+  }
+
+  LogRecord record;
+  while (sent < maxRecords && pop(record)) {
+    emit(record);
+    sent++;
+  }
+  return sent;
+}
@@ -0,0 +1,250 @@
+#include "EnsembleClock.h"
+
+static void writeBe32(uint8_t* p, uint32_t v) {
+  for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (24 - 8 * i));
+}
+
+static void writeBe64(uint8_t* p, int64_t v) {
+  writeBe32(p, (uint32_t)((uint64_t)v >> 32));
+  writeBe32(p + 4, (uint32_t)v);
+}
+
+static uint32_t readBe32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static int64_t readBe64(const uint8_t* p) {
+  return (int64_t)(((uint64_t)readBe32(p) << 32) | readBe32(p + 4));
+}
+
+/*------------------------------------------------------------------
+--------------        Paquets                            ----------
+------------------------------------------------------------------*/
+uint8_t EnsemblePacket::encode(uint8_t* out) const {
+  out[0] = 'L';
+  out[1] = 'Y';
+  out[2] = type;
+  out[3] = ENSEMBLE_GROUP;
+  writeBe32(out + 4, seq);
+  writeBe64(out + 8, t1);
+  if (type == ENSEMBLE_REPLY) {
+    writeBe64(out + 16, t2);
+    writeBe64(out + 24, t3);
+    return 32;
+  }
+  if (type == ENSEMBLE_NOTE) {
+    out[16] = status;
+    out[17] = data1;
+    out[18] = data2;
+    out[19] = 0;
+    return 20;
+  }
+  return 16;
+}
+
+bool EnsemblePacket::decode(const uint8_t* data, uint16_t length) {
+  if (length < 16 || data[0] != 'L' || data[1] != 'Y' || data[3] != ENSEMBLE_GROUP) return false;
+  type = data[2];
+  seq = readBe32(data + 4);
+  t1 = readBe64(data + 8);
+  switch (type) {
+    case ENSEMBLE_REQUEST:
+    case ENSEMBLE_PANIC:
+      return true;
+    case ENSEMBLE_REPLY:
+      if (length < 32) return false;
+      t2 = readBe64(data + 16);
+      t3 = readBe64(data + 24);
+      return true;
+    case ENSEMBLE_NOTE:
+      if (length < 20) return false;
+      status = data[16];
+      data1 = data[17] & 0x7F;
+      data2 = data[18] & 0x7F;
+      return true;
+  }
+  return false;
+}
+
+/*------------------------------------------------------------------
+--------------        Horloge commune                    ----------
+------------------------------------------------------------------*/
+EnsembleClock::EnsembleClock() : _leader(false), _localInit(false), _localExt(0), _seq(0) {
+  reset();
+  resetStats();
+}
+
+void EnsembleClock::reset() {
+  _pending = false;
+  _pendingT1 = 0;
+  _sampleCount = 0;
+  _sampleNext = 0;
+  _blockCount = 0;
+  _blockNext = 0;
+  _blockBest.rttUs = UINT32_MAX;
+  _blockStartUs = 0;
+  _refLocalUs = 0;
+  _offsetUs = 0;
+  _drift = 0;
+}
+
+void EnsembleClock::setLeader(bool leader) {
+  _leader = leader;
+  reset();
+}
+
+int64_t EnsembleClock::extendLocal(uint32_t us) {
+  if (!_localInit) {
+    _localExt = us;
+    _localInit = true;
+  } else {
+    _localExt += (int32_t)(us - (uint32_t)_localExt);
+  }
+  return _localExt;
+}
+
+void EnsembleClock::request(uint32_t localUs, EnsemblePacket* packet) {
+  _pending = true;
+  _seq++;
+  _pendingT1 = extendLocal(localUs);
+  packet->type = ENSEMBLE_REQUEST;
+  packet->seq = _seq;
+  packet->t1 = _pendingT1;
+  _stats.requests++;
+}
+
+void EnsembleClock::reply(const EnsemblePacket& request, uint32_t receiveUs, uint32_t sendUs,
+                          EnsemblePacket* reply) {
+  reply->type = ENSEMBLE_REPLY;
+  reply->seq = request.seq;
+  reply->t1 = request.t1;
+  reply->t2 = now(receiveUs);
+  reply->t3 = now(sendUs);
+}
+
+bool EnsembleClock::onReply(const EnsemblePacket& reply, uint32_t localUs) {
+  // Seule la reponse a la derniere requete compte: une plus ancienne a trop attendu en route
+  if (_leader || !_pending || reply.seq != _seq || reply.t1 != _pendingT1) {
+    _stats.stale++;
+    return false;
+  }
+  _pending = false;
+
+  int64_t t4 = extendLocal(localUs);
+  int64_t rtt = (t4 - reply.t1) - (reply.t3 - reply.t2);
+  if (rtt < 0) rtt = 0;
+  int64_t middle = reply.t1 + (t4 - reply.t1) / 2;
+  int64_t offset = ((reply.t2 - reply.t1) + (reply.t3 - t4)) / 2;
+
+  // Ecart a la correspondance courante: qualite de la derive, ou chef qui a change d'heure
+  if (_sampleCount > 0) {
+    int64_t error = offset - offsetAt(middle);
+    _stats.errorUs = (int32_t)(error > INT32_MAX ? INT32_MAX : error < INT32_MIN ? INT32_MIN : error);
+    if (error > ENSEMBLE_STEP_US || error < -ENSEMBLE_STEP_US) {
+      reset();
+      _stats.steps++;
+    }
+  }
+
+  Sample& s = _samples[_sampleNext];
+  s.localUs = middle;
+  s.offsetUs = offset;
+  s.rttUs = (uint32_t)rtt;
+  _sampleNext = (_sampleNext + 1) % ENSEMBLE_CLOCK_SAMPLES;
+  if (_sampleCount < ENSEMBLE_CLOCK_SAMPLES) _sampleCount++;
+
+  _stats.exchanges++;
+  _stats.rttUs = (uint32_t)rtt;
+  if (_stats.rttMinUs == 0 || (uint32_t)rtt < _stats.rttMinUs) _stats.rttMinUs = (uint32_t)rtt;
+  addReference(s);
+  fit();
+  return true;
+}
+
+// Une tranche de ENSEMBLE_DRIFT_BLOCK_US terminee laisse son plus court aller-retour
+void EnsembleClock::addReference(const Sample& s) {
+  if (_blockBest.rttUs != UINT32_MAX && s.localUs - _blockStartUs >= ENSEMBLE_DRIFT_BLOCK_US) {
+    _blocks[_blockNext] = _blockBest;
+    _blockNext = (_blockNext + 1) % ENSEMBLE_DRIFT_BLOCKS;
+    if (_blockCount < ENSEMBLE_DRIFT_BLOCKS) _blockCount++;
+    _blockBest.rttUs = UINT32_MAX;
+    fitDrift();
+  }
+  if (_blockBest.rttUs == UINT32_MAX) _blockStartUs = s.localUs;
+  if (s.rttUs < _blockBest.rttUs) _blockBest = s;
+}
+
+void EnsembleClock::fitDrift() {
+  if (_blockCount < ENSEMBLE_DRIFT_MIN_BLOCKS) return;  // Derive precedente conservee
+
+  // Moindres carres, abscisses relatives a la premiere reference (precision des doubles)
+  const Sample& first = _blocks[_blockCount < ENSEMBLE_DRIFT_BLOCKS ? 0 : _blockNext];
+  double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0, span = 0;
+  for (uint8_t i = 0; i < _blockCount; i++) {
+    double x = (double)(_blocks[i].localUs - first.localUs);
+    double y = (double)(_blocks[i].offsetUs - first.offsetUs);
+    n++;
+    sx += x;
+    sy += y;
+    sxx += x * x;
+    sxy += x * y;
+    if (x > span) span = x;
+  }
+  if (span < ENSEMBLE_DRIFT_SPAN_US) return;
+  double slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+  if (slope > -ENSEMBLE_DRIFT_MAX && slope < ENSEMBLE_DRIFT_MAX) _drift = slope;
+}
+
+void EnsembleClock::fit() {
+  // Echanges retenus pour le decalage: aller-retour proche du plus court (les autres ont
+  // attendu en route, et l'asymetrie aller/retour, erreur du decalage, croit avec l'attente)
+  uint32_t minRtt = UINT32_MAX;
+  int64_t newest = INT64_MIN;
+  int64_t base = 0;
+  for (uint8_t i = 0; i < _sampleCount; i++) {
+    if (_samples[i].rttUs < minRtt) minRtt = _samples[i].rttUs;
+    if (_samples[i].localUs > newest) {
+      newest = _samples[i].localUs;
+      base = _samples[i].offsetUs;
+    }
+  }
+  uint32_t limit = minRtt + (minRtt / 4 > 500 ? minRtt / 4 : 500);
+
+  // Decalage moyen des echanges retenus, ramene au dernier par la derive
+  double n = 0, sx = 0, sy = 0;
+  for (uint8_t i = 0; i < _sampleCount; i++) {
+    if (_samples[i].rttUs > limit) continue;
+    n++;
+    sx += (double)(_samples[i].localUs - newest);
+    sy += (double)(_samples[i].offsetUs - base);
+  }
+  _refLocalUs = newest;
+  _offsetUs = base + (int64_t)((sy - _drift * sx) / n);
+}
+
+int64_t EnsembleClock::offsetAt(int64_t localUs) const {
+  if (_leader || _sampleCount == 0) return 0;
+  return _offsetUs + (int64_t)(_drift * (double)(localUs - _refLocalUs));
+}
+
+int64_t EnsembleClock::now(uint32_t localUs) {
+  int64_t local = extendLocal(localUs);
+  return local + offsetAt(local);
+}
+
+uint32_t EnsembleClock::toLocal(int64_t ensembleUs) const {
+  // Inverse de local + offsetAt(local): la derive est minime, une correction suffit
+  int64_t local = ensembleUs - offsetAt(ensembleUs - _offsetUs);
+  return (uint32_t)local;
+}
+
+EnsembleClock::Stats EnsembleClock::getStats() const {
+  Stats s = _stats;
+  s.offsetUs = offsetAt(_localExt);
+  s.driftPpm = (float)(_drift * 1e6);
+  return s;
+}
+
+void EnsembleClock::resetStats() {
+  memset(&_stats, 0, sizeof(_stats));
+}
@@ -0,0 +1,148 @@
+#ifndef ENSEMBLECLOCK_H
+#define ENSEMBLECLOCK_H
+
+#include <stdint.h>
+#include <string.h>
+#include "settings.h"
+/***********************************************************************************************
+----------------------------    EnsembleClock.h   ----------------------------------------------
+************************************************************************************************
+Horloge commune d'un ensemble de lyres (EnsembleSync.h): l'heure commune est celle du chef
+(son micros() etendu a 64 bits); chaque suiveur estime la correspondance entre son micros() et
+cette heure par des echanges facon PTP, sur UDP:
+
+  suiveur                         chef
+  t1 = heure locale  ---- Q ---->  t2 = heure commune a la reception
+  t4 = heure locale  <--- R -----  t3 = heure commune a l'envoi (t1, t2, t3 dans la reponse)
+
+  decalage = ((t2 - t1) + (t3 - t4)) / 2   (heure commune - heure locale)
+  aller-retour = (t4 - t1) - (t3 - t2)
+
+Le decalage est exact si l'aller et le retour durent autant: l'erreur est au plus la moitie
+de l'aller-retour. Comme RtpClock pour les echanges CK, les ENSEMBLE_CLOCK_SAMPLES derniers
+echanges, sans ceux dont l'aller-retour est anormalement long (attente en route), donnent le
+decalage. L'horloge locale n'est pas modifiee: c'est la correspondance qui suit le chef, derive
+comprise, entre deux echanges.
+
+La derive (droite des moindres carres) demande plus de recul: 16 s d'echanges dont l'erreur
+atteint la milliseconde la laissent a +/- 50 ppm. Elle est estimee sur les ENSEMBLE_DRIFT_BLOCKS
+derniers echanges de reference: le plus court aller-retour de chaque tranche de
+ENSEMBLE_DRIFT_BLOCK_US (64 s au total). Elle n'est mise a jour qu'a partir de
+ENSEMBLE_DRIFT_MIN_BLOCKS references couvrant ENSEMBLE_DRIFT_SPAN_US.
+
+Un echange dont le decalage s'ecarte de plus de ENSEMBLE_STEP_US de la prediction (chef
+redemarre, autre chef) repart de zero.
+
+Paquets (tous commencent par 'L' 'Y', type, groupe ENSEMBLE_GROUP; entiers gros-boutistes):
+  Q  requete   numero (32 bits), t1 (64 bits)                               16 octets
+  R  reponse   numero, t1, t2, t3                                          32 octets
+  N  note      numero de note, heure commune de jeu (64 bits), statut, note, velocite, 0
+                                                                           20 octets
+  P  panique   numero de note (meme suite que N), heure commune d'envoi          16 octets
+
+Ce fichier n'inclut rien de specifique a Arduino: il est aussi compile par l'outil PC
+tools/lyre_ensemble (plusieurs lyres simulees sur des sockets locales).
+************************************************************************************************/
+
+#define ENSEMBLE_CLOCK_SAMPLES 64       // Echanges retenus (16 s a ENSEMBLE_SYNC_MS = 250)
+#define ENSEMBLE_SYNC_MIN 3             // Echanges avant de jouer a l'heure commune
+#define ENSEMBLE_DRIFT_BLOCK_US 2000000 // Un echange de reference pour la derive toutes les 2 s
+#define ENSEMBLE_DRIFT_BLOCKS 32        // ...32 retenus (64 s)
+#define ENSEMBLE_DRIFT_MIN_BLOCKS 4     // Derive estimee sur au moins 4 references...
+#define ENSEMBLE_DRIFT_SPAN_US 6000000  // ...couvrant au moins 6 s
+#define ENSEMBLE_DRIFT_MAX 0.0005       // +/- 500 ppm: au-dela, echanges incoherents
+#define ENSEMBLE_STEP_US 50000          // Ecart a la prediction qui fait repartir de zero
+#define ENSEMBLE_PACKET_MAX 32
+
+#define ENSEMBLE_REQUEST 'Q'
+#define ENSEMBLE_REPLY 'R'
+#define ENSEMBLE_NOTE 'N'
+#define ENSEMBLE_PANIC 'P'
+
+struct EnsemblePacket {
+  uint8_t type;    // ENSEMBLE_REQUEST, ENSEMBLE_REPLY, ENSEMBLE_NOTE ou ENSEMBLE_PANIC
+  uint32_t seq;    // Numero d'echange ou de note
+  int64_t t1;      // Q, R: envoi de la requete (heure du suiveur). N: heure commune de jeu
+                   // P: heure commune d'envoi
+  int64_t t2;      // R: reception de la requete (heure commune)
+  int64_t t3;      // R: envoi de la reponse (heure commune)
+  uint8_t status;  // N: message MIDI
+  uint8_t data1;
+  uint8_t data2;
+
+  // Octets ecrits dans out (ENSEMBLE_PACKET_MAX)
+  uint8_t encode(uint8_t* out) const;
+  // false: pas un paquet de l'ensemble ENSEMBLE_GROUP
+  bool decode(const uint8_t* data, uint16_t length);
+};
+
+class EnsembleClock {
+  public:
+    struct Stats {
+      uint32_t requests;   // Requetes envoyees
+      uint32_t exchanges;  // Reponses retenues
+      uint32_t stale;      // Reponses sans requete en cours (perdue, doublon, trop tardive)
+      uint32_t steps;      // Correspondance abandonnee (ecart > ENSEMBLE_STEP_US)
+      uint32_t rttUs;      // Aller-retour du dernier echange
+      uint32_t rttMinUs;   // ...le plus court
+      int32_t errorUs;     // Ecart du dernier echange a la prediction (avant correction)
+      int64_t offsetUs;    // Heure commune - heure locale
+      float driftPpm;      // Derive du chef par rapport a l'horloge locale
+    };
+
+  private:
+    struct Sample {
+      int64_t localUs;   // Milieu de l'echange (heure locale)
+      int64_t offsetUs;
+      uint32_t rttUs;
+    };
+
+    bool _leader;
+    bool _localInit;
+    int64_t _localExt;   // micros() etendu a 64 bits
+
+    bool _pending;       // Requete en cours
+    uint32_t _seq;
+    int64_t _pendingT1;
+
+    Sample _samples[ENSEMBLE_CLOCK_SAMPLES];
+    uint8_t _sampleCount, _sampleNext;
+    Sample _blocks[ENSEMBLE_DRIFT_BLOCKS];  // References de la derive
+    uint8_t _blockCount, _blockNext;
+    Sample _blockBest;   // Plus court aller-retour de la tranche en cours
+    int64_t _blockStartUs;
+    int64_t _refLocalUs; // Origine de la derive
+    int64_t _offsetUs;
+    double _drift;
+
+    Stats _stats;
+
+    int64_t extendLocal(uint32_t us);
+    void addReference(const Sample& s);
+    void fitDrift();
+    void fit();
+    int64_t offsetAt(int64_t localUs) const;
+
+  public:
+    EnsembleClock();
+    void reset();                       // Correspondance oubliee
+    void setLeader(bool leader);        // Chef: heure commune = heure locale
+    bool isLeader() const { return _leader; }
+    bool isSynced() const { return _leader || _sampleCount >= ENSEMBLE_SYNC_MIN; }
+
+    // Suiveur: requete a envoyer au chef (la precedente, sans reponse, est abandonnee)
+    void request(uint32_t localUs, EnsemblePacket* packet);
+    // Suiveur: reponse du chef recue a localUs. false: ignoree
+    bool onReply(const EnsemblePacket& reply, uint32_t localUs);
+    // Chef: reponse a une requete recue a receiveUs, envoyee a sendUs (micros())
+    void reply(const EnsemblePacket& request, uint32_t receiveUs, uint32_t sendUs,
+               EnsemblePacket* reply);
+
+    int64_t now(uint32_t localUs);                 // Heure commune a l'instant local
+    uint32_t toLocal(int64_t ensembleUs) const;    // Instant local (micros()) d'une heure commune
+
+    Stats getStats() const;
+    void resetStats();
+};
+
+#endif // ENSEMBLECLOCK_H
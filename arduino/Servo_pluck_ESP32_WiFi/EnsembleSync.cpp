@@ -0,0 +1,257 @@
+#include "EnsembleSync.h"
+#include "DeferredLog.h"
+#include "EventTrace.h"
+#include "LoopScheduler.h"
+
+EnsembleSync::EnsembleSync(Instrument& instrument)
+    : _instrument(instrument), _started(false), _panicCount(0), _noteSeq(0), _leaderKnown(false),
+      _leaderMs(0), _lastRequestMs(0), _expectedSeq(0) {
+  memset(&_stats, 0, sizeof(_stats));
+  for (uint8_t i = 0; i < ENSEMBLE_FOLLOWERS_MAX; i++) {
+    _followers[i].active = false;
+  }
+}
+
+void EnsembleSync::begin() {
+  _clock.setLeader(ENSEMBLE_ROLE == ENSEMBLE_LEADER);
+  _panicCount = _instrument.getPanicCount();
+  _started = _udp.begin(ENSEMBLE_PORT);
+  if (DEBUG) {
+    Serial.printf("[ENS] %s, groupe %d, port %d%s\n",
+                  ENSEMBLE_ROLE == ENSEMBLE_LEADER ? "Chef" : "Suiveur", ENSEMBLE_GROUP,
+                  ENSEMBLE_PORT, _started ? "" : ": ECHEC de l'ecoute");
+  }
+}
+
+void EnsembleSync::update() {
+  if (!_started) return;
+  checkPanic();
+
+  uint8_t buffer[ENSEMBLE_PACKET_MAX];
+  int size;
+  while ((size = _udp.parsePacket()) > 0) {
+    uint32_t receiveUs = micros();
+    int length = _udp.read(buffer, sizeof(buffer));
+    EnsemblePacket packet;
+    if (length <= 0 || !packet.decode(buffer, length)) continue;
+
+    if (_clock.isLeader()) {
+      if (packet.type == ENSEMBLE_REQUEST) onRequest(packet, receiveUs);
+    } else if (packet.type == ENSEMBLE_REPLY) {
+      if (_leaderKnown && _udp.remoteIP() != _leaderIp) continue;  // Autre chef du groupe
+      if (_clock.onReply(packet, receiveUs)) {
+        if (!_leaderKnown) {
+          _leaderIp = _udp.remoteIP();
+          _leaderKnown = true;
+          _expectedSeq = 0;  // Numeros de notes propres a chaque chef
+          DeferredLog::log(LOG_ENS_LEADER, _leaderIp[3], _clock.getStats().rttUs);
+        }
+        _leaderMs = millis();
+      }
+    } else if (_leaderKnown && _udp.remoteIP() == _leaderIp) {
+      if (packet.type == ENSEMBLE_NOTE) onNote(packet, receiveUs);
+      if (packet.type == ENSEMBLE_PANIC) onPanic(packet);
+    }
+  }
+
+  if (!_clock.isLeader()) {
+    sync();
+  }
+
+  // Notes arrivees a echeance, puis sommeil au plus jusqu'a la suivante
+  NoteScheduler::Event e;
+  while (_scheduler.pop(micros(), &e)) {
+    play(e.status, e.data1, e.data2);
+  }
+  uint32_t waitUs = _scheduler.usUntilNext(micros());
+  if (waitUs != UINT32_MAX) {
+    LoopScheduler::wakeWithin(waitUs / 1000);
+  }
+}
+
+// Panique locale (tous roles): les notes en attente ne doivent plus sonner. Le chef la relaie
+void EnsembleSync::checkPanic() {
+  if (_instrument.getPanicCount() == _panicCount) return;
+  _panicCount = _instrument.getPanicCount();
+  _scheduler.clear();
+  if (!_clock.isLeader()) return;
+
+  EnsemblePacket packet;
+  packet.type = ENSEMBLE_PANIC;
+  packet.seq = ++_noteSeq;  // Suite des notes: une panique perdue est comptee comme une note
+  packet.t1 = _clock.now(micros());
+  uint32_t nowMs = millis();
+  for (uint8_t i = 0; i < ENSEMBLE_FOLLOWERS_MAX; i++) {
+    Follower& f = _followers[i];
+    if (f.active && nowMs - f.lastMs < ENSEMBLE_TIMEOUT_MS) {
+      send(packet, f.ip, f.port);
+    }
+  }
+  _stats.panics++;
+}
+
+void EnsembleSync::send(const EnsemblePacket& packet, const IPAddress& ip, uint16_t port) {
+  uint8_t buffer[ENSEMBLE_PACKET_MAX];
+  uint8_t length = packet.encode(buffer);
+  _udp.beginPacket(ip, port);
+  _udp.write(buffer, length);
+  _udp.endPacket();
+}
+
+/*------------------------------------------------------------------
+--------------        Chef                               ----------
+------------------------------------------------------------------*/
+void EnsembleSync::onRequest(const EnsemblePacket& packet, uint32_t receiveUs) {
+  IPAddress ip = _udp.remoteIP();
+  uint16_t port = _udp.remotePort();
+  EnsemblePacket reply;
+  _clock.reply(packet, receiveUs, micros(), &reply);
+  send(reply, ip, port);
+  _stats.requests++;
+
+  // Suiveur connu, place libre ou place d'un suiveur parti
+  uint32_t nowMs = millis();
+  int8_t free = -1;
+  for (uint8_t i = 0; i < ENSEMBLE_FOLLOWERS_MAX; i++) {
+    Follower& f = _followers[i];
+    if (f.active && nowMs - f.lastMs >= ENSEMBLE_TIMEOUT_MS) {
+      f.active = false;
+      _stats.followers--;
+    }
+    if (f.active && f.ip == ip && f.port == port) {
+      f.lastMs = nowMs;
+      return;
+    }
+    if (!f.active && free < 0) free = i;
+  }
+  if (free < 0) return;  // Plus de place: synchronise, mais ne recoit pas les notes
+  Follower& f = _followers[free];
+  f.ip = ip;
+  f.port = port;
+  f.lastMs = nowMs;
+  f.active = true;
+  _stats.followers++;
+  DeferredLog::log(LOG_ENS_FOLLOWER, ip[3], _stats.followers);
+}
+
+bool EnsembleSync::share(uint8_t status, uint8_t data1, uint8_t data2) {
+  if (!_started || !_clock.isLeader()) return false;
+  checkPanic();  // Panique jouee juste avant (meme passage de la loop): relayee avant la note
+
+  uint32_t nowUs = micros();
+  EnsemblePacket packet;
+  packet.type = ENSEMBLE_NOTE;
+  packet.seq = ++_noteSeq;
+  packet.t1 = _clock.now(nowUs) + ENSEMBLE_PLAYOUT_MS * 1000LL;
+  packet.status = status;
+  packet.data1 = data1;
+  packet.data2 = data2;
+
+  uint32_t nowMs = millis();
+  for (uint8_t i = 0; i < ENSEMBLE_FOLLOWERS_MAX; i++) {
+    Follower& f = _followers[i];
+    if (f.active && nowMs - f.lastMs < ENSEMBLE_TIMEOUT_MS) {
+      send(packet, f.ip, f.port);
+      _stats.notesSent++;
+    }
+  }
+
+  // Le chef joue au meme instant que les suiveurs
+  if (!_scheduler.schedule(_clock.toLocal(packet.t1), nowUs, status, data1, data2)) {
+    play(status, data1, data2);
+  }
+  return true;
+}
+
+/*------------------------------------------------------------------
+--------------        Suiveur                            ----------
+------------------------------------------------------------------*/
+void EnsembleSync::sync() {
+  uint32_t nowMs = millis();
+  if (_leaderKnown && nowMs - _leaderMs >= ENSEMBLE_TIMEOUT_MS) {
+    // Chef muet: nouvelle recherche, la correspondance est gardee s'il revient
+    DeferredLog::log(LOG_ENS_LOST, nowMs - _leaderMs);
+    _leaderKnown = false;
+  }
+  if (nowMs - _lastRequestMs >= ENSEMBLE_SYNC_MS) {
+    _lastRequestMs = nowMs;
+    EnsemblePacket request;
+    _clock.request(micros(), &request);
+    send(request, _leaderKnown ? _leaderIp : IPAddress(255, 255, 255, 255), ENSEMBLE_PORT);
+  }
+  LoopScheduler::wakeWithin(ENSEMBLE_SYNC_MS - (nowMs - _lastRequestMs));
+}
+
+bool EnsembleSync::isNext(uint32_t seq) {
+  if (_expectedSeq != 0 && (int32_t)(seq - _expectedSeq) > 0) {
+    _stats.notesLost += seq - _expectedSeq;
+  }
+  if (_expectedSeq == 0 || (int32_t)(seq - _expectedSeq) >= 0) {
+    _expectedSeq = seq + 1;
+    return true;
+  }
+  return false;
+}
+
+void EnsembleSync::onNote(const EnsemblePacket& packet, uint32_t nowUs) {
+  _stats.notesReceived++;
+  isNext(packet.seq);
+
+  if (!_clock.isSynced()) {
+    _stats.notesUnsynced++;
+    play(packet.status, packet.data1, packet.data2);
+    return;
+  }
+  // En retard: joue au prochain passage et compte par la file
+  if (!_scheduler.schedule(_clock.toLocal(packet.t1), nowUs, packet.status, packet.data1,
+                           packet.data2)) {
+    play(packet.status, packet.data1, packet.data2);
+  }
+}
+
+void EnsembleSync::onPanic(const EnsemblePacket& packet) {
+  // Une panique en retard sur des notes plus recentes ne les efface pas
+  if (!isNext(packet.seq)) return;
+  DeferredLog::log(LOG_ENS_PANIC, _scheduler.size());
+  _stats.panics++;
+  _instrument.panic();
+  checkPanic();  // File videe tout de suite: aucune note en attente ne suit la panique
+}
+
+void EnsembleSync::play(uint8_t status, uint8_t data1, uint8_t data2) {
+  if ((status & 0xF0) == MIDI_NOTE_ON && data2 > 0) {
+    EventTrace::record(TRACE_MIDI_NOTE_ON, data1, data2);
+    _instrument.noteOn(data1, data2);
+  } else {
+    EventTrace::record(TRACE_MIDI_NOTE_OFF, data1);
+    _instrument.noteOff(data1);
+  }
+}
+
+void EnsembleSync::printStats() {
+  EnsembleClock::Stats c = _clock.getStats();
+  NoteScheduler::Stats s = _scheduler.getStats();
+  if (_clock.isLeader()) {
+    Serial.printf("[ENS] Chef, groupe %d: %u suiveur(s), %lu requete(s) servie(s), "
+                  "%lu note(s) relayee(s), %lu panique(s)\n",
+                  ENSEMBLE_GROUP, _stats.followers, (unsigned long)_stats.requests,
+                  (unsigned long)_stats.notesSent, (unsigned long)_stats.panics);
+  } else {
+    Serial.printf("[ENS] Suiveur, groupe %d: chef %s | echanges: %lu/%lu (%lu ignores, %lu "
+                  "reprises) | aller-retour %lu us (min %lu) | ecart %ld us | decalage %lld us, "
+                  "derive %.1f ppm\n",
+                  ENSEMBLE_GROUP, _leaderKnown ? _leaderIp.toString().c_str() : "introuvable",
+                  (unsigned long)c.exchanges, (unsigned long)c.requests, (unsigned long)c.stale,
+                  (unsigned long)c.steps, (unsigned long)c.rttUs, (unsigned long)c.rttMinUs,
+                  (long)c.errorUs, (long long)c.offsetUs, c.driftPpm);
+    Serial.printf("[ENS] Notes recues: %lu, perdues: %lu, hors synchro: %lu, paniques: %lu\n",
+                  (unsigned long)_stats.notesReceived, (unsigned long)_stats.notesLost,
+                  (unsigned long)_stats.notesUnsynced, (unsigned long)_stats.panics);
+  }
+  Serial.printf("[ENS] Lecture a +%d ms: %lu note(s), %lu en retard (max %lu us), marge min "
+                "%ld us, file max %u%s\n",
+                ENSEMBLE_PLAYOUT_MS, (unsigned long)s.scheduled, (unsigned long)s.late,
+                (unsigned long)s.lateMaxUs,
+                s.marginMinUs == UINT32_MAX ? -1L : (long)s.marginMinUs, s.depthMax,
+                s.overflows ? " (file pleine!)" : "");
+}
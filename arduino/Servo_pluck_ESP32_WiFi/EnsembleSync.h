@@ -0,0 +1,94 @@
+#ifndef ENSEMBLESYNC_H
+#define ENSEMBLESYNC_H
+
+#include <WiFiUdp.h>
+#include "instrument.h"
+#include "EnsembleClock.h"
+#include "NoteScheduler.h"
+#include "settings.h"
+/***********************************************************************************************
+----------------------------    EnsembleSync.h   -----------------------------------------------
+************************************************************************************************
+Mode ensemble: plusieurs lyres, chacune avec sa propre liaison, jouent au meme instant.
+
+Chef (ENSEMBLE_LEADER): recoit le MIDI et l'OSC comme d'habitude, repond aux echanges
+d'horloge des suiveurs (EnsembleClock.h) et, au lieu de jouer ses notes tout de suite, les
+horodate a l'heure commune + ENSEMBLE_PLAYOUT_MS (share()). Il les envoie a chaque suiveur
+connu et les joue lui-meme a cet instant.
+
+Suiveur (ENSEMBLE_FOLLOWER): cherche le chef de son groupe (requete diffusee sur le reseau
+jusqu'a la premiere reponse), echange avec lui toutes les ENSEMBLE_SYNC_MS, et joue les notes
+recues a l'heure commune convertie en micros() locales (NoteScheduler). Avant ENSEMBLE_SYNC_MIN
+echanges, ou si la file est pleine, les notes sont jouees des reception. Ses propres entrees
+MIDI et OSC restent jouees localement.
+
+Seuls noteOn et noteOff sont relayes: pedales et CC restent propres a chaque lyre. Les notes
+perdues en route (UDP) sont comptees par leur numero, pas renvoyees.
+
+Panique (Instrument::getPanicCount() change: CC 120/121/123, derniere session perdue,
+/lyre/panic): les notes en attente sont abandonnees. Celle du chef est relayee (paquet P):
+chaque suiveur abandonne les siennes et met toutes ses cordes au repos.
+************************************************************************************************/
+
+class EnsembleSync {
+  public:
+    struct Stats {
+      uint32_t notesSent;      // Chef: notes relayees (par suiveur)
+      uint32_t notesReceived;  // Suiveur: notes recues du chef
+      uint32_t notesLost;      // ...manquantes (numeros sautes)
+      uint32_t notesUnsynced;  // ...jouees des reception (horloge pas encore commune)
+      uint32_t requests;       // Chef: requetes d'horloge servies
+      uint32_t panics;         // Paniques relayees (chef) ou recues (suiveur)
+      uint8_t followers;       // Chef: suiveurs actifs
+    };
+
+  private:
+    struct Follower {
+      IPAddress ip;
+      uint16_t port;
+      uint32_t lastMs;  // Derniere requete (millis())
+      bool active;
+    };
+
+    Instrument& _instrument;
+    WiFiUDP _udp;
+    bool _started;
+    EnsembleClock _clock;
+    NoteScheduler _scheduler;
+    uint16_t _panicCount;  // Instrument::getPanicCount() deja traite
+    Stats _stats;
+
+    // Chef
+    Follower _followers[ENSEMBLE_FOLLOWERS_MAX];
+    uint32_t _noteSeq;
+
+    // Suiveur
+    bool _leaderKnown;
+    IPAddress _leaderIp;
+    uint32_t _leaderMs;       // Derniere reponse du chef (millis())
+    uint32_t _lastRequestMs;
+    uint32_t _expectedSeq;    // Prochaine note attendue (0: aucune recue)
+
+    void send(const EnsemblePacket& packet, const IPAddress& ip, uint16_t port);
+    void onRequest(const EnsemblePacket& packet, uint32_t receiveUs);
+    void onNote(const EnsemblePacket& packet, uint32_t nowUs);
+    void onPanic(const EnsemblePacket& packet);
+    void checkPanic();
+    bool isNext(uint32_t seq);  // Suiveur: numero de note attendu, pertes comptees
+    void sync();
+    void play(uint8_t status, uint8_t data1, uint8_t data2);
+
+  public:
+    EnsembleSync(Instrument& instrument);
+    void begin();   // Une fois le WiFi connecte (role ENSEMBLE_ROLE)
+    void update();  // Paquets recus, echanges d'horloge, notes arrivees a echeance
+
+    // Chef: note a jouer par tout l'ensemble. false: pas chef, a jouer localement
+    bool share(uint8_t status, uint8_t data1, uint8_t data2);
+
+    bool isSynced() const { return _clock.isSynced(); }
+    Stats getStats() const { return _stats; }
+    void printStats();
+};
+
+#endif // ENSEMBLESYNC_H
@@ -0,0 +1,56 @@
+#include "JournalUdp.h"
+
+JournalUdp::PacketFunction JournalUdp::packetHandler = nullptr;
+
+int JournalUdp::parsePacket() {
+  int size = WiFiUDP::parsePacket();
+  unsigned long arrivalUs = micros();
+  _length = 0;
+  _position = 0;
+  if (size <= 0) {
+    return size;
+  }
+
+  // Copie du debut du datagramme (tout, sauf au-dela de RTP_JOURNAL_PACKET_MAX)
+  int copied = WiFiUDP::read(_packet, size < RTP_JOURNAL_PACKET_MAX ? size : RTP_JOURNAL_PACKET_MAX);
+  _length = copied > 0 ? copied : 0;
+  if (packetHandler) {
+    packetHandler(_packet, _length, arrivalUs);
+  }
+  return size;
+}
+
+int JournalUdp::available() {
+  return (_length - _position) + WiFiUDP::available();
+}
+
+int JournalUdp::read() {
+  if (_position < _length) {
+    return _packet[_position++];
+  }
+  return WiFiUDP::read();
+}
+
+int JournalUdp::read(unsigned char* buffer, size_t length) {
+  size_t count = 0;
+  while (count < length && _position < _length) {
+    buffer[count++] = _packet[_position++];
+  }
+  if (count < length) {
+    int more = WiFiUDP::read(buffer + count, length - count);
+    if (more > 0) count += more;
+  }
+  return count;
+}
+
+int JournalUdp::peek() {
+  if (_position < _length) {
+    return _packet[_position];
+  }
+  return WiFiUDP::peek();
+}
+
+void JournalUdp::flush() {
+  _position = _length;
+  WiFiUDP::flush();
+}
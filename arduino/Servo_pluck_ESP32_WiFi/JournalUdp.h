@@ -0,0 +1,44 @@
+#ifndef JOURNALUDP_H
+#define JOURNALUDP_H
+
+#include <WiFiUdp.h>
+#include "settings.h"
+/***********************************************************************************************
+----------------------------    JournalUdp.h   -------------------------------------------------
+************************************************************************************************
+Socket UDP des sessions AppleMIDI avec acces aux datagrammes bruts: la bibliotheque lit ses
+paquets octet par octet et ne donne acces ni au journal RTP-MIDI, ni aux horodatages, ni au
+SSRC de l'emetteur. JournalUdp remplace WiFiUDP dans APPLEMIDI_CREATE_CUSTOM_INSTANCE: a chaque
+parsePacket(), le datagramme est copie (jusqu'a RTP_JOURNAL_PACKET_MAX octets) et passe avec
+son heure d'arrivee a la fonction enregistree par setPacketHandler() (MidiSources::onPacket
+dans la lyre), puis servi tel quel a la bibliotheque par read()/peek()/available(). Le
+journal est donc applique, les horodatages connus et la source designee avant que les
+commandes du paquet ne soient livrees.
+
+Les deux sockets (controle et donnees) partagent la meme fonction: parmi les paquets de
+controle, seuls les echanges CK (synchronisation d'horloge) sont utilises.
+************************************************************************************************/
+
+class JournalUdp : public WiFiUDP {
+  private:
+    uint8_t _packet[RTP_JOURNAL_PACKET_MAX];
+    int _length;    // Octets copies du datagramme en cours
+    int _position;  // Prochain octet a servir (au-dela: lu directement dans WiFiUDP)
+
+  public:
+    typedef void (*PacketFunction)(const uint8_t* data, uint16_t length, uint32_t arrivalUs);
+    static void setPacketHandler(PacketFunction handler) { packetHandler = handler; }
+    static PacketFunction packetHandler;  // Commune aux sockets de controle et de donnees
+
+    JournalUdp() : _length(0), _position(0) {}
+
+    int parsePacket();
+    int available();
+    int read();
+    int read(unsigned char* buffer, size_t length);
+    int read(char* buffer, size_t length) { return read((unsigned char*)buffer, length); }
+    int peek();
+    void flush();
+};
+
+#endif // JOURNALUDP_H
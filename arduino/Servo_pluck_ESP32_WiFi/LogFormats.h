@@ -0,0 +1,137 @@
+#ifndef LOGFORMATS_H
+#define LOGFORMATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+/***********************************************************************************************
+----------------------------    LogFormats.h   -------------------------------------------------
+************************************************************************************************
+Messages du journal differe (DeferredLog.h): chaque message est un identifiant et jusqu'a 3
+arguments entiers. Le texte n'est jamais formate dans le chemin critique: il l'est par la
+tache de vidage (mode texte) ou sur le PC par tools/lyre_log (mode binaire).
+
+Ajouter un message: une ligne X(ID, "texte") a la fin de LOG_FORMATS (les identifiants deja
+emis ne doivent pas changer, l'outil PC les relit avec ce meme fichier). Conversions
+acceptees: %lu, %ld, %lx, %lX avec largeur et zeros eventuels.
+
+Trame binaire sur le port serie: 0x00 0xA5 puis un LogRecord (20 octets, little-endian).
+Le texte normal ne contient jamais d'octet 0x00: les deux peuvent se melanger.
+
+Ce fichier n'inclut rien de specifique a Arduino: il est aussi compile par l'outil PC.
+************************************************************************************************/
+
+#define LOG_FORMATS(X) \
+  X(DROPPED,              "[LOG] %lu message(s) perdu(s) (file pleine)") \
+  X(SERVO_BAD_INDEX,      "[SERVO] ERREUR: index servo invalide: %lu") \
+  X(SERVO_PLUCK,          "[SERVO] Pluck servo #%lu - position: %lu") \
+  X(SERVO_MUTE_GROUP,     "[SERVO] Mute groupe: servos %lu-%lu") \
+  X(SERVO_RELEASED,       "[SERVO] Voies liberees: 0x%lX") \
+  X(SERVO_ENABLED,        "[SERVO] Servos actives") \
+  X(INSTR_NOTE_RANGE,     "[INSTRUMENT] Note MIDI %lu hors plage supportee") \
+  X(INSTR_NOTE_UNMAPPED,  "[INSTRUMENT] Note MIDI %lu non jouable (non mappee)") \
+  X(INSTR_PEDAL_RELEASE,  "[INSTRUMENT] Pedale relachee: %lu corde(s) etouffee(s), mouvements evites depuis le demarrage: %lu") \
+  X(INSTR_PANIC,          "[INSTRUMENT] Panique: toutes les cordes au repos") \
+  X(MIDI_IN_NOTE_ON,      "[MIDI IN] Note On: %lu (vel: %lu) canal: %lu") \
+  X(MIDI_IN_NOTE_OFF,     "[MIDI IN] Note Off: %lu canal: %lu") \
+  X(MIDI_IN_CC,           "[MIDI IN] CC: %lu = %lu") \
+  X(MIDI_CHANNEL_IGNORED, "[MIDI] Canal ignore: %lu") \
+  X(MIDI_BAD_VELOCITY,    "[MIDI] Velocite invalide: %lu") \
+  X(MIDI_NOTE_RANGE,      "[MIDI] Note hors plage: %lu") \
+  X(MIDI_RATE_LIMIT,      "[MIDI] RATE LIMIT depasse!") \
+  X(MIDI_OUT_NOTE_ON,     "[MIDI OUT] Note On: %lu (vel: %lu)") \
+  X(MIDI_OUT_NOTE_OFF,    "[MIDI OUT] Note Off: %lu") \
+  X(MIDI_ERROR,           "[MIDI ERR] code %lu (data: %lu), voir ERROR_* dans settings.h") \
+  X(MIDI_PANIC,           "[MIDI] Panique (CC %lu)") \
+  X(MIDI_CC_UNHANDLED,    "[MIDI] CC non gere: %lu = %lu") \
+  X(SYSEX_RECEIVED,       "[SYSEX] Recu %lu octets: %06lX...") \
+  X(SYSEX_TOO_SHORT,      "[SYSEX] Message trop court") \
+  X(SYSEX_NOT_MIDIMIND,   "[SYSEX] Pas un message MidiMind: %02lX %02lX") \
+  X(SYSEX_NOT_REQUEST,    "[SYSEX] Pas une requete, ignore") \
+  X(SYSEX_BLOCK_REQUEST,  "[SYSEX] Block %lu Request recu") \
+  X(SYSEX_BLOCK_REPLY,    "[SYSEX] Block %lu Reply envoye (%lu bytes)") \
+  X(SYSEX_BLOCK_UNKNOWN,  "[SYSEX] Block ID inconnu: %02lX") \
+  X(SYSEX_IDENTITY_REQUEST, "[SYSEX] Identity Request recu") \
+  X(SYSEX_IDENTITY_REPLY, "[SYSEX] Identity Reply envoye") \
+  X(RTP_LOSS,             "[RTP] %lu paquet(s) perdu(s): %lu trou(s) repare(s) par le journal, %lu non repare(s)") \
+  X(RTP_NOTE_ON,          "[RTP] Note On %lu (vel: %lu) canal %lu rejouee depuis le journal") \
+  X(RTP_NOTE_OFF,         "[RTP] Note Off %lu canal %lu recuperee depuis le journal") \
+  X(RTP_CC,               "[RTP] CC %lu = %lu restaure depuis le journal") \
+  X(OSC_NOTE,             "[OSC] Note %lu (vel: %lu) dans %lu us") \
+  X(OSC_MALFORMED,        "[OSC] Datagramme illisible (%lu octets)") \
+  X(ENS_LEADER,           "[ENS] Chef trouve (.%lu), aller-retour %lu us") \
+  X(ENS_FOLLOWER,         "[ENS] Suiveur .%lu connecte (%lu actif(s))") \
+  X(ENS_LOST,             "[ENS] Chef muet depuis %lu ms, recherche") \
+  X(ENS_PANIC,            "[ENS] Panique du chef (%lu note(s) en attente abandonnee(s))")
+
+#define LOG_FORMAT_ENUM(id, text) LOG_##id,
+enum LogFormatId : uint8_t {
+  LOG_FORMATS(LOG_FORMAT_ENUM)
+  LOG_FORMAT_COUNT
+};
+
+#define LOG_MAX_ARGS 3
+
+struct LogRecord {
+  uint32_t timestampUs;  // micros() a l'ecriture
+  uint8_t formatId;      // LogFormatId
+  uint8_t argCount;
+  uint16_t reserved;
+  uint32_t args[LOG_MAX_ARGS];
+};
+
+#define LOG_FRAME_SYNC0 0x00
+#define LOG_FRAME_SYNC1 0xA5
+
+inline const char* logFormatText(uint8_t formatId) {
+  #define LOG_FORMAT_TEXT(id, text) text,
+  static const char* const texts[] = { LOG_FORMATS(LOG_FORMAT_TEXT) };
+  #undef LOG_FORMAT_TEXT
+  return formatId < LOG_FORMAT_COUNT ? texts[formatId] : "[LOG] message inconnu #%lu";
+}
+
+// Formate un enregistrement dans out (tronque a size), retourne la longueur ecrite
+inline int logFormatRecord(char* out, int size, const LogRecord& record) {
+  const char* format = logFormatText(record.formatId);
+  uint32_t unknownArg = record.formatId;
+  const uint32_t* args = record.formatId < LOG_FORMAT_COUNT ? record.args : &unknownArg;
+  uint8_t argCount = record.formatId < LOG_FORMAT_COUNT ? record.argCount : 1;
+  uint8_t argIndex = 0;
+  int length = 0;
+
+  while (*format && length < size - 1) {
+    if (*format != '%') {
+      out[length++] = *format++;
+      continue;
+    }
+    // Specification complete: '%', drapeaux/largeur, 'l', conversion
+    char spec[12];
+    uint8_t n = 0;
+    do {
+      spec[n++] = *format++;
+    } while (*format && n < sizeof(spec) - 2 && !strchr("duxX%", *format));
+    char conversion = *format ? *format++ : 'u';
+    spec[n++] = conversion;
+    spec[n] = 0;
+
+    int written;
+    if (conversion == '%') {
+      written = snprintf(out + length, size - length, "%%");
+    } else {
+      uint32_t value = argIndex < argCount ? args[argIndex] : 0;
+      argIndex++;
+      if (conversion == 'd') {
+        written = snprintf(out + length, size - length, spec, (long)(int32_t)value);
+      } else {
+        written = snprintf(out + length, size - length, spec, (unsigned long)value);
+      }
+    }
+    if (written < 0) break;
+    length += written;
+    if (length > size - 1) length = size - 1;
+  }
+  out[length] = 0;
+  return length;
+}
+
+#endif // LOGFORMATS_H
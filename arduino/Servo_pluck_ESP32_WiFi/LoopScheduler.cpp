@@ -0,0 +1,142 @@
+#include "LoopScheduler.h"
+
+LoopScheduler::Task LoopScheduler::_tasks[LOOP_TASKS_MAX];
+uint8_t LoopScheduler::_taskCount = 0;
+uint32_t LoopScheduler::_wakeWithinMs = UINT32_MAX;
+volatile unsigned long LoopScheduler::_wakeRequestUs = 0;
+volatile bool LoopScheduler::_wakePending = false;
+unsigned long LoopScheduler::_lastRunUs = 0;
+LoopScheduler::Stats LoopScheduler::_stats;
+
+#if defined(ESP32)
+  static TaskHandle_t loopTask = nullptr;
+  static portMUX_TYPE wakeMux = portMUX_INITIALIZER_UNLOCKED;
+  #define WAKE_LOCK() portENTER_CRITICAL(&wakeMux)
+  #define WAKE_UNLOCK() portEXIT_CRITICAL(&wakeMux)
+#else
+  #define WAKE_LOCK()
+  #define WAKE_UNLOCK()
+#endif
+
+void LoopScheduler::begin() {
+  #if defined(ESP32)
+    loopTask = xTaskGetCurrentTaskHandle();
+  #endif
+  resetStats();
+}
+
+bool LoopScheduler::every(const char* name, uint32_t periodMs, TaskFunction function) {
+  if (_taskCount >= LOOP_TASKS_MAX) {
+    Serial.printf("[LOOP] Tache %s ignoree: LOOP_TASKS_MAX atteint\n", name);
+    return false;
+  }
+  Task& task = _tasks[_taskCount++];
+  task.name = name;
+  task.function = function;
+  task.periodUs = periodMs * 1000UL;
+  task.nextUs = micros() + task.periodUs;
+  return true;
+}
+
+void LoopScheduler::wake() {
+  WAKE_LOCK();
+  if (!_wakePending) {
+    _wakePending = true;
+    _wakeRequestUs = micros();
+  }
+  WAKE_UNLOCK();
+  #if defined(ESP32)
+    if (loopTask) {
+      xTaskNotifyGive(loopTask);
+    }
+  #endif
+}
+
+void LoopScheduler::wakeWithin(uint32_t ms) {
+  if (ms < _wakeWithinMs) {
+    _wakeWithinMs = ms;
+  }
+}
+
+void LoopScheduler::run() {
+  unsigned long now = micros();
+  _stats.elapsedUs += now - _lastRunUs;
+  _lastRunUs = now;
+
+  for (uint8_t i = 0; i < _taskCount; i++) {
+    Task& task = _tasks[i];
+    long late = (long)(now - task.nextUs);
+    if (late < 0) continue;
+
+    task.function();
+    _stats.taskRuns++;
+    _stats.lateSumUs += late;
+    if ((uint32_t)late > _stats.lateMaxUs) _stats.lateMaxUs = late;
+
+    // Echeances absolues; une tache en retard de plus d'une periode ne rattrape pas en rafale
+    task.nextUs += task.periodUs;
+    if ((long)(now - task.nextUs) >= 0) {
+      task.nextUs = now + task.periodUs;
+    }
+  }
+
+  // Prochaine echeance: taches, modules (wakeWithin), plafond LOOP_MAX_SLEEP_MS
+  now = micros();
+  uint32_t waitUs = min(_wakeWithinMs, (uint32_t)LOOP_MAX_SLEEP_MS) * 1000UL;
+  for (uint8_t i = 0; i < _taskCount; i++) {
+    long left = (long)(_tasks[i].nextUs - now);
+    waitUs = min(waitUs, left > 0 ? (uint32_t)left : 0);
+  }
+  _wakeWithinMs = UINT32_MAX;
+  _stats.iterations++;
+
+  #if defined(ESP32)
+    // Ticks entiers seulement: a moins d'un tick de l'echeance, l'iteration suivante part tout
+    // de suite plutot que de se reveiller un tick trop tard
+    TickType_t ticks = waitUs / (portTICK_PERIOD_MS * 1000UL);
+    if (ticks > 0) {
+      unsigned long sleepStart = micros();
+      ulTaskNotifyTake(pdTRUE, ticks);
+      _stats.sleepUs += micros() - sleepStart;
+    }
+  #endif
+
+  WAKE_LOCK();
+  bool woken = _wakePending;
+  unsigned long requestUs = _wakeRequestUs;
+  _wakePending = false;
+  WAKE_UNLOCK();
+  if (woken) {
+    uint32_t latency = micros() - requestUs;
+    _stats.wakes++;
+    _stats.wakeLatencySumUs += latency;
+    if (latency > _stats.wakeLatencyMaxUs) _stats.wakeLatencyMaxUs = latency;
+  }
+}
+
+LoopScheduler::Stats LoopScheduler::getStats() {
+  return _stats;
+}
+
+void LoopScheduler::resetStats() {
+  memset(&_stats, 0, sizeof(_stats));
+  _lastRunUs = micros();
+}
+
+void LoopScheduler::print() {
+  Stats s = getStats();
+  uint32_t seconds = s.elapsedUs / 1000000ULL;
+  uint32_t sleepPermille = s.elapsedUs ? (uint32_t)(s.sleepUs * 1000ULL / s.elapsedUs) : 0;
+  Serial.printf("[LOOP] Iterations: %lu (%lu/s) | loop endormie %lu.%lu%% du temps\n",
+                (unsigned long)s.iterations,
+                (unsigned long)(seconds ? s.iterations / seconds : s.iterations),
+                (unsigned long)(sleepPermille / 10), (unsigned long)(sleepPermille % 10));
+  Serial.printf("[LOOP] Reveils par evenement: %lu | delai moy %lu us, max %lu us\n",
+                (unsigned long)s.wakes,
+                (unsigned long)(s.wakes ? s.wakeLatencySumUs / s.wakes : 0),
+                (unsigned long)s.wakeLatencyMaxUs);
+  Serial.printf("[LOOP] Taches: %u, %lu executions | retard moy %lu us, max %lu us\n",
+                _taskCount, (unsigned long)s.taskRuns,
+                (unsigned long)(s.taskRuns ? s.lateSumUs / s.taskRuns : 0),
+                (unsigned long)s.lateMaxUs);
+}
@@ -1,13 +1,25 @@
 #include "MidiHandler.h"
+#include "DeferredLog.h"
+#include "EventTrace.h"
+#include "LoopScheduler.h"
 
-// Initialisation de la variable statique
+// Initialisation des variables statiques
 MidiHandler* MidiHandler::instance = nullptr;
-
-// Creation de l'instance AppleMIDI
-APPLEMIDI_CREATE_DEFAULTSESSION_INSTANCE();
-
-MidiHandler::MidiHandler(Instrument &instrument) : _instrument(instrument) {
+MidiSources MidiHandler::sources;
+EnsembleSync* MidiHandler::ensemble = nullptr;
+
+// Creation de l'instance AppleMIDI: jusqu'a MIDI_SOURCES_MAX participants, socket JournalUdp
+// pour attribuer chaque paquet a sa source et lire journal de recuperation et horodatages
+struct LyreAppleMidiSettings : public APPLEMIDI_NAMESPACE::DefaultSettings {
+  static const uint8_t MaxNumberOfParticipants = MIDI_SOURCES_MAX;
+};
+APPLEMIDI_CREATE_CUSTOM_INSTANCE(JournalUdp, MIDI, APPLEMIDI_SESSION_NAME, DEFAULT_CONTROL_PORT,
+                                 LyreAppleMidiSettings);
+
+MidiHandler::MidiHandler(Instrument &instrument)
+    : _instrument(instrument), _panicCount(instrument.getPanicCount()) {
   instance = this;  // Stocker l'instance pour les callbacks statiques
+  memset(&_journalReported, 0, sizeof(_journalReported));
   if (DEBUG) {
     Serial.println("[MIDI] Handler WiFi initialise");
   }
@@ -24,6 +36,12 @@ void MidiHandler::begin() {
   AppleMIDI.setHandleConnected(onConnected);
   AppleMIDI.setHandleDisconnected(onDisconnected);
 
+  // Chaque datagramme attribue a sa source avant que ses commandes ne soient livrees, pertes
+  // reparees depuis le journal de cette source
+  JournalUdp::setPacketHandler(onPacket);
+  sources.setJournalHandlers(onJournalNoteOn, onJournalNoteOff, onJournalControlChange);
+  sources.setPlayHandler(play);
+
   // Demarrer AppleMIDI
   AppleMIDI.begin(APPLEMIDI_SESSION_NAME);
 
@@ -37,81 +55,189 @@ void MidiHandler::begin() {
 void MidiHandler::update() {
   // Lire les messages MIDI entrants
   AppleMIDI.run();
-}
 
-// Callbacks statiques
-void MidiHandler::onNoteOn(byte channel, byte note, byte velocity) {
-  if (instance && DEBUG) {
-    Serial.print("[MIDI] Note ON - Canal: ");
-    Serial.print(channel);
-    Serial.print(" Note: ");
-    Serial.print(note);
-    Serial.print(" Velocite: ");
-    Serial.println(velocity);
+  // Panique (toutes entrees): les messages en attente ne doivent plus sonner
+  if (_instrument.getPanicCount() != _panicCount) {
+    _panicCount = _instrument.getPanicCount();
+    sources.panic();
   }
 
-  if (instance) {
-    if (velocity > 0) {
-      instance->_instrument.noteOn(note, velocity);
-    } else {
-      // Note Off (velocity 0 = Note Off)
-      instance->_instrument.noteOff(note);
+  // Messages arrives a echeance, toutes sources confondues (budget par appel), puis sommeil
+  // au plus jusqu'au suivant
+  for (uint8_t i = 0; i < MIDI_DISPATCH_BUDGET && sources.dispatch(micros()); i++) {
+  }
+  uint32_t waitUs = sources.usUntilNext(micros());
+  if (waitUs != UINT32_MAX) {
+    LoopScheduler::wakeWithin(waitUs / 1000);
+  }
+
+  // Nouvelles pertes: une ligne par appel, pas par paquet. Totaux des sources connectees: ils
+  // baissent quand l'une d'elles part
+  RtpJournal::Stats s = sources.journalTotals();
+  if (s.gaps != _journalReported.gaps) {
+    if (s.gaps > _journalReported.gaps && s.lost >= _journalReported.lost &&
+        s.repaired >= _journalReported.repaired) {
+      uint32_t repaired = s.repaired - _journalReported.repaired;
+      DeferredLog::log(LOG_RTP_LOSS, s.lost - _journalReported.lost, repaired,
+                       (s.gaps - _journalReported.gaps) - repaired);
     }
+    _journalReported = s;
   }
 }
 
-void MidiHandler::onNoteOff(byte channel, byte note, byte velocity) {
-  if (instance && DEBUG) {
-    Serial.print("[MIDI] Note OFF - Canal: ");
-    Serial.print(channel);
-    Serial.print(" Note: ");
-    Serial.println(note);
+void MidiHandler::printSourceStats() {
+  if (sources.count() == 0) {
+    Serial.println("[SRC] Aucune session");
+    return;
   }
-
-  if (instance) {
-    instance->_instrument.noteOff(note);
+  for (uint8_t i = 0; i < MIDI_SOURCES_MAX; i++) {
+    const MidiSources::Source* s = sources.source(i);
+    if (s) printSource(i, *s);
+  }
+  if (sources.rejected()) {
+    Serial.printf("[SRC] %lu message(s) ecarte(s): session refusee (plus de place) ou fermee\n",
+                  (unsigned long)sources.rejected());
   }
 }
 
-void MidiHandler::onControlChange(byte channel, byte controller, byte value) {
-  if (instance && DEBUG) {
-    Serial.print("[MIDI] Control Change - Canal: ");
-    Serial.print(channel);
-    Serial.print(" Controleur: ");
-    Serial.print(controller);
-    Serial.print(" Valeur: ");
-    Serial.println(value);
-  }
+void MidiHandler::printSource(uint8_t index, const MidiSources::Source& src) {
+  const MidiSources::Stats& m = src.stats;
+  Serial.printf("[SRC] %u \"%s\" (%08lX) | canaux %04X, poids %u | recus: %lu | ecartes: %lu | "
+                "joues: %lu | attente moy %lu us, max %lu us\n",
+                index + 1, src.name[0] ? src.name : "?", (unsigned long)src.ssrc, src.channels,
+                src.weight, (unsigned long)m.received, (unsigned long)m.filtered,
+                (unsigned long)m.played,
+                (unsigned long)(m.played ? m.waitSumUs / m.played : 0), (unsigned long)m.waitMaxUs);
+
+  RtpJournal::Stats j = src.journal.getStats();
+  Serial.printf("[RTP] Paquets: %lu | perdus: %lu en %lu trou(s) | repares: %lu | sans journal: %lu | "
+                "illisibles: %lu | desordre: %lu\n",
+                (unsigned long)j.packets, (unsigned long)j.lost, (unsigned long)j.gaps,
+                (unsigned long)j.repaired, (unsigned long)j.noJournal,
+                (unsigned long)j.malformed, (unsigned long)j.outOfOrder);
+  Serial.printf("[RTP] Journal: %lu noteOn rejoue(s), %lu trop ancien(s), %lu noteOff, %lu CC\n",
+                (unsigned long)j.notesOn, (unsigned long)j.notesLate,
+                (unsigned long)j.notesOff, (unsigned long)j.controllers);
+
+  RtpClock::Stats c = src.clock.getStats();
+  NoteScheduler::Stats s = src.scheduler.getStats();
+  Serial.printf("[RTP] Horloge: %s | %lu echange(s) CK, aller-retour %lu us | decalage %lld ms | "
+                "derive %+.1f ppm\n",
+                src.clock.isSynced() ? "synchronisee (CK)" : "transit minimal",
+                (unsigned long)c.syncs, (unsigned long)c.rttUs, (long long)(c.offsetUs / 1000),
+                c.driftPpm);
+  Serial.printf("[RTP] Transit: %ld us (max %ld) | gigue %lu us | %lu paquet(s) | abandons CK: %lu\n",
+                (long)c.transitUs, (long)c.transitMaxUs, (unsigned long)c.jitterUs,
+                (unsigned long)c.packets, (unsigned long)c.fallbacks);
+  Serial.printf("[RTP] Lecture a +%d ms: %lu message(s), %lu en retard (max %lu us), marge min %ld us, "
+                "file max %u%s\n",
+                RTP_PLAYOUT_MS, (unsigned long)s.scheduled, (unsigned long)s.late,
+                (unsigned long)s.lateMaxUs,
+                s.marginMinUs == UINT32_MAX ? -1L : (long)s.marginMinUs, s.depthMax,
+                s.overflows ? " (file pleine!)" : "");
+}
 
-  if (instance) {
-    instance->processControlChange(controller, value);
+/*------------------------------------------------------------------
+--------------        Lecture horodatee                  ----------
+------------------------------------------------------------------*/
+void MidiHandler::onPacket(const uint8_t* data, uint16_t length, uint32_t arrivalUs) {
+  sources.onPacket(data, length, arrivalUs);
+}
+
+// Instrument commun: la source ne sert qu'aux mesures de MidiSources. Chef d'ensemble: les
+// notes sont jouees par toutes les lyres a l'heure commune (EnsembleSync)
+void MidiHandler::play(uint8_t, const NoteScheduler::Event& event) {
+  uint8_t data1 = event.data1;
+  uint8_t data2 = event.data2;
+  switch (event.status & 0xF0) {
+    case MIDI_NOTE_ON:
+      if (data2 > 0) {
+        if (ensemble && ensemble->share(MIDI_NOTE_ON, data1, data2)) break;
+        EventTrace::record(TRACE_MIDI_NOTE_ON, data1, data2);
+        if (instance) instance->_instrument.noteOn(data1, data2);
+        break;
+      }
+      // Note On velocity 0 = Note Off
+      [[fallthrough]];
+    case MIDI_NOTE_OFF:
+      if (ensemble && ensemble->share(MIDI_NOTE_OFF, data1, 0)) break;
+      EventTrace::record(TRACE_MIDI_NOTE_OFF, data1);
+      if (instance) instance->_instrument.noteOff(data1);
+      break;
+    case MIDI_CONTROL_CHANGE:
+      EventTrace::record(TRACE_MIDI_CC, data1, data2);
+      if (instance) instance->processControlChange(data1, data2);
+      break;
   }
 }
 
+// Callbacks statiques
+void MidiHandler::onNoteOn(byte channel, byte note, byte velocity) {
+  DeferredLog::log(LOG_MIDI_IN_NOTE_ON, note, velocity, channel);
+  sources.receive(MIDI_NOTE_ON | ((channel - 1) & 0x0F), note, velocity, micros());
+}
+
+void MidiHandler::onNoteOff(byte channel, byte note, byte velocity) {
+  DeferredLog::log(LOG_MIDI_IN_NOTE_OFF, note, channel);
+  sources.receive(MIDI_NOTE_OFF | ((channel - 1) & 0x0F), note, velocity, micros());
+}
+
+void MidiHandler::onControlChange(byte channel, byte controller, byte value) {
+  DeferredLog::log(LOG_MIDI_IN_CC, controller, value);
+  sources.receive(MIDI_CONTROL_CHANGE | ((channel - 1) & 0x0F), controller, value, micros());
+}
+
 void MidiHandler::onSysEx(const byte* data, uint16_t length) {
-  if (DEBUG) {
-    Serial.print("[SYSEX] Recu ");
-    Serial.print(length);
-    Serial.print(" bytes: ");
-    for (uint16_t i = 0; i < length && i < 20; i++) {
-      Serial.print(data[i], HEX);
-      Serial.print(" ");
-    }
-    Serial.println();
+  unsigned long receiveUs = micros();  // Au plus pres du paquet RTP (Block 3: ping)
+
+  // Longueur et 3 premiers octets (F0, fabricant, sous-ID): assez pour trier les requetes
+  uint32_t header = 0;
+  for (uint16_t i = 0; i < 3; i++) {
+    header = (header << 8) | (i < length ? data[i] : 0);
   }
-  processSysEx(data, length);
+  DeferredLog::log(LOG_SYSEX_RECEIVED, length, header);
+  processSysEx(data, length, receiveUs);
+}
+
+// Messages perdus: a l'horodatage du paquet qui les repare, apres ceux deja programmes
+void MidiHandler::onJournalNoteOn(uint8_t channel, uint8_t note, uint8_t velocity) {
+  DeferredLog::log(LOG_RTP_NOTE_ON, note, velocity, channel + 1);
+  sources.repair(MIDI_NOTE_ON | channel, note, velocity);
+}
+
+void MidiHandler::onJournalNoteOff(uint8_t channel, uint8_t note) {
+  DeferredLog::log(LOG_RTP_NOTE_OFF, note, channel + 1);
+  sources.repair(MIDI_NOTE_OFF | channel, note, 0);
+}
+
+void MidiHandler::onJournalControlChange(uint8_t channel, uint8_t controller, uint8_t value) {
+  DeferredLog::log(LOG_RTP_CC, controller, value);
+  sources.repair(MIDI_CONTROL_CHANGE | channel, controller, value);
 }
 
 void MidiHandler::onConnected(const APPLEMIDI_NAMESPACE::ssrc_t & ssrc, const char* name) {
+  int8_t index = sources.connect(ssrc, name);
   if (DEBUG) {
-    Serial.print("[MIDI] Connecte a session: ");
-    Serial.println(name);
+    const MidiSources::Source* s = index >= 0 ? sources.source(index) : nullptr;
+    if (s) {
+      Serial.printf("[MIDI] Connecte a session: %s (source %d/%d, canaux %04X, poids %u)\n", name,
+                    index + 1, MIDI_SOURCES_MAX, s->channels, s->weight);
+    } else {
+      Serial.printf("[MIDI] Session %s refusee: %d sources deja connectees\n", name,
+                    MIDI_SOURCES_MAX);
+    }
   }
 }
 
 void MidiHandler::onDisconnected(const APPLEMIDI_NAMESPACE::ssrc_t & ssrc) {
+  // Les noteOff de la session perdue n'arriveront jamais: ses notes sont relachees, et tout
+  // l'instrument quand plus personne ne joue
+  uint8_t remaining = sources.disconnect(ssrc);
   if (DEBUG) {
-    Serial.println("[MIDI] Deconnecte");
+    Serial.printf("[MIDI] Deconnecte (%u session(s) restante(s))\n", remaining);
+  }
+  if (remaining == 0 && instance) {
+    instance->_instrument.panic();
   }
 }
 
@@ -130,11 +256,19 @@ void MidiHandler::processControlChange(byte controller, byte value) {
     case 0x07: // Volume
       //_instrument.volumeControl(value);
       break;
-    case 121: // Reinitialisation de tous les controleurs
-      //_instrument.reset();
+    case 64: // Pedale sustain: mutes differes jusqu'au relachement
+      _instrument.setSustain(value >= 64);
+      break;
+    case 66: // Sostenuto: seules les notes tenues a l'appui sont prolongees
+      _instrument.setSostenuto(value >= 64);
       break;
+    case 68: // Legato: mode pluck-through (le servo traverse la corde a chaque note)
+      _instrument.setPluckThrough(value >= 64);
+      break;
+    case 120: // All Sound Off
+    case 121: // Reinitialisation de tous les controleurs (pedales relachees)
     case 123: // Desactiver toutes les notes
-      //_instrument.mute();
+      _instrument.panic();  // Une seule ecriture I2C, attentes annulees
       break;
     // Ajouter d'autres cas selon les besoins
   }
@@ -144,10 +278,10 @@ void MidiHandler::processControlChange(byte controller, byte value) {
 --------------        MidiMind SysEx Protocol            ----------
 ------------------------------------------------------------------*/
 
-void MidiHandler::processSysEx(const byte* data, uint16_t length) {
+void MidiHandler::processSysEx(const byte* data, uint16_t length, unsigned long receiveUs) {
   // Verifier la taille minimale: F0 7D 00 XX 00 F7 = 6 bytes
   if (length < 6) {
-    if (DEBUG) Serial.println("[SYSEX] Message trop court");
+    DeferredLog::log(LOG_SYSEX_TOO_SHORT);
     return;
   }
 
@@ -157,12 +291,7 @@ void MidiHandler::processSysEx(const byte* data, uint16_t length) {
 
   // Verifier Manufacturer ID et Sub ID
   if (data[offset] != MIDIMIND_MANUFACTURER_ID || data[offset + 1] != MIDIMIND_SUB_ID) {
-    if (DEBUG) {
-      Serial.print("[SYSEX] Pas un message MidiMind: ");
-      Serial.print(data[offset], HEX);
-      Serial.print(" ");
-      Serial.println(data[offset + 1], HEX);
-    }
+    DeferredLog::log(LOG_SYSEX_NOT_MIDIMIND, data[offset], data[offset + 1]);
     return;
   }
 
@@ -171,26 +300,32 @@ void MidiHandler::processSysEx(const byte* data, uint16_t length) {
 
   // Traiter uniquement les requests
   if (msgType != MIDIMIND_REQUEST_TYPE) {
-    if (DEBUG) Serial.println("[SYSEX] Pas une requete, ignore");
+    DeferredLog::log(LOG_SYSEX_NOT_REQUEST);
     return;
   }
 
   switch (blockId) {
     case MIDIMIND_BLOCK1_ID:
-      if (DEBUG) Serial.println("[SYSEX] Block 1 Request recu");
+      DeferredLog::log(LOG_SYSEX_BLOCK_REQUEST, 1);
       sendBlock1Reply();
       break;
 
     case MIDIMIND_BLOCK2_ID:
-      if (DEBUG) Serial.println("[SYSEX] Block 2 Request recu");
+      DeferredLog::log(LOG_SYSEX_BLOCK_REQUEST, 2);
       sendBlock2Reply();
       break;
 
-    default:
-      if (DEBUG) {
-        Serial.print("[SYSEX] Block ID inconnu: ");
-        Serial.println(blockId, HEX);
+    case MIDIMIND_PING_ID:
+      // F0 7D 00 03 00 <nonce: 5 octets> F7
+      if (length < offset + 4 + 5) {
+        DeferredLog::log(LOG_SYSEX_TOO_SHORT);
+        break;
       }
+      sendPingReply(data + offset + 4, receiveUs);
+      break;
+
+    default:
+      DeferredLog::log(LOG_SYSEX_BLOCK_UNKNOWN, blockId);
       break;
   }
 }
@@ -255,11 +390,7 @@ void MidiHandler::sendBlock1Reply() {
   // Envoyer via AppleMIDI
   AppleMIDI.sendSysEx(reply, idx);
 
-  if (DEBUG) {
-    Serial.print("[SYSEX] Block 1 Reply envoye (");
-    Serial.print(idx);
-    Serial.println(" bytes)");
-  }
+  DeferredLog::log(LOG_SYSEX_BLOCK_REPLY, 1, idx);
 }
 
 /*------------------------------------------------------------------
@@ -296,11 +427,40 @@ void MidiHandler::sendBlock2Reply() {
   // Envoyer via AppleMIDI
   AppleMIDI.sendSysEx(reply, idx);
 
-  if (DEBUG) {
-    Serial.print("[SYSEX] Block 2 Reply envoye (");
-    Serial.print(idx);
-    Serial.println(" bytes)");
+  DeferredLog::log(LOG_SYSEX_BLOCK_REPLY, 2, idx);
+}
+
+/*------------------------------------------------------------------
+--------------        Block 3 Reply (Ping)               ----------
+Structure: F0 7D 00 03 01 <Nonce[5]> <RxUs[5]> <TxUs[5]> F7
+Le nonce est renvoye tel quel. RxUs: micros() a la reception du SysEx,
+TxUs: micros() juste avant l'envoi de la reponse (7 bits par octet,
+poids faible en premier). L'ecart TxUs - RxUs est le temps passe dans
+la lyre, a retrancher de l'aller-retour mesure par l'hote.
+------------------------------------------------------------------*/
+void MidiHandler::sendPingReply(const byte* nonce, unsigned long receiveUs) {
+  byte reply[21];
+  uint8_t idx = 0;
+
+  reply[idx++] = 0xF0;
+  reply[idx++] = MIDIMIND_MANUFACTURER_ID;
+  reply[idx++] = MIDIMIND_SUB_ID;
+  reply[idx++] = MIDIMIND_PING_ID;
+  reply[idx++] = MIDIMIND_REPLY_TYPE;
+  for (uint8_t i = 0; i < 5; i++) {
+    reply[idx++] = nonce[i] & 0x7F;
+  }
+  uint32_t rx = receiveUs;
+  for (uint8_t i = 0; i < 5; i++, rx >>= 7) {
+    reply[idx++] = rx & 0x7F;
   }
+  uint32_t tx = micros();
+  for (uint8_t i = 0; i < 5; i++, tx >>= 7) {
+    reply[idx++] = tx & 0x7F;
+  }
+  reply[idx++] = 0xF7;
+
+  AppleMIDI.sendSysEx(reply, idx);
 }
 
 /*------------------------------------------------------------------
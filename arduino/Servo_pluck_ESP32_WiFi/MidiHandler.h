@@ -3,6 +3,9 @@
 
 #include <AppleMIDI.h>
 #include "instrument.h"
+#include "JournalUdp.h"
+#include "MidiSources.h"
+#include "EnsembleSync.h"
 /***********************************************************************************************
 ----------------------------    MIDI message handler WiFi  -------------------------------------
 ************************************************************************************************
@@ -12,6 +15,28 @@ via les methodes .noteOn, .noteOff, etc...
 Supporte le protocole MidiMind SysEx pour l'identification de l'instrument:
 - Block 1: Identification (nom, notes jouables, polyphonie)
 - Block 2: Capacites avancees (CC, aftertouch, pitch bend, etc.)
+- Block 3: Ping (nonce renvoye avec les instants de reception et d'envoi, tools/lyre_ping)
+
+Plusieurs participants (MIDI_SOURCES_MAX sessions simultanees): la session lit ses paquets
+par JournalUdp et chaque datagramme est attribue a sa source par MidiSources, qui garde pour
+chacune son journal, son horloge et sa file, avec ses regles de canaux et son poids
+(MIDI_SOURCE_RULES). Les messages de toutes les sources sont joues dans update(), par ordre
+d'echeance et a tour de role (MIDI_SOURCES_FAIR), au plus MIDI_DISPATCH_BUDGET par appel.
+
+Paquets UDP perdus: avec RTP_JOURNAL, le journal de recuperation du paquet suivant de la meme
+source rejoue les noteOn recents, applique les noteOff et restaure les CC perdus
+(RtpJournal.h). Les messages livres normalement lui sont signales.
+
+Lecture horodatee (RTP_PLAYOUT_MS > 0): noteOn, noteOff et CC ne sont pas joues a leur
+arrivee mais a leur instant d'envoi (horodatage RTP converti par RtpClock) plus
+RTP_PLAYOUT_MS. Les messages repares par le journal sont programmes a l'horodatage du paquet
+qui les repare; les SysEx sont traites des reception et repondus a toutes les sessions.
+
+Panique (CC 120/121/123, derniere session perdue, /lyre/panic: Instrument::getPanicCount()
+change): les messages en attente de toutes les sources sont abandonnes.
+
+Chef d'ensemble (setEnsemble()): les noteOn et noteOff a jouer sont confies a EnsembleSync,
+qui les relaie aux autres lyres et les joue a l'heure commune.
 ************************************************************************************************/
 
 // Constantes MidiMind SysEx Protocol
@@ -19,6 +44,7 @@ Supporte le protocole MidiMind SysEx pour l'identification de l'instrument:
 #define MIDIMIND_SUB_ID           0x00  // MidiMind
 #define MIDIMIND_BLOCK1_ID        0x01  // Block 1: Identification
 #define MIDIMIND_BLOCK2_ID        0x02  // Block 2: Capacites
+#define MIDIMIND_PING_ID          0x03  // Block 3: Ping (mesure de latence)
 #define MIDIMIND_REQUEST_TYPE     0x00  // Request
 #define MIDIMIND_REPLY_TYPE       0x01  // Reply
 #define MIDIMIND_VERSION          0x01  // Version 1.0
@@ -35,20 +61,35 @@ class MidiHandler {
     Instrument& _instrument;
     void processControlChange(byte controller, byte value);
 
+    // Sessions AppleMIDI: messages en attente de leur instant d'envoi + RTP_PLAYOUT_MS
+    static MidiSources sources;
+    static void onPacket(const uint8_t* data, uint16_t length, uint32_t arrivalUs);
+    static void play(uint8_t source, const NoteScheduler::Event& event);
+    static void printSource(uint8_t index, const MidiSources::Source& s);
+    static EnsembleSync* ensemble;  // Chef d'ensemble: notes jouees par toutes les lyres
+
     // Callbacks pour AppleMIDI
     static void onNoteOn(byte channel, byte note, byte velocity);
     static void onNoteOff(byte channel, byte note, byte velocity);
     static void onControlChange(byte channel, byte controller, byte value);
     static void onSysEx(const byte* data, uint16_t length);
 
+    // Messages perdus, repares depuis le journal RTP-MIDI de la source courante
+    static void onJournalNoteOn(uint8_t channel, uint8_t note, uint8_t velocity);
+    static void onJournalNoteOff(uint8_t channel, uint8_t note);
+    static void onJournalControlChange(uint8_t channel, uint8_t controller, uint8_t value);
+    RtpJournal::Stats _journalReported;  // Pertes deja signalees dans le journal differe
+    uint16_t _panicCount;                // Instrument::getPanicCount() deja traite
+
     // Callbacks de connexion
     static void onConnected(const APPLEMIDI_NAMESPACE::ssrc_t & ssrc, const char* name);
     static void onDisconnected(const APPLEMIDI_NAMESPACE::ssrc_t & ssrc);
 
     // MidiMind SysEx handlers
-    static void processSysEx(const byte* data, uint16_t length);
+    static void processSysEx(const byte* data, uint16_t length, unsigned long receiveUs);
     static void sendBlock1Reply();
     static void sendBlock2Reply();
+    static void sendPingReply(const byte* nonce, unsigned long receiveUs);
     static void encode7BitBitmap(const byte* bitmap16, byte* encoded19);
     static void buildNoteBitmap(byte* bitmap16);
 
@@ -59,6 +100,8 @@ class MidiHandler {
     MidiHandler(Instrument &instrument);
     void begin();
     void update();
+    void setEnsemble(EnsembleSync* sync) { ensemble = sync; }
+    void printSourceStats();
 };
 
 #endif // MIDIHANDLER_H
@@ -0,0 +1,311 @@
+#include "MidiSources.h"
+
+#define RTP_VERSION_2 0x80
+#define RTP_PAYLOAD_MIDI 0x61
+
+static const MidiSources::Rule defaultRules[] = MIDI_SOURCE_RULES;
+
+static uint32_t readBe32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+MidiSources::MidiSources()
+    : _rules(defaultRules), _ruleCount(sizeof(defaultRules) / sizeof(defaultRules[0])),
+      _current(-1), _arrivalUs(0), _rejected(0), _fair(MIDI_SOURCES_FAIR), _play(nullptr) {
+  for (uint8_t i = 0; i < MIDI_SOURCES_MAX; i++) {
+    _sources[i].active = false;
+  }
+}
+
+void MidiSources::setJournalHandlers(RtpJournal::NoteOnFunction noteOn,
+                                     RtpJournal::NoteOffFunction noteOff,
+                                     RtpJournal::ControlChangeFunction controlChange) {
+  for (uint8_t i = 0; i < MIDI_SOURCES_MAX; i++) {
+    _sources[i].journal.setHandlers(noteOn, noteOff, controlChange);
+  }
+}
+
+void MidiSources::setRules(const Rule* rules, uint8_t count) {
+  _rules = rules;
+  _ruleCount = count;
+  for (uint8_t i = 0; i < MIDI_SOURCES_MAX; i++) {
+    if (_sources[i].active) applyRule(_sources[i]);
+  }
+}
+
+int8_t MidiSources::find(uint32_t ssrc) const {
+  for (uint8_t i = 0; i < MIDI_SOURCES_MAX; i++) {
+    if (_sources[i].active && _sources[i].ssrc == ssrc) return i;
+  }
+  return -1;
+}
+
+void MidiSources::applyRule(Source& s) {
+  // Premiere regle dont le nom de session commence par prefix; aucune: tout est accepte
+  s.channels = 0xFFFF;
+  s.weight = 1;
+  for (uint8_t r = 0; r < _ruleCount; r++) {
+    if (strncmp(s.name, _rules[r].prefix, strlen(_rules[r].prefix)) == 0) {
+      s.channels = _rules[r].channels;
+      s.weight = _rules[r].weight ? _rules[r].weight : 1;
+      break;
+    }
+  }
+  s.credit = s.weight;
+}
+
+/*------------------------------------------------------------------
+--------------        Sessions                           ----------
+------------------------------------------------------------------*/
+int8_t MidiSources::connect(uint32_t ssrc, const char* name) {
+  int8_t index = find(ssrc);
+  if (index < 0) {
+    for (uint8_t i = 0; i < MIDI_SOURCES_MAX && index < 0; i++) {
+      if (!_sources[i].active) index = i;
+    }
+    if (index < 0) return -1;
+
+    Source& s = _sources[index];
+    s.active = true;
+    s.ssrc = ssrc;
+    memset(s.notesHeld, 0, sizeof(s.notesHeld));
+    memset(&s.stats, 0, sizeof(s.stats));
+    s.journal.reset();
+    s.journal.resetStats();
+    s.clock.reset();
+    s.clock.resetStats();
+    s.scheduler.clear();
+    s.scheduler.resetStats();
+  }
+
+  // Invitation repetee par une session deja ouverte: nom et regle mis a jour
+  Source& s = _sources[index];
+  strncpy(s.name, name ? name : "", MIDI_SOURCE_NAME_MAX - 1);
+  s.name[MIDI_SOURCE_NAME_MAX - 1] = 0;
+  applyRule(s);
+  return index;
+}
+
+uint8_t MidiSources::disconnect(uint32_t ssrc) {
+  int8_t index = find(ssrc);
+  if (index >= 0) {
+    Source& s = _sources[index];
+    s.scheduler.clear();  // Ses noteOff n'arriveront jamais
+    s.active = false;
+    if (_current == index) _current = -1;
+
+    // Notes qu'aucune autre source ne tient: relachees
+    for (uint8_t note = 0; note < 128; note++) {
+      if (!isHeld(s, note)) continue;
+      bool shared = false;
+      for (uint8_t i = 0; i < MIDI_SOURCES_MAX && !shared; i++) {
+        shared = _sources[i].active && isHeld(_sources[i], note);
+      }
+      if (!shared && _play) {
+        NoteScheduler::Event e = { 0, MIDI_NOTE_OFF, note, 0 };
+        _play(index, e);
+      }
+    }
+  }
+  return count();
+}
+
+void MidiSources::panic() {
+  for (uint8_t i = 0; i < MIDI_SOURCES_MAX; i++) {
+    Source& s = _sources[i];
+    s.scheduler.clear();
+    memset(s.notesHeld, 0, sizeof(s.notesHeld));  // Cordes deja au repos
+  }
+}
+
+/*------------------------------------------------------------------
+--------------        Reception                          ----------
+------------------------------------------------------------------*/
+void MidiSources::onPacket(const uint8_t* data, uint16_t length, uint32_t arrivalUs) {
+  uint32_t ssrc;
+  if (length >= 36 && data[0] == 0xFF && data[1] == 0xFF && data[2] == 'C' && data[3] == 'K') {
+    ssrc = readBe32(data + 4);  // Echange CK
+  } else if (length >= 13 && (data[0] & 0xC0) == RTP_VERSION_2 &&
+             (data[1] & 0x7F) == RTP_PAYLOAD_MIDI) {
+    ssrc = readBe32(data + 8);
+  } else {
+    return;  // Invitation, fin de session...: pas de commandes
+  }
+
+  _arrivalUs = arrivalUs;
+  _current = find(ssrc);
+  if (_current < 0) return;  // Pas une session ouverte: ses messages seront ecartes
+  Source& s = _sources[_current];
+  s.clock.onPacket(data, length, arrivalUs);  // Avant le journal: horodatage des reparations
+#if RTP_JOURNAL
+  s.journal.onPacket(data, length);
+#endif
+}
+
+void MidiSources::receive(uint8_t status, uint8_t data1, uint8_t data2, uint32_t nowUs) {
+  if (_current < 0) {
+    _rejected++;
+    return;
+  }
+  Source& s = _sources[_current];
+  switch (status & 0xF0) {
+    case MIDI_NOTE_ON:
+      if (data2 > 0) {
+        s.journal.noteOnReceived(data1);
+        break;
+      }
+      // Note On velocity 0 = Note Off
+      [[fallthrough]];
+    case MIDI_NOTE_OFF:
+      s.journal.noteOffReceived(data1);
+      break;
+    case MIDI_CONTROL_CHANGE:
+      s.journal.controlChangeReceived(data1, data2);
+      break;
+  }
+  enqueue(_current, s.clock.commandTime(status, data1), nowUs, status, data1, data2);
+}
+
+// Messages perdus: a l'horodatage du paquet qui les repare, apres ceux deja programmes
+void MidiSources::repair(uint8_t status, uint8_t data1, uint8_t data2) {
+  if (_current < 0) return;
+  enqueue(_current, _sources[_current].clock.packetTime(), _arrivalUs, status, data1, data2);
+}
+
+void MidiSources::enqueue(uint8_t index, uint32_t sentUs, uint32_t nowUs, uint8_t status,
+                          uint8_t data1, uint8_t data2) {
+  Source& s = _sources[index];
+  s.stats.received++;
+  if (!(s.channels & (1 << (status & 0x0F)))) {
+    s.stats.filtered++;
+    return;
+  }
+#if RTP_PLAYOUT_MS > 0
+  uint32_t dueUs = sentUs + RTP_PLAYOUT_MS * 1000UL;  // Instant d'envoi + delai de lecture
+#else
+  (void)sentUs;
+  uint32_t dueUs = nowUs;  // Des que possible, dans l'ordre d'arrivee
+#endif
+  if (!s.scheduler.schedule(dueUs, nowUs, status, data1, data2)) {
+    NoteScheduler::Event e = { nowUs, status, data1, data2 };  // File pleine: joue aussitot
+    deliver(index, e);
+  }
+}
+
+/*------------------------------------------------------------------
+--------------        Lecture                            ----------
+------------------------------------------------------------------*/
+void MidiSources::deliver(uint8_t index, const NoteScheduler::Event& event) {
+  Source& s = _sources[index];
+  uint8_t note = event.data1 & 0x7F;
+  switch (event.status & 0xF0) {
+    case MIDI_NOTE_ON:
+      if (event.data2 > 0) {
+        s.notesHeld[note >> 3] |= (1 << (note & 7));
+        break;
+      }
+      // Note On velocity 0 = Note Off
+      [[fallthrough]];
+    case MIDI_NOTE_OFF:
+      s.notesHeld[note >> 3] &= ~(1 << (note & 7));
+      break;
+  }
+  s.stats.played++;
+  if (_play) _play(index, event);
+}
+
+bool MidiSources::dispatch(uint32_t nowUs) {
+  for (uint8_t pass = 0; pass < 2; pass++) {
+    // Message du le plus ancien parmi les sources qui ont encore du credit
+    int8_t best = -1;
+    bool waiting = false;  // Une source a un message du mais plus de credit
+    for (uint8_t i = 0; i < MIDI_SOURCES_MAX; i++) {
+      const Source& s = _sources[i];
+      const NoteScheduler::Event* head = s.active ? s.scheduler.peek() : nullptr;
+      if (!head || (int32_t)(head->dueUs - nowUs) > 0) continue;
+      if (_fair && s.credit == 0) {
+        waiting = true;
+        continue;
+      }
+      if (best < 0 || (int32_t)(head->dueUs - _sources[best].scheduler.peek()->dueUs) < 0) {
+        best = i;
+      }
+    }
+    if (best < 0) {
+      if (!waiting) return false;
+      // Tour termine: chaque source retrouve son poids
+      for (uint8_t i = 0; i < MIDI_SOURCES_MAX; i++) {
+        _sources[i].credit = _sources[i].weight;
+      }
+      continue;
+    }
+
+    Source& s = _sources[best];
+    NoteScheduler::Event e;
+    s.scheduler.pop(nowUs, &e);
+    if (s.credit > 0) s.credit--;
+    uint32_t waitUs = nowUs - e.dueUs;
+    s.stats.waitSumUs += waitUs;
+    if (waitUs > s.stats.waitMaxUs) s.stats.waitMaxUs = waitUs;
+    deliver(best, e);
+    return true;
+  }
+  return false;
+}
+
+uint32_t MidiSources::usUntilNext(uint32_t nowUs) {
+  uint32_t wait = UINT32_MAX;
+  for (uint8_t i = 0; i < MIDI_SOURCES_MAX; i++) {
+    if (!_sources[i].active) continue;
+    uint32_t w = _sources[i].scheduler.usUntilNext(nowUs);
+    if (w < wait) wait = w;
+  }
+  return wait;
+}
+
+/*------------------------------------------------------------------
+--------------        Mesures                            ----------
+------------------------------------------------------------------*/
+uint8_t MidiSources::count() const {
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < MIDI_SOURCES_MAX; i++) {
+    if (_sources[i].active) n++;
+  }
+  return n;
+}
+
+const MidiSources::Source* MidiSources::source(uint8_t index) const {
+  return index < MIDI_SOURCES_MAX && _sources[index].active ? &_sources[index] : nullptr;
+}
+
+RtpJournal::Stats MidiSources::journalTotals() const {
+  RtpJournal::Stats total;
+  memset(&total, 0, sizeof(total));
+  for (uint8_t i = 0; i < MIDI_SOURCES_MAX; i++) {
+    if (!_sources[i].active) continue;
+    RtpJournal::Stats s = _sources[i].journal.getStats();
+    total.packets += s.packets;
+    total.lost += s.lost;
+    total.gaps += s.gaps;
+    total.repaired += s.repaired;
+    total.noJournal += s.noJournal;
+    total.outOfOrder += s.outOfOrder;
+    total.malformed += s.malformed;
+    total.notesOn += s.notesOn;
+    total.notesLate += s.notesLate;
+    total.notesOff += s.notesOff;
+    total.controllers += s.controllers;
+  }
+  return total;
+}
+
+void MidiSources::resetStats() {
+  _rejected = 0;
+  for (uint8_t i = 0; i < MIDI_SOURCES_MAX; i++) {
+    Source& s = _sources[i];
+    memset(&s.stats, 0, sizeof(s.stats));
+    s.journal.resetStats();
+    s.clock.resetStats();
+    s.scheduler.resetStats();
+  }
+}
@@ -0,0 +1,131 @@
+#ifndef MIDISOURCES_H
+#define MIDISOURCES_H
+
+#include <stdint.h>
+#include <string.h>
+#include "settings.h"
+#include "RtpJournal.h"
+#include "RtpClock.h"
+#include "NoteScheduler.h"
+/***********************************************************************************************
+----------------------------    MidiSources.h   ------------------------------------------------
+************************************************************************************************
+Plusieurs sessions AppleMIDI simultanees (jusqu'a MIDI_SOURCES_MAX: ordinateur, tablette...)
+fusionnees en un seul flux pour l'instrument. Chaque source, reconnue par son SSRC, a son
+journal RTP-MIDI (RtpJournal), son horloge (RtpClock) et sa file de lecture (NoteScheduler):
+pertes, horodatages et deconnexion d'un participant n'affectent pas les autres.
+
+La bibliotheque livre les commandes sans dire de quelle session elles viennent, mais toujours
+pendant la lecture du paquet qui les porte: onPacket() (appele par JournalUdp pour chaque
+datagramme) designe la source courante d'apres le SSRC du paquet, receive() et repair() (pour
+les reparations de son journal) lui attribuent ensuite les messages. Seules les sessions
+ouvertes (connect(), a l'acceptation de l'invitation) sont des sources: les messages d'un SSRC
+inconnu (session refusee faute de place, paquets d'une session deja fermee) sont ecartes et
+comptes, sans occuper de place ni empecher la panique de la derniere deconnexion.
+
+Regles (MIDI_SOURCE_RULES, choisies par le debut du nom de session): canaux acceptes, les
+autres messages sont ecartes; poids de la source dans le tour equitable.
+
+dispatch() joue un message du, le plus ancien d'abord (appele en boucle, heure relue a chaque
+message: l'instrument prend du temps). Avec MIDI_SOURCES_FAIR, chaque source
+a un credit egal a son poids, depense a chaque message joue et rendu a toutes quand plus
+aucune source en attente n'en a (tour pondere): une source bavarde (rafales de CC) ne retarde
+les autres que d'un message par tour au lieu de toute sa rafale.
+
+Mesures par source: messages recus, ecartes, joues; attente entre l'echeance et le jeu
+(moyenne, maximum). L'echeance est l'instant d'envoi + RTP_PLAYOUT_MS, ou l'arrivee pour un
+message en retard (bilan NoteScheduler de la source).
+
+Ce fichier n'inclut rien de specifique a Arduino: il est aussi compile par l'outil PC
+tools/lyre_sessions (plusieurs pairs sur des sockets locales).
+************************************************************************************************/
+
+#define MIDI_SOURCE_NAME_MAX 24  // Nom de session conserve (tronque)
+
+class MidiSources {
+  public:
+    struct Rule {
+      const char* prefix;  // Debut du nom de session ("" = toutes)
+      uint16_t channels;   // Bit 0 = canal 1
+      uint8_t weight;      // Messages par tour (1 a 255)
+    };
+
+    // Message a jouer maintenant, venant de la source index
+    typedef void (*PlayFunction)(uint8_t source, const NoteScheduler::Event& event);
+
+    struct Stats {
+      uint32_t received;   // Messages livres ou repares par le journal
+      uint32_t filtered;   // ...hors des canaux de la regle, ecartes
+      uint32_t played;
+      uint64_t waitSumUs;  // Attente echeance -> jeu
+      uint32_t waitMaxUs;
+    };
+
+    struct Source {
+      bool active;
+      uint32_t ssrc;
+      char name[MIDI_SOURCE_NAME_MAX];
+      uint16_t channels;
+      uint8_t weight;
+      uint8_t credit;
+      uint8_t notesHeld[16];  // Notes jouees par cette source, pas encore relachees
+      RtpJournal journal;
+      RtpClock clock;
+      NoteScheduler scheduler;
+      Stats stats;
+    };
+
+  private:
+    Source _sources[MIDI_SOURCES_MAX];
+    const Rule* _rules;
+    uint8_t _ruleCount;
+    int8_t _current;     // Source du paquet en cours de lecture (-1: aucune)
+    uint32_t _arrivalUs; // ...et son heure d'arrivee
+    uint32_t _rejected;  // Messages d'un SSRC inconnu (session refusee ou fermee)
+    bool _fair;
+    PlayFunction _play;
+
+    int8_t find(uint32_t ssrc) const;
+    void applyRule(Source& s);
+    void enqueue(uint8_t index, uint32_t sentUs, uint32_t nowUs, uint8_t status, uint8_t data1,
+                 uint8_t data2);
+    void deliver(uint8_t index, const NoteScheduler::Event& event);
+    static bool isHeld(const Source& s, uint8_t note) {
+      return s.notesHeld[note >> 3] & (1 << (note & 7));
+    }
+
+  public:
+    MidiSources();
+    void setPlayHandler(PlayFunction play) { _play = play; }
+    void setRules(const Rule* rules, uint8_t count);  // Defaut: MIDI_SOURCE_RULES
+    void setFair(bool fair) { _fair = fair; }         // Defaut: MIDI_SOURCES_FAIR
+    // Reparations des journaux de toutes les sources, a renvoyer a repair()
+    void setJournalHandlers(RtpJournal::NoteOnFunction noteOn, RtpJournal::NoteOffFunction noteOff,
+                            RtpJournal::ControlChangeFunction controlChange);
+
+    // Session ouverte (invitation acceptee). -1: plus de place
+    int8_t connect(uint32_t ssrc, const char* name);
+    // Session fermee: file abandonnee, notes tenues par elle seule relachees. Sources restantes
+    uint8_t disconnect(uint32_t ssrc);
+    // Panique de l'instrument: files de toutes les sources abandonnees, notes tenues oubliees
+    void panic();
+
+    // Datagramme recu (JournalUdp), avant que la bibliotheque n'en livre les commandes
+    void onPacket(const uint8_t* data, uint16_t length, uint32_t arrivalUs);
+    // Message de canal livre par la bibliotheque pour le paquet courant
+    void receive(uint8_t status, uint8_t data1, uint8_t data2, uint32_t nowUs);
+    // Message perdu, repare par le journal du paquet courant
+    void repair(uint8_t status, uint8_t data1, uint8_t data2);
+
+    // Joue le prochain message du (le plus ancien, au tour de sa source). false: aucun
+    bool dispatch(uint32_t nowUs);
+    uint32_t usUntilNext(uint32_t nowUs);  // UINT32_MAX: rien en attente
+
+    uint8_t count() const;
+    const Source* source(uint8_t index) const;  // nullptr: place libre
+    RtpJournal::Stats journalTotals() const;    // Pertes de toutes les sources
+    uint32_t rejected() const { return _rejected; }
+    void resetStats();
+};
+
+#endif // MIDISOURCES_H
@@ -0,0 +1,66 @@
+#include "NoteScheduler.h"
+
+NoteScheduler::NoteScheduler() {
+  clear();
+  resetStats();
+}
+
+bool NoteScheduler::schedule(uint32_t dueUs, uint32_t nowUs, uint8_t status, uint8_t data1,
+                             uint8_t data2) {
+  if (_count >= RTP_PLAYOUT_QUEUE) {
+    _stats.overflows++;
+    return false;
+  }
+
+  int32_t margin = (int32_t)(dueUs - nowUs);
+  if (margin < 0) {
+    // Arrive trop tard: joue des que possible, apres les messages deja dus
+    _stats.late++;
+    if ((uint32_t)-margin > _stats.lateMaxUs) _stats.lateMaxUs = -margin;
+    dueUs = nowUs;
+  } else if ((uint32_t)margin < _stats.marginMinUs) {
+    _stats.marginMinUs = margin;
+  }
+  _stats.scheduled++;
+
+  // Insertion triee depuis la fin: les messages arrivent presque toujours dans l'ordre
+  uint8_t i = _count;
+  while (i > 0 && (int32_t)(at(i - 1).dueUs - dueUs) > 0) {
+    at(i) = at(i - 1);
+    i--;
+  }
+  Event& e = at(i);
+  e.dueUs = dueUs;
+  e.status = status;
+  e.data1 = data1;
+  e.data2 = data2;
+  _count++;
+  if (_count > _stats.depthMax) _stats.depthMax = _count;
+  return true;
+}
+
+bool NoteScheduler::pop(uint32_t nowUs, Event* event) {
+  if (_count == 0 || (int32_t)(_events[_head].dueUs - nowUs) > 0) {
+    return false;
+  }
+  *event = _events[_head];
+  _head = (_head + 1) % RTP_PLAYOUT_QUEUE;
+  _count--;
+  return true;
+}
+
+uint32_t NoteScheduler::usUntilNext(uint32_t nowUs) {
+  if (_count == 0) return UINT32_MAX;
+  int32_t wait = (int32_t)(_events[_head].dueUs - nowUs);
+  return wait > 0 ? wait : 0;
+}
+
+void NoteScheduler::clear() {
+  _head = 0;
+  _count = 0;
+}
+
+void NoteScheduler::resetStats() {
+  memset(&_stats, 0, sizeof(_stats));
+  _stats.marginMinUs = UINT32_MAX;
+}
@@ -0,0 +1,67 @@
+#ifndef NOTESCHEDULER_H
+#define NOTESCHEDULER_H
+
+#include <stdint.h>
+#include <string.h>
+#include "settings.h"
+/***********************************************************************************************
+----------------------------    NoteScheduler.h   ----------------------------------------------
+************************************************************************************************
+File d'attente des messages MIDI programmes: chaque message recu est joue a son instant
+d'envoi converti en heure locale (RtpClock), plus le delai de lecture RTP_PLAYOUT_MS. La gigue
+du WiFi est absorbee tant qu'un paquet arrive avec moins de RTP_PLAYOUT_MS de retard sur le
+plus rapide; au-dela, le message est joue des son arrivee et compte en retard.
+
+File triee par echeance (RTP_PLAYOUT_QUEUE messages, insertion en fin dans le cas courant):
+pop() rend les messages dus dans l'ordre, usUntilNext() donne le sommeil possible. Pleine, la
+file refuse le message (a jouer tout de suite par l'appelant).
+
+Mesures: messages programmes, en retard (retard max), marge minimale entre l'arrivee et
+l'echeance (delai de lecture superflu), profondeur maximale de la file.
+
+Ce fichier n'inclut rien de specifique a Arduino: il est aussi compile par l'outil PC
+tools/lyre_playout.
+************************************************************************************************/
+
+class NoteScheduler {
+  public:
+    struct Event {
+      uint32_t dueUs;  // micros() d'echeance
+      uint8_t status;  // Statut MIDI recu (canal compris)
+      uint8_t data1;
+      uint8_t data2;
+    };
+
+    struct Stats {
+      uint32_t scheduled;   // Messages programmes
+      uint32_t late;        // ...arrives apres leur echeance (joues aussitot)
+      uint32_t lateMaxUs;
+      uint32_t marginMinUs; // Plus petite avance a l'arrivee (UINT32_MAX: aucune)
+      uint32_t overflows;   // File pleine: joues aussitot
+      uint8_t depthMax;
+    };
+
+  private:
+    Event _events[RTP_PLAYOUT_QUEUE];
+    uint8_t _head;
+    uint8_t _count;
+    Stats _stats;
+
+    Event& at(uint8_t i) { return _events[(_head + i) % RTP_PLAYOUT_QUEUE]; }
+
+  public:
+    NoteScheduler();
+
+    // Message recu a nowUs, a jouer a dueUs. false: file pleine
+    bool schedule(uint32_t dueUs, uint32_t nowUs, uint8_t status, uint8_t data1, uint8_t data2);
+    bool pop(uint32_t nowUs, Event* event);  // Prochain message du, s'il y en a un
+    uint32_t usUntilNext(uint32_t nowUs);    // UINT32_MAX: file vide
+    const Event* peek() const { return _count ? &_events[_head] : nullptr; }  // Prochain, du ou non
+    void clear();                            // Deconnexion, panique: messages abandonnes
+    uint8_t size() const { return _count; }
+
+    Stats getStats() const { return _stats; }
+    void resetStats();
+};
+
+#endif // NOTESCHEDULER_H
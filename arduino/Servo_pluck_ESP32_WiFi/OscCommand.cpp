@@ -0,0 +1,97 @@
+#include "OscCommand.h"
+
+/*------------------------------------------------------------------
+--------------        Adresses OSC                       ----------
+------------------------------------------------------------------*/
+bool OscCommand::decode(const OscMessage& message) {
+  type = OSC_COMMAND_NONE;
+  noteCount = 0;
+
+  // Velocite optionnelle (argument 1): entiere 0-127 ou reelle 0.0-1.0
+  int32_t v = OSC_DEFAULT_VELOCITY;
+  char argType;
+  if (message.arg(1, &argType)) {
+    float f;
+    if ((argType == 'f' || argType == 'd') && message.getFloat(1, &f)) {
+      v = (int32_t)(f * 127 + 0.5f);
+    } else if (!message.getInt(1, &v)) {
+      return false;
+    }
+    v = v < 0 ? 0 : v > 127 ? 127 : v;
+  }
+  velocity = v;
+  status = velocity ? MIDI_NOTE_ON : MIDI_NOTE_OFF;
+
+  int32_t value;
+  if (message.is("/lyre/note") && message.getInt(0, &value) && value >= 0 && value < 128) {
+    // 0-15: numero de servo, au-dela note MIDI (les cordes commencent a MIDI_NOTE_MIN)
+    notes[noteCount++] = value < NUM_SERVOS ? MidiServoMapping[value] : value;
+    type = OSC_COMMAND_NOTES;
+  } else if (message.is("/lyre/chord") && message.getInt(0, &value)) {
+    for (uint8_t servo = 0; servo < NUM_SERVOS; servo++) {
+      if (value & (1 << servo)) notes[noteCount++] = MidiServoMapping[servo];
+    }
+    type = OSC_COMMAND_NOTES;
+  } else if (message.is("/lyre/panic")) {
+    type = OSC_COMMAND_PANIC;
+  } else if (message.is("/lyre/clock")) {
+    type = OSC_COMMAND_CLOCK;
+  }
+  return type != OSC_COMMAND_NONE;
+}
+
+/*------------------------------------------------------------------
+--------------        Heure des bundles                  ----------
+------------------------------------------------------------------*/
+OscClock::OscClock()
+    : _init(false), _localExt(0), _minSinceUs(0), _minLead(INT64_MAX), _regularSeen(false) {
+  _minTransit[0] = _minTransit[1] = INT64_MAX;
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+uint32_t OscClock::toLocal(uint64_t timetag, uint32_t arrivalUs) {
+  if (!_init) {
+    _localExt = arrivalUs;
+    _minSinceUs = _localExt;
+    _init = true;
+  } else {
+    _localExt += (int32_t)(arrivalUs - (uint32_t)_localExt);
+  }
+
+  // Timetag NTP (secondes depuis 1900, fraction sur 32 bits) en microsecondes
+  int64_t senderUs = (int64_t)(timetag >> 32) * 1000000LL +
+                     (int64_t)(((timetag & 0xFFFFFFFFULL) * 1000000ULL) >> 32);
+  int64_t transit = _localExt - senderUs;
+
+  if (_localExt - _minSinceUs >= OSC_CLOCK_WINDOW_US) {
+    if (!_regularSeen && _minLead != INT64_MAX) {
+      // Rien que des bundles en avance pendant une fenetre: nouvelle heure de la regie
+      _minTransit[0] = _minLead;
+      _stats.steps++;
+    } else {
+      _minTransit[0] = _minTransit[1];
+    }
+    _minTransit[1] = INT64_MAX;
+    _minLead = INT64_MAX;
+    _regularSeen = false;
+    _minSinceUs = _localExt;
+  }
+
+  int64_t reference = _minTransit[0] < _minTransit[1] ? _minTransit[0] : _minTransit[1];
+  if (reference != INT64_MAX && transit < reference - OSC_LEAD_MIN_US) {
+    if (transit >= reference - OSC_LEAD_MAX_US) {
+      // En avance: joue a son heure, la reference ne bouge pas
+      _stats.leads++;
+      if (transit < _minLead) _minLead = transit;
+      return (uint32_t)(senderUs + reference);
+    }
+    _minTransit[0] = INT64_MAX;  // Trop en avance: la regie a change d'heure
+    _minTransit[1] = INT64_MAX;
+    _stats.steps++;
+  }
+
+  _regularSeen = true;
+  if (transit < _minTransit[1]) _minTransit[1] = transit;
+  reference = _minTransit[0] < _minTransit[1] ? _minTransit[0] : _minTransit[1];
+  return (uint32_t)(senderUs + reference);
+}
@@ -0,0 +1,72 @@
+#ifndef OSCCOMMAND_H
+#define OSCCOMMAND_H
+
+#include <stdint.h>
+#include <string.h>
+#include "OscParser.h"
+#include "settings.h"
+/***********************************************************************************************
+----------------------------    OscCommand.h   -------------------------------------------------
+************************************************************************************************
+Ce qu'OscListener fait d'un message OSC, sans le WiFi ni l'instrument:
+
+OscCommand: adresse et arguments ramenes a des messages MIDI (notes des cordes, statut,
+velocite) ou a une panique.
+
+OscClock: heure locale (micros()) du timetag d'un bundle. L'horloge de la regie est inconnue:
+la reference est le plus petit transit (arrivee - timetag) des dernieres secondes, comme
+RtpClock avant le premier echange CK. Le premier bundle, ou une regie qui horodate toujours
+avec la meme avance, fixe donc la reference: ce decalage constant est absorbe, le rythme
+conserve. Un bundle horodate plus de OSC_LEAD_MIN_US en avance sur la reference est joue avec
+cette avance et ne deplace pas la reference (sinon les suivants seraient decales pendant 4 a
+8 s). Une fenetre entiere de bundles en avance (la regie a change d'heure), ou une avance de
+plus de OSC_LEAD_MAX_US, fait repartir la reference.
+
+Ce fichier n'inclut rien de specifique a Arduino: il est aussi compile par l'outil PC
+tools/lyre_osc.
+************************************************************************************************/
+
+#define OSC_CLOCK_WINDOW_US 4000000  // Transit minimal sur 4 a 8 s
+#define OSC_LEAD_MIN_US 5000         // Avance sur la reference jouee telle quelle
+#define OSC_LEAD_MAX_US 4000000      // ...au-dela, la regie a change d'heure
+
+#define OSC_COMMAND_NONE 0   // Adresse ou arguments non reconnus
+#define OSC_COMMAND_NOTES 1  // /lyre/note, /lyre/chord
+#define OSC_COMMAND_PANIC 2  // /lyre/panic
+#define OSC_COMMAND_CLOCK 3  // /lyre/clock: reference d'horloge seule (bundle horodate)
+
+struct OscCommand {
+  uint8_t type;              // OSC_COMMAND_...
+  uint8_t status;            // NOTES: MIDI_NOTE_ON, MIDI_NOTE_OFF si velocite 0
+  uint8_t velocity;
+  uint8_t noteCount;
+  uint8_t notes[NUM_SERVOS];
+
+  // false: OSC_COMMAND_NONE
+  bool decode(const OscMessage& message);
+};
+
+class OscClock {
+  public:
+    struct Stats {
+      uint32_t leads;  // Bundles en avance sur la reference, joues avec leur avance
+      uint32_t steps;  // Reference reprise (regie qui a change d'heure)
+    };
+
+  private:
+    bool _init;
+    int64_t _localExt;        // micros() etendu a 64 bits
+    int64_t _minTransit[2];   // Deux fenetres glissantes: suit une derive lente
+    int64_t _minSinceUs;
+    int64_t _minLead;         // Plus petit transit en avance de la fenetre courante
+    bool _regularSeen;        // ...et au moins un bundle a l'heure dans cette fenetre
+    Stats _stats;
+
+  public:
+    OscClock();
+    // Instant local (micros()) du timetag d'un bundle arrive a arrivalUs, sans OSC_PLAYOUT_MS
+    uint32_t toLocal(uint64_t timetag, uint32_t arrivalUs);
+    Stats getStats() const { return _stats; }
+};
+
+#endif // OSCCOMMAND_H
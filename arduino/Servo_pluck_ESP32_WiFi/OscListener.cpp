@@ -0,0 +1,133 @@
+#include "OscListener.h"
+#include "DeferredLog.h"
+#include "EventTrace.h"
+#include "LoopScheduler.h"
+
+OscListener::OscListener(Instrument& instrument)
+    : _instrument(instrument), _started(false), _ensemble(nullptr),
+      _panicCount(instrument.getPanicCount()) {
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+void OscListener::begin() {
+  _started = _udp.begin(OSC_PORT);
+  if (DEBUG) {
+    Serial.printf("[OSC] %s sur le port %d\n", _started ? "Ecoute" : "ECHEC de l'ecoute", OSC_PORT);
+  }
+}
+
+void OscListener::update() {
+  if (!_started) return;
+
+  // Panique d'une autre entree (CC 120/121/123, session perdue): messages en attente abandonnes
+  if (_instrument.getPanicCount() != _panicCount) {
+    _panicCount = _instrument.getPanicCount();
+    _scheduler.clear();
+  }
+
+  // Datagrammes en attente: chacun lu dans _packet puis analyse sur place
+  int size;
+  while ((size = _udp.parsePacket()) > 0) {
+    uint32_t arrivalUs = micros();
+    _stats.packets++;
+    if (size > (int)sizeof(_packet)) {
+      _stats.truncated++;  // Ne tiendrait pas dans _packet: ignore
+      _udp.flush();
+      continue;
+    }
+    int length = _udp.read(_packet, sizeof(_packet));
+    if (length <= 0) continue;
+
+    OscPacket packet(_packet, length);
+    OscMessage message;
+    while (packet.next(message)) {
+      handle(message, arrivalUs);
+    }
+    if (packet.malformed()) {
+      _stats.malformed++;
+      DeferredLog::log(LOG_OSC_MALFORMED, length);
+    }
+  }
+
+  // Messages arrives a echeance, puis sommeil au plus jusqu'au suivant
+  NoteScheduler::Event e;
+  while (_scheduler.pop(micros(), &e)) {
+    play(e.status, e.data1, e.data2);
+  }
+  uint32_t waitUs = _scheduler.usUntilNext(micros());
+  if (waitUs != UINT32_MAX) {
+    LoopScheduler::wakeWithin(waitUs / 1000);
+  }
+}
+
+/*------------------------------------------------------------------
+--------------        Adresses OSC                       ----------
+------------------------------------------------------------------*/
+void OscListener::handle(const OscMessage& message, uint32_t arrivalUs) {
+  _stats.messages++;
+  bool timed = message.timetag != OSC_IMMEDIATE;
+  uint32_t dueUs = arrivalUs;
+  if (timed) {
+    _stats.bundled++;
+    dueUs = _clock.toLocal(message.timetag, arrivalUs) + OSC_PLAYOUT_MS * 1000UL;
+  }
+
+  OscCommand command;
+  if (!command.decode(message)) {
+    _stats.unknown++;
+  } else if (command.type == OSC_COMMAND_NOTES) {
+    for (uint8_t i = 0; i < command.noteCount; i++) {
+      submit(timed, dueUs, arrivalUs, command.status, command.notes[i], command.velocity);
+    }
+  } else if (command.type == OSC_COMMAND_PANIC) {
+    // Messages precedents abandonnes, pas les suivants du meme datagramme. Files MIDI et
+    // d'ensemble videes par leur update() (Instrument::getPanicCount())
+    _scheduler.clear();
+    _instrument.panic();
+    _panicCount = _instrument.getPanicCount();
+  }
+  // OSC_COMMAND_CLOCK: le timetag a servi de reference, rien a jouer
+}
+
+/*------------------------------------------------------------------
+--------------        Lecture horodatee                  ----------
+------------------------------------------------------------------*/
+void OscListener::submit(bool timed, uint32_t dueUs, uint32_t nowUs, uint8_t status,
+                         uint8_t data1, uint8_t data2) {
+  int32_t inUs = (int32_t)(dueUs - nowUs);
+  DeferredLog::log(LOG_OSC_NOTE, data1, status == MIDI_NOTE_ON ? data2 : 0, inUs > 0 ? inUs : 0);
+  // Bundle: programme (en retard: joue au prochain passage et compte). Sinon tout de suite
+  if (timed && _scheduler.schedule(dueUs, nowUs, status, data1, data2)) {
+    return;
+  }
+  play(status, data1, data2);
+}
+
+void OscListener::play(uint8_t status, uint8_t data1, uint8_t data2) {
+  if (_ensemble && _ensemble->share(status, data1, data2)) return;
+  if (status == MIDI_NOTE_ON) {
+    EventTrace::record(TRACE_MIDI_NOTE_ON, data1, data2);
+    _instrument.noteOn(data1, data2);
+  } else {
+    EventTrace::record(TRACE_MIDI_NOTE_OFF, data1);
+    _instrument.noteOff(data1);
+  }
+}
+
+void OscListener::printStats() {
+  NoteScheduler::Stats s = _scheduler.getStats();
+  Serial.printf("[OSC] Port %d: %lu datagramme(s), %lu message(s) dont %lu en bundle | "
+                "illisibles: %lu | tronques: %lu | inconnus: %lu\n",
+                OSC_PORT, (unsigned long)_stats.packets, (unsigned long)_stats.messages,
+                (unsigned long)_stats.bundled, (unsigned long)_stats.malformed,
+                (unsigned long)_stats.truncated, (unsigned long)_stats.unknown);
+  Serial.printf("[OSC] Lecture a +%d ms: %lu message(s), %lu en retard (max %lu us), "
+                "marge min %ld us, file max %u%s\n",
+                OSC_PLAYOUT_MS, (unsigned long)s.scheduled, (unsigned long)s.late,
+                (unsigned long)s.lateMaxUs,
+                s.marginMinUs == UINT32_MAX ? -1L : (long)s.marginMinUs, s.depthMax,
+                s.overflows ? " (file pleine!)" : "");
+  OscClock::Stats c = _clock.getStats();
+  Serial.printf("[OSC] Horloge: %lu bundle(s) en avance, %lu reprise(s) de la reference\n",
+                (unsigned long)c.leads, (unsigned long)c.steps);
+}
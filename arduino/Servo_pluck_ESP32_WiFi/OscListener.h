@@ -0,0 +1,76 @@
+#ifndef OSCLISTENER_H
+#define OSCLISTENER_H
+
+#include <WiFiUdp.h>
+#include "instrument.h"
+#include "NoteScheduler.h"
+#include "OscParser.h"
+#include "OscCommand.h"
+#include "EnsembleSync.h"
+#include "settings.h"
+/***********************************************************************************************
+----------------------------    OscListener.h   ------------------------------------------------
+************************************************************************************************
+Entree OSC sur UDP (port OSC_PORT), pour les systemes de regie qui parlent deja OSC: pas de
+session, pas de journal, un datagramme par commande. Adresses:
+
+  /lyre/note <servo|note> [velocite]  0-15: numero de servo, sinon note MIDI. Velocite entiere
+                                      (0-127) ou reelle (0.0-1.0), 0 = noteOff, absente =
+                                      OSC_DEFAULT_VELOCITY
+  /lyre/chord <masque> [velocite]     Bit N = servo N, toutes les cordes du masque grattees
+                                      (velocite 0: etouffees)
+  /lyre/panic                         Toutes les cordes au repos, messages en attente (OSC,
+                                      MIDI, ensemble) abandonnes
+  /lyre/clock                         Rien: dans un bundle horodate "maintenant", reference
+                                      d'horloge pour un bundle en avance qui le suit
+
+Les messages sont lus en place dans le datagramme (OscParser.h), traduits par OscCommand et
+joues par le meme chemin que le MIDI: instrument.noteOn() / noteOff(), avec trace
+d'evenements.
+
+Bundles horodates: le timetag (heure NTP de la regie) est ramene a l'heure locale par OscClock
+(transit minimal des dernieres secondes, avances jouees telles quelles, OscCommand.h); le
+message est programme a cet instant plus OSC_PLAYOUT_MS (NoteScheduler). Le rythme de la regie
+est ainsi conserve malgre la gigue du WiFi. Messages hors bundle et timetag "immediatement":
+joues des reception. Chef d'ensemble (setEnsemble()): les notes sont confiees a EnsembleSync
+au moment de les jouer, et jouees par toutes les lyres.
+************************************************************************************************/
+
+class OscListener {
+  public:
+    struct Stats {
+      uint32_t packets;    // Datagrammes recus
+      uint32_t messages;   // Messages lus (bundles compris)
+      uint32_t bundled;    // ...horodates par un bundle
+      uint32_t malformed;  // Datagrammes illisibles (en tout ou partie)
+      uint32_t unknown;    // Adresses ou arguments non reconnus
+      uint32_t truncated;  // Datagrammes plus longs que OSC_PACKET_MAX, ignores
+    };
+
+  private:
+    Instrument& _instrument;
+    WiFiUDP _udp;
+    bool _started;
+    uint8_t _packet[OSC_PACKET_MAX];
+    NoteScheduler _scheduler;
+    EnsembleSync* _ensemble;
+    uint16_t _panicCount;  // Instrument::getPanicCount() deja traite
+    Stats _stats;
+
+    OscClock _clock;  // Correspondance timetag -> micros()
+
+    void handle(const OscMessage& message, uint32_t arrivalUs);
+    void submit(bool timed, uint32_t dueUs, uint32_t nowUs, uint8_t status, uint8_t data1,
+                uint8_t data2);
+    void play(uint8_t status, uint8_t data1, uint8_t data2);
+
+  public:
+    OscListener(Instrument& instrument);
+    void begin();   // Une fois le WiFi connecte
+    void update();  // Datagrammes recus, puis messages arrives a echeance
+    void setEnsemble(EnsembleSync* ensemble) { _ensemble = ensemble; }
+    Stats getStats() const { return _stats; }
+    void printStats();
+};
+
+#endif // OSCLISTENER_H
@@ -0,0 +1,225 @@
+#ifndef OSCPARSER_H
+#define OSCPARSER_H
+
+#include <stdint.h>
+#include <string.h>
+/***********************************************************************************************
+----------------------------    OscParser.h   --------------------------------------------------
+************************************************************************************************
+Lecture de paquets OSC 1.0 (Open Sound Control) sans copie: adresse, types et arguments sont
+lus en place dans le datagramme recu, rien n'est alloue ni recopie.
+
+  OscPacket packet(data, length);
+  OscMessage message;
+  while (packet.next(message)) {
+    if (message.is("/lyre/note")) { int32_t note; message.getInt(0, &note); ... }
+  }
+  if (packet.malformed()) ...
+
+Un paquet est un message ("/adresse", ",types", arguments) ou un bundle ("#bundle", timetag,
+elements prefixes par leur taille), eventuellement imbrique (OSC_BUNDLE_DEPTH niveaux).
+Chaque message porte le timetag du bundle le plus proche qui le contient (format NTP: secondes
+depuis 1900 sur 32 bits, fraction sur 32 bits); hors bundle, OSC_IMMEDIATE. Tailles multiples
+de 4, chaines terminees par 0 dans le paquet: sinon le paquet est illisible et la lecture
+s'arrete (les messages deja rendus restent valides).
+
+Arguments lus: i (int32), f (float32), h (int64), d (float64), T/F (vrai/faux), s et S
+(chaines), b (blob), t (timetag), c, r, m (4 octets), N et I (sans donnees).
+
+Ce fichier n'inclut rien de specifique a Arduino: il est aussi compile par l'outil PC
+tools/lyre_osc.
+************************************************************************************************/
+
+#define OSC_BUNDLE_DEPTH 4        // Bundles imbriques lus
+#define OSC_IMMEDIATE 1ULL        // Timetag "immediatement"
+
+struct OscMessage {
+  const char* address;  // Terminee par 0, dans le paquet
+  const char* types;    // Types des arguments, sans la virgule ("" si absents)
+  const uint8_t* args;  // Premier argument
+  const uint8_t* end;   // Fin du message
+  uint64_t timetag;     // Bundle englobant, OSC_IMMEDIATE hors bundle
+
+  static uint32_t readBe32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+  }
+
+  // Octets occupes par une chaine OSC (0 final et bourrage compris), 0: pas terminee avant end
+  static uint32_t stringSize(const uint8_t* p, const uint8_t* end) {
+    const uint8_t* zero = (const uint8_t*)memchr(p, 0, end - p);
+    return zero ? ((zero - p) & ~3u) + 4 : 0;
+  }
+
+  bool is(const char* pattern) const { return strcmp(address, pattern) == 0; }
+  uint8_t count() const { return strlen(types); }
+
+  // Argument index: position et type. nullptr: absent ou hors du message
+  const uint8_t* arg(uint8_t index, char* type) const {
+    const uint8_t* p = args;
+    for (uint8_t i = 0; types[i]; i++) {
+      uint32_t size;
+      switch (types[i]) {
+        case 'i': case 'f': case 'c': case 'r': case 'm': size = 4; break;
+        case 'h': case 'd': case 't': size = 8; break;
+        case 's': case 'S': size = p < end ? stringSize(p, end) : 0; break;
+        case 'b': size = p + 4 <= end ? 4 + ((readBe32(p) + 3) & ~3u) : 0; break;
+        case 'T': case 'F': case 'N': case 'I': size = 0; break;
+        default: return nullptr;  // Type inconnu: taille inconnue, la suite est illisible
+      }
+      if ((types[i] == 's' || types[i] == 'S' || types[i] == 'b') && size == 0) return nullptr;
+      if (p + size > end) return nullptr;
+      if (i == index) {
+        *type = types[i];
+        return p;
+      }
+      p += size;
+    }
+    return nullptr;
+  }
+
+  // Nombre entier: i, h, f et d arrondis, T = 1, F = 0
+  bool getInt(uint8_t index, int32_t* value) const {
+    char type;
+    const uint8_t* p = arg(index, &type);
+    if (!p) return false;
+    switch (type) {
+      case 'i': *value = (int32_t)readBe32(p); return true;
+      case 'h': *value = (int32_t)readBe32(p + 4); return true;
+      case 'T': *value = 1; return true;
+      case 'F': *value = 0; return true;
+      case 'f': case 'd': {
+        float f;
+        if (!getFloat(index, &f)) return false;
+        *value = (int32_t)(f < 0 ? f - 0.5f : f + 0.5f);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Nombre reel: f, d, i, h
+  bool getFloat(uint8_t index, float* value) const {
+    char type;
+    const uint8_t* p = arg(index, &type);
+    if (!p) return false;
+    switch (type) {
+      case 'f': {
+        uint32_t bits = readBe32(p);
+        memcpy(value, &bits, 4);
+        return true;
+      }
+      case 'd': {
+        uint64_t bits = ((uint64_t)readBe32(p) << 32) | readBe32(p + 4);
+        double d;
+        memcpy(&d, &bits, 8);
+        *value = (float)d;
+        return true;
+      }
+      case 'i': *value = (float)(int32_t)readBe32(p); return true;
+      case 'h': *value = (float)(int32_t)readBe32(p + 4); return true;
+    }
+    return false;
+  }
+
+  // Chaine s ou S, dans le paquet
+  const char* getString(uint8_t index) const {
+    char type;
+    const uint8_t* p = arg(index, &type);
+    return p && (type == 's' || type == 'S') ? (const char*)p : nullptr;
+  }
+};
+
+class OscPacket {
+  private:
+    struct Frame {
+      const uint8_t* pos;  // Prochain element du bundle
+      const uint8_t* end;
+      uint64_t timetag;
+    };
+
+    Frame _stack[OSC_BUNDLE_DEPTH + 1];
+    uint8_t _depth;
+    bool _malformed;
+
+    bool fail() {
+      _malformed = true;
+      _depth = 0;
+      _stack[0].pos = _stack[0].end;
+      return false;
+    }
+
+    static bool isBundle(const uint8_t* p, const uint8_t* end) {
+      return end - p >= 16 && memcmp(p, "#bundle", 8) == 0;
+    }
+
+    // Message occupant exactement [p, end)
+    bool readMessage(const uint8_t* p, const uint8_t* end, uint64_t timetag, OscMessage& m) {
+      if (p >= end || *p != '/') return fail();
+      uint32_t size = OscMessage::stringSize(p, end);
+      if (size == 0) return fail();
+      m.address = (const char*)p;
+      p += size;
+      if (p < end && *p == ',') {
+        size = OscMessage::stringSize(p, end);
+        if (size == 0) return fail();
+        m.types = (const char*)p + 1;
+        p += size;
+      } else {
+        m.types = "";  // Ancien format sans types: pas d'arguments lisibles
+      }
+      m.args = p;
+      m.end = end;
+      m.timetag = timetag;
+      return true;
+    }
+
+  public:
+    OscPacket(const uint8_t* data, uint32_t length) : _depth(0), _malformed(false) {
+      _stack[0].pos = data;
+      _stack[0].end = data + length;
+      _stack[0].timetag = OSC_IMMEDIATE;
+      if (length & 3) fail();
+    }
+
+    // Message suivant (dans l'ordre du paquet, bundles parcourus). false: fin ou illisible
+    bool next(OscMessage& message) {
+      while (true) {
+        Frame& f = _stack[_depth];
+        if (f.pos >= f.end) {
+          if (_depth == 0) return false;
+          _depth--;  // Fin du bundle
+          continue;
+        }
+
+        const uint8_t* start;
+        const uint8_t* stop;
+        if (_depth == 0) {
+          // Niveau du datagramme: un seul message ou un seul bundle
+          start = f.pos;
+          stop = f.end;
+        } else {
+          if (f.end - f.pos < 4) return fail();
+          uint32_t size = OscMessage::readBe32(f.pos);
+          if ((size & 3) || size > (uint32_t)(f.end - f.pos - 4)) return fail();
+          start = f.pos + 4;
+          stop = start + size;
+        }
+        f.pos = stop;
+
+        if (isBundle(start, stop)) {
+          if (_depth >= OSC_BUNDLE_DEPTH) return fail();
+          Frame& inner = _stack[++_depth];
+          inner.pos = start + 16;
+          inner.end = stop;
+          inner.timetag = ((uint64_t)OscMessage::readBe32(start + 8) << 32) |
+                          OscMessage::readBe32(start + 12);
+          continue;
+        }
+        return readMessage(start, stop, _stack[_depth].timetag, message);
+      }
+    }
+
+    bool malformed() const { return _malformed; }
+};
+
+#endif // OSCPARSER_H
@@ -0,0 +1,287 @@
+#include "RtpClock.h"
+
+#define RTP_VERSION_2 0x80
+#define RTP_PAYLOAD_MIDI 0x61
+#define CK_TOLERANCE_US 2000      // Avance toleree d'un paquet sur son envoi converti (+ RTT / 2)
+#define CK_DRIFT_SPAN_US 5000000  // Derive estimee sur au moins 5 s d'echanges
+#define CK_DRIFT_MAX 0.0005       // +/- 500 ppm: au-dela, echanges incoherents
+
+static uint32_t readBe32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+RtpClock::RtpClock() {
+  reset();
+  resetStats();
+}
+
+void RtpClock::reset() {
+  _started = false;
+  _ssrc = 0;
+  _localInit = false;
+  _senderInit = false;
+  _localExt = 0;
+  _senderExt = 0;
+  _ckPending = false;
+  _sampleCount = 0;
+  _sampleNext = 0;
+  _ckValid = false;
+  _refLocalUs = 0;
+  _offsetUs = 0;
+  _drift = 0;
+  _minTransit[0] = _minTransit[1] = INT64_MAX;
+  _minSinceUs = 0;
+  _haveTransit = false;
+  _jitter16 = 0;
+  _commandCount = 0;
+  _commandNext = 0;
+  _packetSenderUs = 0;
+}
+
+int64_t RtpClock::extendLocal(uint32_t us) {
+  if (!_localInit) {
+    _localExt = us;
+    _localInit = true;
+  } else {
+    _localExt += (int32_t)(us - (uint32_t)_localExt);
+  }
+  return _localExt;
+}
+
+int64_t RtpClock::extendSender(uint32_t timestamp) {
+  if (!_senderInit) {
+    _senderExt = timestamp;
+    _senderInit = true;
+  } else {
+    _senderExt += (int32_t)(timestamp - (uint32_t)_senderExt);
+  }
+  return _senderExt;
+}
+
+bool RtpClock::onPacket(const uint8_t* data, uint16_t length, uint32_t localUs) {
+  if (length >= 36 && data[0] == 0xFF && data[1] == 0xFF && data[2] == 'C' && data[3] == 'K') {
+    onClockSync(data, localUs);
+    return true;
+  }
+  if (length < 13 || (data[0] & 0xC0) != RTP_VERSION_2 || (data[1] & 0x7F) != RTP_PAYLOAD_MIDI) {
+    return false;
+  }
+
+  uint32_t ssrc = readBe32(data + 8);
+  if (_started && ssrc != _ssrc) {
+    reset();  // Autre emetteur: son horloge n'a rien a voir
+  }
+  _started = true;
+  _ssrc = ssrc;
+
+  int64_t senderTicks = extendSender(readBe32(data + 4));
+  int64_t arrivalUs = extendLocal(localUs);
+  int64_t senderUs = ticksToUs(senderTicks);
+  _stats.packets++;
+
+  // Gigue RFC 3550: variation du transit brut, independante de la correspondance
+  int64_t rawTransit = arrivalUs - senderUs;
+  if (_haveTransit) {
+    int64_t d = rawTransit - _lastTransitUs;
+    uint32_t diff = (uint32_t)(d < 0 ? -d : d);
+    _jitter16 += diff - ((_jitter16 + 8) >> 4);
+  }
+  _lastTransitUs = rawTransit;
+  _haveTransit = true;
+
+  // Transit minimal sur deux fenetres: la plus ancienne est oubliee toutes les 4 s
+  if (arrivalUs - _minSinceUs >= RTP_CLOCK_MIN_WINDOW_US) {
+    _minTransit[0] = _minTransit[1];
+    _minTransit[1] = INT64_MAX;
+    _minSinceUs = arrivalUs;
+  }
+  if (rawTransit < _minTransit[1]) _minTransit[1] = rawTransit;
+
+  int64_t transit = arrivalUs - toLocal(senderUs);
+  if (_ckValid && transit < -(int64_t)(_stats.rttUs / 2 + CK_TOLERANCE_US)) {
+    // Arrive avant d'etre envoye: horloges CK et RTP differentes, retour au transit minimal
+    _ckValid = false;
+    _sampleCount = 0;
+    _stats.fallbacks++;
+    transit = arrivalUs - toLocal(senderUs);
+  }
+  _stats.transitUs = (int32_t)transit;
+  if (transit > _stats.transitMaxUs) _stats.transitMaxUs = (int32_t)transit;
+
+  parseCommands(data, length, senderTicks);
+  return true;
+}
+
+void RtpClock::onClockSync(const uint8_t* data, uint32_t localUs) {
+  // FF FF 'C' 'K', SSRC, COUNT, 3 octets de bourrage, ts1 ts2 ts3 (64 bits)
+  uint8_t count = data[8];
+  uint32_t ts1 = readBe32(data + 16);  // 32 bits de poids faible
+  if (count == 0) {
+    _ckPending = true;
+    _ckTs1 = ts1;
+    _ckLocalUs = extendLocal(localUs);
+    return;
+  }
+  if (count != 2 || !_ckPending || ts1 != _ckTs1) {
+    return;  // CK1 (echange lance par la lyre) ou CK2 sans son CK0
+  }
+  _ckPending = false;
+
+  uint32_t ts3 = readBe32(data + 32);
+  if ((int32_t)(ts3 - ts1) < 0) return;
+  int64_t sent = ticksToUs(extendSender(ts1));
+  uint32_t rtt = (uint32_t)ticksToUs((int32_t)(ts3 - ts1));
+  extendSender(ts3);
+
+  Sample& s = _samples[_sampleNext];
+  s.localUs = _ckLocalUs;
+  s.offsetUs = _ckLocalUs - (sent + rtt / 2);
+  s.rttUs = rtt;
+  _sampleNext = (_sampleNext + 1) % RTP_CLOCK_SAMPLES;
+  if (_sampleCount < RTP_CLOCK_SAMPLES) _sampleCount++;
+
+  _stats.syncs++;
+  _stats.rttUs = rtt;
+  fit();
+  _ckValid = true;
+}
+
+void RtpClock::fit() {
+  // Echanges retenus: aller-retour proche du plus court (les autres ont attendu en route)
+  uint32_t minRtt = UINT32_MAX;
+  int64_t newest = INT64_MIN;
+  int64_t base = 0;
+  for (uint8_t i = 0; i < _sampleCount; i++) {
+    if (_samples[i].rttUs < minRtt) minRtt = _samples[i].rttUs;
+    if (_samples[i].localUs > newest) {
+      newest = _samples[i].localUs;
+      base = _samples[i].offsetUs;
+    }
+  }
+  uint32_t limit = minRtt + (minRtt / 2 > 1000 ? minRtt / 2 : 1000);
+
+  // Moindres carres, abscisses relatives au dernier echange (precision des doubles)
+  double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0, oldest = 0;
+  for (uint8_t i = 0; i < _sampleCount; i++) {
+    if (_samples[i].rttUs > limit) continue;
+    double x = (double)(_samples[i].localUs - newest);
+    double y = (double)(_samples[i].offsetUs - base);
+    n++;
+    sx += x;
+    sy += y;
+    sxx += x * x;
+    sxy += x * y;
+    if (x < oldest) oldest = x;
+  }
+
+  double drift = _ckValid ? _drift : 0;  // Pas assez de recul: derive precedente conservee
+  if (n >= 2 && -oldest >= CK_DRIFT_SPAN_US) {
+    double slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+    if (slope > -CK_DRIFT_MAX && slope < CK_DRIFT_MAX) drift = slope;
+  }
+  _drift = drift;
+  _refLocalUs = newest;
+  _offsetUs = base + (int64_t)((sy - drift * sx) / n);
+}
+
+int64_t RtpClock::toLocal(int64_t senderUs) const {
+  if (_ckValid) {
+    int64_t local = senderUs + _offsetUs;
+    return local + (int64_t)(_drift * (double)(local - _refLocalUs));
+  }
+  int64_t minTransit = _minTransit[0] < _minTransit[1] ? _minTransit[0] : _minTransit[1];
+  return senderUs + (minTransit == INT64_MAX ? 0 : minTransit);
+}
+
+void RtpClock::parseCommands(const uint8_t* data, uint16_t length, int64_t senderTicks) {
+  _commandCount = 0;
+  _commandNext = 0;
+  _packetSenderUs = ticksToUs(senderTicks);
+
+  uint16_t pos = 12 + 4 * (data[0] & 0x0F);
+  if ((data[0] & 0x10) && pos + 4 <= length) {
+    pos += 4 + 4 * ((data[pos + 2] << 8) | data[pos + 3]);
+  }
+  if (pos >= length) return;
+
+  // Section de commandes: B J Z P LEN, puis [delta] commande, [delta] commande...
+  uint8_t flags = data[pos++];
+  uint16_t listLength = flags & 0x0F;
+  if (flags & 0x80) {
+    if (pos >= length) return;
+    listLength = (listLength << 8) | data[pos++];
+  }
+  uint16_t end = pos + listLength;
+  if (end > length) end = length;
+
+  bool delta = flags & 0x20;  // Z: delta avant la premiere commande
+  uint8_t runningStatus = 0;
+  int64_t ticks = senderTicks;
+  while (pos < end && _commandCount < RTP_CLOCK_COMMANDS) {
+    if (delta) {
+      // Delta temps: 1 a 4 octets, 7 bits chacun, cumule depuis l'horodatage du paquet
+      uint32_t value = 0;
+      for (uint8_t i = 0; i < 4 && pos < end; i++) {
+        uint8_t b = data[pos++];
+        value = (value << 7) | (b & 0x7F);
+        if (!(b & 0x80)) break;
+      }
+      ticks += value;
+    }
+    delta = true;
+    if (pos >= end) break;
+
+    uint8_t status = runningStatus;
+    if (data[pos] & 0x80) {
+      status = data[pos++];
+    }
+    if (!(status & 0x80)) return;  // Statut courant inconnu
+
+    uint8_t size;
+    if (status < 0xF0) {
+      runningStatus = status;
+      size = ((status & 0xE0) == 0xC0) ? 1 : 2;  // Cx, Dx: un octet
+    } else if (status == 0xF0) {
+      while (pos < end && data[pos] != 0xF7 && data[pos] != 0xF0 && data[pos] != 0xF4) pos++;
+      if (pos < end) pos++;
+      size = 0;
+    } else {
+      size = (status == 0xF2) ? 2 : (status == 0xF1 || status == 0xF3) ? 1 : 0;
+    }
+
+    Command& c = _commands[_commandCount++];
+    c.status = status;
+    c.data1 = (size > 0 && pos < end) ? data[pos] : 0;
+    c.senderUs = ticksToUs(ticks);
+    pos += size;
+  }
+}
+
+uint32_t RtpClock::commandTime(uint8_t status, uint8_t data1) {
+  int64_t senderUs = _packetSenderUs;
+  for (uint8_t i = _commandNext; i < _commandCount; i++) {
+    if (_commands[i].status == status && _commands[i].data1 == data1) {
+      senderUs = _commands[i].senderUs;
+      _commandNext = i + 1;
+      break;
+    }
+  }
+  return (uint32_t)toLocal(senderUs);
+}
+
+RtpClock::Stats RtpClock::getStats() const {
+  Stats s = _stats;
+  s.jitterUs = _jitter16 >> 4;
+  int64_t minTransit = _minTransit[0] < _minTransit[1] ? _minTransit[0] : _minTransit[1];
+  if (_ckValid) {
+    s.offsetUs = _offsetUs + (int64_t)(_drift * (double)(_localExt - _refLocalUs));  // Au dernier paquet
+  } else {
+    s.offsetUs = (minTransit == INT64_MAX) ? 0 : minTransit;
+  }
+  s.driftPpm = (float)(_drift * 1e6);
+  return s;
+}
+
+void RtpClock::resetStats() {
+  memset(&_stats, 0, sizeof(_stats));
+}
@@ -0,0 +1,122 @@
+#ifndef RTPCLOCK_H
+#define RTPCLOCK_H
+
+#include <stdint.h>
+#include <string.h>
+#include "settings.h"
+/***********************************************************************************************
+----------------------------    RtpClock.h   ---------------------------------------------------
+************************************************************************************************
+Horloge de l'emetteur AppleMIDI vue depuis la lyre: chaque paquet RTP-MIDI porte l'instant
+d'envoi de ses commandes (horodatage RTP, RTP_CLOCK_RATE Hz, plus un delta par commande).
+Convertis en micros() locales, ils permettent de jouer les notes avec le rythme de l'emetteur
+plutot qu'a leur arrivee, gigue WiFi comprise (NoteScheduler.h).
+
+Correspondance emetteur -> local:
+- Echanges CK (synchronisation AppleMIDI, lances par l'ordinateur): CK0 porte ts1, CK2 ts1 et
+  ts3. Aller-retour = ts3 - ts1; a la reception de CK0 (reponse CK1 immediate), l'emetteur
+  etait a ts1 + aller-retour / 2. Decalage = local - emetteur, a +/- la moitie de
+  l'aller-retour pres. Les RTP_CLOCK_SAMPLES derniers echanges, sans ceux dont l'aller-retour
+  est anormalement long, donnent decalage et derive (droite des moindres carres).
+- Avant le premier echange CK, ou si un paquet arrive avant son heure d'envoi convertie (les
+  deux horloges ne correspondent pas): decalage = plus petit transit (arrivee - envoi) des
+  dernieres secondes. Le transit minimal est alors compris dans le decalage.
+
+Mesures: gigue RFC 3550 du transit, transit (arrivee - envoi converti) dernier et maximal,
+aller-retour CK, decalage et derive. Les horodatages CK et RTP doivent venir de la meme
+horloge (c'est le cas de macOS, rtpMIDI et rtpmidid): seuls leurs 32 bits de poids faible sont
+utilises, etendus au fil des paquets.
+
+Ce fichier n'inclut rien de specifique a Arduino: il est aussi compile par les outils PC
+tools/lyre_playout et tools/lyre_journal.
+************************************************************************************************/
+
+#define RTP_CLOCK_SAMPLES 8          // Echanges CK retenus pour le decalage et la derive
+#define RTP_CLOCK_COMMANDS 32        // Commandes horodatees par paquet
+#define RTP_CLOCK_MIN_WINDOW_US 4000000  // Sans CK: transit minimal sur 4 a 8 s
+
+class RtpClock {
+  public:
+    struct Stats {
+      uint32_t packets;       // Paquets RTP-MIDI horodates
+      uint32_t syncs;         // Echanges CK complets
+      uint32_t fallbacks;     // Correspondance CK abandonnee (paquet arrive avant son envoi)
+      uint32_t rttUs;         // Aller-retour du dernier echange CK
+      uint32_t jitterUs;      // Gigue RFC 3550 du transit
+      int32_t transitUs;      // Transit du dernier paquet (arrivee - envoi converti)
+      int32_t transitMaxUs;   // ...le plus long
+      int64_t offsetUs;       // Decalage local - emetteur
+      float driftPpm;         // Derive de l'horloge locale par rapport a l'emetteur
+    };
+
+  private:
+    struct Sample {
+      int64_t localUs;
+      int64_t offsetUs;
+      uint32_t rttUs;
+    };
+    struct Command {
+      uint8_t status;
+      uint8_t data1;
+      int64_t senderUs;
+    };
+
+    bool _started;            // Au moins un paquet de la session
+    uint32_t _ssrc;
+    bool _localInit, _senderInit;
+    int64_t _localExt;        // micros() etendu a 64 bits
+    int64_t _senderExt;       // Horodatage emetteur etendu (unites RTP_CLOCK_RATE)
+
+    // Correspondance par CK
+    bool _ckPending;          // CK0 recu, CK2 attendu
+    uint32_t _ckTs1;
+    int64_t _ckLocalUs;
+    Sample _samples[RTP_CLOCK_SAMPLES];
+    uint8_t _sampleCount, _sampleNext;
+    bool _ckValid;
+    int64_t _refLocalUs;      // Origine de la derive
+    int64_t _offsetUs;
+    double _drift;
+
+    // Correspondance sans CK: transit minimal sur deux fenetres glissantes
+    int64_t _minTransit[2];
+    int64_t _minSinceUs;
+
+    int64_t _lastTransitUs;
+    bool _haveTransit;
+    uint32_t _jitter16;       // Gigue x 16 (RFC 3550)
+
+    Command _commands[RTP_CLOCK_COMMANDS];
+    uint8_t _commandCount, _commandNext;
+    int64_t _packetSenderUs;
+
+    Stats _stats;
+
+    int64_t extendLocal(uint32_t us);
+    int64_t extendSender(uint32_t timestamp);
+    static int64_t ticksToUs(int64_t ticks) { return ticks * 1000000LL / RTP_CLOCK_RATE; }
+    void onClockSync(const uint8_t* data, uint32_t localUs);
+    void fit();
+    void parseCommands(const uint8_t* data, uint16_t length, int64_t senderTicks);
+    int64_t toLocal(int64_t senderUs) const;
+
+  public:
+    RtpClock();
+    void reset();  // Nouvelle session: correspondance et commandes oubliees
+
+    // Datagramme recu (ports de controle et de donnees) a localUs = micros().
+    // false: ni RTP-MIDI ni CK
+    bool onPacket(const uint8_t* data, uint16_t length, uint32_t localUs);
+
+    bool isSynced() const { return _ckValid; }  // Correspondance etablie par CK
+
+    // Instant local (micros()) d'envoi d'une commande livree par la bibliotheque: la premiere du
+    // paquet courant avec ce statut et ce premier octet, sinon l'horodatage du paquet
+    uint32_t commandTime(uint8_t status, uint8_t data1);
+    uint32_t packetTime() const { return (uint32_t)toLocal(_packetSenderUs); }  // Paquet courant
+
+    Stats getStats() const;
+    void resetStats();
+};
+
+#endif // RTPCLOCK_H
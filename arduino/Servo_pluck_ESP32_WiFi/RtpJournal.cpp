@@ -0,0 +1,239 @@
+#include "RtpJournal.h"
+
+#define RTP_VERSION_2 0x80
+#define RTP_PAYLOAD_MIDI 0x61  // Type de charge utile dynamique des sessions AppleMIDI
+
+RtpJournal::RtpJournal() : _noteOn(nullptr), _noteOff(nullptr), _controlChange(nullptr) {
+  reset();
+  resetStats();
+}
+
+void RtpJournal::setHandlers(NoteOnFunction noteOn, NoteOffFunction noteOff,
+                             ControlChangeFunction controlChange) {
+  _noteOn = noteOn;
+  _noteOff = noteOff;
+  _controlChange = controlChange;
+}
+
+void RtpJournal::reset() {
+  _synced = false;
+  _ssrc = 0;
+  _extSeq = 0;
+  memset(_noteOnSeq, 0, sizeof(_noteOnSeq));
+  memset(_notesHeld, 0, sizeof(_notesHeld));
+  memset(_controllers, 0xFF, sizeof(_controllers));
+}
+
+void RtpJournal::setHeld(uint8_t note, bool held) {
+  if (held) {
+    _notesHeld[note >> 3] |= (0x80 >> (note & 7));
+  } else {
+    _notesHeld[note >> 3] &= ~(0x80 >> (note & 7));
+  }
+}
+
+void RtpJournal::noteOnReceived(uint8_t note) {
+  note &= 0x7F;
+  _noteOnSeq[note] = _extSeq;
+  setHeld(note, true);
+}
+
+void RtpJournal::noteOffReceived(uint8_t note) {
+  setHeld(note & 0x7F, false);
+}
+
+void RtpJournal::controlChangeReceived(uint8_t controller, uint8_t value) {
+  _controllers[controller & 0x7F] = value & 0x7F;
+}
+
+bool RtpJournal::onPacket(const uint8_t* data, uint16_t length) {
+  // En-tete RTP: version 2, charge utile MIDI (les paquets de controle commencent par FF FF)
+  if (length < 13 || (data[0] & 0xC0) != RTP_VERSION_2 || (data[1] & 0x7F) != RTP_PAYLOAD_MIDI) {
+    return false;
+  }
+  uint16_t seq = (data[2] << 8) | data[3];
+  uint32_t ssrc = ((uint32_t)data[8] << 24) | ((uint32_t)data[9] << 16) | (data[10] << 8) | data[11];
+  uint16_t pos = 12 + 4 * (data[0] & 0x0F);  // Sources contributrices (CSRC)
+  if ((data[0] & 0x10) && pos + 4 <= length) {
+    pos += 4 + 4 * ((data[pos + 2] << 8) | data[pos + 3]);  // Extension d'en-tete
+  }
+
+  _stats.packets++;
+  if (!_synced || ssrc != _ssrc) {
+    // Premier paquet de la session: rien a comparer
+    reset();
+    _synced = true;
+    _ssrc = ssrc;
+    _extSeq = 0x10000UL + seq;
+    return true;
+  }
+
+  uint16_t delta = seq - (uint16_t)_extSeq;
+  if (delta == 0 || delta >= 0x8000) {
+    _stats.outOfOrder++;
+    return true;
+  }
+  _extSeq += delta;
+  if (delta == 1) {
+    return true;  // Rien de perdu: les commandes du paquet suffisent
+  }
+
+  _stats.lost += delta - 1;
+  _stats.gaps++;
+
+  // Section de commandes: B J Z P LEN (4 bits, 12 si B), puis la liste, puis le journal
+  if (pos >= length) {
+    _stats.malformed++;
+    return true;
+  }
+  uint8_t flags = data[pos++];
+  uint16_t listLength = flags & 0x0F;
+  if (flags & 0x80) {
+    if (pos >= length) {
+      _stats.malformed++;
+      return true;
+    }
+    listLength = (listLength << 8) | data[pos++];
+  }
+  if (!(flags & 0x40)) {
+    _stats.noJournal++;
+    return true;
+  }
+  pos += listLength;
+  if (pos <= length && applyJournal(data + pos, length - pos, seq)) {
+    _stats.repaired++;
+  } else {
+    _stats.malformed++;
+  }
+  return true;
+}
+
+bool RtpJournal::applyJournal(const uint8_t* journal, uint16_t length, uint16_t seq) {
+  // En-tete: S Y A H TOTCHAN (4 bits), numero de sequence du point de controle
+  if (length < 3) return false;
+  bool hasSystem = journal[0] & 0x40;
+  bool hasChannels = journal[0] & 0x20;
+  uint8_t channels = (journal[0] & 0x0F) + 1;
+  uint16_t checkpoint = (journal[1] << 8) | journal[2];
+  uint32_t checkpointExt = _extSeq - (uint16_t)(seq - checkpoint);
+  uint16_t pos = 3;
+
+  if (hasSystem) {
+    // Journal systeme: non utilise ici, sa longueur (10 bits) comprend son en-tete
+    if (pos + 2 > length) return false;
+    pos += ((journal[pos] & 0x03) << 8) | journal[pos + 1];
+  }
+  if (!hasChannels) return pos <= length;
+
+  for (uint8_t i = 0; i < channels; i++) {
+    // Journal de canal: S CHAN (4 bits) H LENGTH (10 bits), puis P C M W N E T A
+    if (pos + 3 > length) return false;
+    uint8_t channel = (journal[pos] >> 3) & 0x0F;
+    uint16_t channelLength = ((journal[pos] & 0x03) << 8) | journal[pos + 1];
+    uint8_t chapters = journal[pos + 2];
+    if (channelLength < 3 || pos + channelLength > length) return false;
+    if (!applyChannel(channel, chapters, journal + pos + 3, channelLength - 3, checkpointExt)) {
+      return false;
+    }
+    pos += channelLength;
+  }
+  return true;
+}
+
+bool RtpJournal::applyChannel(uint8_t channel, uint8_t chapters, const uint8_t* data,
+                              uint16_t length, uint32_t checkpointExt) {
+  uint16_t pos = 0;
+  uint16_t used = 0;
+
+  if (chapters & 0x80) {  // P: programme, 3 octets
+    pos += 3;
+  }
+  if (chapters & 0x40) {  // C: controleurs
+    if (pos > length || !applyChapterC(channel, data + pos, length - pos, &used)) return false;
+    pos += used;
+  }
+  if (chapters & 0x20) {  // M: RPN/NRPN, longueur (10 bits) en-tete compris
+    if (pos + 2 > length) return false;
+    pos += ((data[pos] & 0x03) << 8) | data[pos + 1];
+  }
+  if (chapters & 0x10) {  // W: pitch bend, 2 octets
+    pos += 2;
+  }
+  if (chapters & 0x08) {  // N: notes
+    if (pos > length || !applyChapterN(channel, data + pos, length - pos, &used, checkpointExt)) {
+      return false;
+    }
+    pos += used;
+  }
+  // E, T, A: apres N, couverts par la longueur du journal de canal
+  return pos <= length;
+}
+
+bool RtpJournal::applyChapterN(uint8_t channel, const uint8_t* data, uint16_t length,
+                               uint16_t* used, uint32_t checkpointExt) {
+  // B LEN (7 bits), LOW HIGH (4 bits chacun), LEN notes (S NOTENUM, Y VELOCITY), OFFBITS
+  if (length < 2) return false;
+  uint8_t low = data[1] >> 4;
+  uint8_t high = data[1] & 0x0F;
+  uint16_t logs = data[0] & 0x7F;
+  if (logs == 127 && low == 15 && high == 0) logs = 128;
+  uint16_t offBytes = (low <= high) ? high - low + 1 : 0;
+  uint16_t size = 2 + 2 * logs + offBytes;
+  if (size > length) return false;
+  *used = size;
+  const uint8_t* offBits = data + 2 + 2 * logs;
+
+  for (uint16_t i = 0; i < logs; i++) {
+    uint8_t note = data[2 + 2 * i] & 0x7F;
+    uint8_t velocity = data[3 + 2 * i] & 0x7F;
+    bool recent = data[3 + 2 * i] & 0x80;
+    uint8_t byte = (note >> 3) - low;
+    bool off = (note >> 3) >= low && byte < offBytes && (offBits[byte] & (0x80 >> (note & 7)));
+    // Deja recu: un noteOn depuis le point de controle, encore tenu ou relache aussi chez
+    // l'emetteur (tenu la-bas mais plus ici: c'est un noteOn plus recent qui a ete perdu)
+    if (velocity == 0 || (_noteOnSeq[note] >= checkpointExt && (isHeld(note) || off))) {
+      continue;
+    }
+    _noteOnSeq[note] = _extSeq;
+    if (!recent) {
+      _stats.notesLate++;  // Joue maintenant, il tomberait a contretemps
+      continue;
+    }
+    setHeld(note, true);
+    _stats.notesOn++;
+    if (_noteOn) _noteOn(channel, note, velocity);
+  }
+
+  for (uint16_t i = 0; i < offBytes; i++) {
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      if (!(offBits[i] & (0x80 >> bit))) continue;
+      uint8_t note = (low + i) * 8 + bit;
+      if (!isHeld(note)) continue;
+      setHeld(note, false);
+      _stats.notesOff++;
+      if (_noteOff) _noteOff(channel, note);
+    }
+  }
+  return true;
+}
+
+bool RtpJournal::applyChapterC(uint8_t channel, const uint8_t* data, uint16_t length,
+                               uint16_t* used) {
+  // S LEN (7 bits), puis LEN + 1 controleurs (S NUMBER, A VALUE/ALT)
+  if (length < 1) return false;
+  uint16_t logs = (data[0] & 0x7F) + 1;
+  uint16_t size = 1 + 2 * logs;
+  if (size > length) return false;
+  *used = size;
+
+  for (uint16_t i = 0; i < logs; i++) {
+    uint8_t controller = data[1 + 2 * i] & 0x7F;
+    if (data[2 + 2 * i] & 0x80) continue;  // Outils toggle/count: pas de valeur a restaurer
+    uint8_t value = data[2 + 2 * i] & 0x7F;
+    if (_controllers[controller] == value) continue;
+    _controllers[controller] = value;
+    _stats.controllers++;
+    if (_controlChange) _controlChange(channel, controller, value);
+  }
+  return true;
+}
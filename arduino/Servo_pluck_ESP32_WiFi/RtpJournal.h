@@ -0,0 +1,90 @@
+#ifndef RTPJOURNAL_H
+#define RTPJOURNAL_H
+
+#include <stdint.h>
+#include <string.h>
+/***********************************************************************************************
+----------------------------    RtpJournal.h   -------------------------------------------------
+************************************************************************************************
+Journal de recuperation RTP-MIDI (RFC 6295): chaque paquet RTP-MIDI peut porter, apres ses
+commandes, un resume de l'etat MIDI depuis un point de controle (checkpoint). Quand un paquet
+UDP est perdu, le suivant suffit a reparer l'etat sans retransmission:
+
+- Chapitre N (notes): noteOn perdu rejoue si l'emetteur le juge encore recent (bit Y), sinon
+  compte comme trop ancien; noteOff perdu (bit de OFFBITS sur une note encore tenue ici)
+  applique: plus de corde qui reste bloquee.
+- Chapitre C (controleurs): valeur d'un CC (pedales 64/66/68...) restauree si elle differe
+  de la derniere recue. Les outils "toggle/count" (bit A) ne sont pas appliques.
+- Autres chapitres (P, M, W, E, T, A) et journal systeme: lus pour etre sautes.
+
+onPacket() recoit chaque datagramme avant la bibliotheque AppleMIDI (JournalUdp.h): numero de
+sequence suivi par SSRC, le journal n'est applique que s'il manque des paquets. Pour savoir
+ce qui a deja ete joue, les messages livres normalement sont signales par noteOnReceived(),
+noteOffReceived() et controlChangeReceived(). L'etat est commun aux 16 canaux, comme pour
+l'instrument.
+
+Ce fichier n'inclut rien de specifique a Arduino: il est aussi compile par l'outil PC
+tools/lyre_journal (flux avec pertes simulees).
+************************************************************************************************/
+
+class RtpJournal {
+  public:
+    typedef void (*NoteOnFunction)(uint8_t channel, uint8_t note, uint8_t velocity);
+    typedef void (*NoteOffFunction)(uint8_t channel, uint8_t note);
+    typedef void (*ControlChangeFunction)(uint8_t channel, uint8_t controller, uint8_t value);
+
+    struct Stats {
+      uint32_t packets;      // Paquets RTP-MIDI recus
+      uint32_t lost;         // Paquets manquants (trous de numero de sequence)
+      uint32_t gaps;         // Trous detectes...
+      uint32_t repaired;     // ...dont repares par le journal du paquet suivant
+      uint32_t noJournal;    // ...dont sans journal (emetteur sans journal): etat non repare
+      uint32_t outOfOrder;   // Paquets en retard ou dupliques
+      uint32_t malformed;    // Journaux illisibles
+      uint32_t notesOn;      // noteOn perdus rejoues
+      uint32_t notesLate;    // noteOn perdus trop anciens (Y = 0), pas rejoues
+      uint32_t notesOff;     // noteOff perdus appliques
+      uint32_t controllers;  // CC perdus restaures
+    };
+
+  private:
+    NoteOnFunction _noteOn;
+    NoteOffFunction _noteOff;
+    ControlChangeFunction _controlChange;
+
+    bool _synced;
+    uint32_t _ssrc;
+    uint32_t _extSeq;              // Numero de sequence etendu du dernier paquet (jamais 0)
+    uint32_t _noteOnSeq[128];      // Paquet du dernier noteOn recu ou rejoue (0: aucun)
+    uint8_t _notesHeld[16];        // Bitmap des notes tenues cote recepteur
+    uint8_t _controllers[128];     // Derniere valeur recue (0xFF: inconnue)
+    Stats _stats;
+
+    bool isHeld(uint8_t note) const { return _notesHeld[note >> 3] & (0x80 >> (note & 7)); }
+    void setHeld(uint8_t note, bool held);
+    bool applyJournal(const uint8_t* journal, uint16_t length, uint16_t seq);
+    bool applyChannel(uint8_t channel, uint8_t chapters, const uint8_t* data, uint16_t length,
+                      uint32_t checkpointExt);
+    bool applyChapterN(uint8_t channel, const uint8_t* data, uint16_t length, uint16_t* used,
+                       uint32_t checkpointExt);
+    bool applyChapterC(uint8_t channel, const uint8_t* data, uint16_t length, uint16_t* used);
+
+  public:
+    RtpJournal();
+    void setHandlers(NoteOnFunction noteOn, NoteOffFunction noteOff,
+                     ControlChangeFunction controlChange);
+    void reset();  // Nouvelle session: etat et numeros de sequence oublies
+
+    // Datagramme recu (port de donnees). false: pas un paquet RTP-MIDI (controle AppleMIDI)
+    bool onPacket(const uint8_t* data, uint16_t length);
+
+    // Messages livres normalement par la bibliotheque (apres onPacket du meme paquet)
+    void noteOnReceived(uint8_t note);
+    void noteOffReceived(uint8_t note);
+    void controlChangeReceived(uint8_t controller, uint8_t value);
+
+    Stats getStats() const { return _stats; }
+    void resetStats() { memset(&_stats, 0, sizeof(_stats)); }
+};
+
+#endif // RTPJOURNAL_H
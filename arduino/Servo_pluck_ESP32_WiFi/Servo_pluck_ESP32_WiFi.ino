@@ -17,6 +17,29 @@ BIBLIOTHEQUES REQUISES:
 - Adafruit_PWMServoDriver
 - AppleMIDI (https://github.com/lathoub/Arduino-AppleMIDI-Library)
 
+PERTES DE PAQUETS:
+Un paquet UDP perdu ne laisse plus de note bloquee: le journal de recuperation RTP-MIDI du
+paquet suivant (RFC 6295, chapitres N et C) est applique par RtpJournal (RTP_JOURNAL).
+
+LECTURE HORODATEE:
+Les notes sont jouees a leur instant d'envoi (horodatage RTP, horloge de l'ordinateur
+synchronisee par les echanges CK d'AppleMIDI) plus RTP_PLAYOUT_MS: la gigue du WiFi ne passe
+plus dans le rythme (RtpClock, NoteScheduler).
+
+PLUSIEURS PARTICIPANTS:
+Jusqu'a MIDI_SOURCES_MAX ordinateurs ou tablettes connectes en meme temps (repetition): chaque
+session a son journal, son horloge et sa file, ses canaux et son poids (MIDI_SOURCE_RULES).
+Les messages sont joues par ordre d'echeance, a tour de role entre les sessions (MidiSources).
+
+ENTREE OSC:
+Avec OSC_ENABLED, les systemes de regie envoient /lyre/note, /lyre/chord et /lyre/panic en
+OSC sur le port OSC_PORT, sans session. Les bundles sont joues a leur timetag (OscListener).
+
+ENSEMBLE:
+Plusieurs lyres sur le meme reseau jouent en meme temps (ENSEMBLE_ROLE). Le chef recoit MIDI et
+OSC, distribue son horloge et relaie ses notes horodatees a l'heure commune; les suiveurs
+cadrent leur horloge sur la sienne et jouent ces notes au meme instant (EnsembleSync).
+
 CONFIGURATION WIFI:
 Modifier WIFI_SSID et WIFI_PASSWORD dans settings.h
 
@@ -30,15 +53,33 @@ CONNEXION MIDI:
 
 ************************************************************************************************/
 #include <WiFi.h>
-#include "Instrument.h"
+#include "instrument.h"
 #include "MidiHandler.h"
+#include "OscListener.h"
+#include "EnsembleSync.h"
+#include "DeferredLog.h"
+#include "EventTrace.h"
+#include "LoopScheduler.h"
 #include "settings.h"
 
 Instrument instrument;
 MidiHandler* midiHandler = nullptr;
+#if OSC_ENABLED
+OscListener* oscListener = nullptr;
+#endif
+#if ENSEMBLE_ROLE != ENSEMBLE_OFF
+EnsembleSync* ensemble = nullptr;
+#endif
+
+// Connexion WiFi non-bloquante: suivie dans loop() pendant que les servos s'initialisent
+unsigned long wifiStartTime = 0;
+bool wifiTimeoutReported = false;
 
 void setup() {
   Serial.begin(SERIAL_BAUD_RATE);
+  DeferredLog::begin();  // Avant tout message differe (servos, MIDI)
+  EventTrace::begin();   // Trace d'avant un reset logiciel conservee
+  LoopScheduler::begin();
   delay(500);
   Serial.println("\n==============================================");
   Serial.println("   ESP32 Lyre MIDI via WiFi");
@@ -47,51 +88,95 @@ void setup() {
   // Initialiser I2C avec les pins ESP32
   Wire.begin(PIN_SDA, PIN_SCL);
 
-  // Connexion WiFi
-  Serial.print("[WiFi] Connexion a ");
-  Serial.print(WIFI_SSID);
-  Serial.print(" ");
+  // Detection du PCA9685: non-bloquante, se poursuit dans loop()
+  instrument.begin();
 
+  // Connexion WiFi (le resultat est suivi dans loop())
+  Serial.print("[WiFi] Connexion a ");
+  Serial.println(WIFI_SSID);
   WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  wifiStartTime = millis();
 
-  int attempts = 0;
-  while (WiFi.status() != WL_CONNECTED && attempts < 40) {
-    delay(500);
-    Serial.print(".");
-    attempts++;
-  }
+  // Initialiser le gestionnaire MIDI (demarre une fois le WiFi connecte)
+  midiHandler = new MidiHandler(instrument);
+  #if OSC_ENABLED
+    oscListener = new OscListener(instrument);
+  #endif
+
+  // Mode ensemble: le chef confie ses notes a EnsembleSync, qui les joue sur toutes les lyres
+  #if ENSEMBLE_ROLE != ENSEMBLE_OFF
+    ensemble = new EnsembleSync(instrument);
+    midiHandler->setEnsemble(ensemble);
+    #if OSC_ENABLED
+      oscListener->setEnsemble(ensemble);
+    #endif
+  #endif
+
+  // Taches periodiques de la loop
+  LoopScheduler::every("wifi", 100, checkWifiConnection);
+  #if DEBUG
+    LoopScheduler::every("bilan", 60000, printStats);
+  #endif
 
+  Serial.println("==============================================");
+  Serial.println("[INIT] Initialisation terminee");
+  Serial.println("==============================================\n");
+}
+
+// Suivi de la connexion WiFi: la session AppleMIDI demarre des que le reseau est la
+void checkWifiConnection() {
+  if (wifiStartTime == 0) return;
   if (WiFi.status() == WL_CONNECTED) {
-    Serial.println(" OK!");
-    Serial.print("[WiFi] Adresse IP: ");
+    Serial.print("[WiFi] Connecte, adresse IP: ");
     Serial.println(WiFi.localIP());
-  } else {
-    Serial.println(" ECHEC!");
-    Serial.println("[WiFi] Impossible de se connecter au WiFi");
+    midiHandler->begin();
+    #if OSC_ENABLED
+      oscListener->begin();
+    #endif
+    #if ENSEMBLE_ROLE != ENSEMBLE_OFF
+      ensemble->begin();
+    #endif
+    wifiStartTime = 0;
+  } else if (!wifiTimeoutReported && millis() - wifiStartTime >= 20000) {
+    // Pas de blocage: le WiFi continue d'essayer en arriere-plan
+    Serial.println("[WiFi] ECHEC: pas de connexion apres 20 s");
     Serial.println("[WiFi] Verifiez WIFI_SSID et WIFI_PASSWORD dans settings.h");
-    while(1) {
-      delay(1000);
-    }
+    wifiTimeoutReported = true;
   }
+}
 
-  // Initialiser le gestionnaire MIDI
-  midiHandler = new MidiHandler(instrument);
-  midiHandler->begin();
-
-  Serial.println("==============================================");
-  Serial.println("[INIT] Initialisation terminee");
-  Serial.println("==============================================\n");
+// Bilan debug: boucle, puis pour chaque session messages et attente, pertes de paquets et
+// reparations par le journal RTP-MIDI, horloge et lecture horodatee; entree OSC; ensemble
+void printStats() {
+  LoopScheduler::print();
+  midiHandler->printSourceStats();
+  #if OSC_ENABLED
+    oscListener->printStats();
+  #endif
+  #if ENSEMBLE_ROLE != ENSEMBLE_OFF
+    ensemble->printStats();
+  #endif
 }
 
 void loop() {
   // Mettre a jour l'instrument (gestion de l'initialisation non-bloquante)
   instrument.update();
+  LoopScheduler::wakeWithin(instrument.msUntilUpdate());
 
-  // Lire et traiter les messages MIDI seulement si l'instrument est pret
-  if (instrument.isReady()) {
+  // Lire et traiter les messages MIDI, OSC et d'ensemble seulement si le WiFi est connecte et
+  // l'instrument pret. Les sockets UDP ne signalent pas l'arrivee d'un paquet: relecture au plus
+  // tard dans WIFI_MIDI_POLL_MS
+  if (wifiStartTime == 0 && instrument.isReady()) {
     midiHandler->update();
+    #if OSC_ENABLED
+      oscListener->update();
+    #endif
+    #if ENSEMBLE_ROLE != ENSEMBLE_OFF
+      ensemble->update();
+    #endif
+    LoopScheduler::wakeWithin(WIFI_MIDI_POLL_MS);
   }
 
-  // Petite pause pour ne pas surcharger le CPU
-  delay(1);
+  // Taches dues, puis sommeil jusqu'a la prochaine echeance
+  LoopScheduler::run();
 }
@@ -9,11 +9,62 @@ Fichier de configuration pour ESP32 avec MIDI via WiFi (RTP-MIDI/AppleMIDI)
 
 // Configuration Debug
 #define DEBUG 1
+#define DEFERRED_LOG_BINARY false   // Journal differe (DeferredLog.h): true = trames binaires pour tools/lyre_log
+#define DEFERRED_LOG_DRAIN_MS 20     // Periode de vidage du journal par la tache basse priorite
+#define ENABLE_EVENT_TRACE false     // Trace d'evenements en RAM RTC (EventTrace.h), a vider avec EventTrace::dump()
+#define TRACE_BUFFER_EVENTS 256      // Puissance de 2, 8 octets par evenement (8 Ko de RAM RTC au total)
+#define LOOP_MAX_SLEEP_MS 1000       // Boucle evenementielle (LoopScheduler.h): sommeil max sans echeance ni evenement
+#define LOOP_TASKS_MAX 8             // Taches periodiques de la loop
 
 // Configuration WiFi
 #define WIFI_SSID "VotreSSID"           // Remplacer par votre SSID WiFi
 #define WIFI_PASSWORD "VotreMotDePasse" // Remplacer par votre mot de passe WiFi
 #define APPLEMIDI_SESSION_NAME "ESP32-Lyre-MIDI" // Nom de la session AppleMIDI
+#define WIFI_MIDI_POLL_MS 1             // Session AppleMIDI lue au moins toutes les 1 ms (socket UDP sans notification)
+#define RTP_JOURNAL true                // Paquets perdus repares par le journal RTP-MIDI (RtpJournal.h)
+#define RTP_JOURNAL_PACKET_MAX 1472     // Octets copies par datagramme pour lire le journal (MTU WiFi)
+// Lecture horodatee (RtpClock.h, NoteScheduler.h): chaque message est joue a son instant d'envoi
+// (horodatage RTP, horloge de l'emetteur synchronisee par les echanges CK) plus ce delai.
+// Doit couvrir le transit WiFi et sa gigue (bilan [RTP] Horloge); 0 = joue des reception
+#define RTP_PLAYOUT_MS 30
+#define RTP_CLOCK_RATE 10000            // Horloge des horodatages AppleMIDI (Hz)
+#define RTP_PLAYOUT_QUEUE 64            // Messages en attente de leur echeance (par source)
+
+// Plusieurs participants (MidiSources.h): chaque session AppleMIDI (ordinateur, tablette...) a
+// son journal, son horloge et sa file; les messages sont fusionnes par ordre d'echeance.
+#define MIDI_SOURCES_MAX 4              // Sessions simultanees (participants de la bibliotheque)
+// Regles par nom de session: debut du nom ("" = toutes), canaux acceptes (bit 0 = canal 1) et
+// poids (messages joues par tour quand plusieurs sources attendent). Premiere regle qui
+// correspond, ex: { { "MacBook", 0x0001, 2 }, { "iPad", 0x0002, 1 }, { "", 0xFFFF, 1 } }
+#define MIDI_SOURCE_RULES { { "", 0xFFFF, 1 } }
+#define MIDI_SOURCES_FAIR true          // Tour pondere entre sources; false = ordre d'echeance seul
+#define MIDI_DISPATCH_BUDGET 8          // Messages joues au plus par appel de update()
+
+// Entree OSC (OscListener.h): /lyre/note <servo|note> <vel>, /lyre/chord <masque>, /lyre/panic
+// et bundles horodates, sans session ni journal (systemes de regie)
+#define OSC_ENABLED true
+#define OSC_PORT 8000                   // Port UDP d'ecoute
+#define OSC_PACKET_MAX 1472             // Octets lus par datagramme (MTU WiFi)
+// Bundles: joues a l'instant du timetag, ramene a l'heure locale par le transit minimal
+// observe (horloge de la regie inconnue), plus ce delai qui doit couvrir la gigue du WiFi
+#define OSC_PLAYOUT_MS 20
+#define OSC_DEFAULT_VELOCITY 100        // /lyre/note sans velocite, /lyre/chord
+
+// Ensemble (EnsembleSync.h): plusieurs lyres sur le meme reseau jouent en meme temps. Le chef
+// distribue son horloge (echanges facon PTP sur UDP) et relaie les notes qu'il joue, horodatees
+// a l'heure commune; les suiveurs s'y cadrent et les jouent au meme instant
+#define ENSEMBLE_OFF 0
+#define ENSEMBLE_LEADER 1
+#define ENSEMBLE_FOLLOWER 2
+#define ENSEMBLE_ROLE ENSEMBLE_OFF      // ENSEMBLE_OFF, ENSEMBLE_LEADER ou ENSEMBLE_FOLLOWER
+#define ENSEMBLE_PORT 5110              // Port UDP (chef et suiveurs)
+#define ENSEMBLE_GROUP 1                // Ensembles distincts sur le meme reseau (1-255)
+#define ENSEMBLE_SYNC_MS 250            // Suiveur: un echange d'horloge avec le chef toutes les 250 ms
+// Notes relayees: jouees par tous a l'heure du chef plus ce delai, qui doit couvrir le
+// transit WiFi vers les suiveurs et sa gigue (le chef attend aussi)
+#define ENSEMBLE_PLAYOUT_MS 30
+#define ENSEMBLE_FOLLOWERS_MAX 8        // Chef: suiveurs servis
+#define ENSEMBLE_TIMEOUT_MS 3000        // Chef ou suiveur muet depuis 3 s: considere parti
 
 // Configuration generale
 #define NUM_SERVOS 16
@@ -28,7 +79,33 @@ Fichier de configuration pour ESP32 avec MIDI via WiFi (RTP-MIDI/AppleMIDI)
 // Delais d'initialisation des servos (en millisecondes)
 #define SERVO_INIT_DELAY_MS 500
 #define SERVO_RESET_DELAY_MS 100
-#define SERVO_AUTO_DISABLE_TIMEOUT_MS 2000  // Desactiver apres 2s d'inactivite
+// Balayage d'initialisation par groupes: N servos bougent ensemble (budget alimentation,
+// ~700 mA de pointe par SG90). 16 servos par 4 = 4 x (500 + 100) ms au lieu de 9,6 s.
+#define SERVO_INIT_GROUP_SIZE 4
+// Redemarrage a chaud (watchdog, reset logiciel): l'etat des servos est conserve en memoire RTC
+// et le balayage est saute. Apres une mise sous tension ou une chute d'alimentation il a lieu.
+#define SERVO_WARM_BOOT true
+#define SERVO_AUTO_DISABLE_TIMEOUT_MS 2000  // Voie liberee (bit full-OFF du PCA9685) apres 2s sans mouvement
+// Prediction de trafic: tant que des notes arrivent (une dans la derniere fenetre), les cordes
+// jouees recemment restent alimentees plus longtemps pour ne pas etre reveillees a chaque note
+#define SERVO_TRAFFIC_WINDOW_MS 4000
+#define SERVO_TRAFFIC_HOLD_MS 10000
+
+// Modele de deplacement des servos (SG90: 0.1 s / 60 deg sous 4.8V)
+// Sert a compenser la latence mecanique (partitions compilees, anticipation)
+#define SERVO_US_PER_DEGREE 1667
+#define PLUCK_RELEASE_ANGLE (PLUCK_ANGLE / 2)  // Degres parcourus depuis le repos avant que la corde s'echappe
+
+// Anticipation (lecture programmee): le servo est amene juste avant le point d'echappement,
+// seuls les derniers degres sont parcourus a l'echeance
+#define LOOKAHEAD_PRESTAGE_ANGLE 5   // Doit rester < PLUCK_RELEASE_ANGLE (corde tendue, pas lachee)
+#define LOOKAHEAD_WINDOW_US 60000    // Horizon d'anticipation
+#define LOOKAHEAD_MAX_STAGED 4       // Budget alimentation: servos maintenus en tension simultanement
+
+// Mode pluck-through: apres un grattage le servo reste de l'autre cote de la corde et la note
+// suivante la traverse depuis la (un seul mouvement par note). Activable aussi par CC 68.
+#define PLUCK_THROUGH_MODE false
+#define PLUCK_THROUGH_DAMP_MS 0      // 0 = noteOff ignore, >0 = etouffement N ms apres le grattage
 
 // Types de messages MIDI
 #define MIDI_NOTE_ON 0x90
@@ -89,5 +166,12 @@ const uint16_t SERVO_PULSE_MIN = 500;
 const uint16_t SERVO_PULSE_MAX = 2500;
 const uint16_t SERVO_FREQUENCY = 50;
 const uint32_t PCA9685_OSCILLATOR_FREQ = 27000000;
+const uint8_t PCA9685_I2C_ADDRESS = 0x40;  // Adresse I2C du PCA9685 (cavaliers A0-A5 ouverts)
+
+// Detection du PCA9685 au demarrage (non-bloquante, le BLE/WiFi demarre en parallele)
+#define PCA9685_PROBE_ATTEMPTS 5        // Essais avant de passer en mode degrade (MIDI accepte, erreur signalee)
+#define PCA9685_PROBE_RETRY_MIN_MS 10   // Delai entre deux essais, double a chaque echec...
+#define PCA9685_PROBE_RETRY_MAX_MS 2000 // ...jusqu'a ce plafond (recherche en arriere-plan)
+#define PCA9685_I2C_TIMEOUT_MS 10       // Duree maximale d'une transaction I2C (bus bloque)
 
 #endif
@@ -0,0 +1,226 @@
+/***********************************************************************************************
+----------------------------    lyre_blemidi - file d'envoi BLE-MIDI   -------------------------
+************************************************************************************************
+Compile BleMidiTx.cpp du sketch Pro tel quel, contre les substituts Arduino du simulateur
+(tools/lyre_sim/host, temps virtuel), et verifie les paquets qu'il notifie.
+
+  g++ -std=c++17 -O2 -I tools/lyre_sim/host -I arduino/ESP32_Lyre_BLE_Pro \
+      tools/lyre_blemidi/lyre_blemidi.cpp arduino/ESP32_Lyre_BLE_Pro/BleMidiTx.cpp \
+      -o lyre_blemidi
+
+Utilisation:
+  lyre_blemidi test [--seed N]
+      Pour des tailles de paquet de 20 (MTU minimal), 64, 185 et BLE_TX_PACKET_MAX octets:
+      anneau rempli jusqu'au refus (notes au meme instant, running status, statuts melanges,
+      SysEx jusqu'a la taille du paquet et au-dela, timestamps qui reculent), vide par
+      update()/flush(). Chaque paquet doit tenir dans la taille negociee, et son decodage
+      BLE-MIDI doit redonner les messages acceptes, dans l'ordre. Code de sortie 1 au premier
+      ecart.
+************************************************************************************************/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "BleMidiTx.h"
+#include "LoopScheduler.h"
+
+// Substituts du simulateur: temps virtuel, boucle sans sommeil
+uint64_t simNowUs = 1000000;
+void simAdvance(uint64_t us) { simNowUs += us; }
+HostSerial Serial;
+
+void LoopScheduler::wake() {}
+void LoopScheduler::wakeWithin(uint32_t) {}
+
+struct Message {
+  std::vector<uint8_t> bytes;
+  uint8_t timestamp;  // 7 bits de poids faible du timestamp (ms)
+};
+
+static std::vector<std::vector<uint8_t>> packets;
+
+static void capture(const uint8_t* packet, size_t length) {
+  packets.emplace_back(packet, packet + length);
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+  printf("  %s %s\n", ok ? "ok  " : "ECHEC", what);
+  if (!ok) failures++;
+}
+
+static uint32_t seed = 1;
+
+static uint32_t nextRandom() {
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7FFF;
+}
+
+// Octets de donnees d'un message de canal
+static uint8_t dataBytes(uint8_t status) {
+  uint8_t type = status & 0xF0;
+  return (type == 0xC0 || type == 0xD0) ? 1 : 2;
+}
+
+// Messages d'un paquet BLE-MIDI. false: paquet mal forme
+static bool decode(const std::vector<uint8_t>& packet, std::vector<Message>* out) {
+  size_t i = 0;
+  if (packet.size() < 3 || (packet[i++] & 0xC0) != 0x80) return false;
+  uint8_t runningStatus = 0;
+  uint8_t timestamp = 0;
+  while (i < packet.size()) {
+    if (packet[i] & 0x80) {
+      timestamp = packet[i++] & 0x7F;  // Timestamp, suivi d'un statut ou de donnees
+      if (i >= packet.size()) return false;
+    }
+    Message m;
+    m.timestamp = timestamp;
+    uint8_t status = packet[i];
+    if (status == 0xF0) {
+      // SysEx: donnees jusqu'au timestamp qui precede F7 (un timestamp peut valoir F0)
+      m.bytes.push_back(packet[i++]);
+      while (i < packet.size() && !(packet[i] & 0x80)) {
+        m.bytes.push_back(packet[i++]);
+      }
+      if (i + 1 >= packet.size() || packet[i + 1] != 0xF7) return false;
+      m.bytes.push_back(0xF7);
+      i += 2;
+      runningStatus = 0;
+    } else {
+      if (status & 0x80) {
+        runningStatus = status;
+        i++;
+      }
+      if (runningStatus == 0) return false;
+      m.bytes.push_back(runningStatus);
+      for (uint8_t n = 0; n < dataBytes(runningStatus); n++) {
+        if (i >= packet.size() || (packet[i] & 0x80)) return false;
+        m.bytes.push_back(packet[i++]);
+      }
+    }
+    out->push_back(m);
+  }
+  return true;
+}
+
+// Message au hasard parmi les cas que buildPacket traite differemment
+static std::vector<uint8_t> randomMessage(uint16_t payloadSize) {
+  uint32_t kind = nextRandom() % 10;
+  if (kind < 4) {
+    return { 0x90, (uint8_t)(48 + nextRandom() % 16), 100 };  // Meme statut: running status
+  }
+  if (kind < 6) {
+    static const uint8_t statuses[] = { 0x80, 0x90, 0xB0, 0xB1, 0xE0 };
+    return { statuses[nextRandom() % 5], (uint8_t)(nextRandom() % 128),
+             (uint8_t)(nextRandom() % 128) };
+  }
+  if (kind < 8) {
+    return { (uint8_t)(0xC0 | (nextRandom() % 16)), (uint8_t)(nextRandom() % 128) };
+  }
+  // SysEx: de 3 octets a un peu plus que le paquet (refuse, compte en perte)
+  uint16_t size = 3 + nextRandom() % (payloadSize + 4);
+  if (size > 255) size = 255;
+  std::vector<uint8_t> sysEx(size, 0);
+  sysEx[0] = 0xF0;
+  for (uint16_t i = 1; i + 1 < size; i++) sysEx[i] = (uint8_t)(nextRandom() % 128);
+  sysEx[size - 1] = 0xF7;
+  return sysEx;
+}
+
+// Un SysEx tient dans un paquet: en-tete, timestamp, message, timestamp avant F7
+static bool fits(const std::vector<uint8_t>& message, uint16_t payloadSize) {
+  return message[0] != 0xF0 || 1 + 1 + message.size() + 1 <= payloadSize;
+}
+
+static void runFlood(uint16_t payloadSize) {
+  printf("Paquets de %u octets\n", payloadSize);
+  BleMidiTx::begin(capture);
+  BleMidiTx::setPayloadSize(payloadSize);
+  packets.clear();
+
+  std::vector<Message> accepted;
+  uint32_t refused = 0, tooLong = 0;
+  for (int i = 0; i < 4000; i++) {
+    std::vector<uint8_t> message = randomMessage(payloadSize);
+    if (nextRandom() % 8 == 0) simAdvance(1000 + nextRandom() % 3000);
+
+    bool older = (nextRandom() % 32 == 0);
+    unsigned long atUs = micros() - 20000;
+    bool sent = older ? BleMidiTx::send(message.data(), message.size(), atUs)
+                      : BleMidiTx::send(message.data(), message.size());
+    if (!sent) {
+      // Anneau plein: la loop enverrait, puis le message est repris
+      refused++;
+      BleMidiTx::flush();
+      sent = older ? BleMidiTx::send(message.data(), message.size(), atUs)
+                   : BleMidiTx::send(message.data(), message.size());
+    }
+    if (!sent) continue;
+    if (!fits(message, payloadSize)) {
+      tooLong++;
+      continue;
+    }
+    unsigned long ms = older ? millis() - (micros() - atUs) / 1000 : millis();
+    accepted.push_back({ message, (uint8_t)(ms & 0x7F) });
+    if (nextRandom() % 16 == 0) BleMidiTx::update();
+  }
+  BleMidiTx::flush();
+
+  size_t largest = 0;
+  bool allFit = true, wellFormed = true;
+  std::vector<Message> decoded;
+  for (const std::vector<uint8_t>& p : packets) {
+    largest = p.size() > largest ? p.size() : largest;
+    if (p.size() > payloadSize) allFit = false;
+    if (!decode(p, &decoded)) wellFormed = false;
+  }
+  bool same = decoded.size() == accepted.size();
+  for (size_t i = 0; same && i < decoded.size(); i++) {
+    same = decoded[i].bytes == accepted[i].bytes &&
+           decoded[i].timestamp == accepted[i].timestamp;
+  }
+
+  const BleMidiTx::Stats& s = BleMidiTx::getStats();
+  printf("  %zu paquet(s), plus grand %zu octets, %lu message(s), max %u par paquet, "
+         "%lu refus (anneau plein), %lu SysEx trop long(s)\n",
+         packets.size(), largest, (unsigned long)s.messages, s.maxMessagesPerPacket,
+         (unsigned long)refused, (unsigned long)tooLong);
+  check(allFit, "chaque paquet tient dans la taille negociee");
+  check(wellFormed, "paquets BLE-MIDI bien formes");
+  check(same, "messages acceptes retrouves dans l'ordre, timestamps compris");
+  check(s.dropped == refused + tooLong, "pertes comptees: anneau plein et SysEx trop longs");
+}
+
+static int runTests() {
+  static const uint16_t sizes[] = { 20, 64, 185, BLE_TX_PACKET_MAX };
+  for (uint16_t size : sizes) {
+    runFlood(size);
+  }
+  printf("%s (%d echec(s))\n", failures ? "ECHEC" : "OK", failures);
+  return failures ? 1 : 0;
+}
+
+static void usage() {
+  fprintf(stderr, "Utilisation: lyre_blemidi test [--seed N]\n");
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    usage();
+    return 2;
+  }
+  std::string mode = argv[1];
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--seed" && i + 1 < argc) seed = (uint32_t)atoi(argv[++i]);
+  }
+
+  if (mode == "test") return runTests();
+  usage();
+  return 2;
+}
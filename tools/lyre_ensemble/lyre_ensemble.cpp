@@ -0,0 +1,388 @@
+/***********************************************************************************************
+----------------------------    lyre_ensemble - plusieurs lyres en mesure   --------------------
+************************************************************************************************
+Compile EnsembleClock.cpp et NoteScheduler.cpp du sketch WiFi tels quels et fait tourner un
+ensemble sur le PC: un chef et plusieurs suiveurs, chacun dans son fil avec sa socket UDP
+locale (127.0.0.1) et sa propre horloge (decalage de depart et derive), avec les reglages du
+settings.h passe en -I (ENSEMBLE_SYNC_MS, ENSEMBLE_PLAYOUT_MS...).
+
+  g++ -std=c++17 -O2 -pthread -I arduino/Servo_pluck_ESP32_WiFi \
+      tools/lyre_ensemble/lyre_ensemble.cpp arduino/Servo_pluck_ESP32_WiFi/EnsembleClock.cpp \
+      arduino/Servo_pluck_ESP32_WiFi/NoteScheduler.cpp -o lyre_ensemble
+
+Utilisation:
+  lyre_ensemble [--seconds N] [--followers N] [--jitter-ms N] [--loss P] [--port N]
+                [--sync | --nosync]
+      Sans --sync ni --nosync: les deux, l'un apres l'autre
+
+Reseau simule: chaque datagramme passe par une ligne a retard (fil dedie) avant d'etre envoye
+sur la vraie socket: 1.5 ms plus une gigue exponentielle de moyenne --jitter-ms (3 par
+defaut), 2 % de pointes de 20 a 60 ms (WiFi encombre), --loss % perdus (1 par defaut).
+
+Horloges: le chef derive de +40 ppm, les suiveurs de -120, +85, -30, +150... ppm par rapport
+au PC; depart au hasard sur 32 bits (l'un pres du debordement de micros()).
+
+Le chef joue une note toutes les 60 ms (comme EnsembleSync::share()): horodatee a l'heure
+commune + ENSEMBLE_PLAYOUT_MS, envoyee a chaque suiveur et programmee chez lui.
+- --sync: les suiveurs echangent avec le chef toutes les ENSEMBLE_SYNC_MS (EnsembleClock) et
+  jouent les notes a l'heure commune convertie en heure locale.
+- --nosync: chaque lyre joue des reception, comme des lyres chacune sur sa liaison.
+
+Mesures, apres 3 s de mise en route: ecart entre lyres pour chaque note (dernier jeu - premier
+jeu, heure du PC; p50, p99, max), notes perdues et en retard; par suiveur, erreur de l'heure
+commune estimee (p50, p99) et derive estimee contre derive reelle (horloge du chef vue par
+celle du suiveur).
+************************************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "EnsembleClock.h"
+#include "NoteScheduler.h"
+
+#define NOTE_PERIOD_US 60000
+#define WARMUP_US 3000000
+
+static int64_t hostMicros() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int openUdp(int port) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("bind");
+    return -1;
+  }
+  return fd;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Reseau simule: ligne a retard devant les vraies sockets
+// ---------------------------------------------------------------------------------------------
+struct Datagram {
+  int64_t releaseUs;
+  int fd;
+  int port;
+  std::vector<uint8_t> bytes;
+};
+
+static std::mutex netLock;
+static std::vector<Datagram> inFlight;
+static std::mt19937 netRandom(12345);
+static double jitterMs = 3;
+static double lossPercent = 1;
+
+static void netSend(int fd, int port, const uint8_t* data, uint16_t length) {
+  std::lock_guard<std::mutex> guard(netLock);
+  std::uniform_real_distribution<double> uniform(0, 100);
+  if (uniform(netRandom) < lossPercent) return;
+  double delayUs = 1500 + std::exponential_distribution<double>(1.0 / (jitterMs * 1000))(netRandom);
+  if (uniform(netRandom) < 2) delayUs += 20000 + uniform(netRandom) * 400;
+  inFlight.push_back({ hostMicros() + (int64_t)delayUs, fd, port,
+                       std::vector<uint8_t>(data, data + length) });
+}
+
+static void runNetwork(std::atomic<bool>* running) {
+  while (running->load()) {
+    std::vector<Datagram> due;
+    {
+      std::lock_guard<std::mutex> guard(netLock);
+      int64_t now = hostMicros();
+      for (size_t i = 0; i < inFlight.size();) {
+        if (inFlight[i].releaseUs <= now) {
+          due.push_back(inFlight[i]);
+          inFlight[i] = inFlight.back();
+          inFlight.pop_back();
+        } else {
+          i++;
+        }
+      }
+    }
+    for (const Datagram& d : due) {
+      sockaddr_in to = {};
+      to.sin_family = AF_INET;
+      to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      to.sin_port = htons(d.port);
+      sendto(d.fd, d.bytes.data(), d.bytes.size(), 0, (sockaddr*)&to, sizeof(to));
+    }
+    usleep(100);
+  }
+}
+
+// ---------------------------------------------------------------------------------------------
+// Lyres
+// ---------------------------------------------------------------------------------------------
+struct Device {
+  std::string name;
+  int port;
+  int fd;
+  double ppm;        // Derive par rapport au PC
+  int64_t origin;    // Heure locale au temps 0 du PC
+  EnsembleClock clock;
+  NoteScheduler scheduler;
+  std::vector<uint32_t> errors;  // |heure commune estimee - heure du chef|, us
+  float driftPpm;
+  uint32_t late;
+
+  // micros() de la lyre a l'instant PC hostUs
+  int64_t localExt(int64_t hostUs) const {
+    return origin + hostUs + (int64_t)std::llround(hostUs * ppm * 1e-6);
+  }
+  uint32_t local(int64_t hostUs) const { return (uint32_t)localExt(hostUs); }
+};
+
+static std::vector<Device*> devices;
+static std::vector<std::vector<int64_t>> plays;  // [note][lyre] heure PC du jeu (0: pas joue)
+static std::mutex playLock;
+static int64_t leaderBase;      // Heure commune = leaderBase + (local etendu - celui du debut)
+static int64_t leaderStartExt;
+static bool syncMode = true;
+
+static int64_t leaderEnsemble(int64_t hostUs) {
+  return leaderBase + (devices[0]->localExt(hostUs) - leaderStartExt);
+}
+
+static void recordPlay(uint8_t index, const NoteScheduler::Event& e, int64_t hostUs) {
+  uint32_t note = e.data1 | (e.data2 << 7);
+  std::lock_guard<std::mutex> guard(playLock);
+  if (note < plays.size() && plays[note][index] == 0) plays[note][index] = hostUs;
+}
+
+static void runDevice(uint8_t index, int64_t startUs, int64_t stopUs) {
+  Device& d = *devices[index];
+  bool leader = index == 0;
+  int64_t nextSyncUs = startUs + index * 37000;  // Echanges decales d'une lyre a l'autre
+  int64_t nextNoteUs = startUs;
+  int64_t nextErrorUs = startUs + WARMUP_US;
+  uint32_t noteSeq = 0;
+
+  while (true) {
+    int64_t now = hostMicros();
+    if (now >= stopUs) break;
+
+    // Paquets recus
+    uint8_t buffer[ENSEMBLE_PACKET_MAX];
+    sockaddr_in from = {};
+    socklen_t fromLength = sizeof(from);
+    ssize_t length;
+    while ((length = recvfrom(d.fd, buffer, sizeof(buffer), MSG_DONTWAIT, (sockaddr*)&from,
+                              &fromLength)) > 0) {
+      uint32_t receiveUs = d.local(hostMicros());
+      EnsemblePacket packet;
+      if (!packet.decode(buffer, length)) continue;
+      if (leader && packet.type == ENSEMBLE_REQUEST) {
+        EnsemblePacket reply;
+        d.clock.reply(packet, receiveUs, d.local(hostMicros()), &reply);
+        uint8_t out[ENSEMBLE_PACKET_MAX];
+        netSend(d.fd, ntohs(from.sin_port), out, reply.encode(out));
+      } else if (!leader && packet.type == ENSEMBLE_REPLY) {
+        d.clock.onReply(packet, receiveUs);
+      } else if (!leader && packet.type == ENSEMBLE_NOTE) {
+        uint32_t due = syncMode && d.clock.isSynced() ? d.clock.toLocal(packet.t1) : receiveUs;
+        d.scheduler.schedule(due, receiveUs, packet.status, packet.data1, packet.data2);
+      }
+    }
+
+    now = hostMicros();
+    if (leader && now >= nextNoteUs && now < stopUs - 500000) {
+      // EnsembleSync::share(): heure commune + delai, aux suiveurs puis chez soi
+      EnsemblePacket note;
+      note.type = ENSEMBLE_NOTE;
+      note.seq = ++noteSeq;
+      note.t1 = d.clock.now(d.local(now)) + ENSEMBLE_PLAYOUT_MS * 1000LL;
+      note.status = MIDI_NOTE_ON;
+      note.data1 = noteSeq & 0x7F;
+      note.data2 = (noteSeq >> 7) & 0x7F;
+      uint8_t out[ENSEMBLE_PACKET_MAX];
+      uint8_t size = note.encode(out);
+      for (size_t i = 1; i < devices.size(); i++) netSend(d.fd, devices[i]->port, out, size);
+      uint32_t due = syncMode ? d.clock.toLocal(note.t1) : d.local(now);
+      d.scheduler.schedule(due, d.local(now), note.status, note.data1, note.data2);
+      nextNoteUs += NOTE_PERIOD_US;
+    }
+    if (!leader && syncMode && now >= nextSyncUs) {
+      EnsemblePacket request;
+      d.clock.request(d.local(now), &request);
+      uint8_t out[ENSEMBLE_PACKET_MAX];
+      netSend(d.fd, devices[0]->port, out, request.encode(out));
+      nextSyncUs += ENSEMBLE_SYNC_MS * 1000LL;
+    }
+    if (!leader && syncMode && now >= nextErrorUs && d.clock.isSynced()) {
+      int64_t error = d.clock.now(d.local(now)) - leaderEnsemble(now);
+      d.errors.push_back((uint32_t)std::min<int64_t>(std::llabs(error), UINT32_MAX));
+      nextErrorUs += 100000;
+    }
+
+    // Notes dues
+    NoteScheduler::Event e;
+    while (d.scheduler.pop(d.local(hostMicros()), &e)) {
+      recordPlay(index, e, hostMicros());
+    }
+
+    // Attente: socket, prochaine note due ou prochaine action
+    now = hostMicros();
+    int64_t wakeUs = std::min(leader ? nextNoteUs : nextSyncUs, now + 1000);
+    uint32_t dueIn = d.scheduler.usUntilNext(d.local(now));
+    if (dueIn != UINT32_MAX) wakeUs = std::min(wakeUs, now + (int64_t)dueIn);
+    int64_t waitUs = std::max<int64_t>(0, wakeUs - now);
+    timespec timeout = { (time_t)(waitUs / 1000000), (long)(waitUs % 1000000) * 1000 };
+    pollfd p = { d.fd, POLLIN, 0 };
+    ppoll(&p, 1, &timeout, nullptr);
+  }
+
+  EnsembleClock::Stats s = d.clock.getStats();
+  d.driftPpm = s.driftPpm;
+  d.late = d.scheduler.getStats().late;
+}
+
+static uint32_t percentile(std::vector<uint32_t> v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(p * (v.size() - 1) + 0.5))];
+}
+
+static void run(int port, int seconds, int followers) {
+  static const double drifts[] = { 40, -120, 85, -30, 150, -75, 10, -160, 60 };
+  std::mt19937 origins(777);
+  for (Device* d : devices) delete d;
+  devices.clear();
+  for (int i = 0; i <= followers; i++) {
+    Device* d = new Device();
+    d->name = i == 0 ? "Lyre 1 (chef)" : "Lyre " + std::to_string(i + 1);
+    d->port = port + i;
+    d->fd = openUdp(d->port);
+    d->ppm = drifts[i % 9];
+    d->origin = i == 2 ? 0xFFFFFFFFLL - 2000000 : (int64_t)(origins() & 0xFFFFFFFF);
+    d->clock.setLeader(i == 0);
+    d->driftPpm = 0;
+    d->late = 0;
+    if (d->fd < 0) exit(1);
+    devices.push_back(d);
+  }
+
+  int64_t startUs = hostMicros() + 100000;
+  int64_t stopUs = startUs + (int64_t)seconds * 1000000;
+  leaderStartExt = devices[0]->localExt(startUs);
+  leaderBase = devices[0]->clock.now((uint32_t)leaderStartExt);
+  plays.assign(seconds * 1000000 / NOTE_PERIOD_US + 2, std::vector<int64_t>(devices.size(), 0));
+  {
+    std::lock_guard<std::mutex> guard(netLock);
+    inFlight.clear();
+  }
+
+  std::atomic<bool> running(true);
+  std::thread network(runNetwork, &running);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < devices.size(); i++) threads.emplace_back(runDevice, i, startUs, stopUs);
+  for (std::thread& t : threads) t.join();
+  running = false;
+  network.join();
+
+  // Ecart entre lyres, notes jouees par toutes apres la mise en route
+  std::vector<uint32_t> skews;
+  uint32_t incomplete = 0;
+  for (size_t n = 1; n < plays.size(); n++) {
+    int64_t first = INT64_MAX, last = 0;
+    bool complete = true, any = false;
+    for (int64_t t : plays[n]) {
+      if (t == 0) {
+        complete = false;
+        continue;
+      }
+      any = true;
+      first = std::min(first, t);
+      last = std::max(last, t);
+    }
+    if (!any || first < startUs + WARMUP_US) continue;
+    if (!complete) {
+      incomplete++;
+      continue;
+    }
+    skews.push_back((uint32_t)(last - first));
+  }
+
+  printf("\n=== %s, %d suiveur(s), %d s, gigue %.1f ms, pertes %.1f %% ===\n",
+         syncMode ? "heure commune" : "jeu des reception", followers, seconds, jitterMs,
+         lossPercent);
+  printf("Notes jouees par toutes les lyres: %zu, manquantes chez au moins une: %u\n",
+         skews.size(), incomplete);
+  printf("Ecart entre lyres: p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+         percentile(skews, 0.5) / 1000.0, percentile(skews, 0.99) / 1000.0,
+         percentile(skews, 1.0) / 1000.0);
+  for (size_t i = 1; i < devices.size() && syncMode; i++) {
+    Device& d = *devices[i];
+    // Derive du chef vue du suiveur: (1 + chef) / (1 + suiveur) - 1
+    double actual = ((1 + devices[0]->ppm * 1e-6) / (1 + d.ppm * 1e-6) - 1) * 1e6;
+    printf("  %-8s derive estimee %+7.1f ppm (reelle %+7.1f) | erreur heure commune p50 %u us, "
+           "p99 %u us | en retard: %u\n",
+           d.name.c_str(), d.driftPpm, actual, percentile(d.errors, 0.5),
+           percentile(d.errors, 0.99), d.late);
+  }
+  for (size_t i = 1; i < devices.size() && !syncMode; i++) {
+    printf("  %-8s en retard: %u\n", devices[i]->name.c_str(), devices[i]->late);
+  }
+  for (Device* d : devices) close(d->fd);
+}
+
+static void usage() {
+  fprintf(stderr, "Utilisation: lyre_ensemble [--seconds N] [--followers N] [--jitter-ms N] "
+                  "[--loss P] [--port N] [--sync | --nosync]\n");
+}
+
+int main(int argc, char** argv) {
+  int seconds = 20, followers = 3, port = ENSEMBLE_PORT;
+  int modes = 3;  // 1: heure commune, 2: des reception
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--seconds" && i + 1 < argc) seconds = atoi(argv[++i]);
+    else if (arg == "--followers" && i + 1 < argc) followers = atoi(argv[++i]);
+    else if (arg == "--jitter-ms" && i + 1 < argc) jitterMs = atof(argv[++i]);
+    else if (arg == "--loss" && i + 1 < argc) lossPercent = atof(argv[++i]);
+    else if (arg == "--port" && i + 1 < argc) port = atoi(argv[++i]);
+    else if (arg == "--sync") modes = 1;
+    else if (arg == "--nosync") modes = 2;
+    else {
+      usage();
+      return 2;
+    }
+  }
+  if (seconds < 5 || followers < 1 || followers > 8) {
+    usage();
+    return 2;
+  }
+
+  if (modes & 2) {
+    syncMode = false;
+    run(port, seconds, followers);
+  }
+  if (modes & 1) {
+    syncMode = true;
+    run(port, seconds, followers);
+  }
+  return 0;
+}
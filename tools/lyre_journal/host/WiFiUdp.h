@@ -0,0 +1,51 @@
+#ifndef HOST_WIFIUDP_H
+#define HOST_WIFIUDP_H
+/***********************************************************************************************
+WiFiUdp.h de substitution pour tools/lyre_journal
+
+Reseau local en memoire: udpSend() depose un datagramme, WiFiUDP::parsePacket() le retire dans
+l'ordre d'envoi. L'outil decide des pertes avant l'envoi. Seules les methodes utilisees par
+JournalUdp et par le lecteur de session de l'outil sont fournies, plus micros() (temps
+virtuel, avance par l'outil: heure d'arrivee des paquets pour RtpClock).
+************************************************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+
+inline unsigned long hostMicros = 0;
+inline unsigned long micros() { return hostMicros; }
+
+class WiFiUDP {
+  public:
+    static inline std::deque<std::vector<uint8_t>> network;
+
+    int parsePacket() {
+      if (network.empty()) return 0;
+      _current = network.front();
+      network.pop_front();
+      _position = 0;
+      return (int)_current.size();
+    }
+    int available() { return (int)(_current.size() - _position); }
+    int read() { return _position < _current.size() ? _current[_position++] : -1; }
+    int read(unsigned char* buffer, size_t length) {
+      size_t count = 0;
+      while (count < length && _position < _current.size()) buffer[count++] = _current[_position++];
+      return (int)count;
+    }
+    int peek() { return _position < _current.size() ? _current[_position] : -1; }
+    void flush() { _position = _current.size(); }
+
+  private:
+    std::vector<uint8_t> _current;
+    size_t _position = 0;
+};
+
+inline void udpSend(const std::vector<uint8_t>& datagram) {
+  WiFiUDP::network.push_back(datagram);
+}
+
+#endif // HOST_WIFIUDP_H
@@ -0,0 +1,394 @@
+/***********************************************************************************************
+----------------------------    lyre_journal - pertes RTP-MIDI et journal   --------------------
+************************************************************************************************
+Compile RtpJournal.cpp et JournalUdp.cpp du sketch WiFi tels quels contre un WiFiUDP en
+memoire (dossier host/), puis envoie un flux RTP-MIDI genere (arpeges tenus, pedale de sustain)
+avec des pertes de paquets simulees. Meme flux, memes pertes, journal de l'emetteur active ou
+non.
+
+  g++ -std=c++17 -O2 -I tools/lyre_journal/host -I arduino/Servo_pluck_ESP32_WiFi \
+      tools/lyre_journal/lyre_journal.cpp arduino/Servo_pluck_ESP32_WiFi/RtpJournal.cpp \
+      arduino/Servo_pluck_ESP32_WiFi/JournalUdp.cpp -o lyre_journal
+
+Utilisation:
+  lyre_journal [--packets N] [--seed N] [--loss POURCENT] [--burst N] [--window N]
+               [--recent N]
+      Sans --loss: tableau pour 0, 1, 5, 10 et 20 % de pertes
+
+Emetteur (RFC 6295): chaque paquet porte ses commandes puis, si le journal est actif, l'etat
+depuis le point de controle (paquet courant - --window): chapitre N (noteOn du la fenetre, bit
+Y si moins de --recent paquets, OFFBITS des noteOff) et chapitre C (CC changes). Le recepteur
+joue le role de la bibliotheque AppleMIDI: il lit les commandes par JournalUdp, qui passe
+chaque datagramme au journal, et signale chaque message livre au journal.
+
+Mesures: noteOn perdus (dans un paquet perdu), rejoues par le journal, trop anciens (bit Y a 0),
+jamais joues; notes bloquees (tenues par la lyre, relachees par l'emetteur) a la fin et en
+note-paquets cumules; paquets recus avec une pedale de sustain fausse.
+************************************************************************************************/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "JournalUdp.h"
+#include "RtpJournal.h"
+
+#define NOTE_LOW 55
+#define NOTE_HIGH 81
+#define PEDAL_CC 64
+
+struct Event {
+  uint8_t status, data1, data2;
+};
+
+struct Options {
+  int packets = 5000;
+  uint32_t seed = 1;
+  int window = 16;  // Paquets couverts par le journal (point de controle)
+  int recent = 4;   // noteOn rejoues s'ils ont moins de N paquets
+  int burst = 1;    // Paquets perdus d'affilee par perte
+};
+
+struct Result {
+  int sent = 0, lost = 0;
+  int noteOns = 0, noteOnsLost = 0;
+  int replayed = 0, late = 0, missed = 0;
+  int stuckEnd = 0;
+  long stuckPackets = 0;
+  int pedalWrong = 0;
+};
+
+static uint32_t rngState;
+
+static uint32_t rng() {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Emetteur: etat de reference et dernier changement de chaque note et controleur
+// ---------------------------------------------------------------------------------------------
+
+struct Sender {
+  bool journal = true;
+  int window = 16, recent = 4;
+  uint16_t seq = 0x4321;
+  uint32_t timestamp = 0;
+  bool held[128] = {};
+  uint8_t velocity[128] = {};
+  int noteOnPacket[128];
+  int noteOffPacket[128];
+  uint8_t controllers[128] = {};
+  int controllerPacket[128];
+
+  Sender() {
+    for (int i = 0; i < 128; i++) noteOnPacket[i] = noteOffPacket[i] = controllerPacket[i] = -1;
+  }
+
+  // Journal du paquet 'packet': historique des paquets [packet - window, packet - 1]
+  std::vector<uint8_t> encodeJournal(int packet) {
+    int checkpoint = packet - window;
+    if (checkpoint < 0) checkpoint = 0;
+    std::vector<uint8_t> c, n;
+
+    for (int i = 0; i < 128; i++) {
+      if (controllerPacket[i] >= checkpoint && controllerPacket[i] < packet) {
+        c.push_back(0x80 | i);  // S = 1: pas de recuperation par paquet precedent
+        c.push_back(controllers[i]);
+      }
+    }
+
+    std::vector<uint8_t> logs;
+    uint8_t offBits[16] = {};
+    int low = 16, high = -1;
+    for (int i = 0; i < 128; i++) {
+      if (noteOnPacket[i] >= checkpoint && noteOnPacket[i] < packet) {
+        bool recent = packet - 1 - noteOnPacket[i] < this->recent;
+        logs.push_back(0x80 | i);
+        logs.push_back((recent ? 0x80 : 0x00) | velocity[i]);
+      }
+      if (!held[i] && noteOffPacket[i] >= checkpoint && noteOffPacket[i] < packet) {
+        offBits[i >> 3] |= 0x80 >> (i & 7);
+        if ((i >> 3) < low) low = i >> 3;
+        if ((i >> 3) > high) high = i >> 3;
+      }
+    }
+    if (!logs.empty() || high >= 0) {
+      if (high < 0) low = 15, high = 14;  // Pas d'OFFBITS
+      n.push_back(0x80 | (uint8_t)(logs.size() / 2));
+      n.push_back((uint8_t)(low << 4 | high));
+      n.insert(n.end(), logs.begin(), logs.end());
+      for (int b = low; b <= high; b++) n.push_back(offBits[b]);
+    }
+
+    std::vector<uint8_t> journal = { 0x80, (uint8_t)((seq - (packet - checkpoint)) >> 8),
+                                     (uint8_t)(seq - (packet - checkpoint)) };
+    if (c.empty() && n.empty()) return journal;  // Journal vide: seulement l'en-tete (A = 0)
+
+    std::vector<uint8_t> body;
+    uint8_t chapters = 0;
+    if (!c.empty()) {
+      chapters |= 0x40;
+      body.push_back(0x80 | (uint8_t)(c.size() / 2 - 1));
+      body.insert(body.end(), c.begin(), c.end());
+    }
+    if (!n.empty()) {
+      chapters |= 0x08;
+      body.insert(body.end(), n.begin(), n.end());
+    }
+    uint16_t length = 3 + body.size();
+    journal[0] = 0x80 | 0x20;  // S, A (un journal de canal, TOTCHAN = 0)
+    journal.push_back(0x80 | (uint8_t)(length >> 8 & 0x03));  // S, canal 0
+    journal.push_back((uint8_t)length);
+    journal.push_back(chapters);
+    journal.insert(journal.end(), body.begin(), body.end());
+    return journal;
+  }
+
+  std::vector<uint8_t> encode(int packet, const std::vector<Event>& events) {
+    std::vector<uint8_t> list;
+    for (size_t i = 0; i < events.size(); i++) {
+      if (i > 0) list.push_back(0x00);  // Delta temps nul
+      list.push_back(events[i].status);
+      list.push_back(events[i].data1);
+      list.push_back(events[i].data2);
+    }
+    std::vector<uint8_t> out = { 0x80, 0x61, (uint8_t)(seq >> 8), (uint8_t)seq,
+                                 (uint8_t)(timestamp >> 24), (uint8_t)(timestamp >> 16),
+                                 (uint8_t)(timestamp >> 8), (uint8_t)timestamp,
+                                 0x12, 0x34, 0x56, 0x78 };
+    uint8_t j = (journal && packet > 0) ? 0x40 : 0x00;
+    if (list.size() > 15) {
+      out.push_back(0x80 | j | (uint8_t)(list.size() >> 8));
+      out.push_back((uint8_t)list.size());
+    } else {
+      out.push_back(j | (uint8_t)list.size());
+    }
+    out.insert(out.end(), list.begin(), list.end());
+    if (j) {
+      std::vector<uint8_t> journalBytes = encodeJournal(packet);
+      out.insert(out.end(), journalBytes.begin(), journalBytes.end());
+    }
+
+    // Etat de reference mis a jour apres l'encodage: le journal decrit les paquets precedents
+    for (const Event& e : events) {
+      if ((e.status & 0xF0) == 0x90) {
+        held[e.data1] = true;
+        velocity[e.data1] = e.data2;
+        noteOnPacket[e.data1] = packet;
+      } else if ((e.status & 0xF0) == 0x80) {
+        held[e.data1] = false;
+        noteOffPacket[e.data1] = packet;
+      } else if ((e.status & 0xF0) == 0xB0) {
+        controllers[e.data1] = e.data2;
+        controllerPacket[e.data1] = packet;
+      }
+    }
+    seq++;
+    timestamp += 441;  // 10 ms a 44.1 kHz
+    return out;
+  }
+};
+
+// ---------------------------------------------------------------------------------------------
+// Recepteur: etat de la lyre, alimente par les commandes livrees et par le journal
+// ---------------------------------------------------------------------------------------------
+
+static bool lyreHeld[128];
+static uint8_t lyrePedal;
+static int journalNoteOns;
+
+static void onJournalNoteOn(uint8_t, uint8_t note, uint8_t) {
+  lyreHeld[note] = true;
+  journalNoteOns++;
+}
+
+static void onJournalNoteOff(uint8_t, uint8_t note) {
+  lyreHeld[note] = false;
+}
+
+static void onJournalControlChange(uint8_t, uint8_t controller, uint8_t value) {
+  if (controller == PEDAL_CC) lyrePedal = value;
+}
+
+// Journal de la lyre, alimente par JournalUdp avant la lecture des commandes
+static RtpJournal lyreJournal;
+
+static void onPacket(const uint8_t* data, uint16_t length, uint32_t) {
+  lyreJournal.onPacket(data, length);
+}
+
+// Lecture de la section de commandes comme la bibliotheque AppleMIDI (statut courant compris)
+static void receive(JournalUdp& udp) {
+  int size = udp.parsePacket();
+  if (size < 13) return;
+  uint8_t header[12];
+  udp.read(header, sizeof(header));
+  uint8_t flags = udp.read();
+  int length = flags & 0x0F;
+  if (flags & 0x80) length = (length << 8) | udp.read();
+
+  std::vector<uint8_t> list(length);
+  udp.read(list.data(), length);
+  udp.flush();
+
+  uint8_t status = 0;
+  size_t pos = 0;
+  bool first = !(flags & 0x20);  // Z = 0: pas de delta avant la premiere commande
+  while (pos < list.size()) {
+    if (!first) {
+      while (pos < list.size() && (list[pos] & 0x80)) pos++;  // Delta temps (forme longue)
+      pos++;
+    }
+    first = false;
+    if (pos >= list.size()) break;
+    if (list[pos] & 0x80) status = list[pos++];
+    if (pos + 2 > list.size()) break;
+    uint8_t data1 = list[pos++], data2 = list[pos++];
+
+    if ((status & 0xF0) == 0x90 && data2 > 0) {
+      lyreHeld[data1] = true;
+      lyreJournal.noteOnReceived(data1);
+    } else if ((status & 0xF0) == 0x80 || (status & 0xF0) == 0x90) {
+      lyreHeld[data1] = false;
+      lyreJournal.noteOffReceived(data1);
+    } else if ((status & 0xF0) == 0xB0) {
+      if (data1 == PEDAL_CC) lyrePedal = data2;
+      lyreJournal.controlChangeReceived(data1, data2);
+    }
+  }
+}
+
+// ---------------------------------------------------------------------------------------------
+// Flux et pertes
+// ---------------------------------------------------------------------------------------------
+
+static Result run(const Options& options, int lossPermille, bool journal) {
+  Result r;
+  Sender sender;
+  sender.journal = journal;
+  sender.window = options.window;
+  sender.recent = options.recent;
+
+  JournalUdp udp;
+  JournalUdp::setPacketHandler(onPacket);
+  lyreJournal.reset();
+  lyreJournal.resetStats();
+  lyreJournal.setHandlers(onJournalNoteOn, onJournalNoteOff, onJournalControlChange);
+  for (int i = 0; i < 128; i++) lyreHeld[i] = false;
+  lyrePedal = 0;
+  journalNoteOns = 0;
+
+  rngState = options.seed * 2654435761u + 1;
+  int releaseAt[128];
+  for (int i = 0; i < 128; i++) releaseAt[i] = -1;
+  int burstLeft = 0;
+  const int trailer = 3;  // Paquets de fin: toutes les notes relachees, journal seul
+
+  for (int packet = 0; packet < options.packets + trailer; packet++) {
+    std::vector<Event> events;
+    bool ending = packet >= options.packets;
+    for (int note = 0; note < 128; note++) {
+      if (releaseAt[note] >= 0 && (ending || releaseAt[note] <= packet)) {
+        events.push_back({ 0x80, (uint8_t)note, 0x40 });
+        releaseAt[note] = -1;
+      }
+    }
+    if (!ending) {
+      int count = rng() % 3;  // 0 a 2 notes par paquet
+      for (int i = 0; i < count; i++) {
+        int note = NOTE_LOW + rng() % (NOTE_HIGH - NOTE_LOW + 1);
+        if (releaseAt[note] >= 0) continue;
+        events.push_back({ 0x90, (uint8_t)note, (uint8_t)(40 + rng() % 80) });
+        releaseAt[note] = packet + 1 + rng() % 30;
+        r.noteOns++;
+      }
+      if (rng() % 50 == 0) {
+        events.push_back({ 0xB0, PEDAL_CC, (uint8_t)(sender.controllers[PEDAL_CC] ? 0 : 127) });
+      }
+    } else if (sender.controllers[PEDAL_CC]) {
+      events.push_back({ 0xB0, PEDAL_CC, 0 });
+    }
+
+    // Perte decidee avant l'envoi, identique avec et sans journal (meme graine)
+    bool lost = false;
+    if (burstLeft > 0) {
+      lost = true;
+      burstLeft--;
+    } else if ((int)(rng() % 1000) < lossPermille && packet > 0 && !ending) {
+      lost = true;
+      burstLeft = options.burst - 1;
+    }
+
+    std::vector<uint8_t> datagram = sender.encode(packet, events);
+    r.sent++;
+    if (lost) {
+      r.lost++;
+      for (const Event& e : events) {
+        if ((e.status & 0xF0) == 0x90) r.noteOnsLost++;
+      }
+      continue;
+    }
+    udpSend(datagram);
+    receive(udp);
+
+    for (int note = 0; note < 128; note++) {
+      if (lyreHeld[note] && !sender.held[note]) r.stuckPackets++;
+    }
+    if (lyrePedal != sender.controllers[PEDAL_CC]) r.pedalWrong++;
+  }
+
+  for (int note = 0; note < 128; note++) {
+    if (lyreHeld[note]) r.stuckEnd++;
+  }
+  RtpJournal::Stats stats = lyreJournal.getStats();
+  r.replayed = journalNoteOns;
+  r.late = stats.notesLate;
+  r.missed = r.noteOnsLost - r.replayed;
+  return r;
+}
+
+static void usage() {
+  fprintf(stderr, "Utilisation: lyre_journal [--packets N] [--seed N] [--loss POURCENT] "
+                  "[--burst N] [--window N] [--recent N]\n");
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  double loss = -1;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--packets" && i + 1 < argc) options.packets = atoi(argv[++i]);
+    else if (arg == "--seed" && i + 1 < argc) options.seed = (uint32_t)atoi(argv[++i]);
+    else if (arg == "--loss" && i + 1 < argc) loss = atof(argv[++i]);
+    else if (arg == "--burst" && i + 1 < argc) options.burst = atoi(argv[++i]);
+    else if (arg == "--window" && i + 1 < argc) options.window = atoi(argv[++i]);
+    else if (arg == "--recent" && i + 1 < argc) options.recent = atoi(argv[++i]);
+    else { usage(); return 1; }
+  }
+  if (options.packets <= 0 || options.burst <= 0 || options.window <= 0 || options.recent < 0) {
+    usage();
+    return 1;
+  }
+
+  std::vector<double> losses = { 0, 1, 5, 10, 20 };
+  if (loss >= 0) losses = { loss };
+
+  printf("%d paquets, rafales de %d, fenetre du journal %d paquets, noteOn rejoues sous %d "
+         "paquets\n\n", options.packets, options.burst, options.window, options.recent);
+  printf("Pertes  Journal  Paquets perdus  noteOn perdus  rejoues  trop anciens  jamais joues  "
+         "Bloquees fin  Note-paquets bloques  Pedale fausse\n");
+  for (double l : losses) {
+    for (int journal = 0; journal <= 1; journal++) {
+      Result r = run(options, (int)(l * 10 + 0.5), journal);
+      printf("%5.1f%%  %-7s  %14d  %13d  %7d  %12d  %12d  %12d  %20ld  %13d\n", l,
+             journal ? "oui" : "non", r.lost, r.noteOnsLost, r.replayed, r.late, r.missed,
+             r.stuckEnd, r.stuckPackets, r.pedalWrong);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,99 @@
+/***********************************************************************************************
+----------------------------    lyre_log - decodeur du journal differe   -----------------------
+************************************************************************************************
+Relit la sortie serie d'un sketch compile avec DEFERRED_LOG_BINARY true: les trames binaires
+du journal (0x00 0xA5 + LogRecord, voir LogFormats.h) redeviennent du texte horodate, le texte
+normal (demarrage, commandes serie) est recopie tel quel.
+
+  E=arduino/Servo_pluck_ESP32_BLE_Enhanced
+  g++ -std=c++17 -O2 -I $E tools/lyre_log/lyre_log.cpp -o lyre_log
+
+Utilisation:
+  lyre_log [capture.bin]        (sans fichier: lit l'entree standard)
+
+  stty -F /dev/ttyUSB0 115200 raw && lyre_log < /dev/ttyUSB0
+
+Compiler avec le LogFormats.h du firmware qui a produit la capture: les identifiants de
+message sont les positions dans LOG_FORMATS.
+************************************************************************************************/
+
+#include <cstdio>
+#include <cstring>
+
+#include "LogFormats.h"
+
+static uint32_t readLe32(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Le firmware copie la structure telle quelle: ESP32 little-endian, sans remplissage
+static LogRecord parseRecord(const uint8_t* p) {
+  LogRecord record;
+  record.timestampUs = readLe32(p);
+  record.formatId = p[4];
+  record.argCount = p[5] <= LOG_MAX_ARGS ? p[5] : LOG_MAX_ARGS;
+  record.reserved = 0;
+  for (int i = 0; i < LOG_MAX_ARGS; i++) {
+    record.args[i] = readLe32(p + 8 + 4 * i);
+  }
+  return record;
+}
+
+int main(int argc, char** argv) {
+  static_assert(sizeof(LogRecord) == 20, "LogRecord doit rester sur 20 octets");
+
+  FILE* in = stdin;
+  if (argc > 2 || (argc == 2 && argv[1][0] == '-' && argv[1][1] != 0)) {
+    fprintf(stderr, "Utilisation: lyre_log [capture.bin]\n");
+    return 1;
+  }
+  if (argc == 2 && strcmp(argv[1], "-") != 0) {
+    in = fopen(argv[1], "rb");
+    if (!in) {
+      fprintf(stderr, "Impossible d'ouvrir %s\n", argv[1]);
+      return 1;
+    }
+  }
+
+  uint8_t frame[sizeof(LogRecord)];
+  unsigned long records = 0, dropped = 0, unknown = 0;
+  bool lineStart = true;
+  int c;
+  while ((c = fgetc(in)) != EOF) {
+    if (c != LOG_FRAME_SYNC0) {
+      putchar(c);
+      lineStart = (c == '\n');
+      continue;
+    }
+    int sync = fgetc(in);
+    if (sync != LOG_FRAME_SYNC1) {
+      if (sync != EOF) ungetc(sync, in);
+      continue;  // 0x00 isole: jamais emis par du texte, ignore
+    }
+    if (fread(frame, 1, sizeof(frame), in) != sizeof(frame)) {
+      fprintf(stderr, "Trame tronquee en fin de capture\n");
+      break;
+    }
+
+    LogRecord record = parseRecord(frame);
+    char text[256];
+    logFormatRecord(text, sizeof(text), record);
+    if (!lineStart) putchar('\n');  // Trame au milieu d'une ligne de texte
+    printf("[%10.6f] %s\n", record.timestampUs / 1e6, text);
+    lineStart = true;
+
+    records++;
+    if (record.formatId == LOG_DROPPED) dropped += record.args[0];
+    if (record.formatId >= LOG_FORMAT_COUNT) unknown++;
+  }
+
+  fflush(stdout);
+  fprintf(stderr, "%lu message(s) decode(s), %lu perdu(s) sur la cible", records, dropped);
+  if (unknown) {
+    fprintf(stderr, ", %lu identifiant(s) inconnu(s): LogFormats.h different du firmware?",
+            unknown);
+  }
+  fprintf(stderr, "\n");
+  if (in != stdin) fclose(in);
+  return 0;
+}
@@ -0,0 +1,531 @@
+/***********************************************************************************************
+----------------------------    lyre_osc - entree OSC de la lyre WiFi   ------------------------
+************************************************************************************************
+Compile OscParser.h (lecture en place des paquets OSC) et OscCommand.cpp (commandes et heure
+des bundles) du sketch WiFi tels quels et les exerce sur le PC: tests, mesure sur de vraies
+sockets UDP locales, envoi de commandes a une lyre sur le reseau.
+
+  g++ -std=c++17 -O2 -pthread -I arduino/Servo_pluck_ESP32_WiFi \
+      tools/lyre_osc/lyre_osc.cpp arduino/Servo_pluck_ESP32_WiFi/OscCommand.cpp -o lyre_osc
+
+Utilisation:
+  lyre_osc test
+      Paquets construits a la main (messages, bundles imbriques, velocites entieres et
+      reelles, paquets tronques, mal alignes, chaines non terminees, imbrication excessive),
+      commandes de la lyre (servo ou note, velocite, accords, velocite 0), heure locale des
+      bundles (gigue, bundles en avance, regie qui change d'heure). Code de sortie 1 au premier
+      ecart.
+  lyre_osc bench [--seconds N] [--rate N] [--port N]
+      Un fil envoie --rate bundles/s (defaut 2000) sur 127.0.0.1, horodates a l'heure NTP du
+      PC, contenant /lyre/note et /lyre/chord. Le fil principal les lit et les analyse comme
+      OscListener (OscCommand, OscClock): temps d'analyse par datagramme, messages/s, transit
+      timetag -> lecture (p50, p99, max).
+  lyre_osc send --host IP [--port N] [--in-ms N] note <servo|note> [vel] | chord <masque> [vel]
+                | panic
+      Une commande a la lyre (port OSC_PORT par defaut). Avec --in-ms, dans un bundle horodate
+      N ms plus tard (heure du PC), precede dans le meme datagramme d'un /lyre/clock horodate
+      a l'envoi: la lyre joue la commande N ms apres son arrivee (plus OSC_PLAYOUT_MS).
+************************************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "settings.h"
+#include "OscParser.h"
+#include "OscCommand.h"
+
+#define NTP_UNIX_OFFSET 2208988800ULL  // Secondes de 1900 a 1970
+
+static int64_t hostMicros() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t hostNanos() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Heure NTP du PC (timetag OSC), decalee de inUs
+static uint64_t ntpNow(int64_t inUs = 0) {
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  int64_t us = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 + inUs;
+  uint64_t seconds = us / 1000000 + NTP_UNIX_OFFSET;
+  uint64_t fraction = ((uint64_t)(us % 1000000) << 32) / 1000000;
+  return (seconds << 32) | fraction;
+}
+
+static int64_t ntpToMicros(uint64_t timetag) {
+  return (int64_t)((timetag >> 32) - NTP_UNIX_OFFSET) * 1000000 +
+         (int64_t)(((timetag & 0xFFFFFFFFULL) * 1000000) >> 32);
+}
+
+// ---------------------------------------------------------------------------------------------
+// Construction de paquets
+// ---------------------------------------------------------------------------------------------
+static void putBe32(std::vector<uint8_t>& out, uint32_t v) {
+  for (int i = 3; i >= 0; i--) out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+static void putBe64(std::vector<uint8_t>& out, uint64_t v) {
+  for (int i = 7; i >= 0; i--) out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+static void putString(std::vector<uint8_t>& out, const std::string& s) {
+  out.insert(out.end(), s.begin(), s.end());
+  do out.push_back(0); while (out.size() & 3);
+}
+
+struct Arg {
+  char type;
+  int32_t i;
+  float f;
+};
+
+static Arg intArg(int32_t v) { return { 'i', v, 0 }; }
+static Arg floatArg(float v) { return { 'f', 0, v }; }
+
+static std::vector<uint8_t> message(const std::string& address, const std::vector<Arg>& args) {
+  std::vector<uint8_t> out;
+  putString(out, address);
+  std::string types = ",";
+  for (const Arg& a : args) types += a.type;
+  putString(out, types);
+  for (const Arg& a : args) {
+    if (a.type == 'i') putBe32(out, (uint32_t)a.i);
+    if (a.type == 'f') {
+      uint32_t bits;
+      memcpy(&bits, &a.f, 4);
+      putBe32(out, bits);
+    }
+  }
+  return out;
+}
+
+static std::vector<uint8_t> bundle(uint64_t timetag,
+                                   const std::vector<std::vector<uint8_t>>& elements) {
+  std::vector<uint8_t> out;
+  putString(out, "#bundle");
+  putBe64(out, timetag);
+  for (const std::vector<uint8_t>& e : elements) {
+    putBe32(out, (uint32_t)e.size());
+    out.insert(out.end(), e.begin(), e.end());
+  }
+  return out;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Tests
+// ---------------------------------------------------------------------------------------------
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+  printf("  %s %s\n", ok ? "ok  " : "ECHEC", what);
+  if (!ok) failures++;
+}
+
+// Tous les messages du paquet, et son etat
+static std::vector<OscMessage> parse(const std::vector<uint8_t>& data, bool* malformed) {
+  std::vector<OscMessage> out;
+  OscPacket packet(data.data(), data.size());
+  OscMessage m;
+  while (packet.next(m)) out.push_back(m);
+  *malformed = packet.malformed();
+  return out;
+}
+
+// Commande du premier message du paquet
+static bool command(const std::vector<uint8_t>& data, OscCommand* c) {
+  OscPacket packet(data.data(), data.size());
+  OscMessage m;
+  return packet.next(m) && c->decode(m);
+}
+
+// Timetag NTP d'un instant de la regie (microsecondes depuis une origine arbitraire)
+static uint64_t senderTag(int64_t us) {
+  uint64_t seconds = 0xE1000000ULL + us / 1000000;
+  uint64_t fraction = ((uint64_t)(us % 1000000) << 32) / 1000000;
+  return (seconds << 32) | fraction;
+}
+
+// A 1 us pres (arrondis de la fraction NTP)
+static bool near(uint32_t a, uint32_t b) {
+  int32_t d = (int32_t)(a - b);
+  return d >= -1 && d <= 1;
+}
+
+static void testCommands() {
+  OscCommand c;
+  printf("Commandes\n");
+  std::vector<uint8_t> p = message("/lyre/note", { intArg(3), intArg(90) });
+  check(command(p, &c) && c.type == OSC_COMMAND_NOTES && c.noteCount == 1 &&
+        c.notes[0] == MidiServoMapping[3] && c.status == MIDI_NOTE_ON && c.velocity == 90,
+        "/lyre/note 3 90: servo 3, noteOn 90");
+  p = message("/lyre/note", { intArg(60), floatArg(0.5f) });
+  check(command(p, &c) && c.notes[0] == 60 && c.velocity == 64, "/lyre/note 60 0.5: note 60, 64");
+  p = message("/lyre/note", { intArg(5) });
+  check(command(p, &c) && c.velocity == OSC_DEFAULT_VELOCITY, "sans velocite: OSC_DEFAULT_VELOCITY");
+  p = message("/lyre/note", { intArg(2), intArg(0) });
+  check(command(p, &c) && c.status == MIDI_NOTE_OFF && c.velocity == 0, "velocite 0: noteOff");
+  p = message("/lyre/note", { intArg(2), intArg(300) });
+  check(command(p, &c) && c.status == MIDI_NOTE_ON && c.velocity == 127, "velocite 300: 127");
+  p = message("/lyre/note", { intArg(2), floatArg(-0.5f) });
+  check(command(p, &c) && c.status == MIDI_NOTE_OFF, "velocite -0.5: noteOff");
+  p = message("/lyre/note", { intArg(200) });
+  check(!command(p, &c) && c.type == OSC_COMMAND_NONE, "/lyre/note 200: refusee");
+  p = message("/lyre/chord", { intArg(0x0015) });
+  check(command(p, &c) && c.noteCount == 3 && c.notes[0] == MidiServoMapping[0] &&
+        c.notes[1] == MidiServoMapping[2] && c.notes[2] == MidiServoMapping[4] &&
+        c.status == MIDI_NOTE_ON, "/lyre/chord 0x0015: servos 0, 2, 4");
+  p = message("/lyre/chord", { intArg(0x0015), intArg(0) });
+  check(command(p, &c) && c.noteCount == 3 && c.status == MIDI_NOTE_OFF,
+        "/lyre/chord 0x0015 0: trois noteOff");
+  p = message("/lyre/panic", {});
+  check(command(p, &c) && c.type == OSC_COMMAND_PANIC, "/lyre/panic");
+  p = message("/lyre/clock", {});
+  check(command(p, &c) && c.type == OSC_COMMAND_CLOCK, "/lyre/clock");
+  p = message("/lyre/tune", { intArg(1) });
+  check(!command(p, &c), "adresse inconnue: refusee");
+  std::vector<uint8_t> text;
+  putString(text, "/lyre/note");
+  putString(text, ",is");
+  putBe32(text, 1);
+  putString(text, "fort");
+  check(!command(text, &c), "velocite en chaine: refusee");
+}
+
+static void testClock() {
+  printf("Heure des bundles\n");
+  const uint32_t base = 1000000;  // micros() de la lyre
+  const int64_t sender = 5000000;  // Heure de la regie au premier bundle
+
+  OscClock clock;
+  check(near(clock.toLocal(senderTag(sender), base + 3000), base + 3000),
+        "premier bundle: reference, joue a son arrivee");
+  check(near(clock.toLocal(senderTag(sender + 10000), base + 10000 + 1000), base + 11000),
+        "transit plus court (1 ms): nouvelle reference");
+  check(near(clock.toLocal(senderTag(sender + 20000), base + 20000 + 9000), base + 21000),
+        "gigue de 8 ms: rythme de la regie conserve");
+
+  // Bundle horodate 100 ms en avance: joue avec son avance, la reference ne bouge pas
+  check(near(clock.toLocal(senderTag(sender + 30000 + 100000), base + 30000 + 1000),
+             base + 131000), "bundle en avance de 100 ms: joue 100 ms apres");
+  check(near(clock.toLocal(senderTag(sender + 40000), base + 40000 + 1000), base + 41000),
+        "bundle suivant a l'heure: pas decale par l'avance");
+  check(clock.getStats().leads == 1 && clock.getStats().steps == 0, "une avance, aucune reprise");
+
+  // La regie avance son heure de 1 s: en avance jusqu'a une fenetre entiere, puis reference
+  int64_t t = 50000;
+  uint32_t due = 0;
+  for (; t < 50000 + 3 * OSC_CLOCK_WINDOW_US; t += 100000) {
+    due = clock.toLocal(senderTag(sender + t + 1000000), base + t + 1000);
+  }
+  t -= 100000;
+  check(clock.getStats().steps == 1 && near(due, base + t + 1000),
+        "regie avancee de 1 s: reference reprise apres une fenetre");
+
+  // Avance au-dela de OSC_LEAD_MAX_US: heure de la regie changee, reprise immediate
+  t += 100000;
+  due = clock.toLocal(senderTag(sender + t + 1000000 + 10000000), base + t);
+  check(clock.getStats().steps == 2 && near(due, base + t), "avance de 10 s: reprise immediate");
+
+  // lyre_osc send --in-ms 100: /lyre/clock a l'envoi, puis la commande, dans un datagramme
+  OscClock fresh;
+  std::vector<uint8_t> packet = bundle(senderTag(sender), {
+    message("/lyre/clock", {}),
+    bundle(senderTag(sender + 100000), { message("/lyre/chord", { intArg(0x0015) }) }),
+  });
+  OscPacket osc(packet.data(), packet.size());
+  OscMessage m;
+  due = 0;
+  while (osc.next(m)) due = fresh.toLocal(m.timetag, base + 4000);
+  check(near(due, base + 4000 + 100000), "/lyre/clock puis bundle a +100 ms: joue 100 ms apres");
+
+  // micros() qui deborde entre deux bundles
+  OscClock wrap;
+  wrap.toLocal(senderTag(sender), 0xFFFFF000u);
+  check(near(wrap.toLocal(senderTag(sender + 10000), 0xFFFFF000u + 10000), 0xFFFFF000u + 10000),
+        "debordement de micros()");
+}
+
+static int runTests() {
+  bool bad;
+  int32_t v;
+  float f;
+
+  printf("Message simple\n");
+  std::vector<uint8_t> note = message("/lyre/note", { intArg(3), intArg(90) });
+  std::vector<OscMessage> m = parse(note, &bad);
+  check(!bad && m.size() == 1, "un message, paquet lisible");
+  check(m.size() == 1 && m[0].is("/lyre/note") && !m[0].is("/lyre/chord"), "adresse");
+  check(m.size() == 1 && m[0].timetag == OSC_IMMEDIATE, "hors bundle: immediatement");
+  check(m.size() == 1 && m[0].count() == 2 && m[0].getInt(0, &v) && v == 3, "argument 0 = 3");
+  check(m.size() == 1 && m[0].getInt(1, &v) && v == 90, "argument 1 = 90");
+  check(m.size() == 1 && !m[0].getInt(2, &v), "argument 2 absent");
+  check(m.size() == 1 && (const uint8_t*)m[0].address == note.data(), "lu en place (sans copie)");
+
+  printf("Velocite reelle, sans arguments, chaine\n");
+  // Les messages pointent dans le paquet: il doit survivre a leur lecture
+  std::vector<uint8_t> half = message("/lyre/note", { intArg(60), floatArg(0.5f) });
+  m = parse(half, &bad);
+  check(m.size() == 1 && m[0].getFloat(1, &f) && f == 0.5f, "reel 0.5");
+  check(m.size() == 1 && m[0].getInt(1, &v) && v == 1, "reel 0.5 arrondi en entier: 1");
+  std::vector<uint8_t> panic = message("/lyre/panic", {});
+  m = parse(panic, &bad);
+  check(!bad && m.size() == 1 && m[0].count() == 0, "/lyre/panic sans arguments");
+  std::vector<uint8_t> text;
+  putString(text, "/lyre/name");
+  putString(text, ",si");
+  putString(text, "harpe");
+  putBe32(text, 7);
+  m = parse(text, &bad);
+  check(!bad && m.size() == 1 && m[0].getString(0) && strcmp(m[0].getString(0), "harpe") == 0,
+        "chaine \"harpe\"");
+  check(m.size() == 1 && m[0].getInt(1, &v) && v == 7, "entier apres la chaine");
+
+  printf("Bundles\n");
+  uint64_t t1 = 0xE1234567ULL << 32 | 0x80000000ULL;
+  uint64_t t2 = t1 + (1ULL << 32);
+  std::vector<uint8_t> nested = bundle(t1, {
+    message("/lyre/note", { intArg(0) }),
+    bundle(t2, { message("/lyre/chord", { intArg(0x0005) }), message("/lyre/note", { intArg(1) }) }),
+    message("/lyre/panic", {}),
+  });
+  m = parse(nested, &bad);
+  check(!bad && m.size() == 4, "4 messages dans un bundle imbrique");
+  check(m.size() == 4 && m[0].timetag == t1 && m[3].timetag == t1, "timetag du bundle externe");
+  check(m.size() == 4 && m[1].timetag == t2 && m[2].timetag == t2, "timetag du bundle interne");
+  check(m.size() == 4 && m[1].is("/lyre/chord") && m[1].getInt(0, &v) && v == 5, "masque 5");
+  check(m.size() == 4 && m[3].is("/lyre/panic"), "ordre du paquet conserve");
+  std::vector<uint8_t> empty = bundle(t1, {});
+  m = parse(empty, &bad);
+  check(!bad && m.empty(), "bundle vide");
+
+  printf("Paquets illisibles\n");
+  std::vector<uint8_t> cut(note.begin(), note.end() - 4);
+  m = parse(cut, &bad);
+  check(!bad && m.size() == 1 && !m[0].getInt(1, &v), "argument tronque: absent, pas de lecture hors paquet");
+  std::vector<uint8_t> odd = note;
+  odd.push_back(0);
+  parse(odd, &bad);
+  check(bad, "longueur non multiple de 4");
+  std::vector<uint8_t> open = { '/', 'l', 'y', 'r' };
+  parse(open, &bad);
+  check(bad, "adresse non terminee");
+  parse(std::vector<uint8_t>(8, 0), &bad);
+  check(bad, "pas d'adresse");
+  std::vector<uint8_t> liar = bundle(t1, { message("/lyre/note", { intArg(2) }) });
+  liar[16 + 3] = 0xF0;  // Taille de l'element au-dela du paquet
+  m = parse(liar, &bad);
+  check(bad && m.empty(), "taille d'element au-dela du bundle");
+  std::vector<uint8_t> partial = bundle(t1, { message("/lyre/note", { intArg(4) }) });
+  putBe32(partial, 6);
+  partial.insert(partial.end(), 8, 0);
+  m = parse(partial, &bad);
+  check(bad && m.size() == 1, "element mal aligne: les messages precedents restent lus");
+  std::vector<uint8_t> deep = message("/lyre/note", { intArg(5) });
+  for (int i = 0; i < OSC_BUNDLE_DEPTH; i++) deep = bundle(t1, { deep });
+  m = parse(deep, &bad);
+  check(!bad && m.size() == 1, "imbrication OSC_BUNDLE_DEPTH: lue");
+  deep = bundle(t1, { deep });
+  m = parse(deep, &bad);
+  check(bad && m.empty(), "imbrication OSC_BUNDLE_DEPTH + 1: refusee");
+
+  testCommands();
+  testClock();
+
+  printf("%s (%d echec(s))\n", failures ? "ECHEC" : "OK", failures);
+  return failures ? 1 : 0;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Mesure sur sockets locales
+// ---------------------------------------------------------------------------------------------
+static int openUdp(int port) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("bind");
+    return -1;
+  }
+  return fd;
+}
+
+static void runSender(int port, int64_t stopUs, int rate, std::atomic<uint32_t>* sent) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in to = {};
+  to.sin_family = AF_INET;
+  to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  to.sin_port = htons(port);
+  int64_t periodUs = 1000000 / rate;
+  int64_t next = hostMicros();
+  for (uint32_t i = 0; hostMicros() < stopUs; i++) {
+    std::vector<uint8_t> packet = bundle(ntpNow(), {
+      message("/lyre/note", { intArg(i % NUM_SERVOS), floatArg(0.8f) }),
+      message("/lyre/chord", { intArg(0x0111 << (i % 4)), intArg(90) }),
+    });
+    sendto(fd, packet.data(), packet.size(), 0, (sockaddr*)&to, sizeof(to));
+    (*sent)++;
+    next += periodUs;
+    int64_t wait = next - hostMicros();
+    if (wait > 0) usleep((useconds_t)wait);
+  }
+  close(fd);
+}
+
+static uint32_t percentile(std::vector<uint32_t> v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(p * (v.size() - 1) + 0.5))];
+}
+
+static int runBench(int port, int seconds, int rate) {
+  int fd = openUdp(port);
+  if (fd < 0) return 1;
+  std::atomic<uint32_t> sent(0);
+  int64_t stopUs = hostMicros() + (int64_t)seconds * 1000000;
+  std::thread sender(runSender, port, stopUs, rate, &sent);
+
+  uint8_t packet[OSC_PACKET_MAX];
+  OscClock clock;
+  std::vector<uint32_t> transits;
+  uint64_t parseNs = 0;
+  uint32_t packets = 0, messages = 0, malformed = 0, notes = 0;
+  while (hostMicros() < stopUs + 200000) {
+    pollfd p = { fd, POLLIN, 0 };
+    if (poll(&p, 1, 50) <= 0) continue;
+    int length = recv(fd, packet, sizeof(packet), 0);
+    if (length <= 0) continue;
+    int64_t arrivalUs = ntpToMicros(ntpNow());
+
+    // Analyse comme OscListener::handle(): commande, heure locale du bundle
+    int64_t start = hostNanos();
+    OscPacket osc(packet, length);
+    OscMessage m;
+    OscCommand command;
+    uint64_t timetag = OSC_IMMEDIATE;
+    while (osc.next(m)) {
+      if (m.timetag != OSC_IMMEDIATE) clock.toLocal(m.timetag, (uint32_t)hostMicros());
+      if (command.decode(m) && command.type == OSC_COMMAND_NOTES) notes += command.noteCount;
+      timetag = m.timetag;
+      messages++;
+    }
+    parseNs += hostNanos() - start;
+    packets++;
+    if (osc.malformed()) malformed++;
+    if (timetag != OSC_IMMEDIATE) {
+      transits.push_back((uint32_t)std::max<int64_t>(0, arrivalUs - ntpToMicros(timetag)));
+    }
+  }
+  sender.join();
+  close(fd);
+
+  printf("Datagrammes: %u envoyes, %u recus, %u illisible(s)\n", sent.load(), packets, malformed);
+  printf("Messages: %u (%.0f/s), notes: %u\n", messages, messages / (double)seconds, notes);
+  printf("Analyse: %.0f ns par datagramme\n", packets ? parseNs / (double)packets : 0.0);
+  printf("Transit timetag -> lecture: p50 %u us, p99 %u us, max %u us\n",
+         percentile(transits, 0.5), percentile(transits, 0.99), percentile(transits, 1.0));
+  return packets == sent.load() && !malformed ? 0 : 1;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Envoi a une lyre
+// ---------------------------------------------------------------------------------------------
+static int runSend(const std::string& host, int port, int inMs,
+                   const std::vector<std::string>& command) {
+  std::vector<uint8_t> packet;
+  if (command.size() >= 2 && command[0] == "note") {
+    std::vector<Arg> args = { intArg(atoi(command[1].c_str())) };
+    if (command.size() >= 3) {
+      if (command[2].find('.') != std::string::npos) args.push_back(floatArg(atof(command[2].c_str())));
+      else args.push_back(intArg(atoi(command[2].c_str())));
+    }
+    packet = message("/lyre/note", args);
+  } else if (command.size() >= 2 && command[0] == "chord") {
+    std::vector<Arg> args = { intArg((int32_t)strtol(command[1].c_str(), nullptr, 0)) };
+    if (command.size() >= 3) args.push_back(intArg(atoi(command[2].c_str())));
+    packet = message("/lyre/chord", args);
+  } else if (command.size() == 1 && command[0] == "panic") {
+    packet = message("/lyre/panic", {});
+  } else {
+    return -1;
+  }
+  if (inMs >= 0) {
+    // Reference a l'heure d'envoi d'abord: sinon la lyre prendrait l'avance pour du transit
+    uint64_t now = ntpNow();
+    uint64_t later = now + (((uint64_t)inMs << 32) / 1000);
+    packet = bundle(now, { message("/lyre/clock", {}), bundle(later, { packet }) });
+  }
+
+  sockaddr_in to = {};
+  to.sin_family = AF_INET;
+  to.sin_port = htons(port);
+  if (inet_pton(AF_INET, host.c_str(), &to.sin_addr) != 1) {
+    fprintf(stderr, "Adresse invalide: %s\n", host.c_str());
+    return 1;
+  }
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  bool ok = sendto(fd, packet.data(), packet.size(), 0, (sockaddr*)&to, sizeof(to)) ==
+            (ssize_t)packet.size();
+  close(fd);
+  printf("%s %zu octets vers %s:%d\n", ok ? "Envoye" : "ECHEC de l'envoi:", packet.size(),
+         host.c_str(), port);
+  return ok ? 0 : 1;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "Utilisation: lyre_osc test\n"
+          "             lyre_osc bench [--seconds N] [--rate N] [--port N]\n"
+          "             lyre_osc send --host IP [--port N] [--in-ms N] "
+          "note <servo|note> [vel] | chord <masque> [vel] | panic\n");
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    usage();
+    return 2;
+  }
+  std::string mode = argv[1];
+  int seconds = 5, rate = 2000, port = OSC_PORT, inMs = -1;
+  std::string host;
+  std::vector<std::string> command;
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--seconds" && i + 1 < argc) seconds = atoi(argv[++i]);
+    else if (arg == "--rate" && i + 1 < argc) rate = atoi(argv[++i]);
+    else if (arg == "--port" && i + 1 < argc) port = atoi(argv[++i]);
+    else if (arg == "--host" && i + 1 < argc) host = argv[++i];
+    else if (arg == "--in-ms" && i + 1 < argc) inMs = atoi(argv[++i]);
+    else command.push_back(arg);
+  }
+
+  if (mode == "test") return runTests();
+  if (mode == "bench" && rate > 0 && seconds > 0) return runBench(port, seconds, rate);
+  if (mode == "send" && !host.empty()) {
+    int result = runSend(host, port, inMs, command);
+    if (result >= 0) return result;
+  }
+  usage();
+  return 2;
+}
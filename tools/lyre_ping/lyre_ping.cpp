@@ -0,0 +1,265 @@
+/***********************************************************************************************
+----------------------------    lyre_ping - latence de transport MIDI   ------------------------
+************************************************************************************************
+Envoie des pings MidiMind (Block 3) a la lyre et mesure l'aller-retour, la latence aller et
+retour estimee, la gigue et la derive entre l'horloge du PC et celle de l'ESP32.
+
+  Requete: F0 7D 00 03 00 <nonce: 5 octets> F7
+  Reponse: F0 7D 00 03 01 <nonce> <reception us: 5> <envoi us: 5> F7  (7 bits, poids faible
+           en premier; horloge micros() de l'ESP32)
+
+  g++ -std=c++17 -O2 tools/lyre_ping/lyre_ping.cpp -o lyre_ping
+
+Utilisation (peripherique MIDI brut Linux, /dev/snd/midiC*D*):
+  lyre_ping /dev/snd/midiC1D0 [--count N] [--interval-ms N] [--timeout-ms N]
+            [--label TEXTE] [--csv fichier.csv]
+
+Calcul, pour chaque ping (t0 envoi et t3 reception sur le PC, t1 reception et t2 envoi sur
+la lyre):
+  aller-retour  = (t3 - t0) - (t2 - t1)   temps de transport, sans le traitement dans la lyre
+  decalage      = ((t1 - t0) + (t2 - t3)) / 2   horloge lyre - horloge PC
+La derive est la pente du decalage sur les pings les plus rapides (quart inferieur de
+l'aller-retour, les moins perturbes). L'aller et le retour sont ensuite estimes avec ce
+decalage corrige de la derive: leur somme est exacte, leur partage suppose que les chemins
+les plus rapides sont symetriques. La gigue est celle de la RFC 3550 (variation du temps de
+transit entre deux pings consecutifs, lissee sur 16).
+************************************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+struct Sample {
+  uint32_t nonce;
+  int64_t t0, t3;  // PC (us, horloge monotone)
+  int64_t t1, t2;  // Lyre (us, micros() deroule)
+};
+
+static int64_t hostMicros() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t unpack7(const uint8_t* p, int count) {
+  uint32_t value = 0;
+  for (int i = 0; i < count; i++) {
+    value |= (uint32_t)(p[i] & 0x7F) << (7 * i);
+  }
+  return value;
+}
+
+// Lecteur de flux MIDI: ne garde que les SysEx complets (les octets temps reel intercales,
+// notes de feedback ou erreurs CC 127 sont ignores)
+class SysExReader {
+  private:
+    std::vector<uint8_t> _message;
+    bool _inSysEx = false;
+
+  public:
+    // Retourne true quand un SysEx complet est disponible dans message()
+    bool feed(uint8_t byte) {
+      if (byte >= 0xF8) return false;  // Temps reel: peut apparaitre au milieu d'un SysEx
+      if (byte == 0xF0) {
+        _message.assign(1, byte);
+        _inSysEx = true;
+        return false;
+      }
+      if (!_inSysEx) return false;
+      if (byte & 0x80) {
+        _inSysEx = false;
+        if (byte != 0xF7) return false;  // SysEx interrompu
+        _message.push_back(byte);
+        return true;
+      }
+      _message.push_back(byte);
+      return false;
+    }
+    const std::vector<uint8_t>& message() const { return _message; }
+};
+
+static double percentile(std::vector<double> values, double percent) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  size_t rank = (size_t)std::ceil(values.size() * percent / 100.0);
+  return values[rank ? rank - 1 : 0];
+}
+
+int main(int argc, char** argv) {
+  const char* device = nullptr;
+  const char* csvPath = nullptr;
+  std::string label = "-";
+  int count = 200, intervalMs = 20, timeoutMs = 500;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--count" && i + 1 < argc) count = atoi(argv[++i]);
+    else if (arg == "--interval-ms" && i + 1 < argc) intervalMs = atoi(argv[++i]);
+    else if (arg == "--timeout-ms" && i + 1 < argc) timeoutMs = atoi(argv[++i]);
+    else if (arg == "--label" && i + 1 < argc) label = argv[++i];
+    else if (arg == "--csv" && i + 1 < argc) csvPath = argv[++i];
+    else if (arg[0] != '-' && !device) device = argv[i];
+    else device = nullptr, i = argc;
+  }
+  if (!device || count <= 0) {
+    fprintf(stderr, "Utilisation: lyre_ping /dev/snd/midiCxDy [--count N] [--interval-ms N] "
+                    "[--timeout-ms N] [--label TEXTE] [--csv fichier.csv]\n");
+    return 1;
+  }
+
+  int fd = open(device, O_RDWR | O_NONBLOCK);
+  if (fd < 0) {
+    perror(device);
+    return 1;
+  }
+
+  SysExReader reader;
+  std::vector<Sample> samples;
+  uint32_t nonceBase = (uint32_t)hostMicros() * 2654435761u;
+  int lost = 0;
+  int64_t lastT1 = -1, deviceWrap = 0;
+
+  for (int i = 0; i < count; i++) {
+    uint32_t nonce = nonceBase + i;
+    uint8_t request[11] = { 0xF0, 0x7D, 0x00, 0x03, 0x00 };
+    for (int b = 0; b < 5; b++) request[5 + b] = (nonce >> (7 * b)) & 0x7F;
+    request[10] = 0xF7;
+
+    int64_t t0 = hostMicros();
+    if (write(fd, request, sizeof(request)) != (ssize_t)sizeof(request)) {
+      perror("write");
+      return 1;
+    }
+
+    bool answered = false;
+    int64_t deadline = t0 + (int64_t)timeoutMs * 1000;
+    while (!answered) {
+      int64_t now = hostMicros();
+      if (now >= deadline) break;
+      pollfd pfd = { fd, POLLIN, 0 };
+      if (poll(&pfd, 1, (int)((deadline - now + 999) / 1000)) <= 0) continue;
+      uint8_t buffer[256];
+      ssize_t n = read(fd, buffer, sizeof(buffer));
+      int64_t t3 = hostMicros();
+      for (ssize_t k = 0; k < n; k++) {
+        if (!reader.feed(buffer[k])) continue;
+        const std::vector<uint8_t>& m = reader.message();
+        if (m.size() != 21 || m[1] != 0x7D || m[2] != 0x00 || m[3] != 0x03 || m[4] != 0x01) {
+          continue;
+        }
+        if (unpack7(&m[5], 5) != (nonce & 0xFFFFFFFFu)) continue;  // Reponse d'un ping expire
+
+        Sample s;
+        s.nonce = nonce;
+        s.t0 = t0;
+        s.t3 = t3;
+        int64_t t1 = unpack7(&m[10], 5);
+        int64_t t2 = unpack7(&m[15], 5);
+        if (lastT1 >= 0 && t1 + deviceWrap < lastT1 - (1LL << 31)) {
+          deviceWrap += 1LL << 32;  // micros() de l'ESP32 a reboucle (71 min)
+        }
+        s.t1 = t1 + deviceWrap;
+        s.t2 = t2 + deviceWrap + (t2 < t1 ? (1LL << 32) : 0);
+        lastT1 = s.t1;
+        samples.push_back(s);
+        answered = true;
+      }
+    }
+    if (!answered) lost++;
+
+    int64_t next = t0 + (int64_t)intervalMs * 1000;
+    int64_t now = hostMicros();
+    if (next > now) usleep(next - now);
+  }
+  close(fd);
+
+  if (samples.size() < 2) {
+    fprintf(stderr, "%zu reponse(s) sur %d: lyre connectee? (sketch WiFi ou Enhanced)\n",
+            samples.size(), count);
+    return 1;
+  }
+
+  // Aller-retour et decalage par ping
+  size_t n = samples.size();
+  std::vector<double> rtt(n), offset(n), processing(n);
+  for (size_t i = 0; i < n; i++) {
+    const Sample& s = samples[i];
+    rtt[i] = (double)(s.t3 - s.t0) - (double)(s.t2 - s.t1);
+    offset[i] = ((double)(s.t1 - s.t0) + (double)(s.t2 - s.t3)) / 2;
+    processing[i] = (double)(s.t2 - s.t1);
+  }
+
+  // Derive: droite des moindres carres du decalage, pings du quart inferieur de l'aller-retour
+  double fastLimit = percentile(rtt, 25);
+  double sx = 0, sy = 0, sxx = 0, sxy = 0;
+  int fit = 0;
+  int64_t origin = samples[0].t0;
+  for (size_t i = 0; i < n; i++) {
+    if (rtt[i] > fastLimit) continue;
+    double x = (double)(samples[i].t0 - origin);
+    sx += x; sy += offset[i]; sxx += x * x; sxy += x * offset[i];
+    fit++;
+  }
+  double slope = 0, intercept = sy / fit;
+  if (fit >= 2 && fit * sxx - sx * sx > 0) {
+    slope = (fit * sxy - sx * sy) / (fit * sxx - sx * sx);
+    intercept = (sy - slope * sx) / fit;
+  }
+
+  // Aller / retour avec le decalage modelise, gigue RFC 3550 sur chaque sens
+  std::vector<double> forward(n), back(n);
+  double jitterForward = 0, jitterBack = 0;
+  for (size_t i = 0; i < n; i++) {
+    const Sample& s = samples[i];
+    double theta0 = intercept + slope * (double)(s.t0 - origin);
+    double theta3 = intercept + slope * (double)(s.t3 - origin);
+    forward[i] = (double)(s.t1 - s.t0) - theta0;
+    back[i] = (double)(s.t3 - s.t2) + theta3;
+    if (i > 0) {
+      jitterForward += (std::fabs(forward[i] - forward[i - 1]) - jitterForward) / 16;
+      jitterBack += (std::fabs(back[i] - back[i - 1]) - jitterBack) / 16;
+    }
+  }
+
+  double span = (double)(samples[n - 1].t0 - origin) / 1e6;
+  printf("Transport: %s | %zu ping(s) sur %d, %d perdu(s), %.1f s\n\n", label.c_str(), n, count,
+         lost, span);
+  printf("%-22s %8s %8s %8s %8s %8s\n", "(ms)", "min", "p50", "p95", "p99", "max");
+  auto row = [](const char* name, const std::vector<double>& v) {
+    printf("%-22s %8.2f %8.2f %8.2f %8.2f %8.2f\n", name, percentile(v, 0) / 1000,
+           percentile(v, 50) / 1000, percentile(v, 95) / 1000, percentile(v, 99) / 1000,
+           percentile(v, 100) / 1000);
+  };
+  row("aller-retour", rtt);
+  row("aller (PC -> lyre)", forward);
+  row("retour (lyre -> PC)", back);
+  row("traitement lyre", processing);
+  printf("\nGigue RFC 3550: aller %.0f us, retour %.0f us\n", jitterForward, jitterBack);
+  printf("Derive d'horloge lyre/PC: %+.1f ppm (%d pings rapides)\n", slope * 1e6, fit);
+
+  if (csvPath) {
+    FILE* csv = fopen(csvPath, "w");
+    if (!csv) {
+      perror(csvPath);
+      return 1;
+    }
+    fprintf(csv, "transport,nonce,t0_us,t1_us,t2_us,t3_us,rtt_us,aller_us,retour_us\n");
+    for (size_t i = 0; i < n; i++) {
+      const Sample& s = samples[i];
+      fprintf(csv, "%s,%u,%lld,%lld,%lld,%lld,%.0f,%.0f,%.0f\n", label.c_str(), s.nonce,
+              (long long)s.t0, (long long)s.t1, (long long)s.t2, (long long)s.t3,
+              rtt[i], forward[i], back[i]);
+    }
+    fclose(csv);
+  }
+  return 0;
+}
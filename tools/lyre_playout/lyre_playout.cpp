@@ -0,0 +1,440 @@
+/***********************************************************************************************
+----------------------------    lyre_playout - lecture horodatee RTP-MIDI   --------------------
+************************************************************************************************
+Compile RtpClock.cpp et NoteScheduler.cpp du sketch WiFi tels quels et les fait tourner sur
+le PC, avec les reglages du settings.h passe en -I (RTP_CLOCK_RATE, RTP_PLAYOUT_QUEUE).
+
+  g++ -std=c++17 -O2 -I arduino/Servo_pluck_ESP32_WiFi tools/lyre_playout/lyre_playout.cpp \
+      arduino/Servo_pluck_ESP32_WiFi/RtpClock.cpp \
+      arduino/Servo_pluck_ESP32_WiFi/NoteScheduler.cpp -o lyre_playout
+
+Utilisation:
+  lyre_playout sim [--seconds N] [--jitter-ms N] [--drift-ppm N] [--delay-ms N] [--seed N]
+      Emetteur simule (horloge decalee et derivante, echanges CK toutes les 10 s, transit de
+      2 ms plus une gigue jusqu'a --jitter-ms) et boucle de la lyre lue toutes les 1 ms.
+      Ecart au rythme de l'emetteur en jouant des reception puis avec 10, 20, 30 et 50 ms
+      de delai de lecture (ou --delay-ms seul).
+  lyre_playout listen [--port N] [--delay-ms N] [--name TEXTE]
+      Repondeur AppleMIDI sur les ports N (controle) et N+1 (donnees), 5004 par defaut:
+      invitation acceptee, echanges CK repondus, notes programmees comme dans la lyre.
+      Chaque message est affiche a son echeance avec son transit, puis un bilan toutes les
+      5 s (memes lignes [RTP] que le firmware). Pour un pair RTP-MIDI local (rtpmidid):
+        rtpmidid &
+        rtpmidid-cli connect lyre 127.0.0.1 5004   (ou le menu du pair)
+      puis jouer sur le port ALSA cree par rtpmidid.
+************************************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "RtpClock.h"
+#include "NoteScheduler.h"
+
+#define TICK_US (1000000 / RTP_CLOCK_RATE)
+
+static void putBe32(std::vector<uint8_t>& out, uint32_t v) {
+  for (int i = 3; i >= 0; i--) out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+static void putBe64(std::vector<uint8_t>& out, uint64_t v) {
+  for (int i = 7; i >= 0; i--) out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+static uint64_t readBe64(const uint8_t* p) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) v = (v << 8) | p[i];
+  return v;
+}
+
+static std::vector<uint8_t> clockSync(uint32_t ssrc, uint8_t count, uint64_t ts1, uint64_t ts2,
+                                      uint64_t ts3) {
+  std::vector<uint8_t> out = { 0xFF, 0xFF, 'C', 'K' };
+  putBe32(out, ssrc);
+  out.push_back(count);
+  out.push_back(0);
+  out.push_back(0);
+  out.push_back(0);
+  putBe64(out, ts1);
+  putBe64(out, ts2);
+  putBe64(out, ts3);
+  return out;
+}
+
+// Messages de canal d'une section de commandes RTP-MIDI, dans l'ordre (comme la bibliotheque)
+struct Message {
+  uint8_t status, data1, data2;
+};
+
+static std::vector<Message> decodeCommands(const uint8_t* data, size_t length) {
+  std::vector<Message> out;
+  size_t pos = 12 + 4 * (data[0] & 0x0F);
+  if (pos >= length) return out;
+  uint8_t flags = data[pos++];
+  size_t listLength = flags & 0x0F;
+  if (flags & 0x80) {
+    if (pos >= length) return out;
+    listLength = (listLength << 8) | data[pos++];
+  }
+  size_t end = std::min(length, pos + listLength);
+  bool delta = flags & 0x20;
+  uint8_t running = 0;
+  while (pos < end) {
+    if (delta) {
+      for (int i = 0; i < 4 && pos < end; i++) {
+        if (!(data[pos++] & 0x80)) break;
+      }
+    }
+    delta = true;
+    if (pos >= end) break;
+    uint8_t status = running;
+    if (data[pos] & 0x80) status = data[pos++];
+    if (status == 0xF0) {
+      while (pos < end && data[pos] != 0xF7) pos++;
+      pos++;
+      continue;
+    }
+    if (status >= 0xF0) {
+      pos += (status == 0xF2) ? 2 : (status == 0xF1 || status == 0xF3) ? 1 : 0;
+      continue;
+    }
+    if (!(status & 0x80)) break;
+    running = status;
+    int size = ((status & 0xE0) == 0xC0) ? 1 : 2;
+    if (pos + size > end) break;
+    Message m = { status, data[pos], (uint8_t)(size > 1 ? data[pos + 1] : 0) };
+    pos += size;
+    out.push_back(m);
+  }
+  return out;
+}
+
+// ---------------------------------------------------------------------------------------------
+// sim: emetteur simule, temps virtuel
+// ---------------------------------------------------------------------------------------------
+
+static uint32_t rngState = 1;
+
+static double uniform() {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return (rngState & 0xFFFFFF) / (double)0x1000000;
+}
+
+struct Datagram {
+  int64_t arrivalUs;  // Heure locale d'arrivee (temps reel de la simulation)
+  int64_t sentUs;     // Heure locale d'envoi (reference du rythme)
+  std::vector<uint8_t> bytes;
+};
+
+struct SimResult {
+  double latencyMs;   // Delai moyen envoi -> jeu
+  double p50Us, p99Us, maxUs;  // Ecart au rythme: |(jeu - envoi) - mediane|
+  int notes, late;
+  double offsetErrorUs, driftPpm;
+};
+
+struct SimOptions {
+  int seconds = 120;
+  double jitterMs = 30;
+  double driftPpm = 50;
+  uint32_t seed = 1;
+};
+
+static double percentile(std::vector<double> v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(p * v.size()))];
+}
+
+static SimResult simulate(const SimOptions& o, int delayMs) {
+  rngState = o.seed * 2654435761u + 7;
+  const uint32_t ssrc = 0x5EEDC0DE;
+  const double rate = 1.0 + o.driftPpm * 1e-6;          // Horloge emetteur / horloge lyre
+  const int64_t senderOrigin = 3600LL * 1000000 * 7;    // L'emetteur tourne depuis 7 h
+  const int64_t localOrigin = 4000000000LL;             // micros() proche de son debordement
+  auto senderTicks = [&](int64_t t) { return (uint64_t)((senderOrigin + t * rate) / TICK_US); };
+  auto transit = [&]() {
+    // WiFi: la plupart des paquets en 2-4 ms, un sur dix retarde jusqu'a --jitter-ms
+    double us = 2000 + uniform() * 2000;
+    if (uniform() < 0.1) us += uniform() * o.jitterMs * 1000;
+    return (int64_t)us;
+  };
+
+  std::vector<Datagram> net;
+  int64_t end = (int64_t)o.seconds * 1000000;
+
+  // Echanges CK: trois au debut de la session, puis toutes les 10 s
+  for (int64_t t = 500000; t < end; t += (t < 3000000 ? 1000000 : 10000000)) {
+    int64_t d0 = transit(), d1 = transit();
+    uint64_t ts1 = senderTicks(t);
+    int64_t replied = (t + d0 + 999) / 1000 * 1000 + 100;  // CK1 a la lecture suivante de la socket
+    int64_t ck2Sent = replied + d1;
+    uint64_t ts3 = senderTicks(ck2Sent);
+    net.push_back({ t + d0, t, clockSync(ssrc, 0, ts1, 0, 0) });
+    net.push_back({ ck2Sent + transit(), ck2Sent, clockSync(ssrc, 2, ts1, 0, ts3) });
+  }
+
+  // Notes en doubles croches a 120 BPM, accord de deux notes une fois sur quatre
+  uint16_t seq = 1;
+  for (int64_t t = 1000000; t < end; t += 125000) {
+    std::vector<uint8_t> p = { 0x80, 0x61, (uint8_t)(seq >> 8), (uint8_t)seq };
+    putBe32(p, (uint32_t)senderTicks(t));
+    putBe32(p, ssrc);
+    uint8_t note = 55 + (uint8_t)(uniform() * 27);
+    if (seq % 4 == 0) {
+      p.push_back(7);
+      p.insert(p.end(), { 0x90, note, 100, 0x00, (uint8_t)(note + 4), 100 });
+    } else {
+      p.push_back(3);
+      p.insert(p.end(), { 0x90, note, 100 });
+    }
+    net.push_back({ t + transit(), t, p });
+    seq++;
+  }
+  std::stable_sort(net.begin(), net.end(),
+                   [](const Datagram& a, const Datagram& b) { return a.arrivalUs < b.arrivalUs; });
+
+  // Boucle de la lyre: socket lue toutes les 1 ms (WIFI_MIDI_POLL_MS), file videe ensuite
+  RtpClock clock;
+  NoteScheduler scheduler;
+  std::vector<double> lags;
+  int notes = 0;
+  size_t next = 0;
+  uint32_t eventId = 0;
+  std::vector<std::pair<uint32_t, int64_t>> pending;  // Identifiant (data2) -> envoi
+  for (int64_t now = 0; now <= end + 200000; now += 1000) {
+    uint32_t localNow = (uint32_t)(localOrigin + now);
+    while (next < net.size() && net[next].arrivalUs <= now) {
+      const Datagram& d = net[next++];
+      clock.onPacket(d.bytes.data(), (uint16_t)d.bytes.size(), localNow);
+      if (d.bytes[0] == 0xFF) continue;
+      for (const Message& m : decodeCommands(d.bytes.data(), d.bytes.size())) {
+        uint32_t sent = clock.commandTime(m.status, m.data1);
+        eventId = (eventId + 1) & 0x7F;
+        pending.push_back({ eventId, d.sentUs });
+        if (delayMs == 0 || !scheduler.schedule(sent + delayMs * 1000, localNow, m.status,
+                                                m.data1, (uint8_t)eventId)) {
+          lags.push_back((double)(now - d.sentUs));
+          pending.pop_back();
+        }
+        notes++;
+      }
+    }
+    NoteScheduler::Event e;
+    while (scheduler.pop(localNow, &e)) {
+      for (size_t i = 0; i < pending.size(); i++) {
+        if (pending[i].first == e.data2) {
+          lags.push_back((double)(now - pending[i].second));
+          pending.erase(pending.begin() + i);
+          break;
+        }
+      }
+    }
+  }
+
+  SimResult r = {};
+  double median = percentile(lags, 0.5);
+  std::vector<double> dev;
+  double sum = 0;
+  for (double l : lags) {
+    dev.push_back(std::fabs(l - median));
+    sum += l;
+  }
+  r.latencyMs = lags.empty() ? 0 : sum / lags.size() / 1000;
+  r.p50Us = percentile(dev, 0.5);
+  r.p99Us = percentile(dev, 0.99);
+  r.maxUs = dev.empty() ? 0 : *std::max_element(dev.begin(), dev.end());
+  r.notes = notes;
+  r.late = scheduler.getStats().late;
+
+  // Correspondance finale contre la vraie: envoi a t -> heure locale t
+  RtpClock::Stats s = clock.getStats();
+  int64_t t = end;
+  int64_t trueOffset = (localOrigin + t) - (int64_t)(senderTicks(t) * TICK_US);
+  r.offsetErrorUs = clock.isSynced() ? (double)(s.offsetUs - trueOffset) : NAN;
+  r.driftPpm = s.driftPpm;
+  return r;
+}
+
+static int runSim(const SimOptions& o, int delayMs) {
+  printf("%d s de doubles croches a 120 BPM, transit 2-4 ms + gigue jusqu'a %.0f ms (1 paquet sur "
+         "10), derive emetteur %+.0f ppm\n\n", o.seconds, o.jitterMs, o.driftPpm);
+  printf("Lecture            Latence moy.   Ecart au rythme p50 / p99 / max (ms)   En retard\n");
+  std::vector<int> delays = { 0, 10, 20, 30, 50 };
+  if (delayMs >= 0) delays = { 0, delayMs };
+  SimResult last = {};
+  for (int d : delays) {
+    SimResult r = simulate(o, d);
+    char label[32];
+    if (d == 0) snprintf(label, sizeof(label), "des reception");
+    else snprintf(label, sizeof(label), "horodatee +%d ms", d);
+    printf("%-17s  %9.1f ms   %10.2f / %5.2f / %5.2f              %5d / %d\n", label, r.latencyMs,
+           r.p50Us / 1000, r.p99Us / 1000, r.maxUs / 1000, d ? r.late : 0, r.notes);
+    last = r;
+  }
+  printf("\nHorloge lyre / emetteur: derive estimee %+.1f ppm (reelle %+.0f), erreur de decalage "
+         "%.0f us\n", last.driftPpm, -o.driftPpm, last.offsetErrorUs);
+  return 0;
+}
+
+// ---------------------------------------------------------------------------------------------
+// listen: repondeur AppleMIDI reel
+// ---------------------------------------------------------------------------------------------
+
+static int64_t hostMicros() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int openUdp(int port) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("bind");
+    return -1;
+  }
+  return fd;
+}
+
+static void printStats(const RtpClock& clock, const NoteScheduler& scheduler, int delayMs) {
+  RtpClock::Stats c = clock.getStats();
+  NoteScheduler::Stats s = scheduler.getStats();
+  printf("[RTP] Horloge: %s | %u echange(s) CK, aller-retour %u us | decalage %lld ms | "
+         "derive %+.1f ppm\n", clock.isSynced() ? "synchronisee (CK)" : "transit minimal",
+         c.syncs, c.rttUs, (long long)(c.offsetUs / 1000), c.driftPpm);
+  printf("[RTP] Transit: %d us (max %d) | gigue %u us | %u paquet(s) | abandons CK: %u\n",
+         c.transitUs, c.transitMaxUs, c.jitterUs, c.packets, c.fallbacks);
+  printf("[RTP] Lecture a +%d ms: %u message(s), %u en retard (max %u us), marge min %ld us, "
+         "file max %u\n", delayMs, s.scheduled, s.late, s.lateMaxUs,
+         s.marginMinUs == UINT32_MAX ? -1L : (long)s.marginMinUs, s.depthMax);
+  fflush(stdout);
+}
+
+static int runListen(int port, int delayMs, const std::string& name) {
+  int fds[2] = { openUdp(port), openUdp(port + 1) };
+  if (fds[0] < 0 || fds[1] < 0) return 1;
+  const uint32_t ssrc = 0x4C595245;  // "LYRE"
+  const int64_t start = hostMicros();
+  printf("Session AppleMIDI \"%s\" sur les ports %d/%d, lecture a +%d ms\n", name.c_str(), port,
+         port + 1, delayMs);
+  fflush(stdout);
+
+  RtpClock clock;
+  NoteScheduler scheduler;
+  int64_t nextStats = hostMicros() + 5000000;
+  std::vector<uint32_t> arrivals(128);
+
+  while (true) {
+    pollfd pfd[2] = { { fds[0], POLLIN, 0 }, { fds[1], POLLIN, 0 } };
+    uint32_t wait = scheduler.usUntilNext((uint32_t)hostMicros());
+    poll(pfd, 2, wait == UINT32_MAX ? 100 : (int)std::min<uint32_t>(wait / 1000, 100));
+
+    for (int s = 0; s < 2; s++) {
+      if (!(pfd[s].revents & POLLIN)) continue;
+      uint8_t buf[1500];
+      sockaddr_in from = {};
+      socklen_t fromLen = sizeof(from);
+      ssize_t n = recvfrom(fds[s], buf, sizeof(buf), 0, (sockaddr*)&from, &fromLen);
+      uint32_t now = (uint32_t)hostMicros();
+      if (n <= 0) continue;
+
+      if (n >= 16 && buf[0] == 0xFF && buf[1] == 0xFF && buf[2] == 'I' && buf[3] == 'N') {
+        // Invitation: acceptee sur chaque port avec le meme jeton
+        std::vector<uint8_t> ok = { 0xFF, 0xFF, 'O', 'K', 0, 0, 0, 2 };
+        ok.insert(ok.end(), buf + 8, buf + 12);
+        putBe32(ok, ssrc);
+        ok.insert(ok.end(), name.begin(), name.end());
+        ok.push_back(0);
+        sendto(fds[s], ok.data(), ok.size(), 0, (sockaddr*)&from, fromLen);
+        if (s == 0) printf("Invitation de %s\n", n > 16 ? (const char*)buf + 16 : "?");
+        continue;
+      }
+      if (n >= 4 && buf[0] == 0xFF && buf[1] == 0xFF && buf[2] == 'B' && buf[3] == 'Y') {
+        printf("Fin de session\n");
+        printStats(clock, scheduler, delayMs);
+        clock.reset();
+        scheduler.clear();
+        continue;
+      }
+      clock.onPacket(buf, (uint16_t)n, now);
+      if (n >= 36 && buf[0] == 0xFF && buf[2] == 'C' && buf[3] == 'K' && buf[8] == 0) {
+        uint64_t ts2 = (uint64_t)(hostMicros() - start) / TICK_US;
+        std::vector<uint8_t> reply = clockSync(ssrc, 1, readBe64(buf + 12), ts2, 0);
+        sendto(fds[s], reply.data(), reply.size(), 0, (sockaddr*)&from, fromLen);
+        continue;
+      }
+      if (s != 1 || n < 13 || (buf[1] & 0x7F) != 0x61) continue;
+
+      for (const Message& m : decodeCommands(buf, n)) {
+        uint32_t sent = clock.commandTime(m.status, m.data1);
+        arrivals[m.data1] = now - sent;
+        if (delayMs == 0 || !scheduler.schedule(sent + delayMs * 1000, now, m.status, m.data1,
+                                                m.data2)) {
+          printf("%02X %3u %3u  transit %6.2f ms  joue a l'arrivee\n", m.status, m.data1,
+                 m.data2, (int32_t)arrivals[m.data1] / 1000.0);
+        }
+      }
+    }
+
+    NoteScheduler::Event e;
+    uint32_t now = (uint32_t)hostMicros();
+    while (scheduler.pop(now, &e)) {
+      printf("%02X %3u %3u  transit %6.2f ms  joue %+6.2f ms apres l'echeance\n", e.status, e.data1,
+             e.data2, (int32_t)arrivals[e.data1] / 1000.0, (int32_t)(now - e.dueUs) / 1000.0);
+    }
+    if (hostMicros() >= nextStats) {
+      printStats(clock, scheduler, delayMs);
+      nextStats += 5000000;
+    }
+  }
+}
+
+static void usage() {
+  fprintf(stderr, "Utilisation: lyre_playout sim [--seconds N] [--jitter-ms N] [--drift-ppm N] "
+                  "[--delay-ms N] [--seed N]\n"
+                  "             lyre_playout listen [--port N] [--delay-ms N] [--name TEXTE]\n");
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    usage();
+    return 1;
+  }
+  std::string mode = argv[1];
+  SimOptions sim;
+  int delayMs = -1, port = 5004;
+  std::string name = "lyre_playout";
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--seconds" && i + 1 < argc) sim.seconds = atoi(argv[++i]);
+    else if (arg == "--jitter-ms" && i + 1 < argc) sim.jitterMs = atof(argv[++i]);
+    else if (arg == "--drift-ppm" && i + 1 < argc) sim.driftPpm = atof(argv[++i]);
+    else if (arg == "--seed" && i + 1 < argc) sim.seed = (uint32_t)atoi(argv[++i]);
+    else if (arg == "--delay-ms" && i + 1 < argc) delayMs = atoi(argv[++i]);
+    else if (arg == "--port" && i + 1 < argc) port = atoi(argv[++i]);
+    else if (arg == "--name" && i + 1 < argc) name = argv[++i];
+    else { usage(); return 1; }
+  }
+  if (mode == "sim" && sim.seconds > 0) return runSim(sim, delayMs);
+  if (mode == "listen") return runListen(port, delayMs < 0 ? RTP_PLAYOUT_MS : delayMs, name);
+  usage();
+  return 1;
+}
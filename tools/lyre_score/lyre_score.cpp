@@ -0,0 +1,399 @@
+/***********************************************************************************************
+----------------------------    lyre_score - compilateur de partitions   -----------------------
+************************************************************************************************
+Compile un fichier MIDI (.mid) en partition binaire (.lyrs) pour ScorePlayer.
+
+Tout ce que le firmware decide normalement a chaque note est resolu ici, une fois pour toutes:
+- notes injouables transposees a l'octave (ou supprimees avec --unplayable drop)
+- direction de grattage planifiee (meme alternance que ServoController::pluck)
+- compensation de latence mecanique (SERVO_US_PER_DEGREE) appliquee a chaque mouvement
+- collisions: un servo encore en mouvement retarde la note (--max-shift-ms) ou la supprime
+- mute supprime quand la note suivante sur la meme corde arrive avant la fin du retour
+
+Le profil instrument (initialAngles, mapping, PLUCK_ANGLE) vient du settings.h du sketch
+passe en -I a la compilation:
+
+  g++ -std=c++17 -O2 -I arduino/Servo_pluck_ESP32_BLE_Enhanced \
+      tools/lyre_score/lyre_score.cpp -o lyre_score
+
+Utilisation:
+  lyre_score morceau.mid -o morceau.lyrs [--c-array morceau.h] [--channel 1-16]
+             [--unplayable fold|drop] [--max-shift-ms 30]
+************************************************************************************************/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "settings.h"
+#include "ScoreFormat.h"
+
+/*------------------------------------------------------------------
+--------------        Lecture du fichier MIDI            ----------
+------------------------------------------------------------------*/
+
+struct MidiEvent {
+  uint64_t tick;
+  uint32_t order;    // Ordre d'apparition (tri stable entre pistes)
+  uint8_t type;      // 0 = tempo, 1 = note on, 2 = note off
+  uint8_t channel;
+  uint8_t note;
+  uint32_t tempo;    // Microsecondes par noire (type 0)
+};
+
+static uint32_t readBE(const std::vector<uint8_t>& d, size_t pos, int bytes) {
+  uint32_t v = 0;
+  for (int i = 0; i < bytes; i++) v = (v << 8) | d.at(pos + i);
+  return v;
+}
+
+static uint32_t readVarLen(const std::vector<uint8_t>& d, size_t& pos) {
+  uint32_t v = 0;
+  for (int i = 0; i < 4; i++) {
+    uint8_t b = d.at(pos++);
+    v = (v << 7) | (b & 0x7F);
+    if (!(b & 0x80)) break;
+  }
+  return v;
+}
+
+static bool parseMidiFile(const std::vector<uint8_t>& d, std::vector<MidiEvent>& events,
+                          uint16_t& division) {
+  if (d.size() < 14 || memcmp(d.data(), "MThd", 4) != 0) {
+    fprintf(stderr, "ERREUR: pas un fichier MIDI standard\n");
+    return false;
+  }
+  uint32_t headerLength = readBE(d, 4, 4);
+  uint16_t trackCount = readBE(d, 10, 2);
+  division = readBE(d, 12, 2);
+
+  size_t pos = 8 + headerLength;
+  uint32_t order = 0;
+  for (uint16_t track = 0; track < trackCount && pos + 8 <= d.size(); track++) {
+    if (memcmp(&d[pos], "MTrk", 4) != 0) {
+      fprintf(stderr, "ERREUR: piste %u invalide\n", track);
+      return false;
+    }
+    size_t end = pos + 8 + readBE(d, pos + 4, 4);
+    pos += 8;
+    uint64_t tick = 0;
+    uint8_t status = 0;
+
+    while (pos < end) {
+      tick += readVarLen(d, pos);
+      uint8_t b = d.at(pos);
+      if (b & 0x80) {
+        pos++;
+        if (b < 0xF0) status = b;  // Running status uniquement pour les messages canal
+      } else if (status == 0) {
+        fprintf(stderr, "ERREUR: running status sans statut (piste %u)\n", track);
+        return false;
+      } else {
+        b = status;
+      }
+
+      if (b == 0xFF) {  // Meta
+        uint8_t meta = d.at(pos++);
+        uint32_t len = readVarLen(d, pos);
+        if (meta == 0x51 && len == 3) {
+          events.push_back({tick, order++, 0, 0, 0, readBE(d, pos, 3)});
+        }
+        pos += len;
+        if (meta == 0x2F) break;
+      } else if (b == 0xF0 || b == 0xF7) {  // SysEx ignore
+        pos += readVarLen(d, pos);
+      } else {
+        uint8_t kind = b & 0xF0;
+        uint8_t channel = b & 0x0F;
+        uint8_t data1 = d.at(pos++);
+        uint8_t data2 = (kind == 0xC0 || kind == 0xD0) ? 0 : d.at(pos++);
+        if (kind == 0x90 && data2 > 0) {
+          events.push_back({tick, order++, 1, channel, data1, 0});
+        } else if (kind == 0x80 || kind == 0x90) {
+          events.push_back({tick, order++, 2, channel, data1, 0});
+        }
+      }
+    }
+    pos = end;
+  }
+
+  std::stable_sort(events.begin(), events.end(), [](const MidiEvent& a, const MidiEvent& b) {
+    return a.tick != b.tick ? a.tick < b.tick : a.order < b.order;
+  });
+  return true;
+}
+
+/*------------------------------------------------------------------
+--------------        Profil instrument                  ----------
+------------------------------------------------------------------*/
+
+// Meme calcul que ServoController::setServoAngle (map() Arduino puis conversion 12 bits)
+static uint16_t angleToTick(long angle) {
+  long pulsation = (angle - SERVO_MIN_ANGLE) * (SERVO_PULSE_MAX - SERVO_PULSE_MIN) /
+                   (SERVO_MAX_ANGLE - SERVO_MIN_ANGLE) + SERVO_PULSE_MIN;
+  return (uint16_t)int(float((uint16_t)pulsation) / 1000000 * SERVO_FREQUENCY * 4096);
+}
+
+static int servoForNote(int note, bool fold) {
+  if (fold) {
+    while (note < MIDI_NOTE_MIN) note += 12;
+    while (note > MIDI_NOTE_MAX) note -= 12;
+  }
+  if (note < MIDI_NOTE_MIN || note > MIDI_NOTE_MAX) return -1;
+  int servo = ServoMidiMapping[note - MIDI_NOTE_MIN];
+  // Note alteree non accordee: on joue la corde juste en dessous (ex: F#4 -> F4)
+  if (servo == -1 && fold && note > MIDI_NOTE_MIN) {
+    servo = ServoMidiMapping[note - 1 - MIDI_NOTE_MIN];
+  }
+  return servo;
+}
+
+// Latence entre la commande et l'echappement de la corde (meme modele que
+// ServoController::pluckLatencyUs)
+static uint32_t pluckLatencyUs(bool fromRest) {
+  uint32_t degrees = fromRest ? PLUCK_RELEASE_ANGLE : PLUCK_ANGLE + PLUCK_RELEASE_ANGLE;
+  return degrees * SERVO_US_PER_DEGREE;
+}
+
+static uint32_t travelUs(uint32_t degrees) {
+  return degrees * SERVO_US_PER_DEGREE;
+}
+
+/*------------------------------------------------------------------
+--------------        Planification par servo            ----------
+------------------------------------------------------------------*/
+
+struct Actuation {
+  uint64_t timeUs;
+  uint8_t servo;
+  uint8_t flags;
+  uint16_t tick;
+};
+
+struct Stats {
+  uint32_t notes = 0;
+  uint32_t folded = 0;
+  uint32_t unplayable = 0;
+  uint32_t shifted = 0;
+  uint32_t collisions = 0;
+  uint32_t mutesSkipped = 0;
+};
+
+struct TimedNote {
+  uint64_t timeUs;
+  bool on;
+};
+
+static void planServo(uint8_t servo, const std::vector<TimedNote>& notes, uint32_t maxShiftUs,
+                      std::vector<Actuation>& out, Stats& stats) {
+  const uint32_t maxLead = pluckLatencyUs(false);
+  bool atRest = true;
+  uint8_t position = 0;  // Bit de currentPositions du servo
+  uint64_t busyUntil = 0;
+
+  for (size_t i = 0; i < notes.size(); i++) {
+    if (notes[i].on) {
+      uint64_t due = notes[i].timeUs + maxLead - pluckLatencyUs(atRest);
+      if (due < busyUntil) {
+        if (busyUntil - due > maxShiftUs) {
+          stats.collisions++;
+          continue;
+        }
+        due = busyUntil;
+        stats.shifted++;
+      }
+
+      int8_t direction = (position == 1) ? 1 : -1;
+      if ((servo % 2) != 0) direction = -direction;
+      position ^= 1;
+
+      uint8_t flags = SCORE_FLAG_PLUCK | (position ? SCORE_FLAG_DIR_UP : 0);
+      out.push_back({due, servo, flags,
+                     angleToTick((long)initialAngles[servo] + direction * PLUCK_ANGLE)});
+      busyUntil = due + travelUs(atRest ? PLUCK_ANGLE : 2 * PLUCK_ANGLE);
+      atRest = false;
+    } else {
+      if (atRest) continue;
+      uint64_t due = std::max<uint64_t>(notes[i].timeUs + maxLead, busyUntil);
+
+      // Si la note suivante sur cette corde tombe pendant le retour, on la grattera
+      // directement depuis l'autre cote: le mute ne ferait que la retarder
+      bool skip = false;
+      for (size_t j = i + 1; j < notes.size(); j++) {
+        if (!notes[j].on) continue;
+        uint64_t nextDue = notes[j].timeUs + maxLead - pluckLatencyUs(true);
+        skip = nextDue < due + travelUs(PLUCK_ANGLE);
+        break;
+      }
+      if (skip) {
+        stats.mutesSkipped++;
+        continue;
+      }
+
+      out.push_back({due, servo, SCORE_FLAG_MUTE, angleToTick(initialAngles[servo])});
+      busyUntil = due + travelUs(PLUCK_ANGLE);
+      atRest = true;
+    }
+  }
+}
+
+/*------------------------------------------------------------------
+--------------        Ecriture                           ----------
+------------------------------------------------------------------*/
+
+static std::vector<uint8_t> encodeScore(const std::vector<Actuation>& actuations) {
+  ScoreHeader header;
+  header.magic = SCORE_MAGIC;
+  header.version = SCORE_FORMAT_VERSION;
+  header.numServos = NUM_SERVOS;
+  header.headerSize = sizeof(ScoreHeader);
+  header.recordCount = actuations.size();
+  header.profileHash = scoreProfileHash();
+
+  std::vector<uint8_t> bytes(sizeof(header) + actuations.size() * sizeof(ScoreRecord));
+  memcpy(bytes.data(), &header, sizeof(header));
+
+  uint64_t previous = 0;
+  for (size_t i = 0; i < actuations.size(); i++) {
+    ScoreRecord record;
+    record.deltaUs = (uint32_t)(actuations[i].timeUs - previous);
+    record.servo = actuations[i].servo;
+    record.flags = actuations[i].flags | (i + 1 == actuations.size() ? SCORE_FLAG_END : 0);
+    record.tick = actuations[i].tick;
+    memcpy(&bytes[sizeof(header) + i * sizeof(record)], &record, sizeof(record));
+    previous = actuations[i].timeUs;
+  }
+  return bytes;
+}
+
+static bool writeCArray(const char* path, const std::vector<uint8_t>& bytes) {
+  FILE* f = fopen(path, "w");
+  if (!f) return false;
+  fprintf(f, "// Genere par tools/lyre_score - ne pas modifier\n");
+  fprintf(f, "#include \"stdint.h\"\n\n");
+  fprintf(f, "const uint8_t lyreScore[] __attribute__((aligned(4))) = {");
+  for (size_t i = 0; i < bytes.size(); i++) {
+    fprintf(f, "%s0x%02X,", (i % 16) ? " " : "\n  ", bytes[i]);
+  }
+  fprintf(f, "\n};\nconst size_t lyreScoreLength = %zu;\n", bytes.size());
+  fclose(f);
+  return true;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "Utilisation: lyre_score <fichier.mid> -o <sortie.lyrs> [--c-array <sortie.h>]\n"
+          "             [--channel 1-16] [--unplayable fold|drop] [--max-shift-ms N]\n");
+}
+
+int main(int argc, char** argv) {
+  const char* input = nullptr;
+  const char* output = nullptr;
+  const char* cArray = nullptr;
+  int channel = 0;  // 0 = tous
+  bool fold = true;
+  uint32_t maxShiftUs = 30000;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-o" && i + 1 < argc) output = argv[++i];
+    else if (arg == "--c-array" && i + 1 < argc) cArray = argv[++i];
+    else if (arg == "--channel" && i + 1 < argc) channel = atoi(argv[++i]);
+    else if (arg == "--unplayable" && i + 1 < argc) fold = std::string(argv[++i]) != "drop";
+    else if (arg == "--max-shift-ms" && i + 1 < argc) maxShiftUs = atoi(argv[++i]) * 1000;
+    else if (arg[0] != '-' && !input) input = argv[i];
+    else { usage(); return 1; }
+  }
+  if (!input || (!output && !cArray)) {
+    usage();
+    return 1;
+  }
+
+  std::ifstream in(input, std::ios::binary);
+  std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  std::vector<MidiEvent> events;
+  uint16_t division = 0;
+  try {
+    if (!parseMidiFile(data, events, division)) return 1;
+  } catch (const std::out_of_range&) {
+    fprintf(stderr, "ERREUR: fichier MIDI tronque\n");
+    return 1;
+  }
+
+  // Conversion ticks -> microsecondes (carte de tempo ou SMPTE)
+  double usPerTick;
+  uint32_t tempo = 500000;
+  bool smpte = division & 0x8000;
+  if (smpte) {
+    int fps = -(int8_t)(division >> 8);
+    usPerTick = 1000000.0 / (fps * (division & 0xFF));
+  } else {
+    usPerTick = (double)tempo / division;
+  }
+
+  Stats stats;
+  std::vector<std::vector<TimedNote>> perServo(NUM_SERVOS);
+  uint64_t lastTick = 0;
+  double timeUs = 0;
+  for (const MidiEvent& e : events) {
+    timeUs += (e.tick - lastTick) * usPerTick;
+    lastTick = e.tick;
+    if (e.type == 0) {
+      if (!smpte) usPerTick = (double)e.tempo / division;
+      continue;
+    }
+    if (channel && e.channel != channel - 1) continue;
+
+    int servo = servoForNote(e.note, fold);
+    if (e.type == 1) {
+      stats.notes++;
+      if (servo < 0) {
+        stats.unplayable++;
+        continue;
+      }
+      if (e.note < MIDI_NOTE_MIN || e.note > MIDI_NOTE_MAX ||
+          ServoMidiMapping[e.note - MIDI_NOTE_MIN] != servo) {
+        stats.folded++;
+      }
+    }
+    if (servo >= 0) perServo[servo].push_back({(uint64_t)timeUs, e.type == 1});
+  }
+
+  std::vector<Actuation> actuations;
+  for (uint8_t servo = 0; servo < NUM_SERVOS; servo++) {
+    planServo(servo, perServo[servo], maxShiftUs, actuations, stats);
+  }
+  std::stable_sort(actuations.begin(), actuations.end(),
+                   [](const Actuation& a, const Actuation& b) { return a.timeUs < b.timeUs; });
+
+  if (actuations.empty()) {
+    fprintf(stderr, "ERREUR: aucune note jouable\n");
+    return 1;
+  }
+
+  std::vector<uint8_t> bytes = encodeScore(actuations);
+  if (output) {
+    std::ofstream out(output, std::ios::binary);
+    out.write((const char*)bytes.data(), bytes.size());
+  }
+  if (cArray && !writeCArray(cArray, bytes)) {
+    fprintf(stderr, "ERREUR: ecriture de %s impossible\n", cArray);
+    return 1;
+  }
+
+  printf("Notes lues:          %u\n", stats.notes);
+  printf("Transposees:         %u\n", stats.folded);
+  printf("Injouables:          %u\n", stats.unplayable);
+  printf("Decalees (servo occupe): %u\n", stats.shifted);
+  printf("Supprimees (collision):  %u\n", stats.collisions);
+  printf("Mutes supprimes:     %u\n", stats.mutesSkipped);
+  printf("Actionnements:       %zu\n", actuations.size());
+  printf("Duree:               %.2f s\n", actuations.back().timeUs / 1e6);
+  printf("Taille:              %zu octets\n", bytes.size());
+  return 0;
+}
@@ -0,0 +1,453 @@
+/***********************************************************************************************
+----------------------------    lyre_sessions - plusieurs participants AppleMIDI   -------------
+************************************************************************************************
+Compile MidiSources.cpp du sketch WiFi (avec RtpJournal, RtpClock et NoteScheduler) tel quel
+et le fait tourner sur le PC derriere de vraies sockets UDP locales (127.0.0.1), avec les
+reglages du settings.h passe en -I (MIDI_SOURCES_MAX, RTP_PLAYOUT_MS, MIDI_DISPATCH_BUDGET...).
+
+  g++ -std=c++17 -O2 -pthread -I arduino/Servo_pluck_ESP32_WiFi \
+      tools/lyre_sessions/lyre_sessions.cpp arduino/Servo_pluck_ESP32_WiFi/MidiSources.cpp \
+      arduino/Servo_pluck_ESP32_WiFi/RtpJournal.cpp arduino/Servo_pluck_ESP32_WiFi/RtpClock.cpp \
+      arduino/Servo_pluck_ESP32_WiFi/NoteScheduler.cpp -o lyre_sessions
+
+Utilisation:
+  lyre_sessions [--seconds N] [--cost-us N] [--port N] [--fair | --fifo]
+      Sans --fair ni --fifo: les deux, l'un apres l'autre, meme trafic
+
+Recepteur (fil principal): repondeur AppleMIDI sur les ports N et N+1 (5104 par defaut),
+invitations acceptees, echanges CK repondus, fin de session (BY) transmise a MidiSources.
+Chaque datagramme passe par MidiSources::onPacket() puis ses commandes par receive(), comme
+dans la lyre. dispatch() est appele a chaque tour de boucle, MIDI_DISPATCH_BUDGET fois au
+plus; chaque message joue coute --cost-us (250 par defaut: ecriture I2C et calcul de
+l'instrument, attente active), soit environ 55 % d'occupation avec ce trafic.
+
+Pairs (un fil et deux sockets chacun, horodatages et echanges CK sur l'horloge du PC):
+- "Sequenceur 1": rafale de 40 CC sur le canal 1 toutes les 20 ms (2000 messages/s) et une
+  note de batterie sur le canal 10, ecartee par sa regle (canal 1 seul, poids 1).
+- "Clavier 2": une note toutes les 50 ms sur le canal 2 (poids 2).
+- "Tablette 3": accord de 3 notes toutes les 120 ms sur le canal 3 (regle par defaut).
+
+Mesures par source: messages joues et ecartes, attente entre l'echeance et le jeu (p50, p99,
+max), puis la ligne [SRC] du firmware.
+************************************************************************************************/
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "MidiSources.h"
+
+#define TICK_US (1000000 / RTP_CLOCK_RATE)
+
+static const MidiSources::Rule rules[] = {
+  { "Sequenceur", 0x0001, 1 },
+  { "Clavier", 0x0002, 2 },
+  { "", 0xFFFF, 1 },
+};
+
+static int64_t hostMicros() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleepUntil(int64_t us) {
+  int64_t wait = us - hostMicros();
+  if (wait > 0) usleep((useconds_t)wait);
+}
+
+static void putBe16(std::vector<uint8_t>& out, uint16_t v) {
+  out.push_back((uint8_t)(v >> 8));
+  out.push_back((uint8_t)v);
+}
+
+static void putBe32(std::vector<uint8_t>& out, uint32_t v) {
+  for (int i = 3; i >= 0; i--) out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+static void putBe64(std::vector<uint8_t>& out, uint64_t v) {
+  for (int i = 7; i >= 0; i--) out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+static uint32_t readBe32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t readBe64(const uint8_t* p) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) v = (v << 8) | p[i];
+  return v;
+}
+
+static std::vector<uint8_t> control(const char* command, uint32_t token, uint32_t ssrc,
+                                    const std::string& name) {
+  std::vector<uint8_t> out = { 0xFF, 0xFF, (uint8_t)command[0], (uint8_t)command[1], 0, 0, 0, 2 };
+  putBe32(out, token);
+  putBe32(out, ssrc);
+  if (!name.empty()) {
+    out.insert(out.end(), name.begin(), name.end());
+    out.push_back(0);
+  }
+  return out;
+}
+
+static std::vector<uint8_t> clockSync(uint32_t ssrc, uint8_t count, uint64_t ts1, uint64_t ts2,
+                                      uint64_t ts3) {
+  std::vector<uint8_t> out = { 0xFF, 0xFF, 'C', 'K' };
+  putBe32(out, ssrc);
+  out.push_back(count);
+  out.push_back(0);
+  out.push_back(0);
+  out.push_back(0);
+  putBe64(out, ts1);
+  putBe64(out, ts2);
+  putBe64(out, ts3);
+  return out;
+}
+
+struct Message {
+  uint8_t status, data1, data2;
+};
+
+// Paquet RTP-MIDI sans journal: statut complet et delta nul entre les commandes
+static std::vector<uint8_t> rtpMidi(uint32_t ssrc, uint16_t seq, uint32_t timestamp,
+                                    const std::vector<Message>& messages) {
+  std::vector<uint8_t> list;
+  for (size_t i = 0; i < messages.size(); i++) {
+    if (i > 0) list.push_back(0);
+    list.push_back(messages[i].status);
+    list.push_back(messages[i].data1);
+    list.push_back(messages[i].data2);
+  }
+  std::vector<uint8_t> out = { 0x80, 0x61 };
+  putBe16(out, seq);
+  putBe32(out, timestamp);
+  putBe32(out, ssrc);
+  if (list.size() > 15) {
+    out.push_back(0x80 | (uint8_t)(list.size() >> 8));
+    out.push_back((uint8_t)list.size());
+  } else {
+    out.push_back((uint8_t)list.size());
+  }
+  out.insert(out.end(), list.begin(), list.end());
+  return out;
+}
+
+// Messages de canal d'une section de commandes, dans l'ordre (comme la bibliotheque)
+static std::vector<Message> decodeCommands(const uint8_t* data, size_t length) {
+  std::vector<Message> out;
+  size_t pos = 12 + 4 * (data[0] & 0x0F);
+  if (pos >= length) return out;
+  uint8_t flags = data[pos++];
+  size_t listLength = flags & 0x0F;
+  if (flags & 0x80) {
+    if (pos >= length) return out;
+    listLength = (listLength << 8) | data[pos++];
+  }
+  size_t end = std::min(length, pos + listLength);
+  bool delta = flags & 0x20;
+  uint8_t running = 0;
+  while (pos < end) {
+    if (delta) {
+      for (int i = 0; i < 4 && pos < end; i++) {
+        if (!(data[pos++] & 0x80)) break;
+      }
+    }
+    delta = true;
+    if (pos >= end) break;
+    uint8_t status = running;
+    if (data[pos] & 0x80) status = data[pos++];
+    if (!(status & 0x80) || status >= 0xF0) break;
+    running = status;
+    int size = ((status & 0xE0) == 0xC0) ? 1 : 2;
+    if (pos + size > end) break;
+    Message m = { status, data[pos], (uint8_t)(size > 1 ? data[pos + 1] : 0) };
+    pos += size;
+    out.push_back(m);
+  }
+  return out;
+}
+
+static int openUdp(int port) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("bind");
+    return -1;
+  }
+  return fd;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Pairs
+// ---------------------------------------------------------------------------------------------
+
+struct Peer {
+  std::string name;
+  uint32_t ssrc;
+  int controlFd, dataFd;
+  sockaddr_in controlAddr, dataAddr;
+  uint16_t seq;
+
+  uint32_t ticks() const { return (uint32_t)(hostMicros() / TICK_US); }
+
+  bool request(int fd, const sockaddr_in& to, const std::vector<uint8_t>& packet, uint8_t* reply,
+               const char* expected) {
+    for (int attempt = 0; attempt < 5; attempt++) {
+      sendto(fd, packet.data(), packet.size(), 0, (const sockaddr*)&to, sizeof(to));
+      pollfd pfd = { fd, POLLIN, 0 };
+      while (poll(&pfd, 1, 200) > 0) {
+        ssize_t n = recv(fd, reply, 64, 0);
+        if (n >= 4 && reply[2] == expected[0] && reply[3] == expected[1]) return true;
+      }
+    }
+    return false;
+  }
+
+  void clockExchange() {
+    uint8_t reply[64];
+    uint64_t ts1 = ticks();
+    if (!request(dataFd, dataAddr, clockSync(ssrc, 0, ts1, 0, 0), reply, "CK")) return;
+    std::vector<uint8_t> ck2 = clockSync(ssrc, 2, ts1, readBe64(reply + 20), ticks());
+    sendto(dataFd, ck2.data(), ck2.size(), 0, (const sockaddr*)&dataAddr, sizeof(dataAddr));
+  }
+
+  void send(const std::vector<Message>& messages) {
+    std::vector<uint8_t> packet = rtpMidi(ssrc, seq++, ticks(), messages);
+    sendto(dataFd, packet.data(), packet.size(), 0, (const sockaddr*)&dataAddr, sizeof(dataAddr));
+  }
+};
+
+// Emission d'un pair: step(n) rend les messages du n-ieme pas de periodUs
+template <class Step>
+static void runPeer(Peer peer, int64_t startUs, int64_t stopUs, int64_t periodUs, Step step) {
+  uint8_t reply[64];
+  uint32_t token = peer.ssrc ^ 0x1234;
+  if (!peer.request(peer.controlFd, peer.controlAddr, control("IN", token, peer.ssrc, peer.name),
+                    reply, "OK") ||
+      !peer.request(peer.dataFd, peer.dataAddr, control("IN", token, peer.ssrc, peer.name), reply,
+                    "OK")) {
+    fprintf(stderr, "%s: pas de reponse a l'invitation\n", peer.name.c_str());
+    return;
+  }
+  peer.clockExchange();
+  int64_t nextCk = startUs + 2000000;
+  for (int n = 0; startUs + n * periodUs < stopUs; n++) {
+    sleepUntil(startUs + n * periodUs);
+    std::vector<Message> messages = step(n);
+    if (!messages.empty()) peer.send(messages);
+    if (hostMicros() >= nextCk) {
+      peer.clockExchange();
+      nextCk += 2000000;
+    }
+  }
+  std::vector<uint8_t> bye = control("BY", token, peer.ssrc, "");
+  sendto(peer.controlFd, bye.data(), bye.size(), 0, (const sockaddr*)&peer.controlAddr,
+         sizeof(peer.controlAddr));
+}
+
+// ---------------------------------------------------------------------------------------------
+// Recepteur
+// ---------------------------------------------------------------------------------------------
+
+struct Measure {
+  std::string name;
+  std::vector<uint32_t> waits;  // Echeance -> jeu (us)
+  MidiSources::Stats stats;
+  bool done = false;
+};
+
+static MidiSources sources;
+static std::vector<Measure> measures;
+static uint32_t costUs = 250;
+
+static void play(uint8_t source, const NoteScheduler::Event& event) {
+  int64_t start = hostMicros();
+  if (source < measures.size() && event.dueUs) {
+    measures[source].waits.push_back((uint32_t)start - event.dueUs);
+  }
+  while (hostMicros() - start < costUs) {
+    // Instrument occupe: ecriture I2C et calcul du grattage
+  }
+}
+
+static uint32_t percentile(std::vector<uint32_t> v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(p * v.size()))];
+}
+
+static void snapshot(uint8_t index) {
+  const MidiSources::Source* s = sources.source(index);
+  if (!s || index >= measures.size()) return;
+  measures[index].name = s->name;
+  measures[index].stats = s->stats;
+  measures[index].done = true;
+  printf("[SRC] %u \"%s\" (%08X) | canaux %04X, poids %u | recus: %u | ecartes: %u | joues: %u | "
+         "attente moy %u us, max %u us\n",
+         index + 1, s->name, s->ssrc, s->channels, s->weight, s->stats.received,
+         s->stats.filtered, s->stats.played,
+         (uint32_t)(s->stats.played ? s->stats.waitSumUs / s->stats.played : 0),
+         s->stats.waitMaxUs);
+}
+
+static bool run(int port, int seconds, bool fair) {
+  int fds[2] = { openUdp(port), openUdp(port + 1) };
+  if (fds[0] < 0 || fds[1] < 0) return false;
+  const uint32_t ssrc = 0x4C595245;  // "LYRE"
+  sources.setFair(fair);
+  measures.assign(MIDI_SOURCES_MAX, Measure());
+
+  auto peer = [&](const char* name, uint32_t id) {
+    Peer p;
+    p.name = name;
+    p.ssrc = id;
+    p.seq = 1;
+    p.controlFd = openUdp(0);
+    p.dataFd = openUdp(0);
+    for (int i = 0; i < 2; i++) {
+      sockaddr_in& a = i ? p.dataAddr : p.controlAddr;
+      a = {};
+      a.sin_family = AF_INET;
+      a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      a.sin_port = htons(port + i);
+    }
+    return p;
+  };
+  int64_t start = hostMicros() + 300000;
+  int64_t stop = start + seconds * 1000000LL;
+  std::vector<std::thread> threads;
+  threads.emplace_back(runPeer<std::vector<Message> (*)(int)>, peer("Sequenceur 1", 0x11111111),
+                       start, stop, 20000, [](int n) {
+                         std::vector<Message> m;
+                         for (int i = 0; i < 40; i++) {
+                           m.push_back({ 0xB0, 1, (uint8_t)((n * 40 + i) & 0x7F) });
+                         }
+                         if (n % 5 == 0) m.push_back({ 0x99, 36, 100 });  // Canal 10: ecarte
+                         return m;
+                       });
+  threads.emplace_back(runPeer<std::vector<Message> (*)(int)>, peer("Clavier 2", 0x22222222),
+                       start + 3100, stop, 25000, [](int n) {
+                         uint8_t note = 55 + (n / 2) % 27;
+                         return std::vector<Message>{ { (uint8_t)(n % 2 ? 0x81 : 0x91), note,
+                                                        (uint8_t)(n % 2 ? 0 : 100) } };
+                       });
+  threads.emplace_back(runPeer<std::vector<Message> (*)(int)>, peer("Tablette 3", 0x33333333),
+                       start + 7700, stop, 60000, [](int n) {
+                         uint8_t root = 60 + (n / 2) % 12;
+                         uint8_t status = n % 2 ? 0x82 : 0x92;
+                         uint8_t velocity = n % 2 ? 0 : 90;
+                         return std::vector<Message>{ { status, root, velocity },
+                                                      { status, (uint8_t)(root + 4), velocity },
+                                                      { status, (uint8_t)(root + 7), velocity } };
+                       });
+
+  printf("== %s: %d s, %u us par message joue, lecture a +%d ms, budget %d ==\n",
+         fair ? "tour pondere (MIDI_SOURCES_FAIR true)" : "ordre d'echeance seul (false)", seconds,
+         costUs, RTP_PLAYOUT_MS, MIDI_DISPATCH_BUDGET);
+  int64_t end = stop + 1000000;
+  uint8_t buf[1500];
+  while (hostMicros() < end) {
+    pollfd pfd[2] = { { fds[0], POLLIN, 0 }, { fds[1], POLLIN, 0 } };
+    uint32_t wait = sources.usUntilNext((uint32_t)hostMicros());
+    poll(pfd, 2, wait == UINT32_MAX ? 5 : (int)std::min<uint32_t>(wait / 1000, 5));
+
+    for (int s = 0; s < 2; s++) {
+      // Tous les datagrammes en attente, comme AppleMIDI.run() a chaque update()
+      while (true) {
+        sockaddr_in from = {};
+        socklen_t fromLen = sizeof(from);
+        ssize_t n = recvfrom(fds[s], buf, sizeof(buf), MSG_DONTWAIT, (sockaddr*)&from, &fromLen);
+        if (n <= 0) break;
+        uint32_t now = (uint32_t)hostMicros();
+        if (n >= 16 && buf[0] == 0xFF && buf[1] == 0xFF && buf[2] == 'I' && buf[3] == 'N') {
+          std::vector<uint8_t> ok = control("OK", readBe32(buf + 8), ssrc, "lyre_sessions");
+          sendto(fds[s], ok.data(), ok.size(), 0, (sockaddr*)&from, fromLen);
+          if (s == 1) sources.connect(readBe32(buf + 12), n > 16 ? (const char*)buf + 16 : "");
+          continue;
+        }
+        if (n >= 16 && buf[0] == 0xFF && buf[1] == 0xFF && buf[2] == 'B' && buf[3] == 'Y') {
+          uint32_t peerSsrc = readBe32(buf + 12);
+          for (uint8_t i = 0; i < MIDI_SOURCES_MAX; i++) {
+            const MidiSources::Source* src = sources.source(i);
+            if (src && src->ssrc == peerSsrc) snapshot(i);
+          }
+          sources.disconnect(peerSsrc);
+          continue;
+        }
+        sources.onPacket(buf, (uint16_t)n, now);
+        if (n >= 36 && buf[2] == 'C' && buf[3] == 'K' && buf[8] == 0) {
+          uint64_t ts2 = (uint64_t)hostMicros() / TICK_US;
+          std::vector<uint8_t> reply = clockSync(ssrc, 1, readBe64(buf + 12), ts2, 0);
+          sendto(fds[s], reply.data(), reply.size(), 0, (sockaddr*)&from, fromLen);
+          continue;
+        }
+        if (s != 1) continue;
+        for (const Message& m : decodeCommands(buf, n)) {
+          sources.receive(m.status, m.data1, m.data2, now);
+        }
+      }
+    }
+    for (int i = 0; i < MIDI_DISPATCH_BUDGET && sources.dispatch((uint32_t)hostMicros()); i++) {
+    }
+  }
+  for (std::thread& t : threads) t.join();
+  close(fds[0]);
+  close(fds[1]);
+
+  printf("Source          Joues  Ecartes  Attente p50   p99      max\n");
+  for (const Measure& m : measures) {
+    if (!m.done) continue;
+    printf("%-14s %6u %8u  %7.2f ms %6.2f ms %6.2f ms\n", m.name.c_str(), m.stats.played,
+           m.stats.filtered, percentile(m.waits, 0.5) / 1000.0, percentile(m.waits, 0.99) / 1000.0,
+           percentile(m.waits, 1.0) / 1000.0);
+  }
+  printf("\n");
+  fflush(stdout);
+  return true;
+}
+
+static void usage() {
+  fprintf(stderr, "Utilisation: lyre_sessions [--seconds N] [--cost-us N] [--port N] "
+                  "[--fair | --fifo]\n");
+}
+
+int main(int argc, char** argv) {
+  int seconds = 10, port = 5104;
+  int mode = -1;  // -1: les deux
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--seconds" && i + 1 < argc) seconds = atoi(argv[++i]);
+    else if (arg == "--cost-us" && i + 1 < argc) costUs = (uint32_t)atoi(argv[++i]);
+    else if (arg == "--port" && i + 1 < argc) port = atoi(argv[++i]);
+    else if (arg == "--fair") mode = 1;
+    else if (arg == "--fifo") mode = 0;
+    else { usage(); return 1; }
+  }
+  if (seconds <= 0) {
+    usage();
+    return 1;
+  }
+  sources.setRules(rules, sizeof(rules) / sizeof(rules[0]));
+  sources.setPlayHandler(play);
+  if (mode != 1 && !run(port, seconds, false)) return 1;
+  if (mode != 0 && !run(port, seconds, true)) return 1;
+  return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef HOST_ADAFRUIT_PWMSERVODRIVER_H
+#define HOST_ADAFRUIT_PWMSERVODRIVER_H
+/***********************************************************************************************
+Adafruit_PWMServoDriver de substitution: memes ecritures I2C que la bibliotheque (registre
+LEDn_ON_L puis 4 octets) pour que le temps de bus simule soit realiste.
+************************************************************************************************/
+
+#include "Wire.h"
+
+#define PCA9685_MODE1 0x00
+#define PCA9685_LED0_ON_L 0x06
+
+class Adafruit_PWMServoDriver {
+  private:
+    uint8_t _address;
+    TwoWire* _wire;
+
+  public:
+    Adafruit_PWMServoDriver(uint8_t address = 0x40, TwoWire& wire = Wire)
+      : _address(address), _wire(&wire) {}
+    bool begin(uint8_t = 0) {
+      _wire->beginTransmission(_address);
+      _wire->write(PCA9685_MODE1);
+      _wire->write(0x20);  // Auto-increment
+      return _wire->endTransmission() == 0;
+    }
+    void setOscillatorFrequency(uint32_t) {}
+    void setPWMFreq(float) {}
+    uint8_t setPWM(uint8_t num, uint16_t on, uint16_t off) {
+      _wire->beginTransmission(_address);
+      _wire->write(PCA9685_LED0_ON_L + 4 * num);
+      _wire->write(on & 0xFF);
+      _wire->write(on >> 8);
+      _wire->write(off & 0xFF);
+      _wire->write(off >> 8);
+      return _wire->endTransmission();
+    }
+};
+
+#endif
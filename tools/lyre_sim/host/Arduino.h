@@ -0,0 +1,66 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+/***********************************************************************************************
+Arduino.h de substitution pour le simulateur PC (tools/lyre_sim)
+
+Le temps est virtuel: simNowUs n'avance que lorsque le simulateur le decide (simAdvance) ou
+lorsqu'une transaction I2C simulee consomme du temps de bus. Le code firmware compile tel quel.
+************************************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+#define OUTPUT_OPEN_DRAIN 0x12
+#define LOW 0x0
+#define HIGH 0x1
+#define HEX 16
+
+// Broches I2C par defaut de l'ESP32
+#define SDA 21
+#define SCL 22
+
+extern uint64_t simNowUs;
+void simAdvance(uint64_t us);
+void simOnPinWrite(uint8_t pin, uint8_t value);
+int simOnPinRead(uint8_t pin);
+
+inline unsigned long micros() { return (unsigned long)simNowUs; }
+inline unsigned long millis() { return (unsigned long)(simNowUs / 1000); }
+inline void delay(unsigned long ms) { simAdvance((uint64_t)ms * 1000); }
+inline void delayMicroseconds(unsigned int us) { simAdvance(us); }
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t pin, uint8_t value) { simOnPinWrite(pin, value); }
+inline int digitalRead(uint8_t pin) { return simOnPinRead(pin); }
+inline long map(long x, long inMin, long inMax, long outMin, long outMax) {
+  return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+// Le simulateur n'affiche rien du firmware: ses propres resultats passent par printf
+class HostSerial {
+  public:
+    void begin(unsigned long) {}
+    int available() { return 0; }
+    int read() { return -1; }
+    template <typename T> void print(T) {}
+    template <typename T> void print(T, int) {}
+    template <typename T> void println(T) {}
+    template <typename T> void println(T, int) {}
+    void println() {}
+    template <typename... A> void printf(const char*, A...) {}
+    size_t write(const uint8_t*, size_t length) { return length; }
+    size_t write(uint8_t) { return 1; }
+};
+extern HostSerial Serial;
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+/***********************************************************************************************
+Wire.h de substitution: chaque transaction I2C est decodee comme une ecriture de registres
+PCA9685 (auto-increment) et coute le temps de bus correspondant (9 bits par octet). Un esclave
+bloque (stuckBits) fait expirer chaque transaction apres setTimeOut().
+************************************************************************************************/
+
+#include "Arduino.h"
+
+void simOnPcaRegister(uint8_t reg, uint8_t value);
+
+class TwoWire {
+  private:
+    uint8_t _buffer[128];
+    uint8_t _length;
+    uint8_t _address;
+
+  public:
+    uint32_t clockHz = 100000;
+    uint32_t transactions = 0;
+    uint32_t bytesSent = 0;
+    bool devicePresent = true;  // false: le PCA9685 ne repond pas (NACK)
+    uint8_t stuckBits = 0;      // > 0: un esclave tient SDA a 0 pour encore autant de coups d'horloge
+    uint16_t timeoutMs = 50;
+
+    void begin() { clockHz = 100000; }  // Horloge par defaut du core ESP32
+    void begin(int, int) { clockHz = 100000; }
+    void end() {}
+    void setClock(uint32_t hz) { clockHz = hz; }
+    uint32_t getClock() { return clockHz; }
+    void setTimeOut(uint16_t ms) { timeoutMs = ms; }
+    void beginTransmission(uint8_t address) { _address = address; _length = 0; }
+    size_t write(uint8_t value) {
+      if (_length >= sizeof(_buffer)) return 0;
+      _buffer[_length++] = value;
+      return 1;
+    }
+    size_t write(const uint8_t* data, size_t length) {
+      size_t n = 0;
+      while (n < length && write(data[n])) n++;
+      return n;
+    }
+    uint8_t endTransmission(bool = true) {
+      if (stuckBits) {
+        // Bus bloque: le maitre ne peut pas generer START, la transaction expire
+        simAdvance((uint64_t)timeoutMs * 1000);
+        transactions++;
+        return 5;
+      }
+      // Adresse + donnees, 9 bits par octet
+      simAdvance((uint64_t)(_length + 1) * 9 * 1000000 / clockHz);
+      transactions++;
+      bytesSent += _length + 1;
+      if (!devicePresent) return 2;
+      for (uint8_t i = 1; i < _length; i++) {
+        simOnPcaRegister(_buffer[0] + i - 1, _buffer[i]);
+      }
+      return 0;
+    }
+    uint8_t requestFrom(uint8_t, uint8_t) { return 0; }
+    int read() { return 0; }
+};
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef HOST_ESP_ATTR_H
+#define HOST_ESP_ATTR_H
+/***********************************************************************************************
+esp_attr.h de substitution: sur PC la memoire RTC est une variable globale ordinaire, elle
+survit donc aux "redemarrages" simules (nouvelle instance de Instrument).
+************************************************************************************************/
+
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
+#define IRAM_ATTR
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef HOST_ESP_SYSTEM_H
+#define HOST_ESP_SYSTEM_H
+/***********************************************************************************************
+esp_system.h de substitution: la cause du dernier reset est choisie par le scenario.
+************************************************************************************************/
+
+typedef enum {
+  ESP_RST_UNKNOWN,
+  ESP_RST_POWERON,
+  ESP_RST_EXT,
+  ESP_RST_SW,
+  ESP_RST_PANIC,
+  ESP_RST_INT_WDT,
+  ESP_RST_TASK_WDT,
+  ESP_RST_WDT,
+  ESP_RST_DEEPSLEEP,
+  ESP_RST_BROWNOUT,
+  ESP_RST_SDIO,
+} esp_reset_reason_t;
+
+extern esp_reset_reason_t simResetReason;
+inline esp_reset_reason_t esp_reset_reason() { return simResetReason; }
+
+#endif
@@ -0,0 +1,679 @@
+/***********************************************************************************************
+----------------------------    lyre_sim - simulateur PC du coeur firmware   -------------------
+************************************************************************************************
+Compile ServoController.cpp et instrument.cpp d'un sketch tels quels contre des substituts
+Arduino/Wire/PCA9685 (dossier host/) et rejoue des scenarios en temps virtuel.
+
+Modele mecanique (approximatif, memes constantes que settings.h):
+- une nouvelle consigne n'agit qu'a la trame PWM suivante (--dead-ms, 10 ms = demi-trame 50 Hz)
+- le servo tourne ensuite a SERVO_US_PER_DEGREE vers sa consigne
+- la corde est accrochee quand le mediator passe par la position de repos, et sonne quand il
+  s'en eloigne de PLUCK_RELEASE_ANGLE degres
+- une voie sans impulsion (OE haut ou bit full-OFF) ne bouge plus; quand les impulsions
+  reviennent, le servo ne repart qu'apres --wake-ms (20 ms: une trame complete pour se
+  resynchroniser, en plus du temps mort)
+
+  g++ -std=c++17 -O2 -I tools/lyre_sim/host -I arduino/Servo_pluck_ESP32_BLE_Enhanced \
+      tools/lyre_sim/lyre_sim.cpp arduino/Servo_pluck_ESP32_BLE_Enhanced/ServoController.cpp \
+      arduino/Servo_pluck_ESP32_BLE_Enhanced/instrument.cpp \
+      arduino/Servo_pluck_ESP32_BLE_Enhanced/DeferredLog.cpp \
+      arduino/Servo_pluck_ESP32_BLE_Enhanced/EventTrace.cpp -o lyre_sim
+
+Scenarios:
+  lyre_sim repeat [--servo N] [--notes N] [--dead-ms N]
+      Plafond de repetition sur une corde, mode normal contre mode pluck-through
+  lyre_sim sustain [--notes N]
+      Arpeges avec noteOff rapproches, sans puis avec pedale de sustain (CC 64)
+  lyre_sim panic
+      Pire cas d'un All Notes Off: boucle noteOff historique contre Instrument::panic()
+  lyre_sim idle [--wake-ms N]
+      Sessions types: latence de reveil des voies liberees et servo-secondes alimentees
+  lyre_sim boot
+      Temps avant la premiere note: mise sous tension puis reset watchdog (memoire RTC)
+  lyre_sim degraded
+      PCA9685 absent, branche en retard ou bus bloque: duree max de update(), mode degrade
+************************************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "instrument.h"
+
+uint64_t simNowUs = 0;
+esp_reset_reason_t simResetReason = ESP_RST_POWERON;
+HostSerial Serial;
+TwoWire Wire;
+
+/*------------------------------------------------------------------
+--------------        Modele mecanique                   ----------
+------------------------------------------------------------------*/
+
+struct ServoModel {
+  double angle;         // Position actuelle (degres)
+  double startAngle;    // Position au moment de la derniere consigne
+  double target;        // Consigne
+  uint64_t commandUs;   // Instant de la derniere consigne
+  bool energized;       // Impulsions presentes sur la voie
+  bool loaded;          // Corde accrochee par le mediator
+  uint64_t wakeUntilUs; // Impulsions revenues: immobile jusqu'a cet instant
+  std::vector<uint64_t> sounds;
+};
+
+static ServoModel servos[NUM_SERVOS];
+static uint8_t pcaRegisters[256];
+static bool outputEnabled = true;  // Broche OE (active basse)
+static uint64_t deadUs = 10000;
+static uint32_t pcaWrites = 0;     // Voies reprogrammees (OFF_H ecrit avec une nouvelle valeur)
+static uint32_t pcaCutoffs = 0;    // Bit full-OFF ecrit (voie coupee): pas un mouvement
+static uint64_t wakeUs = 20000;
+static double energizedServoUs = 0;  // Integrale du nombre de voies alimentees
+
+// Memes broches que ServoController.cpp
+#if defined(I2C_SDA) && defined(I2C_SCL)
+  #define SERVO_SIM_SDA I2C_SDA
+  #define SERVO_SIM_SCL I2C_SCL
+#elif defined(PIN_SDA) && defined(PIN_SCL)
+  #define SERVO_SIM_SDA PIN_SDA
+  #define SERVO_SIM_SCL PIN_SCL
+#else
+  #define SERVO_SIM_SDA SDA
+  #define SERVO_SIM_SCL SCL
+#endif
+
+static double tickToAngle(uint16_t tick) {
+  double pulseUs = tick / 4096.0 / SERVO_FREQUENCY * 1e6;
+  return (pulseUs - SERVO_PULSE_MIN) * (SERVO_MAX_ANGLE - SERVO_MIN_ANGLE) /
+         (SERVO_PULSE_MAX - SERVO_PULSE_MIN) + SERVO_MIN_ANGLE;
+}
+
+void simOnPcaRegister(uint8_t reg, uint8_t value) {
+  pcaRegisters[reg] = value;
+  if (reg < PCA9685_LED0_ON_L || reg >= PCA9685_LED0_ON_L + 4 * NUM_SERVOS) return;
+  if ((reg - PCA9685_LED0_ON_L) % 4 != 3) return;  // Voie prise en compte a l'ecriture de OFF_H
+
+  uint8_t channel = (reg - PCA9685_LED0_ON_L) / 4;
+  ServoModel& s = servos[channel];
+  if (value & 0x10) {  // Bit full-OFF
+    pcaCutoffs++;
+    s.energized = false;
+    return;
+  }
+  uint16_t tick = pcaRegisters[reg - 1] | ((value & 0x0F) << 8);
+  if (s.energized && fabs(tickToAngle(tick) - s.target) < 1e-6) return;  // Reecriture identique
+  pcaWrites++;
+  if (!s.energized && outputEnabled) s.wakeUntilUs = simNowUs + wakeUs;
+  s.energized = true;
+  s.startAngle = s.angle;
+  s.target = tickToAngle(tick);
+  s.commandUs = simNowUs;
+}
+
+void simOnPinWrite(uint8_t pin, uint8_t value) {
+  // Recuperation du bus: chaque front montant de SCL fait avancer l'esclave bloque d'un bit
+  if (pin == SERVO_SIM_SCL) {
+    if (value == HIGH && Wire.stuckBits > 0) Wire.stuckBits--;
+    return;
+  }
+  if (pin != PIN_SERVO_OE) return;
+  bool enabled = (value == LOW);
+  if (enabled && !outputEnabled) {
+    for (uint8_t i = 0; i < NUM_SERVOS; i++) servos[i].wakeUntilUs = simNowUs + wakeUs;
+  }
+  outputEnabled = enabled;
+}
+
+int simOnPinRead(uint8_t pin) {
+  if (pin == SERVO_SIM_SDA) return Wire.stuckBits > 0 ? LOW : HIGH;
+  return HIGH;
+}
+
+static void stepPhysics(uint64_t dt) {
+  for (uint8_t i = 0; i < NUM_SERVOS; i++) {
+    ServoModel& s = servos[i];
+    if (!outputEnabled || !s.energized) continue;
+    energizedServoUs += dt;
+    if (simNowUs < s.commandUs + deadUs || simNowUs < s.wakeUntilUs) continue;
+
+    double rest = initialAngles[i];
+    double before = s.angle - rest;
+    double stepDeg = (double)dt / SERVO_US_PER_DEGREE;
+    if (fabs(s.target - s.angle) <= stepDeg) s.angle = s.target;
+    else s.angle += (s.target > s.angle) ? stepDeg : -stepDeg;
+    double after = s.angle - rest;
+
+    if (fabs(after) < 1e-6 || (before < 0) != (after < 0)) s.loaded = true;
+    if (s.loaded && fabs(after) >= PLUCK_RELEASE_ANGLE) {
+      s.loaded = false;
+      s.sounds.push_back(simNowUs);
+    }
+  }
+}
+
+void simAdvance(uint64_t us) {
+  const uint64_t step = 50;
+  while (us > 0) {
+    uint64_t dt = us < step ? us : step;
+    simNowUs += dt;
+    stepPhysics(dt);
+    us -= dt;
+  }
+}
+
+static void resetModel() {
+  for (uint8_t i = 0; i < NUM_SERVOS; i++) {
+    servos[i].angle = servos[i].startAngle = servos[i].target = initialAngles[i];
+    servos[i].energized = true;
+    servos[i].loaded = true;
+    servos[i].wakeUntilUs = 0;
+    servos[i].sounds.clear();
+  }
+}
+
+// Fait tourner loop() au rythme d'une iteration par milliseconde
+static void runFor(Instrument& instrument, uint64_t us) {
+  uint64_t end = simNowUs + us;
+  while (simNowUs < end) {
+    instrument.update();
+    simAdvance(end - simNowUs < 1000 ? end - simNowUs : 1000);
+  }
+}
+
+static void bootInstrument(Instrument& instrument) {
+  instrument.begin();
+  while (!instrument.isReady()) runFor(instrument, 1000);
+}
+
+/*------------------------------------------------------------------
+--------------        Scenario: repetition               ----------
+------------------------------------------------------------------*/
+
+// Joue N notes a intervalle fixe (noteOff gateUs apres le noteOn, 0 = mi-intervalle) et
+// verifie que chacune sonne une fois avant la suivante
+static bool repetitionOk(Instrument& instrument, uint8_t servo, uint64_t intervalUs,
+                         uint64_t gateUs, int notes, uint32_t& writes) {
+  uint8_t note = MidiServoMapping[servo];
+  instrument.noteOff(note);
+  runFor(instrument, 300000);
+  servos[servo].sounds.clear();
+  uint32_t writesBefore = pcaWrites;
+
+  uint64_t gate = (gateUs == 0 || gateUs >= intervalUs) ? intervalUs / 2 : gateUs;
+  uint64_t start = simNowUs;
+  for (int k = 0; k < notes; k++) {
+    instrument.noteOn(note, 100);
+    runFor(instrument, gate);
+    instrument.noteOff(note);
+    runFor(instrument, intervalUs - gate);
+  }
+  writes = pcaWrites - writesBefore;
+
+  const std::vector<uint64_t>& sounds = servos[servo].sounds;
+  if ((int)sounds.size() != notes) return false;
+  for (int k = 0; k < notes; k++) {
+    if (sounds[k] < start + k * intervalUs || sounds[k] >= start + (k + 1) * intervalUs) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int scenarioRepeat(uint8_t servo, int notes) {
+  Instrument instrument;
+  resetModel();
+  bootInstrument(instrument);
+
+  printf("Corde %u (note %u), %d notes par essai, temps mort %.1f ms\n\n",
+         servo, MidiServoMapping[servo], notes, deadUs / 1000.0);
+  printf("%-14s %-16s %-16s %-10s %s\n", "Gate", "Mode", "Intervalle min", "Notes/s",
+         "Ecritures/note");
+
+  // Legato (noteOff a mi-intervalle) puis staccato (noteOff 10 ms apres le noteOn, cas des
+  // claviers et arpegiateurs: le mute rattrape le grattage avant que la corde ne sonne)
+  const uint64_t gates[2] = {0, 10000};
+  for (int g = 0; g < 2; g++) {
+    double ceilings[2] = {0, 0};
+    for (int mode = 0; mode < 2; mode++) {
+      instrument.setPluckThrough(mode == 1, 0);
+      uint64_t best = 0;
+      uint32_t bestWrites = 0;
+      // Balayage decroissant: on garde le plus petit intervalle tant que tout passe
+      for (uint64_t interval = 300000; interval >= 5000; interval -= 1000) {
+        uint32_t writes;
+        if (!repetitionOk(instrument, servo, interval, gates[g], notes, writes)) break;
+        best = interval;
+        bestWrites = writes;
+      }
+      const char* gate = g ? "10 ms" : "mi-intervalle";
+      const char* name = mode ? "pluck-through" : "normal";
+      if (best == 0) {
+        printf("%-14s %-16s %-16s\n", gate, name, "> 300 ms");
+        continue;
+      }
+      ceilings[mode] = 1e6 / best;
+      printf("%-14s %-16s %-16s %-10.1f %.1f\n", gate, name,
+             (std::to_string(best / 1000) + " ms").c_str(), ceilings[mode],
+             (double)bestWrites / notes);
+    }
+    if (ceilings[0] > 0 && ceilings[1] > 0) {
+      printf("%-14s Gain pluck-through: x%.2f\n", "", ceilings[1] / ceilings[0]);
+    }
+  }
+  return 0;
+}
+
+/*------------------------------------------------------------------
+--------------        Scenario: pedale de sustain        ----------
+------------------------------------------------------------------*/
+
+// Arpege montant puis descendant sur 8 cordes, noteOff juste apres chaque noteOn (jeu au
+// clavier sous la pedale), pedale relachee a la fin de chaque mesure
+static int scenarioSustain(int notes) {
+  Instrument instrument;
+  resetModel();
+  bootInstrument(instrument);
+
+  const uint8_t pattern[] = {0, 2, 4, 6, 8, 6, 4, 2};
+  const uint8_t patternLength = sizeof(pattern);
+
+  printf("%d notes, arpege sur 8 cordes, 120 ms par note, pedale relachee tous les 8 notes\n\n",
+         notes);
+  printf("%-10s %-12s %-14s %-12s %-12s %s\n", "Pedale", "Cordes", "Mouvements", "Coupures",
+         "I2C", "Cordes au repos a la fin");
+
+  for (int pedal = 0; pedal < 2; pedal++) {
+    runFor(instrument, 500000);
+    instrument.resetSustainStats();
+    uint32_t writesBefore = pcaWrites;
+    uint32_t cutoffsBefore = pcaCutoffs;
+    uint32_t transactionsBefore = Wire.transactions;
+    uint32_t sounded = 0;
+    for (uint8_t i = 0; i < NUM_SERVOS; i++) servos[i].sounds.clear();
+
+    for (int k = 0; k < notes; k++) {
+      if (pedal && k % patternLength == 0) instrument.setSustain(true);
+      uint8_t note = MidiServoMapping[pattern[k % patternLength]];
+      instrument.noteOn(note, 100);
+      runFor(instrument, 40000);
+      instrument.noteOff(note);
+      runFor(instrument, 80000);
+      if (pedal && k % patternLength == patternLength - 1) instrument.setSustain(false);
+    }
+    runFor(instrument, 300000);
+
+    for (uint8_t i = 0; i < NUM_SERVOS; i++) sounded += servos[i].sounds.size();
+    uint8_t atRest = 0;
+    for (uint8_t i = 0; i < NUM_SERVOS; i++) {
+      if (fabs(servos[i].angle - initialAngles[i]) < 0.5) atRest++;
+    }
+    printf("%-10s %-12u %-14u %-12u %-12u %u/%u\n", pedal ? "CC 64" : "aucune", sounded,
+           pcaWrites - writesBefore, pcaCutoffs - cutoffsBefore,
+           Wire.transactions - transactionsBefore, atRest, NUM_SERVOS);
+    if (pedal) {
+      const Instrument::SustainStats& stats = instrument.getSustainStats();
+      printf("\nMutes differes: %u, mouvements evites: %u, relachements: %u (%u cordes)\n",
+             stats.deferredMutes, stats.savedMoves, stats.flushes, stats.flushedMutes);
+    }
+  }
+  return 0;
+}
+
+/*------------------------------------------------------------------
+--------------        Scenario: panique                  ----------
+------------------------------------------------------------------*/
+
+// Pire cas: les 16 cordes viennent d'etre grattees (aucune au repos). Le temps mesure est le
+// temps de bus I2C simule entre l'appel et le retour, celui du CPU etant negligeable devant.
+static void pluckAll(Instrument& instrument) {
+  for (uint8_t i = 0; i < NUM_SERVOS; i++) instrument.noteOn(MidiServoMapping[i], 100);
+  runFor(instrument, 100000);
+}
+
+static int scenarioPanic() {
+  Instrument instrument;
+  resetModel();
+  bootInstrument(instrument);
+
+  printf("%-10s %-24s %-14s %-8s %-12s %s\n", "Bus I2C", "Methode", "Transactions", "Octets",
+         "Duree appel", "Derniere corde au repos");
+
+  const uint32_t clocks[2] = {100000, 400000};
+  for (uint8_t c = 0; c < 2; c++) {
+    Wire.setClock(clocks[c]);
+    for (int method = 0; method < 2; method++) {
+      pluckAll(instrument);
+      uint32_t transactions = Wire.transactions;
+      uint32_t bytes = Wire.bytesSent;
+      uint64_t start = simNowUs;
+
+      if (method == 0) {
+        // Ancien gestionnaire CC 123: un noteOff par note de la plage
+        for (int note = MIDI_NOTE_MIN; note <= MIDI_NOTE_MAX; note++) instrument.noteOff(note);
+      } else {
+        instrument.panic();
+      }
+      uint64_t callUs = simNowUs - start;
+
+      // Instant ou le dernier servo atteint sa position de repos
+      uint64_t settledUs = 0;
+      while (settledUs == 0 && simNowUs - start < 1000000) {
+        runFor(instrument, 100);
+        bool allAtRest = true;
+        for (uint8_t i = 0; i < NUM_SERVOS; i++) {
+          // La consigne de repos est quantifiee par le PCA9685: tolerance d'un demi-degre
+          if (servos[i].angle != servos[i].target ||
+              fabs(servos[i].angle - initialAngles[i]) > 0.5) allAtRest = false;
+        }
+        if (allAtRest) settledUs = simNowUs - start;
+      }
+
+      char clock[16];
+      snprintf(clock, sizeof(clock), "%u kHz", clocks[c] / 1000);
+      printf("%-10s %-24s %-14u %-8u %-12s %.1f ms\n", clock,
+             method ? "Instrument::panic()" : "boucle noteOff",
+             Wire.transactions - transactions, Wire.bytesSent - bytes,
+             (std::to_string(callUs) + " us").c_str(), settledUs / 1000.0);
+    }
+  }
+  return 0;
+}
+
+/*------------------------------------------------------------------
+--------------        Scenario: liberation des voies     ----------
+------------------------------------------------------------------*/
+
+struct NoteEvent {
+  uint64_t atUs;
+  uint8_t servo;
+  bool on;
+};
+
+struct Session {
+  const char* name;
+  uint64_t durationUs;
+  std::vector<NoteEvent> events;
+};
+
+static void addNote(Session& session, uint64_t atUs, uint8_t servo, uint64_t gateUs) {
+  session.events.push_back({atUs, servo, true});
+  session.events.push_back({atUs + gateUs, servo, false});
+}
+
+static std::vector<Session> typicalSessions() {
+  std::vector<Session> sessions;
+  uint32_t seed = 12345;
+  auto random = [&seed](uint32_t n) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % n;
+  };
+
+  // Melodie: une note toutes les 250 ms sur 8 cordes voisines, trois pauses de 4 s
+  Session melody = {"melodie", 60000000, {}};
+  int string = 6;
+  for (uint64_t t = 0; t < melody.durationUs - 1000000; t += 250000) {
+    uint64_t s = t / 1000000;
+    if ((s >= 15 && s < 19) || (s >= 30 && s < 34) || (s >= 45 && s < 49)) continue;
+    string += (int)random(3) - 1;
+    string = std::min(10, std::max(3, string));
+    addNote(melody, t, string, 200000);
+  }
+  sessions.push_back(melody);
+
+  // Accompagnement epars: un accord de 3 cordes toutes les 3 s
+  Session chords = {"accords epars", 60000000, {}};
+  const uint8_t shapes[3][3] = {{0, 4, 7}, {2, 5, 9}, {4, 7, 11}};
+  for (uint64_t t = 0, k = 0; t < chords.durationUs - 2000000; t += 3000000, k++) {
+    for (uint8_t n = 0; n < 3; n++) addNote(chords, t + n * 20000, shapes[k % 3][n], 1500000);
+  }
+  sessions.push_back(chords);
+
+  // Sequenceur: arpeges denses, 8 notes/s sur 12 cordes
+  Session sequencer = {"sequenceur", 30000000, {}};
+  for (uint64_t t = 0; t < sequencer.durationUs - 1000000; t += 125000) {
+    addNote(sequencer, t, random(12), 60000);
+  }
+  sessions.push_back(sequencer);
+
+  for (Session& session : sessions) {
+    std::stable_sort(session.events.begin(), session.events.end(),
+                     [](const NoteEvent& a, const NoteEvent& b) { return a.atUs < b.atUs; });
+  }
+  return sessions;
+}
+
+static int scenarioIdle() {
+  printf("Reveil %.0f ms, voie liberee apres %d ms (%d ms pendant le trafic)\n\n",
+         wakeUs / 1000.0, SERVO_AUTO_DISABLE_TIMEOUT_MS, SERVO_TRAFFIC_HOLD_MS);
+  printf("%-14s %-7s | %-22s %-13s %-13s | %-22s %s\n", "Session", "Notes",
+         "Voie par voie: froides", "lat. chaude", "lat. froide", "OE global: froides",
+         "servo-s (voie / OE global / toujours)");
+
+  for (const Session& session : typicalSessions()) {
+    Instrument instrument;
+    resetModel();
+    bootInstrument(instrument);
+    runFor(instrument, 3000000);  // Toutes les voies liberees
+
+    struct Played { uint64_t atUs; uint8_t servo; bool cold; };
+    std::vector<Played> played;
+    for (uint8_t i = 0; i < NUM_SERVOS; i++) servos[i].sounds.clear();
+    energizedServoUs = 0;
+    uint64_t start = simNowUs;
+
+    for (const NoteEvent& event : session.events) {
+      if (start + event.atUs > simNowUs) runFor(instrument, start + event.atUs - simNowUs);
+      uint8_t note = MidiServoMapping[event.servo];
+      if (event.on) {
+        bool cold = !(instrument.getEnergizedMask() & (1 << event.servo));
+        played.push_back({simNowUs, event.servo, cold});
+        instrument.noteOn(note, 100);
+      } else {
+        instrument.noteOff(note);
+      }
+    }
+    runFor(instrument, start + session.durationUs - simNowUs);
+
+    // Latence noteOn -> corde lachee, chaude (voie alimentee) ou froide (voie a reveiller)
+    double warmSum = 0, coldSum = 0;
+    int warm = 0, cold = 0;
+    for (size_t k = 0; k < played.size(); k++) {
+      uint64_t limit = UINT64_MAX;
+      for (size_t j = k + 1; j < played.size(); j++) {
+        if (played[j].servo == played[k].servo) { limit = played[j].atUs; break; }
+      }
+      for (uint64_t sound : servos[played[k].servo].sounds) {
+        if (sound >= played[k].atUs && sound < limit) {
+          double latency = (sound - played[k].atUs) / 1000.0;
+          if (played[k].cold) { coldSum += latency; cold++; }
+          else { warmSum += latency; warm++; }
+          break;
+        }
+      }
+    }
+
+    // Ancien comportement (OE global apres SERVO_AUTO_DISABLE_TIMEOUT_MS sans commande)
+    // estime sur la meme chronologie: toutes les voies alimentees pendant l'activite
+    uint64_t legacyUs = 0, activeUntil = 0;
+    int legacyCold = 0;
+    const uint64_t timeoutUs = (uint64_t)SERVO_AUTO_DISABLE_TIMEOUT_MS * 1000;
+    for (const NoteEvent& event : session.events) {
+      if (event.on && (activeUntil == 0 || event.atUs >= activeUntil)) legacyCold++;
+      uint64_t from = std::max(event.atUs, activeUntil);
+      activeUntil = std::max(activeUntil, event.atUs + timeoutUs);
+      if (activeUntil > from) legacyUs += activeUntil - from;
+    }
+    legacyUs = std::min(legacyUs, session.durationUs) * NUM_SERVOS;
+
+    char coldText[32];
+    snprintf(coldText, sizeof(coldText), "%d/%zu", cold, played.size());
+    char legacyText[32];
+    snprintf(legacyText, sizeof(legacyText), "%d/%zu", legacyCold, played.size());
+    printf("%-14s %-7zu | %-22s %-13s %-13s | %-22s %.0f / %.0f / %.0f\n", session.name,
+           played.size(), coldText,
+           warm ? (std::to_string(warmSum / warm).substr(0, 4) + " ms").c_str() : "-",
+           cold ? (std::to_string(coldSum / cold).substr(0, 4) + " ms").c_str() : "-",
+           legacyText, energizedServoUs / 1e6, legacyUs / 1e6,
+           NUM_SERVOS * session.durationUs / 1e6);
+  }
+  return 0;
+}
+
+/*------------------------------------------------------------------
+--------------        Scenario: demarrage                ----------
+------------------------------------------------------------------*/
+
+static bool allAtRest() {
+  for (uint8_t i = 0; i < NUM_SERVOS; i++) {
+    if (servos[i].angle != servos[i].target || fabs(servos[i].angle - initialAngles[i]) > 0.5) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Construit l'instrument comme setup() et mesure le temps jusqu'a isReady() (premiere note
+// acceptee) et jusqu'a ce que toutes les cordes soient physiquement au repos
+static void measureBoot(const char* name, esp_reset_reason_t reason) {
+  simResetReason = reason;
+  uint64_t start = simNowUs;
+  Instrument instrument;
+  instrument.begin();
+  const uint64_t pending = UINT64_MAX;
+  uint64_t readyUs = pending, restUs = pending;
+  while (simNowUs - start < 30000000 && restUs == pending) {
+    if (readyUs == pending && instrument.isReady()) readyUs = simNowUs - start;
+    if (readyUs != pending && allAtRest()) restUs = simNowUs - start;
+    if (restUs == pending) runFor(instrument, 100);
+  }
+  printf("%-30s %-14.1f %.1f\n", name, readyUs / 1000.0, restUs / 1000.0);
+
+  // Quelques notes pour laisser des cordes hors repos avant le reset suivant
+  for (uint8_t i = 0; i < NUM_SERVOS; i += 3) instrument.noteOn(MidiServoMapping[i], 100);
+  runFor(instrument, 100000);
+}
+
+static int scenarioBoot() {
+  resetModel();
+  printf("Groupes de %d servos, ouverture %d ms, fermeture %d ms (balayage sequentiel: %.1f s)\n\n",
+         SERVO_INIT_GROUP_SIZE, SERVO_INIT_DELAY_MS, SERVO_RESET_DELAY_MS,
+         NUM_SERVOS * (SERVO_INIT_DELAY_MS + SERVO_RESET_DELAY_MS) / 1000.0);
+  printf("%-30s %-14s %s\n", "Demarrage", "Pret (ms)", "Cordes au repos (ms)");
+  measureBoot("mise sous tension", ESP_RST_POWERON);
+  measureBoot("reset watchdog (a chaud)", ESP_RST_TASK_WDT);
+  measureBoot("reset logiciel (a chaud)", ESP_RST_SW);
+  measureBoot("chute d'alimentation", ESP_RST_BROWNOUT);
+  return 0;
+}
+
+/*------------------------------------------------------------------
+--------------        Scenario: PCA9685 absent           ----------
+------------------------------------------------------------------*/
+
+// begin() puis loop() pendant 10 s. Le PCA9685 apparait a plugMs (0 = present des le depart,
+// -1 = jamais); stuckBits simule un esclave qui tient SDA a 0 au demarrage.
+static void measureProbe(const char* name, long plugMs, uint8_t stuckBits) {
+  resetModel();
+  simResetReason = ESP_RST_POWERON;
+  Wire.devicePresent = (plugMs == 0);
+  Wire.stuckBits = stuckBits;
+  uint32_t transactionsBefore = Wire.transactions;
+
+  uint64_t start = simNowUs;
+  Instrument instrument;
+  uint64_t before = simNowUs;
+  instrument.begin();
+  uint64_t maxBlockUs = simNowUs - before;
+
+  const uint64_t pending = UINT64_MAX;
+  uint64_t readyUs = pending, onlineUs = pending;
+  int notes = 0, errors = 0;
+  while (simNowUs - start < 10000000) {
+    if (plugMs > 0 && simNowUs - start >= (uint64_t)plugMs * 1000) Wire.devicePresent = true;
+
+    before = simNowUs;
+    instrument.update();
+    maxBlockUs = std::max(maxBlockUs, simNowUs - before);
+
+    if (readyUs == pending && instrument.isReady()) readyUs = simNowUs - start;
+    if (onlineUs == pending && instrument.isReady() && instrument.isOnline()) {
+      onlineUs = simNowUs - start;
+    }
+    // Une note toutes les 250 ms des que l'instrument accepte le MIDI
+    if (instrument.isReady() && (simNowUs - start) % 250000 < 1000) {
+      instrument.noteOn(MidiServoMapping[notes % NUM_SERVOS], 100);
+      notes++;
+      if (!instrument.isOnline()) errors++;
+    }
+    simAdvance(1000);
+  }
+
+  char ready[16], online[16];
+  snprintf(ready, sizeof(ready), readyUs == pending ? "-" : "%.0f", readyUs / 1000.0);
+  snprintf(online, sizeof(online), onlineUs == pending ? "-" : "%.0f", onlineUs / 1000.0);
+  printf("%-26s %-10s %-12s %-14.1f %-12u %d/%d\n", name, ready, online, maxBlockUs / 1000.0,
+         (unsigned)(Wire.transactions - transactionsBefore), errors, notes);
+  Wire.devicePresent = true;
+  Wire.stuckBits = 0;
+}
+
+static int scenarioDegraded() {
+  printf("Essais: %d, backoff %d-%d ms, timeout I2C %d ms\n\n", PCA9685_PROBE_ATTEMPTS,
+         PCA9685_PROBE_RETRY_MIN_MS, PCA9685_PROBE_RETRY_MAX_MS, PCA9685_I2C_TIMEOUT_MS);
+  printf("%-26s %-10s %-12s %-14s %-12s %s\n", "PCA9685", "MIDI (ms)", "En ligne (ms)",
+         "update max (ms)", "Transactions", "Notes en erreur");
+  measureProbe("present", 0, 0);
+  measureProbe("branche a 3 s", 3000, 0);
+  measureProbe("absent", -1, 0);
+
+  // Recuperation du bus: Wire.end()/begin() ne doit pas perdre l'horloge choisie par le sketch
+  Wire.setClock(400000);
+  measureProbe("bus bloque (SDA a 0)", 0, 5);
+  printf("\nHorloge I2C apres recuperation: %u kHz (400 avant)\n", Wire.clockHz / 1000);
+  Wire.setClock(100000);
+  return 0;
+}
+
+/*------------------------------------------------------------------
+--------------        Main                               ----------
+------------------------------------------------------------------*/
+
+static void usage() {
+  fprintf(stderr,
+          "Utilisation: lyre_sim repeat|sustain|panic|idle|boot|degraded [--servo N] [--notes N] "
+          "[--dead-ms N] [--wake-ms N]\n");
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    usage();
+    return 1;
+  }
+  std::string scenario = argv[1];
+  int servo = 7;
+  int notes = 20;
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--servo" && i + 1 < argc) servo = atoi(argv[++i]);
+    else if (arg == "--notes" && i + 1 < argc) notes = atoi(argv[++i]);
+    else if (arg == "--dead-ms" && i + 1 < argc) deadUs = (uint64_t)(atof(argv[++i]) * 1000);
+    else if (arg == "--wake-ms" && i + 1 < argc) wakeUs = (uint64_t)(atof(argv[++i]) * 1000);
+    else { usage(); return 1; }
+  }
+  if (servo < 0 || servo >= NUM_SERVOS) {
+    usage();
+    return 1;
+  }
+
+  if (scenario == "repeat") return scenarioRepeat(servo, notes);
+  if (scenario == "sustain") return scenarioSustain(notes);
+  if (scenario == "panic") return scenarioPanic();
+  if (scenario == "idle") return scenarioIdle();
+  if (scenario == "boot") return scenarioBoot();
+  if (scenario == "degraded") return scenarioDegraded();
+  usage();
+  return 1;
+}
@@ -0,0 +1,338 @@
+/***********************************************************************************************
+----------------------------    lyre_trace - lecture de la trace d'evenements   ----------------
+************************************************************************************************
+Relit un vidage de EventTrace (TraceFormat.h) et affiche la chronologie et la latence par
+corde: entree MIDI -> decision de l'instrument -> fin de l'ecriture I2C sur la voie.
+
+  E=arduino/Servo_pluck_ESP32_BLE_Enhanced
+  g++ -std=c++17 -O2 -I $E tools/lyre_trace/lyre_trace.cpp -o lyre_trace
+
+Entrees acceptees:
+  - capture du port serie apres la commande 't' (texte et trame 0x00 0xA6 melanges)
+  - fichier .syx des reponses a F0 7D 54 01 F7 (SysEx MIDI, pas besoin de cable USB)
+
+Utilisation:
+  lyre_trace capture.bin [--timeline] [--boot N]
+
+  --timeline   chronologie evenement par evenement, une colonne par corde
+  --boot N     seulement le demarrage N (0 = mise sous tension, defaut: tous)
+************************************************************************************************/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "TraceFormat.h"
+#include "settings.h"
+
+struct Dump {
+  TraceDumpHeader header;
+  std::vector<TraceEvent> events;
+};
+
+static uint32_t readLe(const uint8_t* p, int bytes) {
+  uint32_t value = 0;
+  for (int i = bytes - 1; i >= 0; i--) {
+    value = (value << 8) | p[i];
+  }
+  return value;
+}
+
+static uint32_t unpack7(const uint8_t*& p, int count) {
+  uint32_t value = 0;
+  for (int i = 0; i < count; i++) {
+    value |= (uint32_t)(*p++ & 0x7F) << (7 * i);
+  }
+  return value;
+}
+
+// Trame serie: 0x00 0xA6, en-tete de 24 octets, evenements de 8 octets
+static bool parseSerial(const std::vector<uint8_t>& data, Dump& dump) {
+  for (size_t i = 0; i + 2 + sizeof(TraceDumpHeader) <= data.size(); i++) {
+    if (data[i] != TRACE_FRAME_SYNC0 || data[i + 1] != TRACE_FRAME_SYNC1) continue;
+    const uint8_t* p = &data[i + 2];
+    TraceDumpHeader& h = dump.header;
+    h.magic = readLe(p, 4);
+    if (h.magic != TRACE_MAGIC) continue;
+    h.version = readLe(p + 4, 2);
+    h.count = readLe(p + 6, 2);
+    h.total = readLe(p + 8, 4);
+    h.bootCount = readLe(p + 12, 4);
+    h.nowUs = readLe(p + 16, 4);
+    p += sizeof(TraceDumpHeader);
+
+    size_t available = (data.size() - (p - data.data())) / sizeof(TraceEvent);
+    if (available < h.count) {
+      fprintf(stderr, "Trace tronquee: %zu evenements sur %u\n", available, h.count);
+      h.count = available;
+    }
+    dump.events.clear();
+    for (uint16_t n = 0; n < h.count; n++, p += sizeof(TraceEvent)) {
+      TraceEvent e;
+      e.timestampUs = readLe(p, 4);
+      e.type = p[4];
+      e.a = p[5];
+      e.b = readLe(p + 6, 2);
+      dump.events.push_back(e);
+    }
+    return true;  // Premiere trame valide de la capture
+  }
+  return false;
+}
+
+// Reponses SysEx F0 7D 54 02 (en-tete) et F0 7D 54 03 (blocs d'evenements)
+static bool parseSysEx(const std::vector<uint8_t>& data, Dump& dump) {
+  bool haveHeader = false;
+  for (size_t i = 0; i + 4 < data.size(); i++) {
+    if (data[i] != 0xF0 || data[i + 1] != SYSEX_MANUFACTURER_ID || data[i + 2] != SYSEX_TRACE) {
+      continue;
+    }
+    size_t end = i + 3;
+    while (end < data.size() && data[end] != 0xF7) end++;
+    if (end >= data.size()) break;
+    const uint8_t* p = &data[i + 4];
+
+    if (data[i + 3] == SYSEX_TRACE_HEADER) {
+      TraceDumpHeader& h = dump.header;
+      h.magic = unpack7(p, 5);
+      h.version = unpack7(p, 1);
+      h.count = unpack7(p, 2);
+      h.total = unpack7(p, 5);
+      h.bootCount = unpack7(p, 5);
+      h.nowUs = unpack7(p, 5);
+      dump.events.assign(h.count, TraceEvent{0, TRACE_NONE, 0, 0});
+      haveHeader = (h.magic == TRACE_MAGIC);
+    } else if (data[i + 3] == SYSEX_TRACE_EVENTS && haveHeader) {
+      uint16_t index = unpack7(p, 2);
+      while (p + 11 <= &data[end] && index < dump.events.size()) {
+        TraceEvent& e = dump.events[index++];
+        e.timestampUs = unpack7(p, 5);
+        e.type = unpack7(p, 1);
+        e.a = unpack7(p, 2);
+        e.b = unpack7(p, 3);
+      }
+    }
+    i = end;
+  }
+  return haveHeader;
+}
+
+static const char* resetName(uint8_t reason) {
+  static const char* const names[] = {
+    "inconnu", "mise sous tension", "broche EN", "logiciel", "panic", "watchdog IRQ",
+    "watchdog tache", "watchdog", "deep sleep", "chute d'alimentation", "SDIO"
+  };
+  return reason < sizeof(names) / sizeof(names[0]) ? names[reason] : "?";
+}
+
+static std::string describe(const TraceEvent& e) {
+  char text[96];
+  switch (e.type) {
+    case TRACE_BOOT:
+      snprintf(text, sizeof(text), "demarrage %u (reset: %s)", e.b, resetName(e.a));
+      break;
+    case TRACE_MIDI_NOTE_ON:  snprintf(text, sizeof(text), "note %u vel %u", e.a, e.b); break;
+    case TRACE_MIDI_NOTE_OFF: snprintf(text, sizeof(text), "note %u", e.a); break;
+    case TRACE_MIDI_CC:       snprintf(text, sizeof(text), "CC %u = %u", e.a, e.b); break;
+    case TRACE_PLUCK:
+    case TRACE_MUTE:
+    case TRACE_MUTE_DEFERRED:
+      snprintf(text, sizeof(text), "corde %u (note %u)", e.a, e.b);
+      break;
+    case TRACE_SCORE:         snprintf(text, sizeof(text), "corde %u tick %u", e.a, e.b); break;
+    case TRACE_SERVO_WRITE:
+      if (e.b >= 4096) snprintf(text, sizeof(text), "voie %u full-OFF", e.a);
+      else snprintf(text, sizeof(text), "voie %u tick %u", e.a, e.b);
+      break;
+    case TRACE_GROUP_WRITE:
+      snprintf(text, sizeof(text), "voies %u-%u (alimentees 0x%04X)", e.a & 15, e.a >> 4, e.b);
+      break;
+    case TRACE_POWER: {
+      static const char* const states[] = { "OE coupe", "OE actif", "liberees", "reveil" };
+      snprintf(text, sizeof(text), "%s 0x%04X", e.a < 4 ? states[e.a] : "?", e.b);
+      break;
+    }
+    case TRACE_I2C_ERROR:     snprintf(text, sizeof(text), "code %u", e.a); break;
+    case TRACE_DEVICE: {
+      static const char* const states[] = { "PCA9685 perdu", "PCA9685 detecte", "mode degrade" };
+      snprintf(text, sizeof(text), "%s", e.a < 3 ? states[e.a] : "?");
+      break;
+    }
+    default: text[0] = 0; break;
+  }
+  return text;
+}
+
+// Masque des cordes touchees par l'evenement (colonnes de la chronologie)
+static uint16_t stringsOf(const TraceEvent& e, char& mark) {
+  switch (e.type) {
+    case TRACE_PLUCK:         mark = 'P'; return 1 << (e.a & 15);
+    case TRACE_MUTE:          mark = 'M'; return 1 << (e.a & 15);
+    case TRACE_MUTE_DEFERRED: mark = 'm'; return 1 << (e.a & 15);
+    case TRACE_SCORE:         mark = 'S'; return 1 << (e.a & 15);
+    case TRACE_SERVO_WRITE:   mark = e.b >= 4096 ? 'o' : 'W'; return 1 << (e.a & 15);
+    case TRACE_GROUP_WRITE: {
+      mark = 'W';
+      uint16_t mask = 0;
+      for (uint8_t i = e.a & 15; i <= (e.a >> 4); i++) mask |= 1 << i;
+      return mask;
+    }
+    case TRACE_POWER:
+      mark = e.a == TRACE_POWER_RELEASE ? 'o' : '+';
+      return e.a >= TRACE_POWER_RELEASE ? e.b : 0;
+    default: return 0;
+  }
+}
+
+struct StringLatency {
+  std::vector<uint32_t> decisionUs;  // Entree MIDI -> decision (PLUCK)
+  std::vector<uint32_t> totalUs;     // Entree MIDI (ou echeance partition) -> fin d'ecriture
+};
+
+static uint32_t percentile(std::vector<uint32_t> values, int percent) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  size_t rank = (values.size() * percent + 99) / 100;
+  return values[rank ? rank - 1 : 0];
+}
+
+int main(int argc, char** argv) {
+  const char* path = nullptr;
+  bool timeline = false, usage = false;
+  long onlyBoot = -1;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--timeline") timeline = true;
+    else if (arg == "--boot" && i + 1 < argc) onlyBoot = atol(argv[++i]);
+    else if (arg[0] != '-' && !path) path = argv[i];
+    else usage = true;
+  }
+  if (!path || usage) {
+    fprintf(stderr, "Utilisation: lyre_trace capture.bin|trace.syx [--timeline] [--boot N]\n");
+    return 1;
+  }
+
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "Impossible d'ouvrir %s\n", path);
+    return 1;
+  }
+  std::vector<uint8_t> data;
+  uint8_t buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+    data.insert(data.end(), buffer, buffer + n);
+  }
+  fclose(f);
+
+  Dump dump;
+  if (!parseSerial(data, dump) && !parseSysEx(data, dump)) {
+    fprintf(stderr, "Aucune trace dans %s (commande 't' ou SysEx F0 7D 54 01 F7)\n", path);
+    return 1;
+  }
+  printf("Trace: %u evenements (sur %lu enregistres), demarrage a chaud n %lu\n",
+         dump.header.count, (unsigned long)dump.header.total,
+         (unsigned long)dump.header.bootCount);
+
+  // Numero de demarrage de chaque evenement: le dernier BOOT vaut header.bootCount
+  // (les evenements anterieurs au premier BOOT appartiennent au demarrage precedent)
+  long boot = (long)dump.header.bootCount;
+  for (const TraceEvent& e : dump.events) {
+    if (e.type == TRACE_BOOT) boot--;
+  }
+
+  StringLatency strings[NUM_SERVOS];
+  uint64_t noteOnUs[128];
+  uint64_t pendingUs[NUM_SERVOS];  // Debut de la chaine en attente de l'ecriture
+  uint64_t offset = 0, lastRaw = 0, bootStartUs = 0;
+  bool started = false;
+
+  auto resetPairs = [&]() {
+    for (auto& t : noteOnUs) t = UINT64_MAX;
+    for (auto& t : pendingUs) t = UINT64_MAX;
+  };
+  resetPairs();
+
+  if (timeline) printf("\n    temps (ms)  evenement    cordes 0..%d      detail\n", NUM_SERVOS - 1);
+
+  for (const TraceEvent& e : dump.events) {
+    if (e.type == TRACE_NONE) continue;  // Bloc SysEx manquant
+    if (e.type == TRACE_BOOT) {
+      boot = e.b;
+      offset = 0;
+      lastRaw = e.timestampUs;
+      bootStartUs = e.timestampUs;
+      started = true;
+      resetPairs();
+    } else if (e.timestampUs < lastRaw) {
+      offset += 1ULL << 32;  // micros() a reboucle (71 min)
+    }
+    lastRaw = e.timestampUs;
+    uint64_t t = offset + e.timestampUs;
+    if (!started) {
+      bootStartUs = t;
+      started = true;
+    }
+    if (onlyBoot >= 0 && boot != onlyBoot) continue;
+
+    switch (e.type) {
+      case TRACE_MIDI_NOTE_ON:
+        if (e.b > 0 && e.a < 128) noteOnUs[e.a] = t;
+        break;
+      case TRACE_PLUCK:
+        if (e.a < NUM_SERVOS && e.b < 128 && noteOnUs[e.b] != UINT64_MAX) {
+          strings[e.a].decisionUs.push_back(t - noteOnUs[e.b]);
+          pendingUs[e.a] = noteOnUs[e.b];
+          noteOnUs[e.b] = UINT64_MAX;
+        }
+        break;
+      case TRACE_SCORE:
+        if (e.a < NUM_SERVOS) pendingUs[e.a] = t;
+        break;
+      case TRACE_SERVO_WRITE:
+      case TRACE_GROUP_WRITE: {
+        char mark;
+        uint16_t mask = stringsOf(e, mark);
+        for (uint8_t s = 0; s < NUM_SERVOS; s++) {
+          if ((mask & (1 << s)) && pendingUs[s] != UINT64_MAX) {
+            strings[s].totalUs.push_back(t - pendingUs[s]);
+            pendingUs[s] = UINT64_MAX;
+          }
+        }
+        break;
+      }
+      case TRACE_PANIC:
+        resetPairs();
+        break;
+    }
+
+    if (timeline) {
+      if (e.type == TRACE_BOOT) printf("  --- demarrage %ld ---\n", boot);
+      char lanes[NUM_SERVOS + 1];
+      char mark = ' ';
+      uint16_t mask = stringsOf(e, mark);
+      for (uint8_t s = 0; s < NUM_SERVOS; s++) lanes[s] = (mask & (1 << s)) ? mark : '.';
+      lanes[NUM_SERVOS] = 0;
+      printf("  %12.3f  %-11s  %s  %s\n", (t - bootStartUs) / 1000.0,
+             traceEventName(e.type), lanes, describe(e).c_str());
+    }
+  }
+
+  printf("\nLatence par corde (us): entree MIDI ou echeance partition -> fin d'ecriture I2C\n");
+  printf("Corde  Notes   decision p50   total p50    p95    max\n");
+  for (uint8_t s = 0; s < NUM_SERVOS; s++) {
+    StringLatency& l = strings[s];
+    if (l.totalUs.empty() && l.decisionUs.empty()) continue;
+    printf("%5u %6zu %14lu %11lu %6lu %6lu\n", s, l.totalUs.size(),
+           (unsigned long)percentile(l.decisionUs, 50), (unsigned long)percentile(l.totalUs, 50),
+           (unsigned long)percentile(l.totalUs, 95), (unsigned long)percentile(l.totalUs, 100));
+  }
+  if (timeline) {
+    printf("\nP grattage, M etouffement, m etouffement differe, S partition, W ecriture,\n"
+           "o voie liberee (full-OFF), + voie realimentee\n");
+  }
+  return 0;
+}
@@ -0,0 +1,107 @@
+/***********************************************************************************************
+----------------------------    profiler_bench - cout du profileur   ---------------------------
+************************************************************************************************
+Mesure sur le PC le cout d'une section PROFILE_SCOPE (Profiler.h du sketch Enhanced): la meme
+boucle de travail est chronometree sans section, avec une section, puis avec deux sections
+imbriquees. La difference par iteration est le cout du profileur lui-meme.
+
+  E=arduino/Servo_pluck_ESP32_BLE_Enhanced
+  g++ -std=c++17 -O2 -I tools/lyre_sim/host -I $E \
+      tools/profiler_bench/profiler_bench.cpp $E/Profiler.cpp -o profiler_bench
+
+Utilisation:
+  profiler_bench [--iterations N] [--work N]
+
+Sur l'ESP32 le compteur est CCOUNT (une instruction rsr) au lieu du TSC: la commande serie
+'f' affiche le cout mesure sur la cible par Profiler::calibrate().
+************************************************************************************************/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "Profiler.h"
+
+uint64_t simNowUs = 0;
+void simAdvance(uint64_t us) { simNowUs += us; }
+void simOnPinWrite(uint8_t, uint8_t) {}
+int simOnPinRead(uint8_t) { return HIGH; }
+HostSerial Serial;
+
+static volatile uint32_t sink = 0;
+
+// Travail simule: quelques operations dependantes, non eliminables par l'optimiseur
+static inline void work(int amount) {
+  uint32_t x = sink;
+  for (int i = 0; i < amount; i++) {
+    x = x * 1664525u + 1013904223u;
+  }
+  sink = x;
+}
+
+__attribute__((noinline)) static void bare(int amount) {
+  work(amount);
+}
+
+__attribute__((noinline)) static void oneScope(int amount) {
+  PROFILER_SCOPE_IMPL("une section");
+  work(amount);
+}
+
+__attribute__((noinline)) static void nestedScopes(int amount) {
+  PROFILER_SCOPE_IMPL("externe");
+  {
+    PROFILER_SCOPE_IMPL("interne");
+    work(amount);
+  }
+}
+
+template <typename F>
+static double nsPerCall(F f, long iterations, int amount) {
+  double best = 1e30;
+  for (int run = 0; run < 5; run++) {
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+      f(amount);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+    if (ns < best) best = ns;
+  }
+  return best;
+}
+
+int main(int argc, char** argv) {
+  long iterations = 2000000;
+  int amount = 20;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--iterations" && i + 1 < argc) iterations = atol(argv[++i]);
+    else if (arg == "--work" && i + 1 < argc) amount = atoi(argv[++i]);
+    else {
+      fprintf(stderr, "Utilisation: profiler_bench [--iterations N] [--work N]\n");
+      return 1;
+    }
+  }
+
+  double base = nsPerCall(bare, iterations, amount);
+  double one = nsPerCall(oneScope, iterations, amount);
+  double nested = nsPerCall(nestedScopes, iterations, amount);
+
+  printf("Compteur: %s, %ld iterations, travail %d operations\n\n", PROFILER_UNIT,
+         iterations, amount);
+  printf("%-24s %-12s %s\n", "Variante", "ns/appel", "Surcout/section (ns)");
+  printf("%-24s %-12.2f %s\n", "sans section", base, "-");
+  printf("%-24s %-12.2f %.2f\n", "une section", one, one - base);
+  printf("%-24s %-12.2f %.2f\n", "deux sections imbriquees", nested, (nested - base) / 2);
+
+  printf("\nProfiler::calibrate(): %lu %s par section vide\n",
+         (unsigned long)Profiler::calibrate(), PROFILER_UNIT);
+  for (uint8_t i = 0; i < Profiler::sectionCount(); i++) {
+    ProfileSection* s = Profiler::section(i);
+    printf("  %-12s appels %-10lu max %lu %s\n", s->name, (unsigned long)s->count,
+           (unsigned long)s->max, PROFILER_UNIT);
+  }
+  return 0;
+}